@@ -4113,12 +4113,15 @@ void asCWriter::WriteDataType(const asCDataType *dt)
 	if( t == ttIdentifier )
 		WriteObjectType(dt->GetObjectType());
 
+	// Laid out the way ReadDataType expects the bits, so saved bytecode can
+	// be loaded again
 	struct
 	{
-		char isObjectHandle :1;
-		char isHandleToConst:1;
-		char isReference    :1;
+		char pad            :4;
 		char isReadOnly     :1;
+		char isReference    :1;
+		char isHandleToConst:1;
+		char isObjectHandle :1;
 	} bits = {0};
 
 	bits.isObjectHandle  = dt->IsObjectHandle();
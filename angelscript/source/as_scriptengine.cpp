@@ -863,6 +863,8 @@ asCModule *asCScriptEngine::FindNewOwnerForSharedType(asCObjectType *type, asCMo
 			foundIdx = mod->enumTypes.IndexOf(type);
 		else if( type->flags & asOBJ_TYPEDEF )
 			foundIdx = mod->typeDefs.IndexOf(type);
+		else if( type->flags & asOBJ_TEMPLATE )
+			foundIdx = mod->templateInstances.IndexOf(type);
 		else
 			foundIdx = mod->classTypes.IndexOf(type);
 		
@@ -1,4 +1,163 @@
 #include "asf.h"
+#include "hash.h"
+#include "memory.h"
+#include "profile.h"
+#include "symbols.h"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+
+const uint8_t cAsfMagic[4] = {
+	'A', 'S', 'F', 0x07
+};
+
+}
+
+bool ParseAsfHeader(const uint8_t *fileData, size_t fileLength, AsfHeader &header, const char **error)
+{
+	*error = nullptr;
+	if (fileLength < sizeof(cAsfMagic) + 3 * sizeof(uint32_t))
+	{
+		*error = "missing or truncated";
+		return false;
+	}
+
+	const uint8_t *data = fileData;
+	if (memcmp(data, cAsfMagic, sizeof(cAsfMagic)))
+	{
+		return false;
+	}
+	data += sizeof(cAsfMagic);
+	memcpy(&header.codeOffset, data, sizeof(uint32_t));
+	data += sizeof(uint32_t);
+	memcpy(&header.codeSize, data, sizeof(uint32_t));
+	data += sizeof(uint32_t);
+	uint32_t dependencyCount;
+	memcpy(&dependencyCount, data, sizeof(uint32_t));
+	data += sizeof(uint32_t);
+
+	size_t headerSize = data - fileData;
+	if (dependencyCount > (fileLength - headerSize) / 64 ||
+		header.codeOffset > fileLength || header.codeSize > fileLength - header.codeOffset)
+	{
+		*error = "header points outside of the file";
+		return false;
+	}
+
+	header.dependencies.clear();
+	for (uint32_t i = 0; i < dependencyCount; ++i)
+	{
+		const char *dependencyName = reinterpret_cast<const char *>(data);
+		header.dependencies.emplace_back(dependencyName, strnlen(dependencyName, 64));
+		data += 64;
+	}
+	return true;
+}
+
+std::vector<uint8_t> BuildAsfFile(const std::vector<std::string> &dependencies, const uint8_t *code, size_t codeSize)
+{
+	size_t headerSize = sizeof(cAsfMagic) + 3 * sizeof(uint32_t) + 64 * dependencies.size();
+	std::vector<uint8_t> fileData(headerSize + codeSize, 0);
+
+	uint8_t *data = fileData.data();
+	memcpy(data, cAsfMagic, sizeof(cAsfMagic));
+	data += sizeof(cAsfMagic);
+	uint32_t fields[3] = {
+		static_cast<uint32_t>(headerSize), static_cast<uint32_t>(codeSize), static_cast<uint32_t>(dependencies.size())
+	};
+	memcpy(data, fields, sizeof(fields));
+	data += sizeof(fields);
+
+	// Names are cut to fit their slot; the slot is zero padded
+	for (const std::string &dependency : dependencies)
+	{
+		memcpy(data, dependency.data(), std::min<size_t>(dependency.size(), 63));
+		data += 64;
+	}
+
+	if (codeSize)
+	{
+		memcpy(data, code, codeSize);
+	}
+	return fileData;
+}
+
+// A module's file, mapped and with its header read, waiting to be loaded
+struct AsfFile
+{
+	boost::iostreams::mapped_file_source file;
+	AsfHeader header;
+	bool valid = false;
+	std::time_t modified = 0;
+
+	// Why the file can't be loaded; empty if it just isn't an ASF file
+	std::string error;
+};
+
+namespace
+{
+
+enum SortState
+{
+	SORT_NEW,
+	SORT_VISITING,
+	SORT_DONE,
+};
+
+std::unique_ptr<AsfFile> ReadAsfFile(const boost::filesystem::path &path)
+{
+	std::unique_ptr<AsfFile> asfFile(new AsfFile);
+
+	// Map the file rather than reading it, so the bytes are only copied
+	// once, by the bytecode reader
+	boost::system::error_code error;
+	uintmax_t fileSize = boost::filesystem::file_size(path, error);
+	if (error || fileSize < sizeof(cAsfMagic) + 3 * sizeof(uint32_t))
+	{
+		asfFile->error = "missing or truncated";
+		return asfFile;
+	}
+	asfFile->modified = boost::filesystem::last_write_time(path, error);
+
+	try
+	{
+		asfFile->file.open(path.string());
+	}
+	catch (const std::exception &e)
+	{
+		asfFile->error = e.what();
+		return asfFile;
+	}
+	const uint8_t *fileData = reinterpret_cast<const uint8_t *>(asfFile->file.data());
+	size_t fileLength = asfFile->file.size();
+
+	const char *headerError;
+	if (!ParseAsfHeader(fileData, fileLength, asfFile->header, &headerError))
+	{
+		asfFile->error = headerError ? headerError : "";
+		return asfFile;
+	}
+
+	// Fault the code in here, where it overlaps with reading other files,
+	// rather than in the reader, which runs one module at a time
+	volatile uint8_t sink = 0;
+	for (size_t offset = asfFile->header.codeOffset; offset < asfFile->header.codeOffset + asfFile->header.codeSize; offset += 4096)
+	{
+		sink += fileData[offset];
+	}
+
+	asfFile->valid = true;
+	return asfFile;
+}
+
+}
 
 AsfModuleTracker::AsfModuleTracker(asIScriptEngine *engine, const std::string &root)
 {
@@ -18,65 +177,367 @@ AsfModule *AsfModuleTracker::getModule(const std::string &name)
 {
 	// Check if it has been loaded already
 	auto it = mModules.find(name);
-	if (it != mModules.end())
+	if (it != mModules.end() && !it->second->mEvicted)
 	{
+		it->second->mLastUse = ++mTick;
 		return it->second;
 	}
-	else
+
+	// Not found; read the headers of everything it needs that isn't loaded
+	// yet, one level of the DAG at a time
+	FileMap files;
+	std::vector<std::string> level = { name };
+	while (!level.empty())
 	{
-		// Not found, load
-		boost::filesystem::path filePath = mRoot;
-		filePath.concat(name);
-		std::ifstream inputStream(filePath.string(), std::ios::binary);
-		std::vector<uint8_t> inputBuffer((std::istreambuf_iterator<char>(inputStream)), (std::istreambuf_iterator<char>()));
-		auto *newModule = new AsfModule(name, inputBuffer, this);
-		mModules[name] = newModule;
-		return newModule;
+		readFiles(level, files);
+
+		std::vector<std::string> nextLevel;
+		for (const std::string &levelName : level)
+		{
+			for (const std::string &dependency : files[levelName]->header.dependencies)
+			{
+				if (!isLoaded(dependency) && !files.count(dependency) &&
+				    std::find(nextLevel.begin(), nextLevel.end(), dependency) == nextLevel.end())
+				{
+					nextLevel.push_back(dependency);
+				}
+			}
+		}
+		level = std::move(nextLevel);
 	}
+
+	// Load dependencies before their dependents
+	std::map<std::string, int> states;
+	std::vector<std::string> path;
+	std::vector<std::string> order;
+	std::set<std::string> cyclic;
+	sortModules(name, files, states, path, order, cyclic);
+
+	for (const std::string &moduleName : order)
+	{
+		// Evicted modules are loaded into the same object again
+		AsfModule *&newModule = mModules[moduleName];
+		if (!newModule)
+		{
+			newModule = new AsfModule(moduleName, this);
+		}
+
+		const AsfFile &file = *files[moduleName];
+		if (!file.valid)
+		{
+			if (!file.error.empty())
+			{
+				std::cout << moduleName << ": " << file.error << "\n";
+			}
+		}
+		else if (!cyclic.count(moduleName))
+		{
+			newModule->load(file);
+			newModule->mHash = mTrackChanges ? HashBytes(file.file.data(), file.file.size()) : 0;
+		}
+
+		if (newModule->mModule)
+		{
+			for (const std::string &dependency : newModule->mDependencies)
+			{
+				auto dependencyModule = mModules.find(dependency);
+				if (dependencyModule != mModules.end())
+				{
+					++dependencyModule->second->mDependents;
+				}
+			}
+			mResident += newModule->mSize;
+			mPeakResident = std::max(mPeakResident, mResident);
+		}
+	}
+
+	AsfModule *module = mModules[name];
+	module->mLastUse = ++mTick;
+	evict(module);
+	return module;
 }
 
-AsfModule::AsfModule(const std::string &name, const std::vector<uint8_t> &buffer, AsfModuleTracker *tracker)
-	: mName(name), mData(buffer), mTracker(tracker)
+bool AsfModuleTracker::isLoaded(const std::string &name) const
 {
-	mName = name;
-	mData = buffer;
-	
-	// Parse ASF header
-	uint8_t *data = mData.data();
-	if (memcmp(data, cAsfMagic, sizeof(cAsfMagic)))
+	// Modules that failed to load count as loaded, they aren't tried again
+	auto it = mModules.find(name);
+	return it != mModules.end() && !it->second->mEvicted;
+}
+
+void AsfModuleTracker::evict(const AsfModule *keep)
+{
+	while (mMemoryBudget && mResident > mMemoryBudget)
 	{
-		return;
+		// The least recently used module nothing loaded needs; dependencies
+		// become candidates once their last dependent is gone
+		AsfModule *victim = nullptr;
+		for (const auto &it : mModules)
+		{
+			AsfModule *module = it.second;
+			if (module != keep && module->mModule && !module->mDependents &&
+			    (!victim || module->mLastUse < victim->mLastUse))
+			{
+				victim = module;
+			}
+		}
+		if (!victim)
+		{
+			break;
+		}
+
+		unload(victim);
+		++mEvictionCount;
+
+		// Ids and addresses of what was discarded get reused
+		SymbolCache::invalidate(mEngine);
 	}
-	data += sizeof(cAsfMagic);
-	uint32_t codeOffset = *reinterpret_cast<uint32_t *>(data);
-	data += sizeof(uint32_t);
-	uint32_t codeSize = *reinterpret_cast<uint32_t *>(data);
-	data += sizeof(uint32_t);
-	uint32_t dependencyCount = *reinterpret_cast<uint32_t *>(data);
-	data += sizeof(uint32_t);
+}
 
-	// Parse dependencies
-	for (uint32_t i = 0; i < dependencyCount; ++i)
+unsigned int AsfModuleTracker::refresh(const std::string &name)
+{
+	// Check the loaded part of the module's dependency DAG
+	std::set<std::string> changed;
+	std::set<std::string> visited;
+	std::vector<std::string> pending = { name };
+	while (!pending.empty())
 	{
-		mDependencies.emplace_back(reinterpret_cast<char *>(data));
-		data += 64;
+		std::string moduleName = pending.back();
+		pending.pop_back();
+		auto it = mModules.find(moduleName);
+		if (!visited.insert(moduleName).second || it == mModules.end() || it->second->mEvicted)
+		{
+			continue;
+		}
+
+		AsfModule *module = it->second;
+		if (!module->mModule)
+		{
+			module->mEvicted = true;
+			continue;
+		}
+		if (hasChanged(module))
+		{
+			changed.insert(moduleName);
+		}
+		pending.insert(pending.end(), module->mDependencies.begin(), module->mDependencies.end());
+	}
+	if (changed.empty())
+	{
+		return 0;
+	}
+
+	// Everything loaded on top of a changed module goes with it
+	for (bool grown = true; grown; )
+	{
+		grown = false;
+		for (const auto &it : mModules)
+		{
+			const AsfModule *module = it.second;
+			if (!module->mModule || changed.count(it.first))
+			{
+				continue;
+			}
+			for (const std::string &dependency : module->mDependencies)
+			{
+				if (changed.count(dependency))
+				{
+					changed.insert(it.first);
+					grown = true;
+					break;
+				}
+			}
+		}
+	}
+
+	// Dependents first, as with eviction
+	unsigned int discarded = 0;
+	for (bool progress = true; progress; )
+	{
+		progress = false;
+		for (const std::string &moduleName : changed)
+		{
+			AsfModule *module = mModules[moduleName];
+			if (module->mModule && !module->mDependents)
+			{
+				unload(module);
+				++discarded;
+				progress = true;
+			}
+		}
+	}
+
+	// Ids and addresses of what was discarded get reused
+	SymbolCache::invalidate(mEngine);
+	return discarded;
+}
+
+bool AsfModuleTracker::hasChanged(AsfModule *module) const
+{
+	boost::filesystem::path filePath = mRoot;
+	filePath.concat(module->mName);
+	boost::system::error_code error;
+	uintmax_t fileSize = boost::filesystem::file_size(filePath, error);
+	std::time_t modified = error ? 0 : boost::filesystem::last_write_time(filePath, error);
+	if (error)
+	{
+		return true;
 	}
+	if (modified == module->mModified && fileSize == module->mFileSize)
+	{
+		return false;
+	}
+
+	// Only touched; remember the new time so the file isn't hashed again
+	uint64_t hash;
+	if (module->mHash && HashFile(filePath.string(), hash) && hash == module->mHash)
+	{
+		module->mModified = modified;
+		module->mFileSize = fileSize;
+		return false;
+	}
+	return true;
+}
 
-	// Load dependencies
-	for (const auto &dep : mDependencies)
+void AsfModuleTracker::unload(AsfModule *module)
+{
+	for (const std::string &dependency : module->mDependencies)
 	{
-		if (!mTracker->getModule(dep))
+		auto dependencyModule = mModules.find(dependency);
+		if (dependencyModule != mModules.end())
 		{
-			// Dependency failed to load
-			return;
+			--dependencyModule->second->mDependents;
 		}
 	}
+	module->mModule->Discard();
+	module->mModule = nullptr;
+	module->mIds.reset();
+	module->mEvicted = true;
+	mResident -= module->mSize;
+}
+
+void AsfModuleTracker::readFiles(const std::vector<std::string> &names, FileMap &files)
+{
+	ProfileScope scope(STAGE_READ);
+	std::vector<std::unique_ptr<AsfFile>> read(names.size());
+	std::atomic<size_t> next(0);
+	auto readNext = [&]()
+	{
+		for (size_t i = next++; i < names.size(); i = next++)
+		{
+			boost::filesystem::path filePath = mRoot;
+			filePath.concat(names[i]);
+			read[i] = ReadAsfFile(filePath);
+		}
+	};
+
+	// Independent files are read side by side; the engine isn't touched
+	unsigned int readerCount = mReaderCount ? mReaderCount : std::max(std::thread::hardware_concurrency(), 1u);
+	size_t threadCount = std::min<size_t>(names.size(), readerCount);
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadCount; ++i)
+	{
+		threads.emplace_back(readNext);
+	}
+	readNext();
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		files[names[i]] = std::move(read[i]);
+	}
+}
+
+void AsfModuleTracker::sortModules(const std::string &name, const FileMap &files, std::map<std::string, int> &states,
+                                   std::vector<std::string> &path, std::vector<std::string> &order, std::set<std::string> &cyclic)
+{
+	// Loaded by an earlier call
+	auto file = files.find(name);
+	if (file == files.end())
+	{
+		return;
+	}
+
+	int &state = states[name];
+	if (state == SORT_DONE)
+	{
+		return;
+	}
+	if (state == SORT_VISITING)
+	{
+		// Everything on the path from the earlier visit is in the cycle
+		auto first = std::find(path.begin(), path.end(), name);
+		std::string cycle;
+		for (auto it = first; it != path.end(); ++it)
+		{
+			cycle += *it + " -> ";
+			cyclic.insert(*it);
+		}
+		std::cout << name << ": dependency cycle " << cycle << name << "\n";
+		return;
+	}
+
+	state = SORT_VISITING;
+	path.push_back(name);
+	for (const std::string &dependency : file->second->header.dependencies)
+	{
+		sortModules(dependency, files, states, path, order, cyclic);
+	}
+	path.pop_back();
+	states[name] = SORT_DONE;
+	order.push_back(name);
+}
+
+AsfModule::AsfModule(const std::string &name, AsfModuleTracker *tracker)
+	: mTracker(tracker), mName(name)
+{
+
+}
+
+AsfModule::~AsfModule()
+{
+
+}
+
+ModuleIds &AsfModule::getIds()
+{
+	if (!mIds)
+	{
+		mIds.reset(new ModuleIds(mModule));
+	}
+	return *mIds;
+}
+
+void AsfModule::load(const AsfFile &file)
+{
+	ProfileScope scope(STAGE_LOAD);
+	mDependencies = file.header.dependencies;
+	mIds.reset();
+	mEvicted = false;
+	mModified = file.modified;
+	mFileSize = file.file.size();
+	int64_t memoryBefore = GetThreadScriptMemory();
 
 	// Load code
-	BinaryCodeStream code(std::vector<uint8_t>(mData.begin() + codeOffset, 
-											   mData.begin() + codeOffset + codeSize));
-	mModule = mTracker->getEngine()->GetModule(name.c_str(), asGM_ALWAYS_CREATE);
+	const uint8_t *fileData = reinterpret_cast<const uint8_t *>(file.file.data());
+	BinaryCodeStream code(fileData + file.header.codeOffset, file.header.codeSize);
+	mModule = mTracker->getEngine()->GetModule(mName.c_str(), asGM_ALWAYS_CREATE);
 
 	bool debugInfo = false;
-	mModule->LoadByteCode(&code, &debugInfo);
+	int result = mModule->LoadByteCode(&code, &debugInfo);
+	if (result < 0 || code.hasOverrun())
+	{
+		// The reader has already reset the module, it just stays empty
+		std::cout << mName << ": failed to load bytecode\n";
+		mModule = nullptr;
+	}
+
+	// Whatever the engine allocated for it; the load may also collect
+	// garbage, which makes this an estimate
+	mSize = std::max<int64_t>(GetThreadScriptMemory() - memoryBefore, 0);
+
+	// The engine keeps its own copy of everything it needs, so the
+	// mapping can go once the tracker is done with it
 }
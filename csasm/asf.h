@@ -2,65 +2,150 @@
 
 #include "angelscript.h"
 
-#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
 #include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
 #include <boost/filesystem.hpp>
 
 typedef unsigned char uint8_t;
 
+// Reads straight out of a read-only view of the code region
 class BinaryCodeStream : public asIBinaryStream
 {
 public:
-	BinaryCodeStream(const std::vector<uint8_t> &data)
-		: mData(data)
+	BinaryCodeStream(const uint8_t *data, size_t size)
+		: mData(data), mSize(size)
 	{
 		
 	}
 
 	virtual void Read(void *ptr, asUINT size)
 	{
-		memcpy(ptr, mData.data() + mHead, size);
+		// The reader mostly asks for single bytes
+		if (size == 1 && mHead < mSize)
+		{
+			*static_cast<uint8_t *>(ptr) = mData[mHead++];
+			return;
+		}
+
+		// Never read past the view; hand out zeroes for the missing part
+		// and remember the overrun instead
+		size_t available = mSize - mHead;
+		if (size > available)
+		{
+			memcpy(ptr, mData + mHead, available);
+			memset(static_cast<uint8_t *>(ptr) + available, 0, size - available);
+			mHead = mSize;
+			mOverrun = true;
+			return;
+		}
+
+		memcpy(ptr, mData + mHead, size);
 		mHead += size;
 	}
 
 	virtual void Write(const void *ptr, asUINT size)
 	{
-		const uint8_t *data = static_cast<const uint8_t *>(ptr);
-		mData.insert(mData.begin(), data, data + size);
+		// The view is read-only
+		mOverrun = true;
+	}
+
+	bool hasOverrun() const
+	{
+		return mOverrun;
 	}
 
 private:
-	std::vector<uint8_t> mData;
-	int mHead = 0;
+	const uint8_t *mData;
+	size_t mSize;
+	size_t mHead = 0;
+	bool mOverrun = false;
 };
 
+// Where an ASF file keeps its bytecode and which modules it needs
+struct AsfHeader
+{
+	uint32_t codeOffset = 0;
+	uint32_t codeSize = 0;
+	std::vector<std::string> dependencies;
+};
+
+// Parses and bounds checks the header of a mapped ASF file; on failure error
+// says why, or is null if the file just isn't an ASF file
+bool ParseAsfHeader(const uint8_t *fileData, size_t fileLength, AsfHeader &header, const char **error);
+
+// Lays out an ASF file the way ParseAsfHeader reads it: the header, the
+// dependency names in 64 byte slots, then the bytecode
+std::vector<uint8_t> BuildAsfFile(const std::vector<std::string> &dependencies, const uint8_t *code, size_t codeSize);
+
 class AsfModuleTracker;
+class ModuleIds;
+struct AsfFile;
 
 class AsfModule
 {
 public:
-	AsfModule(const std::string &name, const std::vector<uint8_t> &buffer, AsfModuleTracker *tracker);
+	AsfModule(const std::string &name, AsfModuleTracker *tracker);
+	~AsfModule();
 	
 	asIScriptModule *getScriptModule() const
 	{
 		return mModule;
 	}
 
+	// The ids dumps of the loaded module use, numbered on first request and
+	// kept until it is discarded; the script module must be loaded
+	ModuleIds &getIds();
+
 private:
+	void load(const AsfFile &file);
+
 	AsfModuleTracker *mTracker;
 
 	std::string mName;
-	std::vector<uint8_t> mData;
 
 	std::vector<std::string> mDependencies;
 	asIScriptModule *mModule = nullptr;
+	std::unique_ptr<ModuleIds> mIds;
+
+	// Script memory the module took up when it was loaded
+	int64_t mSize = 0;
+
+	// Tick of the last request for the module or one of its dependents
+	uint64_t mLastUse = 0;
+
+	// Number of loaded modules that depend on this one
+	unsigned int mDependents = 0;
+
+	// Discarded to stay within the memory budget or because its file
+	// changed; loaded again when needed
+	bool mEvicted = false;
+
+	// The file as it was loaded; the hash is only taken when the tracker
+	// checks for changes
+	std::time_t mModified = 0;
+	uintmax_t mFileSize = 0;
+	uint64_t mHash = 0;
 
 	friend class AsfModuleTracker;
-	const uint8_t cAsfMagic[4] = {
-		'A', 'S', 'F', 0x07
-	};
 };
 
+// Loads modules into an engine along with everything they depend on. The
+// headers of a module's whole dependency DAG are read first, a level at a
+// time with the files of a level read concurrently; then the modules are
+// loaded dependencies first. The engine only loads one module at a time, so
+// that part stays serial. Modules in a dependency cycle fail to load.
+//
+// With a memory budget, the least recently used modules that no loaded module
+// depends on are discarded once the loaded ones take up more script memory
+// than that. A module returned by getModule stays valid, but its script
+// module may be discarded by the next call. Loaded again, it gets new engine
+// ids; dumps number ids by module (see ModuleIds), so they come out the same.
 class AsfModuleTracker
 {
 public:
@@ -74,8 +159,67 @@ public:
 
 	AsfModule *getModule(const std::string &name);
 
+	// Script memory the loaded modules may take up in bytes, 0 for no limit.
+	// Needs InstallScriptMemoryAccounting to measure the modules.
+	void setMemoryBudget(int64_t budget)
+	{
+		mMemoryBudget = budget;
+	}
+
+	unsigned int getEvictionCount() const
+	{
+		return mEvictionCount;
+	}
+
+	// Most script memory the loaded modules took up at once
+	int64_t getPeakResident() const
+	{
+		return mPeakResident;
+	}
+
+	// Threads reading the files of a dependency level at once, 0 for one per
+	// hardware thread. Trackers running side by side, one per worker, should
+	// read with one each, or every level starts a thread per core per worker.
+	void setReaderCount(unsigned int count)
+	{
+		mReaderCount = count;
+	}
+
+	// Hashes the files as they are loaded, so refresh can tell a touched
+	// file from a changed one
+	void setTrackChanges(bool trackChanges)
+	{
+		mTrackChanges = trackChanges;
+	}
+
+	// Discards the loaded modules among name and its dependencies whose files
+	// changed since they were loaded, along with every loaded module that
+	// depends on them, so the next getModule loads them again. A file has
+	// changed if its modification time or size differs and, with change
+	// tracking, so does its hash. Modules that failed to load are tried
+	// again. Returns the number of modules discarded.
+	unsigned int refresh(const std::string &name);
+
 private:
+	typedef std::map<std::string, std::unique_ptr<AsfFile>> FileMap;
+
+	void readFiles(const std::vector<std::string> &names, FileMap &files);
+	void sortModules(const std::string &name, const FileMap &files, std::map<std::string, int> &states,
+	                 std::vector<std::string> &path, std::vector<std::string> &order, std::set<std::string> &cyclic);
+	bool isLoaded(const std::string &name) const;
+	void evict(const AsfModule *keep);
+	void unload(AsfModule *module);
+	bool hasChanged(AsfModule *module) const;
+
 	asIScriptEngine *mEngine;
 	boost::filesystem::path mRoot;
 	std::map<std::string, AsfModule *> mModules;
+
+	int64_t mMemoryBudget = 0;
+	int64_t mResident = 0;
+	int64_t mPeakResident = 0;
+	unsigned int mEvictionCount = 0;
+	uint64_t mTick = 0;
+	unsigned int mReaderCount = 0;
+	bool mTrackChanges = false;
 };
\ No newline at end of file
@@ -0,0 +1,557 @@
+#include "batch.h"
+
+#include "asf.h"
+#include "disasm.h"
+#include "profile.h"
+#include "rawmodule.h"
+#include "records.h"
+#include "workqueue.h"
+#include "xref.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+std::vector<std::string> CollectModuleNames(const std::string &root)
+{
+	std::vector<std::string> names;
+
+	boost::filesystem::path rootPath = root;
+	for (boost::filesystem::recursive_directory_iterator it(rootPath), end; it != end; ++it)
+	{
+		if (!boost::filesystem::is_regular_file(it->status()))
+		{
+			continue;
+		}
+
+		std::string extension = it->path().extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		if (extension != ".asf")
+		{
+			continue;
+		}
+
+		// Module names are relative to the root, the same way dependencies
+		// are named inside the ASF files
+		names.push_back(boost::filesystem::relative(it->path(), rootPath).generic_string());
+	}
+
+	// Directory iteration order is unspecified
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+std::vector<std::string> ReadModuleList(const std::string &listFile)
+{
+	std::vector<std::string> names;
+
+	std::ifstream listStream(listFile);
+	std::string line;
+	while (std::getline(listStream, line))
+	{
+		// Tolerate CRLF lists and blank lines
+		if (!line.empty() && line.back() == '\r')
+		{
+			line.pop_back();
+		}
+		if (!line.empty())
+		{
+			names.push_back(line);
+		}
+	}
+	return names;
+}
+
+std::vector<std::string> CollectCorpusNames(const CorpusOptions &options)
+{
+	return options.listFile.empty() ? CollectModuleNames(options.root) : ReadModuleList(options.listFile);
+}
+
+unsigned int GetCorpusJobs(const CorpusOptions &options, size_t moduleCount)
+{
+	unsigned int jobs = options.jobs;
+	if (jobs == 0)
+	{
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+	}
+	return static_cast<unsigned int>(std::min<size_t>(jobs, std::max<size_t>(moduleCount, 1)));
+}
+
+unsigned int ForEachRawModule(const CorpusOptions &options, const std::vector<std::string> &names, unsigned int jobs,
+                              const std::function<void(unsigned int worker, size_t index, const RawModule &module)> &visit)
+{
+	std::atomic<size_t> next(0);
+	std::atomic<unsigned int> failed(0);
+	std::mutex logMutex;
+	auto readModules = [&](unsigned int worker)
+	{
+		for (size_t i = next++; i < names.size(); i = next++)
+		{
+			boost::filesystem::path filePath = options.root;
+			filePath.concat(names[i]);
+
+			RawModule module;
+			std::string error;
+			if (!LoadRawModule(filePath.string(), module, error))
+			{
+				std::lock_guard<std::mutex> lock(logMutex);
+				std::cout << names[i] << ": " << error << "\n";
+				++failed;
+				continue;
+			}
+			visit(worker, i, module);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < jobs; ++i)
+	{
+		threads.emplace_back(readModules, i);
+	}
+	readModules(0);
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+	return failed;
+}
+
+unsigned int GetCacheVariant(OutputFormat format, bool inspect)
+{
+	return static_cast<unsigned int>(format) | (inspect ? 0x100 : 0);
+}
+
+namespace
+{
+
+// Cache entries holding a module's references or constants rather than a
+// dump
+const unsigned int cXrefCacheVariant = 0x200;
+const unsigned int cConstantCacheVariant = 0x400;
+
+// Dumps naming shared functions, and those functions
+const unsigned int cSharedDumpCacheVariant = 0x800;
+const unsigned int cSharedCodeCacheVariant = 0x1000;
+
+struct BatchContext
+{
+	const EngineFactory *engineFactory;
+	const BatchOptions *options;
+	std::vector<std::string> names;
+
+	WorkStealingQueues *queues;
+	unsigned int jobs = 1;
+
+	// Results are reported in module order regardless of which worker
+	// finishes first
+	std::mutex reportMutex;
+	std::vector<std::string> reports;
+	std::vector<bool> finished;
+	size_t nextReport = 0;
+	unsigned int failed = 0;
+
+	// Memory budget statistics, summed and maxed over the workers
+	std::mutex memoryMutex;
+	unsigned int evictions = 0;
+	int64_t peakResident = 0;
+};
+
+std::string GetOutputPath(const BatchOptions &options, const std::string &name)
+{
+	boost::filesystem::path outputPath = options.outputDir;
+	outputPath /= name + GetOutputExtension(options.format);
+	boost::filesystem::create_directories(outputPath.parent_path());
+	return outputPath.string();
+}
+
+// What to produce for a module that isn't in the cache
+struct ModuleWork
+{
+	bool dump;
+	std::vector<Xref> *xrefs;
+	std::vector<FunctionConstants> *constants;
+};
+
+std::string WriteDump(const BatchOptions &options, const std::string &name, const std::function<void(OutputSink &)> &dump, bool &failed)
+{
+	ProfileScope scope(STAGE_DUMP);
+	FileSink outputSink(GetOutputPath(options, name));
+	if (!outputSink.isOpen())
+	{
+		failed = true;
+		return "\tfailed to open output file\n";
+	}
+	dump(outputSink);
+
+	failed = false;
+	return "";
+}
+
+std::string DisassembleModule(AsfModuleTracker &tracker, const BatchOptions &options, const std::string &name, const ModuleWork &work, bool &failed)
+{
+	AsfModule *module = tracker.getModule(name);
+	if (!module->getScriptModule())
+	{
+		failed = true;
+		return "\tfailed to load\n";
+	}
+
+	if (work.xrefs)
+	{
+		ProfileScope scope(STAGE_XREF);
+		CollectXrefs(module->getScriptModule(), *work.xrefs);
+	}
+	if (work.constants)
+	{
+		ProfileScope scope(STAGE_XREF);
+		CollectConstants(module->getScriptModule(), *work.constants);
+	}
+
+	failed = false;
+	if (!work.dump)
+	{
+		return "";
+	}
+	return WriteDump(options, name, [&](OutputSink &outputSink)
+	{
+		DumpModule(module->getScriptModule(), outputSink, options.format, nullptr, options.shared, &module->getIds());
+	}, failed);
+}
+
+std::string InspectModule(const BatchOptions &options, const std::string &name, const ModuleWork &work, bool &failed)
+{
+	boost::filesystem::path filePath = options.root;
+	filePath.concat(name);
+
+	RawModule module;
+	std::string error;
+	{
+		ProfileScope scope(STAGE_LOAD);
+		if (!LoadRawModule(filePath.string(), module, error))
+		{
+			failed = true;
+			return "\t" + error + "\n";
+		}
+	}
+
+	if (work.xrefs)
+	{
+		ProfileScope scope(STAGE_XREF);
+		CollectRawXrefs(module, *work.xrefs);
+	}
+	if (work.constants)
+	{
+		ProfileScope scope(STAGE_XREF);
+		CollectRawConstants(module, *work.constants);
+	}
+
+	failed = false;
+	if (!work.dump)
+	{
+		return "";
+	}
+	return WriteDump(options, name, [&](OutputSink &outputSink)
+	{
+		DumpRawModule(module, outputSink, nullptr, options.shared);
+	}, failed);
+}
+
+void ReportResult(BatchContext &context, size_t index, const std::string &report, bool failed)
+{
+	std::lock_guard<std::mutex> lock(context.reportMutex);
+	context.reports[index] = report;
+	context.finished[index] = true;
+	if (failed)
+	{
+		++context.failed;
+	}
+
+	// Flush every result that is now contiguous with the ones printed
+	while (context.nextReport < context.names.size() && context.finished[context.nextReport])
+	{
+		size_t i = context.nextReport++;
+		std::cout << fmtString("[%u/%u] %s\n",
+		                       static_cast<unsigned int>(i + 1),
+		                       static_cast<unsigned int>(context.names.size()),
+		                       context.names[i].c_str())
+		          << context.reports[i];
+		context.reports[i].clear();
+	}
+}
+
+// Cache key of a module's dump or references; false if uncached
+bool GetModuleKey(const BatchOptions &options, const std::string &name, unsigned int variant, uint64_t &key)
+{
+	if (!options.cache)
+	{
+		return false;
+	}
+	ProfileScope scope(STAGE_CACHE);
+	if (options.inspect)
+	{
+		// Inspection doesn't look at the dependencies
+		boost::filesystem::path filePath = options.root;
+		filePath.concat(name);
+		return options.cache->getStandaloneKey(filePath.string(), variant, key);
+	}
+	return options.cache->getKey(options.root, name, variant, key);
+}
+
+// Copies the dump, references and constants from the cache if the module is unchanged;
+// otherwise loads it, into the engine through the tracker or by inspection,
+// produces what is missing and stores it
+std::string ProcessModule(const BatchOptions &options, AsfModuleTracker *tracker, const std::string &name, bool &failed)
+{
+	const unsigned int inspectVariant = options.inspect ? 0x100 : 0;
+
+	uint64_t key = 0;
+	unsigned int sharedVariant = options.shared ? cSharedDumpCacheVariant : 0;
+	bool keyed = GetModuleKey(options, name, GetCacheVariant(options.format, options.inspect) | sharedVariant, key);
+	uint64_t sharedKey = 0;
+	bool sharedKeyed = keyed && options.shared && GetModuleKey(options, name, cSharedCodeCacheVariant | inspectVariant, sharedKey);
+	ModuleWork work = { true, nullptr, nullptr };
+	if (keyed && (!options.shared || sharedKeyed))
+	{
+		ProfileScope scope(STAGE_CACHE);
+
+		// A cached dump naming shared functions only fits if they are
+		// written under the same names in this batch
+		StringSink sharedCode;
+		if (!options.shared || options.cache->fetch(sharedKey, sharedCode))
+		{
+			FileSink outputSink(GetOutputPath(options, name));
+			work.dump = !outputSink.isOpen() || !options.cache->fetch(key, outputSink) ||
+			            (options.shared && !options.shared->importFunctions(sharedCode.str()));
+		}
+	}
+
+	std::vector<Xref> xrefs;
+	uint64_t xrefKey = 0;
+	bool xrefKeyed = false;
+	if (options.xrefs)
+	{
+		xrefKeyed = GetModuleKey(options, name, cXrefCacheVariant | inspectVariant, xrefKey);
+		ProfileScope scope(STAGE_CACHE);
+		StringSink cached;
+		if (!xrefKeyed || !options.cache->fetch(xrefKey, cached) || !ParseXrefs(cached.str(), xrefs))
+		{
+			work.xrefs = &xrefs;
+		}
+	}
+
+	std::vector<FunctionConstants> constants;
+	uint64_t constantKey = 0;
+	bool constantKeyed = false;
+	if (options.constants)
+	{
+		constantKeyed = GetModuleKey(options, name, cConstantCacheVariant | inspectVariant, constantKey);
+		ProfileScope scope(STAGE_CACHE);
+		StringSink cached;
+		if (!constantKeyed || !options.cache->fetch(constantKey, cached) || !ParseConstants(cached.str(), constants))
+		{
+			work.constants = &constants;
+		}
+	}
+
+	if (options.cache)
+	{
+		options.cache->countModule(!work.dump && !work.xrefs && !work.constants);
+	}
+
+	std::string report;
+	failed = false;
+	if (work.dump || work.xrefs || work.constants)
+	{
+		report = tracker ? DisassembleModule(*tracker, options, name, work, failed) : InspectModule(options, name, work, failed);
+		if (failed)
+		{
+			return report;
+		}
+		if (keyed && work.dump)
+		{
+			ProfileScope scope(STAGE_CACHE);
+			std::string outputPath = GetOutputPath(options, name);
+			std::vector<std::string> sharedNames;
+			std::string sharedCode;
+			if (!options.shared ||
+			    (sharedKeyed && ReadSharedNames(outputPath, sharedNames) && options.shared->exportFunctions(sharedNames, sharedCode) &&
+			     options.cache->storeContents(sharedKey, sharedCode)))
+			{
+				options.cache->storeFile(key, outputPath);
+			}
+		}
+		if (xrefKeyed && work.xrefs)
+		{
+			ProfileScope scope(STAGE_CACHE);
+			options.cache->storeContents(xrefKey, FormatXrefs(xrefs));
+		}
+		if (constantKeyed && work.constants)
+		{
+			ProfileScope scope(STAGE_CACHE);
+			options.cache->storeContents(constantKey, FormatConstants(constants));
+		}
+	}
+
+	if (options.xrefs)
+	{
+		options.xrefs->addModule(name, xrefs);
+	}
+	if (options.constants)
+	{
+		options.constants->addModule(name, constants);
+	}
+	return report;
+}
+
+void RunInspectWorker(BatchContext &context, size_t worker)
+{
+	// Nothing is shared between modules, so there is no per-worker state
+	size_t task;
+	while (context.queues->pop(worker, task))
+	{
+		bool failed;
+		Profiler::beginModule(context.names[task]);
+		std::string report = ProcessModule(*context.options, nullptr, context.names[task], failed);
+		Profiler::endModule();
+		ReportResult(context, task, report, failed);
+	}
+}
+
+void RunWorker(BatchContext &context, size_t worker)
+{
+	if (context.options->inspect)
+	{
+		RunInspectWorker(context, worker);
+		return;
+	}
+
+	// Module loading isn't safe to share, so every worker brings its own
+	// engine; modules shared by several of its tasks are still loaded once
+	asIScriptEngine *engine = (*context.engineFactory)();
+	if (engine)
+	{
+		AsfModuleTracker tracker(engine, context.options->root);
+		tracker.setMemoryBudget(context.options->memoryBudget);
+
+		// The other workers already keep the cores busy
+		tracker.setReaderCount(context.jobs > 1 ? 1 : 0);
+
+		size_t task;
+		while (context.queues->pop(worker, task))
+		{
+			bool failed;
+			Profiler::beginModule(context.names[task]);
+			std::string report = ProcessModule(*context.options, &tracker, context.names[task], failed);
+			Profiler::endModule();
+			ReportResult(context, task, report, failed);
+		}
+
+		std::lock_guard<std::mutex> lock(context.memoryMutex);
+		context.evictions += tracker.getEvictionCount();
+		context.peakResident = std::max(context.peakResident, tracker.getPeakResident());
+	}
+	else
+	{
+		// Leave the tasks to the other workers
+		std::cout << "failed to create engine\n";
+	}
+
+	if (engine)
+	{
+		engine->ShutDownAndRelease();
+	}
+}
+
+}
+
+int RunBatch(const EngineFactory &engineFactory, const BatchOptions &options)
+{
+	BatchContext context;
+	context.engineFactory = &engineFactory;
+	context.options = &options;
+	context.names = CollectCorpusNames(options);
+	context.reports.resize(context.names.size());
+	context.finished.resize(context.names.size(), false);
+
+	unsigned int jobs = GetCorpusJobs(options, context.names.size());
+
+	// Hand out the biggest modules first so a huge one isn't left for last
+	// while everyone else is idle
+	std::vector<size_t> order(context.names.size());
+	std::vector<uintmax_t> sizes(context.names.size(), 0);
+	for (size_t i = 0; i < context.names.size(); ++i)
+	{
+		order[i] = i;
+
+		boost::system::error_code error;
+		boost::filesystem::path filePath = options.root;
+		filePath.concat(context.names[i]);
+		uintmax_t size = boost::filesystem::file_size(filePath, error);
+		sizes[i] = error ? 0 : size;
+	}
+	std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b)
+	{
+		return sizes[a] > sizes[b];
+	});
+
+	WorkStealingQueues queues(jobs);
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		queues.push(i % jobs, order[i]);
+	}
+	context.queues = &queues;
+	context.jobs = jobs;
+
+	if (jobs == 1)
+	{
+		RunWorker(context, 0);
+	}
+	else
+	{
+		// Engines get created on the worker threads
+		asPrepareMultithread();
+
+		std::vector<std::thread> workers;
+		for (unsigned int i = 0; i < jobs; ++i)
+		{
+			workers.emplace_back([&context, i]()
+			{
+				RunWorker(context, i);
+				asThreadCleanup();
+			});
+		}
+		for (auto &worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	// Tasks left behind by workers that couldn't create an engine
+	for (size_t i = 0; i < context.names.size(); ++i)
+	{
+		if (!context.finished[i])
+		{
+			ReportResult(context, i, "\tskipped\n", true);
+		}
+	}
+
+	std::cout << fmtString("%u modules, %u failed\n",
+	                       static_cast<unsigned int>(context.names.size()), context.failed);
+	if (options.cache)
+	{
+		std::cout << fmtString("cache: %u hits, %u misses\n", options.cache->getHits(), options.cache->getMisses());
+	}
+	if (options.memoryBudget)
+	{
+		std::cout << fmtString("memory: %u evictions, peak %.1f MiB per worker\n",
+		                       context.evictions, context.peakResident / (1024.0 * 1024.0));
+	}
+	return context.failed ? -1 : 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "cache.h"
+#include "constants.h"
+#include "records.h"
+#include "shared.h"
+#include "xref.h"
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Creates a fully configured engine; called once per worker
+typedef std::function<asIScriptEngine *()> EngineFactory;
+
+struct RawModule;
+
+// The modules a corpus-wide mode reads, and how many workers read them
+struct CorpusOptions
+{
+	// Directory the module names are relative to
+	std::string root;
+
+	// Optional file with one module name per line; the root is scanned for
+	// .asf files if this is empty
+	std::string listFile;
+
+	// Number of worker threads; 0 picks one per hardware thread
+	unsigned int jobs = 1;
+};
+
+// Every batch worker has its own engine
+struct BatchOptions : CorpusOptions
+{
+	// Dumps are written here, mirroring the module names
+	std::string outputDir;
+
+	OutputFormat format = FORMAT_TEXT;
+
+	// Read the modules directly with the engine-free reader instead of
+	// loading them into engines; text output only
+	bool inspect = false;
+
+	// Optional; unchanged modules are copied from here instead of being
+	// loaded and dumped again
+	DumpCache *cache = nullptr;
+
+	// Optional; receives the references of every module for the xref index
+	XrefIndexBuilder *xrefs = nullptr;
+
+	// Optional; receives the constants of every module for the constant
+	// index
+	ConstantIndexBuilder *constants = nullptr;
+
+	// Optional; the bytecode of shared functions goes here once instead of
+	// into every text dump. Cached dumps bring the shared functions they name
+	// along.
+	SharedCodeWriter *shared = nullptr;
+
+	// Script memory in bytes each worker's loaded modules may take up before
+	// the least recently used are discarded; 0 keeps everything loaded.
+	// Needs InstallScriptMemoryAccounting. Dumps don't depend on it, so it
+	// isn't part of the cache keys.
+	int64_t memoryBudget = 0;
+};
+
+// Tells apart the kinds of dump of the same module in the cache
+unsigned int GetCacheVariant(OutputFormat format, bool inspect);
+
+std::vector<std::string> CollectModuleNames(const std::string &root);
+std::vector<std::string> ReadModuleList(const std::string &listFile);
+
+// The list file's names, or the root's modules if there is no list
+std::vector<std::string> CollectCorpusNames(const CorpusOptions &options);
+
+// The workers for that many modules: the jobs asked for, but never more than
+// one per module
+unsigned int GetCorpusJobs(const CorpusOptions &options, size_t moduleCount);
+
+// Reads the named modules without an engine on that many workers and passes
+// each to visit along with the worker reading it and the module's index in
+// names. Modules that can't be read are logged and skipped; returns how many.
+unsigned int ForEachRawModule(const CorpusOptions &options, const std::vector<std::string> &names, unsigned int jobs,
+                              const std::function<void(unsigned int worker, size_t index, const RawModule &module)> &visit);
+
+// Disassembles every module of the batch. Each worker configures a single
+// engine through the factory and reuses it for all of its modules; inspection
+// needs no engine and the factory may be empty.
+int RunBatch(const EngineFactory &engineFactory, const BatchOptions &options);
@@ -0,0 +1,195 @@
+#include "bench.h"
+
+#include "asf.h"
+#include "decoder.h"
+#include "disasm.h"
+#include "rawmodule.h"
+#include "symbols.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+namespace
+{
+
+typedef std::chrono::steady_clock BenchClock;
+
+struct CorpusSize
+{
+	size_t modules = 0;
+	uint64_t functions = 0;
+	uint64_t instructions = 0;
+	uintmax_t bytes = 0;
+};
+
+void PrintStage(const char *stage, double seconds, const CorpusSize &size)
+{
+	double rate = seconds > 0.0 ? 1.0 / seconds : 0.0;
+	std::cout << fmtString("\t%-9s %10.3f ms %10.1f modules/s %8.2f MiB/s %8.2f M instructions/s\n",
+	                       stage,
+	                       seconds * 1000.0,
+	                       size.modules * rate,
+	                       size.bytes * rate / (1024.0 * 1024.0),
+	                       size.instructions * rate / 1000000.0);
+}
+
+}
+
+void BenchDecode(asIScriptModule *module, unsigned int iterations)
+{
+	// Count the instructions once up front
+	uint64_t instructionCount = 0;
+	for (asUINT i = 0; i < module->GetFunctionCount(); ++i)
+	{
+		asUINT length;
+		asDWORD *code = module->GetFunctionByIndex(i)->GetByteCode(&length);
+		DecodedInstruction instruction;
+		for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+		{
+			++instructionCount;
+		}
+	}
+
+	NullSink sink;
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned int iteration = 0; iteration < iterations; ++iteration)
+	{
+		ModuleIds ids(module);
+		for (asUINT i = 0; i < module->GetFunctionCount(); ++i)
+		{
+			dumpBytecode(module->GetFunctionByIndex(i), ids, sink);
+		}
+	}
+	sink.flush();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	uint64_t total = instructionCount * iterations;
+	std::cout << fmtString("decoded %llu instructions (%llu x %u) in %.3f ms, %.2f M instructions/s\n",
+	                       static_cast<unsigned long long>(total),
+	                       static_cast<unsigned long long>(instructionCount),
+	                       iterations,
+	                       elapsed.count() * 1000.0,
+	                       elapsed.count() > 0.0 ? total / elapsed.count() / 1000000.0 : 0.0);
+}
+
+bool BenchCorpus(const EngineFactory &engineFactory, const std::string &workDir, const CorpusShape &shape,
+                 const std::vector<unsigned int> &sizes)
+{
+	for (unsigned int moduleCount : sizes)
+	{
+		CorpusShape corpusShape = shape;
+		corpusShape.modules = moduleCount;
+
+		// Module names are appended to the root as they are
+		boost::filesystem::path corpusPath = workDir;
+		corpusPath /= std::to_string(moduleCount);
+		std::string root = corpusPath.generic_string() + "/";
+
+		std::vector<std::string> names;
+		std::string error;
+		auto start = BenchClock::now();
+		asIScriptEngine *generatorEngine = engineFactory();
+		if (!generatorEngine)
+		{
+			return false;
+		}
+		bool generated = GenerateCorpus(generatorEngine, corpusShape, root, names, error);
+		generatorEngine->ShutDownAndRelease();
+		if (!generated)
+		{
+			std::cout << error << "\n";
+			return false;
+		}
+		std::chrono::duration<double> generateTime = BenchClock::now() - start;
+
+		CorpusSize size;
+		size.modules = names.size();
+		for (const std::string &name : names)
+		{
+			size.bytes += boost::filesystem::file_size(root + name);
+		}
+
+		// Configuring the engine isn't part of loading
+		asIScriptEngine *engine = engineFactory();
+		if (!engine)
+		{
+			return false;
+		}
+		std::unique_ptr<AsfModuleTracker> tracker(new AsfModuleTracker(engine, root));
+		std::vector<asIScriptModule *> modules;
+		start = BenchClock::now();
+		for (const std::string &name : names)
+		{
+			modules.push_back(tracker->getModule(name)->getScriptModule());
+		}
+		std::chrono::duration<double> loadTime = BenchClock::now() - start;
+		if (std::find(modules.begin(), modules.end(), nullptr) != modules.end())
+		{
+			tracker.reset();
+			engine->ShutDownAndRelease();
+			return false;
+		}
+
+		// The reader's modules are kept until the end so freeing them isn't
+		// timed
+		std::vector<RawModule> rawModules(names.size());
+		start = BenchClock::now();
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			if (!LoadRawModule(root + names[i], rawModules[i], error))
+			{
+				std::cout << names[i] << ": " << error << "\n";
+				tracker.reset();
+				engine->ShutDownAndRelease();
+				return false;
+			}
+		}
+		std::chrono::duration<double> translateTime = BenchClock::now() - start;
+
+		for (const RawModule &rawModule : rawModules)
+		{
+			for (const RawFunction &function : rawModule.functions)
+			{
+				if (function.funcType != asFUNC_SCRIPT)
+				{
+					continue;
+				}
+				++size.functions;
+				DecodedInstruction instruction;
+				const asDWORD *code = function.byteCode.data();
+				asUINT length = static_cast<asUINT>(function.byteCode.size());
+				for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+				{
+					++size.instructions;
+				}
+			}
+		}
+
+		NullSink sink;
+		start = BenchClock::now();
+		for (asIScriptModule *module : modules)
+		{
+			DumpModule(module, sink);
+		}
+		sink.flush();
+		std::chrono::duration<double> dumpTime = BenchClock::now() - start;
+
+		tracker.reset();
+		engine->ShutDownAndRelease();
+
+		std::cout << fmtString("corpus of %u modules: %llu functions, %llu instructions, %.2f MiB, generated in %.3f ms\n",
+		                       static_cast<unsigned int>(size.modules),
+		                       static_cast<unsigned long long>(size.functions),
+		                       static_cast<unsigned long long>(size.instructions),
+		                       size.bytes / (1024.0 * 1024.0),
+		                       generateTime.count() * 1000.0);
+		PrintStage("load", loadTime.count(), size);
+		PrintStage("translate", translateTime.count(), size);
+		PrintStage("dump", dumpTime.count(), size);
+	}
+	return true;
+}
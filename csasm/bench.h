@@ -0,0 +1,21 @@
+#pragma once
+
+#include "batch.h"
+#include "generator.h"
+
+#include <angelscript.h>
+
+#include <string>
+#include <vector>
+
+// Disassembles every function of the module repeatedly into a null sink and
+// reports the instruction throughput of the bytecode decoder
+void BenchDecode(asIScriptModule *module, unsigned int iterations);
+
+// Generates a corpus of the shape for each of the module counts into its own
+// directory under workDir, then times loading it into an engine, translating
+// it with the engine-free reader and dumping it as text, and reports the
+// throughput of each stage. Returns false if a corpus can't be generated or
+// a module doesn't load.
+bool BenchCorpus(const EngineFactory &engineFactory, const std::string &workDir, const CorpusShape &shape,
+                 const std::vector<unsigned int> &sizes);
@@ -0,0 +1,193 @@
+#include "cache.h"
+
+#include "asf.h"
+#include "hash.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstdio>
+#include <fstream>
+
+namespace
+{
+
+// Bump whenever the dump output changes, so older entries stop matching
+const uint64_t cCacheVersion = 3;
+
+// Deeper than any real dependency chain; also stops dependency cycles
+const int cMaxDependencyDepth = 64;
+
+}
+
+DumpCache::DumpCache(const std::string &directory, uint64_t configHash)
+	: mDirectory(directory), mConfigHash(configHash), mHits(0), mMisses(0)
+{
+	boost::system::error_code error;
+	boost::filesystem::create_directories(mDirectory, error);
+}
+
+bool DumpCache::getKey(const std::string &root, const std::string &name, unsigned int variant, uint64_t &key)
+{
+	uint64_t moduleHash;
+	if (!getModuleHash(root, name, 0, moduleHash))
+	{
+		return false;
+	}
+
+	key = CombineHash(cCacheVersion, mConfigHash);
+	key = CombineHash(key, variant);
+	key = CombineHash(key, moduleHash);
+	return true;
+}
+
+bool DumpCache::getStandaloneKey(const std::string &path, unsigned int variant, uint64_t &key)
+{
+	uint64_t fileHash;
+	if (!HashFile(path, fileHash))
+	{
+		return false;
+	}
+
+	key = CombineHash(cCacheVersion, variant);
+	key = CombineHash(key, fileHash);
+	return true;
+}
+
+bool DumpCache::getModuleHash(const std::string &root, const std::string &name, int depth, uint64_t &hash)
+{
+	if (depth > cMaxDependencyDepth)
+	{
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mModuleMutex);
+		auto it = mModuleHashes.find(name);
+		if (it != mModuleHashes.end())
+		{
+			hash = it->second;
+			return true;
+		}
+	}
+
+	// Module names are concatenated to the root, as in AsfModuleTracker
+	boost::filesystem::path filePath = root;
+	filePath.concat(name);
+
+	boost::system::error_code error;
+	if (boost::filesystem::file_size(filePath, error) == 0 || error)
+	{
+		return false;
+	}
+
+	boost::iostreams::mapped_file_source file;
+	try
+	{
+		file.open(filePath.string());
+	}
+	catch (const std::exception &)
+	{
+		return false;
+	}
+
+	AsfHeader header;
+	const char *headerError;
+	if (!ParseAsfHeader(reinterpret_cast<const uint8_t *>(file.data()), file.size(), header, &headerError))
+	{
+		return false;
+	}
+
+	// A dependency changing changes what the module's dump resolves to
+	hash = HashBytes(file.data(), file.size());
+	for (const std::string &dependency : header.dependencies)
+	{
+		uint64_t dependencyHash;
+		if (!getModuleHash(root, dependency, depth + 1, dependencyHash))
+		{
+			return false;
+		}
+		hash = CombineHash(hash, dependencyHash);
+	}
+
+	std::lock_guard<std::mutex> lock(mModuleMutex);
+	mModuleHashes[name] = hash;
+	return true;
+}
+
+std::string DumpCache::getEntryPath(uint64_t key) const
+{
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%016llx.dump", static_cast<unsigned long long>(key));
+	return (boost::filesystem::path(mDirectory) / fileName).string();
+}
+
+std::string DumpCache::getTempPath(uint64_t key) const
+{
+	// Random, so concurrent writers, even from other runs, never collide
+	return getEntryPath(key) + boost::filesystem::unique_path(".%%%%%%%%.tmp").string();
+}
+
+bool DumpCache::fetch(uint64_t key, OutputSink &sink)
+{
+	std::string entryPath = getEntryPath(key);
+
+	// Empty dumps aren't stored, and can't be mapped anyway
+	boost::system::error_code error;
+	if (boost::filesystem::file_size(entryPath, error) == 0 || error)
+	{
+		return false;
+	}
+
+	boost::iostreams::mapped_file_source file;
+	try
+	{
+		file.open(entryPath);
+	}
+	catch (const std::exception &)
+	{
+		return false;
+	}
+
+	sink.write(file.data(), file.size());
+	sink.flush();
+	return true;
+}
+
+bool DumpCache::storeFile(uint64_t key, const std::string &dumpPath)
+{
+	std::string tempPath = getTempPath(key);
+	boost::system::error_code error;
+	boost::filesystem::copy_file(dumpPath, tempPath, error);
+	if (error)
+	{
+		return false;
+	}
+	return commit(tempPath, key);
+}
+
+bool DumpCache::storeContents(uint64_t key, const std::string &contents)
+{
+	std::string tempPath = getTempPath(key);
+	{
+		std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+		if (!stream.write(contents.data(), contents.size()))
+		{
+			return false;
+		}
+	}
+	return commit(tempPath, key);
+}
+
+bool DumpCache::commit(const std::string &tempPath, uint64_t key)
+{
+	// Entries only ever appear whole, even to a concurrent run
+	boost::system::error_code error;
+	boost::filesystem::rename(tempPath, getEntryPath(key), error);
+	if (error)
+	{
+		boost::filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "sink.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Finished dumps on disk, keyed by everything that goes into them: the
+// module file, the keys of its dependencies, the config and the kind of
+// dump. Safe to share between workers and between concurrent runs.
+class DumpCache
+{
+public:
+	DumpCache(const std::string &directory, uint64_t configHash);
+
+	// Key of a module's dump; false if the module or one of its
+	// dependencies can't be read
+	bool getKey(const std::string &root, const std::string &name, unsigned int variant, uint64_t &key);
+
+	// Key of a dump that depends on the file alone, like an inspection
+	bool getStandaloneKey(const std::string &path, unsigned int variant, uint64_t &key);
+
+	// Streams a cached dump into the sink
+	bool fetch(uint64_t key, OutputSink &sink);
+
+	// Stores a dump that was written to a file, or one held in memory
+	bool storeFile(uint64_t key, const std::string &dumpPath);
+	bool storeContents(uint64_t key, const std::string &contents);
+
+	// Statistics are per module rather than per entry, as a module may need
+	// several: a hit if everything it needed came from the cache
+	void countModule(bool hit)
+	{
+		if (hit)
+		{
+			++mHits;
+		}
+		else
+		{
+			++mMisses;
+		}
+	}
+
+	unsigned int getHits() const
+	{
+		return mHits;
+	}
+
+	unsigned int getMisses() const
+	{
+		return mMisses;
+	}
+
+private:
+	std::string getEntryPath(uint64_t key) const;
+	std::string getTempPath(uint64_t key) const;
+	bool commit(const std::string &tempPath, uint64_t key);
+	bool getModuleHash(const std::string &root, const std::string &name, int depth, uint64_t &hash);
+
+	std::string mDirectory;
+	uint64_t mConfigHash;
+
+	// Hashes of module files with their dependencies, by name
+	std::mutex mModuleMutex;
+	std::map<std::string, uint64_t> mModuleHashes;
+
+	std::atomic<unsigned int> mHits;
+	std::atomic<unsigned int> mMisses;
+};
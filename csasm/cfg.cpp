@@ -0,0 +1,336 @@
+#include "cfg.h"
+#include "decoder.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// Calls can throw, which leaves the function in the middle of the block
+bool IsCall(asEBCInstr op)
+{
+	switch (op)
+	{
+	case asBC_CALL:
+	case asBC_CALLSYS:
+	case asBC_CALLBND:
+	case asBC_CALLINTF:
+	case asBC_CallPtr:
+	case asBC_Thiscall1:
+	case asBC_ALLOC:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Target of the instruction's jump operand, if it has one
+bool GetJumpTarget(const DecodedInstruction &instruction, asUINT &target)
+{
+	for (int i = 0; i < instruction.descriptor->operandCount; ++i)
+	{
+		if (instruction.descriptor->operands[i].kind == OPERAND_JUMP)
+		{
+			target = instruction.getJumpTarget(instruction.operands[i]);
+			return true;
+		}
+	}
+	return false;
+}
+
+void AddEdge(std::vector<BasicBlock> &blocks, asUINT from, asUINT to)
+{
+	if (to == cNoBlock)
+	{
+		return;
+	}
+	std::vector<asUINT> &successors = blocks[from].successors;
+	if (std::find(successors.begin(), successors.end(), to) == successors.end())
+	{
+		successors.push_back(to);
+		blocks[to].predecessors.push_back(from);
+	}
+}
+
+}
+
+void ControlFlowGraph::build(const asDWORD *code, asUINT length)
+{
+	mBlocks.clear();
+	mLoops.clear();
+	mOrder.clear();
+	mOrderIndex.clear();
+
+	splitBlocks(code, length);
+	computeDominators();
+	findLoops();
+}
+
+void ControlFlowGraph::splitBlocks(const asDWORD *code, asUINT length)
+{
+	// Where blocks start; one past the end so a trailing branch needs no check
+	std::vector<uint8_t> leaders(length + 1, 0);
+	leaders[0] = 1;
+	DecodedInstruction instruction;
+	asUINT position = 0;
+	for (; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+	{
+		asUINT end = position + instruction.getLength();
+		asUINT target;
+		if (GetJumpTarget(instruction, target))
+		{
+			if (target < length)
+			{
+				leaders[target] = 1;
+			}
+			leaders[end] = 1;
+		}
+		else if (instruction.op == asBC_RET || instruction.op == asBC_JMPP || IsCall(instruction.op))
+		{
+			leaders[end] = 1;
+		}
+	}
+	asUINT codeEnd = position;
+
+	// Block starting at each position, to resolve jumps without a search
+	std::vector<asUINT> blockAt(codeEnd, cNoBlock);
+	std::vector<asUINT> lastInstructions;
+	for (position = 0; position < codeEnd; position += instruction.getLength())
+	{
+		DecodeInstruction(code, length, position, instruction);
+		if (leaders[position])
+		{
+			blockAt[position] = static_cast<asUINT>(mBlocks.size());
+			mBlocks.emplace_back();
+			mBlocks.back().start = position;
+			lastInstructions.push_back(position);
+		}
+		mBlocks.back().end = position + instruction.getLength();
+		++mBlocks.back().instructions;
+		lastInstructions.back() = position;
+	}
+
+	auto blockStartingAt = [&blockAt, codeEnd](asUINT target)
+	{
+		return target < codeEnd ? blockAt[target] : cNoBlock;
+	};
+	for (asUINT block = 0; block < mBlocks.size(); ++block)
+	{
+		DecodeInstruction(code, length, lastInstructions[block], instruction);
+		asUINT end = mBlocks[block].end;
+		asUINT target;
+		if (instruction.op == asBC_RET)
+		{
+			continue;
+		}
+		if (instruction.op == asBC_JMPP)
+		{
+			// The table is made of JMPs, each a block of its own
+			DecodedInstruction entry;
+			for (asUINT next = end; next < codeEnd && DecodeInstruction(code, length, next, entry) && entry.op == asBC_JMP;
+			     next += entry.getLength())
+			{
+				AddEdge(mBlocks, block, blockStartingAt(next));
+			}
+			continue;
+		}
+		if (instruction.op != asBC_JMP)
+		{
+			AddEdge(mBlocks, block, blockStartingAt(end));
+		}
+		if (GetJumpTarget(instruction, target))
+		{
+			AddEdge(mBlocks, block, blockStartingAt(target));
+		}
+	}
+}
+
+void ControlFlowGraph::computeDominators()
+{
+	mOrderIndex.assign(mBlocks.size(), cNoBlock);
+	if (mBlocks.empty())
+	{
+		return;
+	}
+
+	// Postorder of what the entry reaches, without recursion
+	std::vector<std::pair<asUINT, size_t>> stack;
+	stack.emplace_back(0, 0);
+	mBlocks[0].reachable = true;
+	while (!stack.empty())
+	{
+		asUINT block = stack.back().first;
+		size_t &next = stack.back().second;
+		if (next < mBlocks[block].successors.size())
+		{
+			asUINT successor = mBlocks[block].successors[next++];
+			if (!mBlocks[successor].reachable)
+			{
+				mBlocks[successor].reachable = true;
+				stack.emplace_back(successor, 0);
+			}
+			continue;
+		}
+		mOrder.push_back(block);
+		stack.pop_back();
+	}
+	std::reverse(mOrder.begin(), mOrder.end());
+	for (asUINT i = 0; i < mOrder.size(); ++i)
+	{
+		mOrderIndex[mOrder[i]] = i;
+	}
+
+	// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"; the
+	// entry is its own dominator while this runs
+	std::vector<asUINT> dominators(mBlocks.size(), cNoBlock);
+	dominators[0] = 0;
+	auto intersect = [this, &dominators](asUINT a, asUINT b)
+	{
+		while (a != b)
+		{
+			while (mOrderIndex[a] > mOrderIndex[b])
+			{
+				a = dominators[a];
+			}
+			while (mOrderIndex[b] > mOrderIndex[a])
+			{
+				b = dominators[b];
+			}
+		}
+		return a;
+	};
+	for (bool changed = true; changed; )
+	{
+		changed = false;
+		for (size_t i = 1; i < mOrder.size(); ++i)
+		{
+			asUINT block = mOrder[i];
+			asUINT dominator = cNoBlock;
+			for (asUINT predecessor : mBlocks[block].predecessors)
+			{
+				if (dominators[predecessor] != cNoBlock)
+				{
+					dominator = dominator == cNoBlock ? predecessor : intersect(predecessor, dominator);
+				}
+			}
+			if (dominators[block] != dominator)
+			{
+				dominators[block] = dominator;
+				changed = true;
+			}
+		}
+	}
+
+	for (size_t i = 1; i < mOrder.size(); ++i)
+	{
+		mBlocks[mOrder[i]].immediateDominator = dominators[mOrder[i]];
+	}
+}
+
+void ControlFlowGraph::findLoops()
+{
+	// Headers in block order, which is the order of their positions
+	std::vector<asUINT> visited(mBlocks.size(), cNoLoop);
+	std::vector<asUINT> work;
+	for (asUINT header = 0; header < mBlocks.size(); ++header)
+	{
+		Loop loop;
+		for (asUINT predecessor : mBlocks[header].predecessors)
+		{
+			if (dominates(header, predecessor))
+			{
+				loop.latches.push_back(predecessor);
+			}
+		}
+		if (loop.latches.empty())
+		{
+			continue;
+		}
+		std::sort(loop.latches.begin(), loop.latches.end());
+
+		// Walk back from the latches; the header stops the walk
+		asUINT index = static_cast<asUINT>(mLoops.size());
+		loop.header = header;
+		loop.blocks.push_back(header);
+		visited[header] = index;
+		work = loop.latches;
+		while (!work.empty())
+		{
+			asUINT block = work.back();
+			work.pop_back();
+			if (visited[block] == index || !mBlocks[block].reachable)
+			{
+				continue;
+			}
+			visited[block] = index;
+			loop.blocks.push_back(block);
+			work.insert(work.end(), mBlocks[block].predecessors.begin(), mBlocks[block].predecessors.end());
+		}
+		std::sort(loop.blocks.begin(), loop.blocks.end());
+		mLoops.push_back(std::move(loop));
+	}
+
+	// Natural loops with different headers are nested or apart, so the
+	// smallest loop around a header is its parent
+	for (Loop &loop : mLoops)
+	{
+		for (const Loop &other : mLoops)
+		{
+			if (&other == &loop || !std::binary_search(other.blocks.begin(), other.blocks.end(), loop.header))
+			{
+				continue;
+			}
+			++loop.depth;
+			if (loop.parent == cNoLoop || mLoops[loop.parent].blocks.size() > other.blocks.size())
+			{
+				loop.parent = static_cast<asUINT>(&other - mLoops.data());
+			}
+		}
+	}
+
+	for (asUINT index = 0; index < mLoops.size(); ++index)
+	{
+		for (asUINT block : mLoops[index].blocks)
+		{
+			BasicBlock &basicBlock = mBlocks[block];
+			++basicBlock.loopDepth;
+			if (basicBlock.loop == cNoLoop || mLoops[basicBlock.loop].depth < mLoops[index].depth)
+			{
+				basicBlock.loop = index;
+			}
+		}
+	}
+}
+
+asUINT ControlFlowGraph::getBlockAt(asUINT position) const
+{
+	auto after = std::upper_bound(mBlocks.begin(), mBlocks.end(), position, [](asUINT position, const BasicBlock &block)
+	{
+		return position < block.start;
+	});
+	if (after == mBlocks.begin() || position >= (after - 1)->end)
+	{
+		return cNoBlock;
+	}
+	return static_cast<asUINT>(after - 1 - mBlocks.begin());
+}
+
+bool ControlFlowGraph::dominates(asUINT a, asUINT b) const
+{
+	if (a >= mBlocks.size() || b >= mBlocks.size() || !mBlocks[a].reachable || !mBlocks[b].reachable)
+	{
+		return false;
+	}
+	for (;;)
+	{
+		if (b == a)
+		{
+			return true;
+		}
+		if (b == 0)
+		{
+			return false;
+		}
+		b = mBlocks[b].immediateDominator;
+	}
+}
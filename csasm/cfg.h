@@ -0,0 +1,89 @@
+#pragma once
+
+#include <angelscript.h>
+
+#include <vector>
+
+const asUINT cNoBlock = ~0u;
+const asUINT cNoLoop = ~0u;
+
+struct BasicBlock
+{
+	// Dword positions of the first instruction and one past the last
+	asUINT start = 0;
+	asUINT end = 0;
+	asUINT instructions = 0;
+
+	// Falling through first, then jump targets; no duplicates
+	std::vector<asUINT> successors;
+	std::vector<asUINT> predecessors;
+
+	bool reachable = false;
+
+	// cNoBlock for the entry and for blocks that can't be reached
+	asUINT immediateDominator = cNoBlock;
+
+	// Innermost loop the block is in and how many loops it is in
+	asUINT loop = cNoLoop;
+	asUINT loopDepth = 0;
+};
+
+// A natural loop: the blocks that reach a back edge to the header without
+// passing the header. Back edges to the same header make one loop.
+struct Loop
+{
+	asUINT header = cNoBlock;
+
+	// Sorted, header included
+	std::vector<asUINT> blocks;
+
+	// Blocks with a back edge to the header
+	std::vector<asUINT> latches;
+
+	asUINT parent = cNoLoop;
+	asUINT depth = 1;
+};
+
+// Basic blocks of a function's bytecode, with dominators, natural loops and
+// which blocks can be reached from the entry. Blocks start at the entry, at
+// jump targets and after branches, RET and calls, since a call can throw and
+// leave the function there. The jump table behind JMPP isn't sized in the
+// bytecode; the JMPs right after it are taken as its entries.
+//
+// Works on engine and raw bytecode alike, as only jumps are followed.
+// Bytecode cut off in the middle of an instruction ends before it.
+class ControlFlowGraph
+{
+public:
+	void build(const asDWORD *code, asUINT length);
+
+	const std::vector<BasicBlock> &getBlocks() const
+	{
+		return mBlocks;
+	}
+
+	// In the order of their headers
+	const std::vector<Loop> &getLoops() const
+	{
+		return mLoops;
+	}
+
+	// Block holding the instruction at position, cNoBlock if none
+	asUINT getBlockAt(asUINT position) const;
+
+	// Whether every path from the entry to b passes a; blocks dominate
+	// themselves, unreachable ones are dominated by nothing
+	bool dominates(asUINT a, asUINT b) const;
+
+private:
+	void splitBlocks(const asDWORD *code, asUINT length);
+	void computeDominators();
+	void findLoops();
+
+	std::vector<BasicBlock> mBlocks;
+	std::vector<Loop> mLoops;
+
+	// Reachable blocks in reverse postorder and each block's place in it
+	std::vector<asUINT> mOrder;
+	std::vector<asUINT> mOrderIndex;
+};
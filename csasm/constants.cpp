@@ -0,0 +1,673 @@
+#include "constants.h"
+
+#include "decoder.h"
+#include "disasm.h"
+#include "sjis.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+
+namespace
+{
+
+const char cIndexMagic[4] = { 'C', 'S', 'C', 'I' };
+const uint32_t cIndexVersion = 1;
+
+// The index is laid out as
+//   IndexHeader
+//   u32 string offsets[stringCount + 1], into the string data, padded to a
+//       multiple of eight bytes
+//   ConstantIndexEntry entries[entryCount], by size, value, module,
+//       function, position
+//   string data
+// in host byte order. Strings are sorted, so their ids compare like them and
+// every lookup is a binary search.
+struct IndexHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t stringCount;
+	uint32_t entryCount;
+};
+
+static_assert(sizeof(ConstantIndexEntry) == 24, "index entries are written as they are");
+
+// Whether the operand is a value the script wrote rather than an offset,
+// variable or symbol
+bool IsImmediate(const DecodedInstruction &instruction, int index)
+{
+	switch (instruction.operands[index].kind)
+	{
+	case OPERAND_CONSTANT:
+		// Cast's is a type id
+		return instruction.op != asBC_Cast;
+	case OPERAND_HEX:
+	case OPERAND_FLOAT:
+		return true;
+	case OPERAND_SIGNED:
+		switch (instruction.op)
+		{
+		case asBC_CMPIi:
+		case asBC_CMPIu:
+		case asBC_ADDIi:
+		case asBC_SUBIi:
+		case asBC_MULIi:
+			return true;
+		case asBC_SetG4:
+			return index == 1;
+		default:
+			return false;
+		}
+	default:
+		return false;
+	}
+}
+
+// Adds the constants of one function's bytecode; resolve gives the text of
+// a string id and returns false if it doesn't resolve
+template<typename Resolve>
+void CollectFunctionConstants(const asDWORD *code, asUINT length, const std::string &function,
+                              const Resolve &resolve, std::vector<FunctionConstants> &functions)
+{
+	FunctionConstants constants;
+	DecodedInstruction instruction;
+	for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+	{
+		for (int i = 0; i < instruction.descriptor->operandCount; ++i)
+		{
+			const DecodedOperand &operand = instruction.operands[i];
+			ConstantUse use;
+			use.position = position;
+			use.op = instruction.op;
+			use.value = 0;
+			if (operand.kind == OPERAND_STRING)
+			{
+				use.size = 0;
+				if (!resolve(static_cast<asUINT>(operand.value), use.text))
+				{
+					continue;
+				}
+			}
+			else if (IsImmediate(instruction, i))
+			{
+				use.size = operand.size;
+				use.value = operand.value;
+			}
+			else
+			{
+				continue;
+			}
+			constants.uses.push_back(std::move(use));
+		}
+	}
+
+	if (!constants.uses.empty())
+	{
+		constants.function = function;
+		functions.push_back(std::move(constants));
+	}
+}
+
+const char cHexDigits[] = "0123456789abcdef";
+
+// String constants can hold anything, so the cache has them in hex
+std::string EncodeHex(const std::string &str)
+{
+	std::string hex;
+	hex.reserve(str.size() * 2);
+	for (unsigned char c : str)
+	{
+		hex += cHexDigits[c >> 4];
+		hex += cHexDigits[c & 0xf];
+	}
+	return hex;
+}
+
+bool DecodeHex(const std::string &hex, std::string &str)
+{
+	auto digit = [](char c)
+	{
+		const char *found = strchr(cHexDigits, c);
+		return c && found ? static_cast<int>(found - cHexDigits) : -1;
+	};
+	if (hex.size() % 2)
+	{
+		return false;
+	}
+	str.clear();
+	for (size_t i = 0; i < hex.size(); i += 2)
+	{
+		int high = digit(hex[i]);
+		int low = digit(hex[i + 1]);
+		if (high < 0 || low < 0)
+		{
+			return false;
+		}
+		str += static_cast<char>(high << 4 | low);
+	}
+	return true;
+}
+
+template<typename T>
+void AppendValue(std::string &out, T value)
+{
+	out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// Immediate an entry stands for: size and bits
+typedef std::pair<uint8_t, uint64_t> ValueKey;
+
+// Sizes and bits a value query matches; false if it isn't a number
+bool ParseValueQuery(const std::string &query, std::vector<ValueKey> &keys)
+{
+	if (query.empty())
+	{
+		return false;
+	}
+
+	const char *begin = query.c_str();
+	char *end;
+	errno = 0;
+	bool negative = query[0] == '-';
+	uint64_t bits = negative ? static_cast<uint64_t>(strtoll(begin, &end, 0)) : strtoull(begin, &end, 0);
+	if (*end == '\0' && errno == 0)
+	{
+		for (uint8_t size : { 1, 2, 4, 8 })
+		{
+			uint64_t mask = size == 8 ? ~uint64_t(0) : (uint64_t(1) << size * 8) - 1;
+			uint64_t signBits = ~(mask >> 1);
+			bool fits = negative ? (bits & signBits) == signBits : (bits & ~mask) == 0;
+			if (fits)
+			{
+				keys.emplace_back(size, bits & mask);
+			}
+		}
+		return true;
+	}
+
+	errno = 0;
+	double number = strtod(begin, &end);
+	if (*end != '\0' || errno != 0)
+	{
+		return false;
+	}
+	float single = static_cast<float>(number);
+	uint32_t singleBits;
+	memcpy(&singleBits, &single, sizeof(singleBits));
+	keys.emplace_back(4, singleBits);
+	uint64_t doubleBits;
+	memcpy(&doubleBits, &number, sizeof(doubleBits));
+	keys.emplace_back(8, doubleBits);
+	return true;
+}
+
+class ConstantIndexReader
+{
+public:
+	bool open(const std::string &path, std::string &error)
+	{
+		boost::system::error_code sizeError;
+		if (boost::filesystem::file_size(path, sizeError) < sizeof(IndexHeader) || sizeError)
+		{
+			error = "not a constant index";
+			return false;
+		}
+
+		try
+		{
+			mFile.open(path);
+		}
+		catch (const std::exception &)
+		{
+			error = "failed to open";
+			return false;
+		}
+
+		const char *data = mFile.data();
+		size_t size = mFile.size();
+		memcpy(&mHeader, data, sizeof(mHeader));
+		if (memcmp(mHeader.magic, cIndexMagic, sizeof(cIndexMagic)) != 0 || mHeader.version != cIndexVersion)
+		{
+			error = "not a constant index of this version";
+			return false;
+		}
+
+		uint64_t offsetsSize = (uint64_t(mHeader.stringCount) + 1) * sizeof(uint32_t);
+		offsetsSize = (offsetsSize + 7) & ~uint64_t(7);
+		if (offsetsSize + uint64_t(mHeader.entryCount) * sizeof(ConstantIndexEntry) > size - sizeof(IndexHeader))
+		{
+			error = "truncated";
+			return false;
+		}
+
+		// The header and offsets keep the entries at a multiple of eight
+		const char *head = data + sizeof(IndexHeader);
+		mOffsets = reinterpret_cast<const uint32_t *>(head);
+		head += offsetsSize;
+		mEntries = reinterpret_cast<const ConstantIndexEntry *>(head);
+		head += mHeader.entryCount * sizeof(ConstantIndexEntry);
+		mStrings = head;
+
+		size_t stringsSize = data + size - head;
+		for (uint32_t i = 0; i < mHeader.stringCount; ++i)
+		{
+			if (mOffsets[i] > mOffsets[i + 1])
+			{
+				error = "corrupt string table";
+				return false;
+			}
+		}
+		if (mOffsets[mHeader.stringCount] > stringsSize)
+		{
+			error = "corrupt string table";
+			return false;
+		}
+		return true;
+	}
+
+	std::string getString(uint32_t id) const
+	{
+		if (id >= mHeader.stringCount)
+		{
+			return "?";
+		}
+		return std::string(mStrings + mOffsets[id], mOffsets[id + 1] - mOffsets[id]);
+	}
+
+	bool findString(const std::string &str, uint32_t &id) const
+	{
+		uint32_t low = 0;
+		uint32_t high = mHeader.stringCount;
+		while (low < high)
+		{
+			uint32_t middle = low + (high - low) / 2;
+			int order = compare(middle, str);
+			if (order == 0)
+			{
+				id = middle;
+				return true;
+			}
+			if (order < 0)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return false;
+	}
+
+	// Uses of the immediate, or of the string constant with size 0
+	std::pair<const ConstantIndexEntry *, const ConstantIndexEntry *> getEntries(uint8_t size, uint64_t value) const
+	{
+		const ConstantIndexEntry *end = mEntries + mHeader.entryCount;
+		ValueKey key(size, value);
+		auto begin = std::lower_bound(mEntries, end, key, [](const ConstantIndexEntry &entry, const ValueKey &key)
+		{
+			return ValueKey(entry.size, entry.value) < key;
+		});
+		end = std::upper_bound(begin, end, key, [](const ValueKey &key, const ConstantIndexEntry &entry)
+		{
+			return key < ValueKey(entry.size, entry.value);
+		});
+		return std::make_pair(begin, end);
+	}
+
+	// String constants are the entries of size 0, which sort first
+	std::vector<uint32_t> getStringConstants() const
+	{
+		std::vector<uint32_t> ids;
+		for (const ConstantIndexEntry *entry = mEntries; entry != mEntries + mHeader.entryCount && entry->size == 0; ++entry)
+		{
+			if (ids.empty() || ids.back() != entry->value)
+			{
+				ids.push_back(static_cast<uint32_t>(entry->value));
+			}
+		}
+		return ids;
+	}
+
+private:
+	int compare(uint32_t id, const std::string &str) const
+	{
+		size_t length = mOffsets[id + 1] - mOffsets[id];
+		int order = memcmp(mStrings + mOffsets[id], str.data(), std::min(length, str.size()));
+		if (order != 0)
+		{
+			return order;
+		}
+		return length < str.size() ? -1 : (length > str.size() ? 1 : 0);
+	}
+
+	boost::iostreams::mapped_file_source mFile;
+	IndexHeader mHeader;
+	const uint32_t *mOffsets = nullptr;
+	const ConstantIndexEntry *mEntries = nullptr;
+	const char *mStrings = nullptr;
+};
+
+void WriteEntries(OutputSink &sink, const ConstantIndexReader &index,
+                  const std::pair<const ConstantIndexEntry *, const ConstantIndexEntry *> &entries)
+{
+	for (const ConstantIndexEntry *entry = entries.first; entry != entries.second; ++entry)
+	{
+		sink.format("\t%s\t%s\t%04x\t%s\n",
+		            index.getString(entry->module).c_str(),
+		            index.getString(entry->function).c_str(),
+		            entry->position,
+		            GetOpcodeDescriptor(static_cast<asEBCInstr>(entry->op)).name);
+	}
+}
+
+}
+
+void CollectConstants(asIScriptModule *module, std::vector<FunctionConstants> &functions)
+{
+	asIScriptEngine *engine = module->GetEngine();
+	auto resolve = [engine](asUINT id, std::string &text)
+	{
+		size_t length;
+		const char *str = ResolveString(engine, id, &length);
+		if (!str)
+		{
+			return false;
+		}
+		text = SjisToUtf8(std::string(str, length));
+		return true;
+	};
+
+	std::vector<asIScriptFunction *> scriptFunctions;
+	GetScriptFunctions(module, scriptFunctions);
+	for (asIScriptFunction *function : scriptFunctions)
+	{
+		asUINT length;
+		asDWORD *code = function->GetByteCode(&length);
+		if (code)
+		{
+			CollectFunctionConstants(code, length, function->GetDeclaration(true, true, false), resolve, functions);
+		}
+	}
+}
+
+void CollectRawConstants(const RawModule &module, std::vector<FunctionConstants> &functions)
+{
+	auto resolve = [&module](asUINT index, std::string &text)
+	{
+		if (index >= module.usedStrings.size())
+		{
+			return false;
+		}
+		text = SjisToUtf8(module.usedStrings[index]);
+		return true;
+	};
+	for (const RawFunction &function : module.functions)
+	{
+		if (function.funcType == asFUNC_SCRIPT)
+		{
+			CollectFunctionConstants(function.byteCode.data(), static_cast<asUINT>(function.byteCode.size()),
+			                         function.getDeclaration(), resolve, functions);
+		}
+	}
+}
+
+std::string FormatConstants(const std::vector<FunctionConstants> &functions)
+{
+	// The count goes first, so a module without constants still has an
+	// entry. Declarations start a line, their uses follow indented.
+	std::string text = std::to_string(functions.size()) + "\n";
+	for (const FunctionConstants &function : functions)
+	{
+		text += function.function;
+		text += '\n';
+		for (const ConstantUse &use : function.uses)
+		{
+			text += fmtString("\t%u %u %u ", use.position, static_cast<unsigned int>(use.op), static_cast<unsigned int>(use.size));
+			text += use.size ? std::to_string(use.value) : EncodeHex(use.text);
+			text += '\n';
+		}
+	}
+	return text;
+}
+
+bool ParseConstants(const std::string &text, std::vector<FunctionConstants> &functions)
+{
+	std::istringstream stream(text);
+	std::string line;
+	size_t count;
+	if (!std::getline(stream, line) || !(std::istringstream(line) >> count))
+	{
+		return false;
+	}
+
+	functions.clear();
+	while (std::getline(stream, line))
+	{
+		if (line.empty() || line[0] != '\t')
+		{
+			functions.emplace_back();
+			functions.back().function = line;
+			continue;
+		}
+		if (functions.empty())
+		{
+			return false;
+		}
+
+		std::istringstream fields(line);
+		unsigned int op;
+		unsigned int size;
+		std::string value;
+		ConstantUse use;
+		if (!(fields >> use.position >> op >> size) || op > 0xff || size > 8)
+		{
+			return false;
+		}
+		fields >> value;
+		use.op = static_cast<asEBCInstr>(op);
+		use.size = static_cast<uint8_t>(size);
+		use.value = 0;
+		if (size ? !(std::istringstream(value) >> use.value) : !DecodeHex(value, use.text))
+		{
+			return false;
+		}
+		functions.back().uses.push_back(std::move(use));
+	}
+	return functions.size() == count;
+}
+
+uint32_t ConstantIndexBuilder::intern(const std::string &str)
+{
+	auto inserted = mStringIds.emplace(str, static_cast<uint32_t>(mStrings.size()));
+	if (inserted.second)
+	{
+		// Keys stay put when the map grows
+		mStrings.push_back(&inserted.first->first);
+	}
+	return inserted.first->second;
+}
+
+void ConstantIndexBuilder::addModule(const std::string &name, const std::vector<FunctionConstants> &functions)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	uint32_t module = intern(name);
+	for (const FunctionConstants &function : functions)
+	{
+		uint32_t declaration = intern(function.function);
+		for (const ConstantUse &use : function.uses)
+		{
+			ConstantIndexEntry entry = {};
+			entry.value = use.size ? use.value : intern(use.text);
+			entry.module = module;
+			entry.function = declaration;
+			entry.position = use.position;
+			entry.size = use.size;
+			entry.op = static_cast<uint8_t>(use.op);
+			mEntries.push_back(entry);
+		}
+	}
+}
+
+bool ConstantIndexBuilder::write(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	// Renumber the strings in sorted order
+	std::vector<uint32_t> order(mStrings.size());
+	for (uint32_t id = 0; id < order.size(); ++id)
+	{
+		order[id] = id;
+	}
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+	{
+		return *mStrings[a] < *mStrings[b];
+	});
+	std::vector<uint32_t> rank(order.size());
+	for (uint32_t i = 0; i < order.size(); ++i)
+	{
+		rank[order[i]] = i;
+	}
+
+	std::vector<ConstantIndexEntry> entries = mEntries;
+	for (ConstantIndexEntry &entry : entries)
+	{
+		if (!entry.size)
+		{
+			entry.value = rank[entry.value];
+		}
+		entry.module = rank[entry.module];
+		entry.function = rank[entry.function];
+	}
+	std::sort(entries.begin(), entries.end(), [](const ConstantIndexEntry &a, const ConstantIndexEntry &b)
+	{
+		return std::tie(a.size, a.value, a.module, a.function, a.position) <
+		       std::tie(b.size, b.value, b.module, b.function, b.position);
+	});
+
+	IndexHeader header;
+	memcpy(header.magic, cIndexMagic, sizeof(cIndexMagic));
+	header.version = cIndexVersion;
+	header.stringCount = static_cast<uint32_t>(order.size());
+	header.entryCount = static_cast<uint32_t>(entries.size());
+
+	std::string out;
+	AppendValue(out, header);
+	uint32_t offset = 0;
+	AppendValue(out, offset);
+	for (uint32_t id : order)
+	{
+		offset += static_cast<uint32_t>(mStrings[id]->size());
+		AppendValue(out, offset);
+	}
+	out.resize((out.size() + 7) & ~size_t(7));
+	out.append(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(ConstantIndexEntry));
+	for (uint32_t id : order)
+	{
+		out.append(*mStrings[id]);
+	}
+
+	// Write next to the target and rename, so queries never map a half
+	// written index; under a random name, so batches writing the same index
+	// don't truncate each other's file
+	std::string tempPath = path + boost::filesystem::unique_path(".%%%%%%%%.tmp").string();
+	bool written;
+	{
+		std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+		written = static_cast<bool>(stream.write(out.data(), out.size()));
+	}
+
+	boost::system::error_code error;
+	if (written)
+	{
+		boost::filesystem::rename(tempPath, path, error);
+	}
+	if (!written || error)
+	{
+		boost::filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
+
+bool QueryConstantIndex(const std::string &path, const std::string &verb, const std::string &query,
+                        OutputSink &sink, std::string &error)
+{
+	std::vector<ValueKey> keys;
+	if (verb == "value")
+	{
+		if (!ParseValueQuery(query, keys))
+		{
+			error = "not a number: " + query;
+			return false;
+		}
+	}
+	else if (verb != "string" && verb != "substring")
+	{
+		error = "unknown query " + verb;
+		return false;
+	}
+
+	ConstantIndexReader index;
+	if (!index.open(path, error))
+	{
+		return false;
+	}
+
+	std::vector<uint32_t> strings;
+	if (verb == "string")
+	{
+		uint32_t id;
+		if (index.findString(query, id))
+		{
+			strings.push_back(id);
+		}
+	}
+	else if (verb == "substring")
+	{
+		for (uint32_t id : index.getStringConstants())
+		{
+			if (index.getString(id).find(query) != std::string::npos)
+			{
+				strings.push_back(id);
+			}
+		}
+	}
+
+	unsigned int found = 0;
+	for (const ValueKey &key : keys)
+	{
+		auto entries = index.getEntries(key.first, key.second);
+		if (entries.first != entries.second)
+		{
+			sink.format("%u bytes 0x%llx\n", static_cast<unsigned int>(key.first), static_cast<unsigned long long>(key.second));
+			WriteEntries(sink, index, entries);
+			found += static_cast<unsigned int>(entries.second - entries.first);
+		}
+	}
+	for (uint32_t id : strings)
+	{
+		auto entries = index.getEntries(0, id);
+		if (entries.first != entries.second)
+		{
+			sink.put('"');
+			sink.write(index.getString(id));
+			sink.write("\"\n", 2);
+			WriteEntries(sink, index, entries);
+			found += static_cast<unsigned int>(entries.second - entries.first);
+		}
+	}
+	if (!found)
+	{
+		sink.format("no uses of %s\n", query.c_str());
+	}
+	return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "rawmodule.h"
+#include "sink.h"
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// An immediate or a string constant an instruction uses. Immediates are the
+// constants pushed and stored (PshC4, SetV4, PshC8, ...) and those compared
+// against or added, e.g. by CMPIi or ADDIf, with value holding their bits.
+// Strings are kept as UTF-8 text, since their ids only mean something to
+// one engine or module.
+struct ConstantUse
+{
+	// Dword position of the instruction
+	asUINT position;
+	asEBCInstr op;
+
+	// Bytes of the immediate, 0 for a string
+	uint8_t size;
+
+	uint64_t value;
+	std::string text;
+};
+
+struct FunctionConstants
+{
+	// Declaration of the function
+	std::string function;
+	std::vector<ConstantUse> uses;
+};
+
+// Constants used by every function with bytecode in a module; functions
+// without any are left out
+void CollectConstants(asIScriptModule *module, std::vector<FunctionConstants> &functions);
+void CollectRawConstants(const RawModule &module, std::vector<FunctionConstants> &functions);
+
+// Plain text form, for keeping the constants of a module in the dump cache
+std::string FormatConstants(const std::vector<FunctionConstants> &functions);
+bool ParseConstants(const std::string &text, std::vector<FunctionConstants> &functions);
+
+// A use by string ids, as the index stores it. value is a string id for
+// string constants.
+struct ConstantIndexEntry
+{
+	uint64_t value;
+	uint32_t module;
+	uint32_t function;
+	uint32_t position;
+	uint8_t size;
+	uint8_t op;
+	uint16_t padding;
+};
+
+// Collects the constants of a whole batch and writes them out as an
+// inverted index. Modules may be added from several workers at once.
+class ConstantIndexBuilder
+{
+public:
+	void addModule(const std::string &name, const std::vector<FunctionConstants> &functions);
+
+	bool write(const std::string &path);
+
+private:
+	uint32_t intern(const std::string &str);
+
+	std::mutex mMutex;
+	std::unordered_map<std::string, uint32_t> mStringIds;
+	std::vector<const std::string *> mStrings;
+	std::vector<ConstantIndexEntry> mEntries;
+};
+
+// Query verbs and what they look up
+//   value <number>     immediates with that value: integers in decimal or
+//                      0x hex, negative ones by their two's complement at
+//                      every size they fit; anything with a point or an
+//                      exponent as float and double
+//   string <text>      uses of the string constant
+//   substring <text>   uses of every string constant containing the text
+// Each use is listed with its module, function, position and opcode.
+// Answered straight from the mapped index; false with error set if it
+// can't be read.
+bool QueryConstantIndex(const std::string &path, const std::string &verb, const std::string &query,
+                        OutputSink &sink, std::string &error);
@@ -1,31 +1,43 @@
 #include "asf.h"
+#include "batch.h"
+#include "bench.h"
+#include "cache.h"
+#include "constants.h"
+#include "diff.h"
+#include "disasm.h"
+#include "generator.h"
+#include "memory.h"
+#include "prereg.h"
+#include "profile.h"
+#include "rawmodule.h"
+#include "records.h"
+#include "server.h"
+#include "shared.h"
+#include "stats.h"
+#include "stringtable.h"
+#include "xref.h"
 
 #include "platform.h"
 
 #include <angelscript.h>
 
-// for bytecode translation features
-#include <../source/as_scriptengine.h>
-
 #include <scriptstdstring/scriptstdstring.h>
 #include <scriptarray/scriptarray.h>
 #include <scriptany/scriptany.h>
 #include <weakref/weakref.h>
 
-#include "json.hpp"
+#include <boost/filesystem.hpp>
 
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
-
-template<typename... A>
-static std::string fmtString(const std::string &format, A... args)
-{
-	// Thread safe
-	static thread_local char sFormatBuf[2048];
-	snprintf(sFormatBuf, sizeof(sFormatBuf), format.c_str(), args...);
-	return std::string(sFormatBuf);
-}
+#include <vector>
 
 void AngelScriptMessageCallback(const asSMessageInfo *msg, void *param)
 {
@@ -513,612 +525,913 @@ void RegisterScriptMathTypes(asIScriptEngine *engine)
 	RegisterScriptMathTypeDefinitions(engine);
 }
 
-void RegisterScriptPreregNamespaces(asIScriptEngine *engine, const nlohmann::json &config)
+void RegisterScriptPreregRecord(asIScriptEngine *engine, const PreregRecord &record)
 {
-	for (const auto &registration : config["namespaces"])
+	switch (record.kind)
 	{
-		engine->SetDefaultNamespace(registration["namespace"].get<std::string>().c_str());
+	case PREREG_NAMESPACE:
 		RegisterScriptCafeTypedefs(engine);
-		engine->SetDefaultNamespace("");
+		break;
+	case PREREG_OBJECT_TYPE:
+		engine->RegisterObjectType(record.objectName.c_str(), record.value, record.flags);
+		break;
+	case PREREG_OBJECT_PROPERTY:
+		engine->RegisterObjectProperty(record.objectName.c_str(), record.declaration.c_str(), record.value);
+		break;
+	case PREREG_OBJECT_BEHAVIOUR:
+		engine->RegisterObjectBehaviour(record.objectName.c_str(),
+		                                static_cast<asEBehaviours>(record.value),
+		                                record.declaration.c_str(),
+		                                asFUNCTION(0),
+		                                static_cast<asECallConvTypes>(record.flags));
+		break;
+	case PREREG_OBJECT_METHOD:
+		engine->RegisterObjectMethod(record.objectName.c_str(),
+		                             record.declaration.c_str(),
+		                             asFUNCTION(0),
+		                             record.value ? asCALL_THISCALL_ASGLOBAL : asCALL_THISCALL);
+		break;
+	case PREREG_GLOBAL_FUNCTION:
+		engine->RegisterGlobalFunction(record.declaration.c_str(), asFUNCTION(0), asCALL_CDECL);
+		break;
+	case PREREG_GLOBAL_PROPERTY:
+		engine->RegisterGlobalProperty(record.declaration.c_str(),
+		                               reinterpret_cast<void *>(static_cast<size_t>(engine->GetGlobalPropertyCount() + 1)));
+		break;
+	default:
+		break;
 	}
 }
 
-void RegisterScriptPreregEnumsAndValues(asIScriptEngine *engine, const nlohmann::json &config)
+bool RegisterScriptPrereg(asIScriptEngine *engine, const PreregSource &prereg)
 {
-	// Unused in PMCS
+	// Enums and values are unused in PMCS
+
+	// Records come in registration order; consecutive ones mostly share a
+	// namespace, so it is only switched when it changes
+	bool first = true;
+	std::string nameSpace;
+	bool result = prereg([&](const PreregRecord &record)
+	{
+		if (first || nameSpace != record.nameSpace)
+		{
+			first = false;
+			nameSpace = record.nameSpace;
+			engine->SetDefaultNamespace(nameSpace.c_str());
+		}
+		RegisterScriptPreregRecord(engine, record);
+	});
+	engine->SetDefaultNamespace("");
+	return result;
 }
 
-void RegisterScriptPreregObjectTypes(asIScriptEngine *engine, const nlohmann::json &config)
+bool ConfigureEngine(asIScriptEngine *engine, const PreregSource &prereg)
 {
-	for (const auto &registration : config["object_types"])
-	{
-		engine->SetDefaultNamespace(registration["namespace"].get<std::string>().c_str());
-		engine->RegisterObjectType(registration["object_name"].get<std::string>().c_str(),
-								   registration["size"].get<int>(),
-								   registration["flags"].get<asDWORD>());
-		engine->SetDefaultNamespace("");
-	}
+	// Replicate the PMCS scripting environment
+
+	// Init PMCS global properties
+	// PMCS has this at true, but we're building, so we have to diverge here
+	engine->SetEngineProperty(asEP_INIT_GLOBAL_VARS_AFTER_BUILD, 0);
+	engine->SetEngineProperty(asEP_OPTIMIZE_BYTECODE, 1);
+	engine->SetEngineProperty(asEP_SCRIPT_SCANNER, 1);
+	engine->SetEngineProperty(asEP_STRING_ENCODING, 0);
+	engine->SetEngineProperty(asEP_ALLOW_UNSAFE_REFERENCES, 1);
+	engine->SetEngineProperty(asEP_AUTO_GARBAGE_COLLECT, 1);
+
+	// Register script extensions
+	RegisterStdString(engine);
+	engine->RegisterObjectBehaviour("string", asBEHAVE_CONSTRUCT, "void f(const int)", asFUNCTION(0), asCALL_CDECL_OBJLAST);
+	engine->RegisterObjectBehaviour("string", asBEHAVE_CONSTRUCT, "void f(const uint)", asFUNCTION(0), asCALL_CDECL_OBJLAST);
+	engine->RegisterObjectBehaviour("string", asBEHAVE_CONSTRUCT, "void f(const bool)", asFUNCTION(0), asCALL_CDECL_OBJLAST);
+	engine->RegisterObjectBehaviour("string", asBEHAVE_CONSTRUCT, "void f(const float)", asFUNCTION(0), asCALL_CDECL_OBJLAST);
+	RegisterScriptArray(engine, false);
+	RegisterStdStringUtils(engine);
+	RegisterScriptAny(engine);
+	RegisterScriptWeakRef(engine);
+
+	// PMCS-specific extensions
+	RegisterScriptCafeTypedefs(engine);
+	RegisterScriptMathTypes(engine);
+
+	// The rest of this comes from the data through a linked list built through
+	// global constructors; we get it from a JSON dump of that list
+	return RegisterScriptPrereg(engine, prereg);
 }
 
-void RegisterScriptPreregObjectProperties(asIScriptEngine *engine, const nlohmann::json &config)
+static void PrintUsage()
 {
-	for (const auto &registration : config["object_properties"])
-	{
-		engine->SetDefaultNamespace(registration["namespace"].get<std::string>().c_str());
-		engine->RegisterObjectProperty(registration["object_name"].get<std::string>().c_str(),
-									   registration["declaration"].get<std::string>().c_str(),
-									   registration["offset"].get<int>());
-		engine->SetDefaultNamespace("");
-	}
+	std::cout << "usage: csasm <root> <config> <module>\n"
+	          << "       csasm <root> <config> --batch <output dir> [--list <file>] [--jobs <n>]\n"
+	          << "       csasm <root> <config> <module> --bench-decode <iterations>\n"
+	          << "       csasm <output dir> <config> --generate [<shape>]\n"
+	          << "       csasm <work dir> <config> --bench-corpus <module counts, comma separated> [<shape>]\n"
+	          << "       csasm --inspect <asf file>\n"
+	          << "       csasm --inspect <root> --batch <output dir> [--list <file>] [--jobs <n>]\n"
+	          << "       csasm --diff <old root> <new root> [--list <file>]\n"
+	          << "       csasm <root> <config> --serve [--socket <path>] [--jobs <n>]\n"
+	          << "       csasm --stats <root> [--list <file>] [--jobs <n>] [--summary <file>]\n"
+	          << "       csasm --strings <root> [--list <file>] [--jobs <n>]\n"
+	          << "       csasm --query <index> refs|callers|readers|writers|users|callees|uses <symbol>\n"
+	          << "       csasm --find <index> value|string|substring <number or text>\n"
+	          << "options: --format text|jsonl|binary, --output <file> for a single module,\n"
+	          << "         --snapshot <file> to cache the parsed config,\n"
+	          << "         --cache <dir> to reuse dumps of unchanged modules,\n"
+	          << "         --xref <file> to write a cross-reference index of a batch,\n"
+	          << "         --constants <file> to write an index of the immediates and strings a batch uses,\n"
+	          << "         --split-shared to write the bytecode of shared functions once, into shared/ of\n"
+	          << "         a text batch, instead of into every module using them\n"
+	          << "         --memory-budget <MiB> to bound the modules each batch worker keeps loaded,\n"
+	          << "         --profile to print the time and script memory of each stage and the slowest\n"
+	          << "         modules of a dump or batch, --profile-json <file> to write them as jsonl records\n"
+	          << "         --summary <file> to write the counts of --stats as records (jsonl unless --format binary)\n"
+	          << "shape of a generated corpus: --modules <n>, --functions <n per module>,\n"
+	          << "         --statements <n per function>, --seed <n>\n"
+	          << "filters for a single module: --filter <glob>, --filter-regex <regex>, --namespace <ns>,\n"
+	          << "         --type <object type>, --function-id <id> (not with --inspect), --headers-only,\n"
+	          << "         --blocks to split the bytecode into basic blocks with their edges, dominators and loops\n";
 }
 
-void RegisterScriptPreregObjectBehaviours(asIScriptEngine *engine, const nlohmann::json &config)
+// A whole decimal number from minimum to maximum; anything else is a usage
+// error rather than an exception
+static bool ParseNumber(const std::string &text, long long minimum, long long maximum, long long &value)
 {
-	for (const auto &registration : config["object_behaviours"])
+	errno = 0;
+	char *end;
+	long long parsed = strtoll(text.c_str(), &end, 10);
+	if (text.empty() || *end || errno == ERANGE || parsed < minimum || parsed > maximum)
 	{
-		engine->SetDefaultNamespace(registration["namespace"].get<std::string>().c_str());
-		engine->RegisterObjectBehaviour(registration["object_name"].get<std::string>().c_str(),
-										registration["behaviour"].get<asEBehaviours>(),
-										registration["declaration"].get<std::string>().c_str(),
-										asFUNCTION(0),
-										registration["calling_convention"].get<asECallConvTypes>());
-		engine->SetDefaultNamespace("");
+		return false;
 	}
+	value = parsed;
+	return true;
 }
 
-void RegisterScriptPreregObjectMethods(asIScriptEngine *engine, const nlohmann::json &config)
+// ParseNumber for the counts and seeds options take
+static bool ParseCount(const std::string &text, unsigned int &value)
 {
-	for (const auto &registration : config["object_methods"])
+	long long parsed;
+	if (!ParseNumber(text, 0, UINT_MAX, parsed))
 	{
-		engine->SetDefaultNamespace(registration["namespace"].get<std::string>().c_str());
-		engine->RegisterObjectMethod(registration["object_name"].get<std::string>().c_str(),
-									 registration["declaration"].get<std::string>().c_str(),
-									 asFUNCTION(0),
-									 registration["global"].get<int>() ? asCALL_THISCALL_ASGLOBAL : asCALL_THISCALL);
-		engine->SetDefaultNamespace("");
+		return false;
 	}
+	value = static_cast<unsigned int>(parsed);
+	return true;
 }
 
-void RegisterScriptPreregGlobalFunctions(asIScriptEngine *engine, const nlohmann::json &config)
+// A size in MiB, fractions allowed, as bytes; negative sizes are rejected
+static bool ParseMebibytes(const std::string &text, int64_t &bytes)
 {
-	for (const auto &registration : config["global_functions"])
+	char *end;
+	double mebibytes = strtod(text.c_str(), &end);
+	if (text.empty() || *end || !(mebibytes >= 0.0) || mebibytes * 1024 * 1024 >= static_cast<double>(INT64_MAX))
 	{
-		engine->SetDefaultNamespace(registration["namespace"].get<std::string>().c_str());
-		engine->RegisterGlobalFunction(registration["declaration"].get<std::string>().c_str(),
-									   asFUNCTION(0),
-									   asCALL_CDECL);
-		engine->SetDefaultNamespace("");
+		return false;
 	}
+	bytes = static_cast<int64_t>(mebibytes * 1024 * 1024);
+	return true;
 }
 
-void RegisterScriptPreregGlobalProperties(asIScriptEngine *engine, const nlohmann::json &config)
+// Writes a single module's dump into the sink. With a key the dump comes from
+// the cache when it is there; otherwise dump produces it and it is stored.
+static bool DumpThroughCache(DumpCache *cache, const uint64_t *key, OutputSink &sink,
+                             const std::function<bool(OutputSink &)> &dump)
 {
+	if (!cache || !key)
+	{
+		return dump(sink);
+	}
+	{
+		ProfileScope scope(STAGE_CACHE);
+		bool hit = cache->fetch(*key, sink);
+		cache->countModule(hit);
+		if (hit)
+		{
+			return true;
+		}
+	}
 
-	for (const auto &registration : config["global_properties"])
+	StringSink dumpSink;
+	if (!dump(dumpSink))
 	{
-		engine->SetDefaultNamespace(registration["namespace"].get<std::string>().c_str());
-		engine->RegisterGlobalProperty(registration["declaration"].get<std::string>().c_str(),
-									   reinterpret_cast<void *>(static_cast<size_t>(engine->GetGlobalPropertyCount() + 1)));
-		engine->SetDefaultNamespace("");
+		return false;
 	}
+	const std::string &contents = dumpSink.str();
+	sink.write(contents);
+	sink.flush();
+	ProfileScope scope(STAGE_CACHE);
+	cache->storeContents(*key, contents);
+	return true;
 }
 
-void ConfigureEngine(asIScriptEngine *engine, const nlohmann::json &config)
+// Runs the dump into the --output file if there is one, stdout otherwise
+static int WriteOutput(const std::string &outputPath, const std::function<bool(OutputSink &)> &dump)
 {
-	// Replicate the PMCS scripting environment
+	if (outputPath.empty())
+	{
+		StreamSink outputSink(std::cout);
+		return dump(outputSink) ? 0 : -1;
+	}
 
-	// Init PMCS global properties
-	// PMCS has this at true, but we're building, so we have to diverge here
-	engine->SetEngineProperty(asEP_INIT_GLOBAL_VARS_AFTER_BUILD, 0);
-	engine->SetEngineProperty(asEP_OPTIMIZE_BYTECODE, 1);
-	engine->SetEngineProperty(asEP_SCRIPT_SCANNER, 1);
-	engine->SetEngineProperty(asEP_STRING_ENCODING, 0);
-	engine->SetEngineProperty(asEP_ALLOW_UNSAFE_REFERENCES, 1);
-	engine->SetEngineProperty(asEP_AUTO_GARBAGE_COLLECT, 1);
+	// Keeps structured output apart from the log on stdout
+	FileSink outputSink(outputPath);
+	if (!outputSink.isOpen())
+	{
+		std::cout << "failed to open " << outputPath << "\n";
+		return -1;
+	}
+	return dump(outputSink) ? 0 : -1;
+}
 
-	// Register script extensions
-	RegisterStdString(engine);
-	engine->RegisterObjectBehaviour("string", asBEHAVE_CONSTRUCT, "void f(const int)", asFUNCTION(0), asCALL_CDECL_OBJLAST);
-	engine->RegisterObjectBehaviour("string", asBEHAVE_CONSTRUCT, "void f(const uint)", asFUNCTION(0), asCALL_CDECL_OBJLAST);
-	engine->RegisterObjectBehaviour("string", asBEHAVE_CONSTRUCT, "void f(const bool)", asFUNCTION(0), asCALL_CDECL_OBJLAST);
-	engine->RegisterObjectBehaviour("string", asBEHAVE_CONSTRUCT, "void f(const float)", asFUNCTION(0), asCALL_CDECL_OBJLAST);
-	RegisterScriptArray(engine, false);
-	RegisterStdStringUtils(engine);
-	RegisterScriptAny(engine);
-	RegisterScriptWeakRef(engine);
+// Rows of the slowest module list
+const size_t cProfiledModules = 20;
 
-	// PMCS-specific extensions
-	RegisterScriptCafeTypedefs(engine);
-	RegisterScriptMathTypes(engine);
+static void WriteProfile(bool printProfile, const std::string &profilePath)
+{
+	if (printProfile)
+	{
+		StreamSink profileSink(std::cout);
+		Profiler::writeReport(profileSink, cProfiledModules);
+	}
+	if (!profilePath.empty())
+	{
+		FileSink profileSink(profilePath);
+		if (!profileSink.isOpen())
+		{
+			std::cout << "failed to open " << profilePath << "\n";
+			return;
+		}
+		JsonLinesWriter writer(profileSink);
+		Profiler::writeRecords(writer, cProfiledModules);
+	}
+}
 
-	// The rest of this comes from the data through a linked list built through
-	// global constructors; we parse this as a JSON
-	RegisterScriptPreregNamespaces(engine, config);
-	RegisterScriptPreregEnumsAndValues(engine, config);
-	RegisterScriptPreregObjectTypes(engine, config);
-	RegisterScriptPreregObjectProperties(engine, config);
-	RegisterScriptPreregObjectBehaviours(engine, config);
-	RegisterScriptPreregObjectMethods(engine, config);
-	RegisterScriptPreregGlobalFunctions(engine, config);
-	RegisterScriptPreregGlobalProperties(engine, config);
+static void PrintCacheStats(const DumpCache &cache)
+{
+	std::cout << fmtString("cache: %u hits, %u misses\n", cache.getHits(), cache.getMisses());
 }
 
-std::string dumpBytecode(asIScriptFunction *func)
+// Runs the batch, collecting references into the index at xrefPath and
+// constants into the one at constantPath if set
+static int RunIndexedBatch(const EngineFactory &engineFactory, BatchOptions &batchOptions, const std::string &xrefPath,
+                           const std::string &constantPath, bool splitShared)
 {
-	std::string dump;
-	asCScriptFunction *function = static_cast<asCScriptFunction *>(func);
+	boost::filesystem::path sharedDir = batchOptions.outputDir;
+	sharedDir /= "shared";
+	SharedCodeWriter shared(sharedDir.string());
+	if (splitShared)
+	{
+		batchOptions.shared = &shared;
+	}
+	XrefIndexBuilder xrefs;
+	if (!xrefPath.empty())
+	{
+		batchOptions.xrefs = &xrefs;
+	}
+	ConstantIndexBuilder constants;
+	if (!constantPath.empty())
+	{
+		batchOptions.constants = &constants;
+	}
 
-	asCScriptEngine *engine = static_cast<asCScriptEngine *>(function->GetEngine());
-	
-	asUINT length;
-	asDWORD *code = function->GetByteCode(&length);
-	for (uint32_t position = 0; position < length; )
+	int result = RunBatch(engineFactory, batchOptions);
+	if (!xrefPath.empty() && !xrefs.write(xrefPath))
+	{
+		std::cout << "failed to write xref index " << xrefPath << "\n";
+		result = -1;
+	}
+	if (!constantPath.empty() && !constants.write(constantPath))
+	{
+		std::cout << "failed to write constant index " << constantPath << "\n";
+		result = -1;
+	}
+	if (splitShared)
 	{
-		std::string disas = "UNK";
+		std::cout << fmtString("shared: %u functions written for %u uses\n",
+		                       shared.getWrittenCount(), shared.getReferenceCount());
+		if (shared.getFailedCount())
+		{
+			std::cout << fmtString("failed to write %u shared functions to %s\n",
+			                       shared.getFailedCount(), sharedDir.string().c_str());
+			result = -1;
+		}
+	}
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	// ConIO for UTF8 characters
+	setupConsoleCodePage();
 
-		// Read opcode
-		asDWORD *inst = code + position;
-		asEBCInstr op = static_cast<asEBCInstr>(*reinterpret_cast<asBYTE *>(inst));
-		const char *mnem = asBCInfo[op].name;
-		switch (asBCInfo[op].type)
+	// Not on stdout, which may carry records or the server's responses
+	std::cerr << fmtString("csasm by PistonMiner, built on %s\n\n", __TIMESTAMP__);
+
+	std::vector<std::string> positional;
+	bool batchMode = false;
+	bool inspectMode = false;
+	BatchOptions batchOptions;
+	unsigned int benchIterations = 0;
+	std::string outputPath;
+	std::string snapshotPath;
+	std::string cacheDir;
+	std::string xrefPath;
+	std::string queryPath;
+	std::string constantPath;
+	std::string findPath;
+	bool diffMode = false;
+	bool statsMode = false;
+	bool stringsMode = false;
+	bool splitShared = false;
+	bool generateMode = false;
+	std::vector<unsigned int> benchSizes;
+	CorpusShape corpusShape;
+	bool shaped = false;
+	bool printProfile = false;
+	bool serveMode = false;
+	std::string socketPath;
+	std::string profilePath;
+	std::string summaryPath;
+	DumpFilter dumpFilter;
+	bool filtered = false;
+	bool badNumber = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--batch" && i + 1 < argc)
 		{
-		case asBCTYPE_NO_ARG: // no args
-			{
-				disas = fmtString("%-8s", mnem);
-			}
-			break;
-		case asBCTYPE_W_ARG: // word imm
+			batchMode = true;
+			batchOptions.outputDir = argv[++i];
+		}
+		else if (arg == "--list" && i + 1 < argc)
+		{
+			batchOptions.listFile = argv[++i];
+		}
+		else if (arg == "--jobs" && i + 1 < argc)
+		{
+			badNumber |= !ParseCount(argv[++i], batchOptions.jobs);
+		}
+		else if (arg == "--format" && i + 1 < argc)
+		{
+			if (!ParseOutputFormat(argv[++i], batchOptions.format))
 			{
-				asWORD arg0 = asBC_WORDARG0(inst);
-				switch (op)
-				{
-				case asBC_STR:
-					{
-						const auto &str = engine->GetConstantString(arg0);
-						disas = fmtString("%-8s %d (%d:\"%s\")", mnem, arg0, str.GetLength(), str.AddressOf());
-					}
-					break;
-				default:
-					disas = fmtString("%-8s %d", mnem, arg0);
-					break;
-				}
+				PrintUsage();
+				resetConsoleCodePage();
+				return -1;
 			}
-			break;
-		case asBCTYPE_wW_ARG: // word var dst
-		case asBCTYPE_rW_ARG: // word var src
+		}
+		else if (arg == "--output" && i + 1 < argc)
+		{
+			outputPath = argv[++i];
+		}
+		else if (arg == "--snapshot" && i + 1 < argc)
+		{
+			snapshotPath = argv[++i];
+		}
+		else if (arg == "--cache" && i + 1 < argc)
+		{
+			cacheDir = argv[++i];
+		}
+		else if (arg == "--xref" && i + 1 < argc)
+		{
+			xrefPath = argv[++i];
+		}
+		else if (arg == "--memory-budget" && i + 1 < argc)
+		{
+			if (!ParseMebibytes(argv[++i], batchOptions.memoryBudget))
 			{
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				disas = fmtString("%-8s v%d", mnem,
-								  reinterpret_cast<int16_t &>(arg0));
+				PrintUsage();
+				resetConsoleCodePage();
+				return -1;
 			}
-			break;
-		case asBCTYPE_wW_rW_ARG: // word dst, word src
-		case asBCTYPE_rW_rW_ARG: // word src, word src
+		}
+		else if ((arg == "--filter" || arg == "--filter-regex") && i + 1 < argc)
+		{
+			filtered = true;
+			if (!dumpFilter.setPattern(argv[++i], arg == "--filter-regex"))
 			{
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				uint16_t arg1 = asBC_WORDARG1(inst);
-				disas = fmtString("%-8s v%d, v%d", mnem,
-								  reinterpret_cast<int16_t &>(arg0),
-								  reinterpret_cast<int16_t &>(arg1));
+				std::cout << "invalid regex " << argv[i] << "\n";
+				resetConsoleCodePage();
+				return -1;
 			}
-			break;
-		case asBCTYPE_wW_W_ARG: // word dst, word imm
+		}
+		else if (arg == "--namespace" && i + 1 < argc)
+		{
+			filtered = true;
+			dumpFilter.setNamespace(argv[++i]);
+		}
+		else if (arg == "--type" && i + 1 < argc)
+		{
+			filtered = true;
+			dumpFilter.setObjectType(argv[++i]);
+		}
+		else if (arg == "--function-id" && i + 1 < argc)
+		{
+			filtered = true;
+			long long id;
+			if (!ParseNumber(argv[++i], 0, INT_MAX, id))
 			{
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				uint16_t arg1 = asBC_WORDARG1(inst);
-				disas = fmtString("%-8s v%d, %d", mnem,
-								  reinterpret_cast<int16_t &>(arg0),
-								  reinterpret_cast<int16_t &>(arg1));
+				PrintUsage();
+				resetConsoleCodePage();
+				return -1;
 			}
-			break;
-		case asBCTYPE_wW_rW_DW_ARG: // word dst, word src, dword imm
-		case asBCTYPE_rW_W_DW_ARG:  // word src, word imm, dword imm
+			dumpFilter.setFunctionId(static_cast<int>(id));
+		}
+		else if (arg == "--headers-only")
+		{
+			filtered = true;
+			dumpFilter.setLevel(DUMP_HEADERS);
+		}
+		else if (arg == "--blocks")
+		{
+			filtered = true;
+			dumpFilter.setLevel(DUMP_BLOCKS);
+		}
+		else if (arg == "--query" && i + 1 < argc)
+		{
+			queryPath = argv[++i];
+		}
+		else if (arg == "--constants" && i + 1 < argc)
+		{
+			constantPath = argv[++i];
+		}
+		else if (arg == "--split-shared")
+		{
+			splitShared = true;
+		}
+		else if (arg == "--find" && i + 1 < argc)
+		{
+			findPath = argv[++i];
+		}
+		else if (arg == "--diff")
+		{
+			diffMode = true;
+		}
+		else if (arg == "--stats")
+		{
+			statsMode = true;
+		}
+		else if (arg == "--strings")
+		{
+			stringsMode = true;
+		}
+		else if (arg == "--summary" && i + 1 < argc)
+		{
+			summaryPath = argv[++i];
+		}
+		else if (arg == "--inspect")
+		{
+			inspectMode = true;
+		}
+		else if (arg == "--bench-decode" && i + 1 < argc)
+		{
+			badNumber |= !ParseCount(argv[++i], benchIterations);
+		}
+		else if (arg == "--serve")
+		{
+			serveMode = true;
+		}
+		else if (arg == "--socket" && i + 1 < argc)
+		{
+			socketPath = argv[++i];
+		}
+		else if (arg == "--profile")
+		{
+			printProfile = true;
+		}
+		else if (arg == "--profile-json" && i + 1 < argc)
+		{
+			profilePath = argv[++i];
+		}
+		else if (arg == "--generate")
+		{
+			generateMode = true;
+		}
+		else if (arg == "--bench-corpus" && i + 1 < argc)
+		{
+			std::stringstream sizes(argv[++i]);
+			std::string size;
+			while (std::getline(sizes, size, ','))
 			{
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				uint16_t arg1 = asBC_WORDARG1(inst);
-				uint32_t arg2 = asBC_DWORDARG(inst);
-				switch (op)
-				{
-				case asBC_ADDIf:
-				case asBC_SUBIf:
-				case asBC_MULIf:
-					disas = fmtString("%-8s v%d, v%d, %f", mnem,
-									  reinterpret_cast<int16_t &>(arg0),
-									  reinterpret_cast<int16_t &>(arg1),
-									  reinterpret_cast<float &>(arg2));
-					break;
-				default:
-					disas = fmtString("%-8s v%d, v%d, %d", mnem,
-									  reinterpret_cast<int16_t &>(arg0),
-									  reinterpret_cast<int16_t &>(arg1),
-									  reinterpret_cast<int16_t &>(arg2));
-					break;
-				}
+				unsigned int count = 0;
+				badNumber |= !ParseCount(size, count);
+				benchSizes.push_back(count);
 			}
-			break;
-		case asBCTYPE_DW_ARG: // dword imm
-			{
-				uint32_t arg0 = asBC_DWORDARG(inst);
-				switch (op)
-				{
-				case asBC_OBJTYPE:
-					{
-						asIObjectType *type = reinterpret_cast<asIObjectType *>(arg0);
-						disas = fmtString("%-8s 0x%x (type:%s)", mnem, arg0, type->GetName());
-					}
-					break;
-				case asBC_FuncPtr:
-					{
-						asIScriptFunction *func = reinterpret_cast<asIScriptFunction *>(arg0);
-						disas = fmtString("%-8s 0x%x (func:%s)", mnem, arg0, func->GetDeclaration());
-					}
-					break;
-				case asBC_PshC4:
-				case asBC_Cast:
-					disas = fmtString("%-8s 0x%x (i:%d, f:%g)", mnem,
-									  arg0, reinterpret_cast<int &>(arg0), reinterpret_cast<float &>(arg0));
-					break;
-				case asBC_TYPEID:
-					disas = fmtString("%-8s 0x%x (decl:%s)", mnem,
-									  arg0, engine->GetTypeDeclaration(reinterpret_cast<int &>(arg0)));
-					break;
-				case asBC_PGA: // global vars
-				case asBC_PshGPtr:
-				case asBC_LDG:
-				case asBC_PshG4:
-					{
-						asCGlobalProperty *prop = function->GetPropertyByGlobalVarPtr(reinterpret_cast<void *>(arg0));
-						disas = fmtString("%-8s 0x%x (%d:%s)", mnem,
-										  arg0,
-										  prop->id,
-										  prop->name.AddressOf());
-					}
-					break;
-				case asBC_CALL:
-				case asBC_CALLSYS:
-				case asBC_CALLBND:
-				case asBC_CALLINTF:
-				case asBC_Thiscall1:
-					{
-						asIScriptFunction *func;
-						if (arg0 & 0x40000000)
-						{
-							func = engine->importedFunctions[reinterpret_cast<int &>(arg0) & ~0x40000000]->importedFunctionSignature;
-						}
-						else
-						{
-							func = engine->GetFunctionById(reinterpret_cast<int &>(arg0));
-						}
+		}
+		else if (arg == "--modules" && i + 1 < argc)
+		{
+			shaped = true;
+			badNumber |= !ParseCount(argv[++i], corpusShape.modules);
+		}
+		else if (arg == "--functions" && i + 1 < argc)
+		{
+			shaped = true;
+			badNumber |= !ParseCount(argv[++i], corpusShape.functions);
+		}
+		else if (arg == "--statements" && i + 1 < argc)
+		{
+			shaped = true;
+			badNumber |= !ParseCount(argv[++i], corpusShape.statements);
+		}
+		else if (arg == "--seed" && i + 1 < argc)
+		{
+			shaped = true;
+			badNumber |= !ParseCount(argv[++i], corpusShape.seed);
+		}
+		else
+		{
+			positional.push_back(arg);
+		}
+	}
 
-						disas = fmtString("%-8s %d (%s)", mnem,
-										  arg0,
-										  func->GetDeclaration(true, true, true));
-					}
-					break;
-				case asBC_REFCPY:
-					disas = fmtString("%-8s 0x%x", mnem, arg0);
-					break;
-				case asBC_JMP:
-				case asBC_JZ:
-				case asBC_JLowZ:
-				case asBC_JS:
-				case asBC_JP:
-				case asBC_JNZ:
-				case asBC_JLowNZ:
-				case asBC_JNS:
-				case asBC_JNP:
-					disas = fmtString("%-8s %+d (d:%x)", mnem,
-									  reinterpret_cast<int &>(arg0),
-									  position + reinterpret_cast<int &>(arg0));
-					break;
-				default:
-					disas = fmtString("%-8s %d", mnem, reinterpret_cast<int &>(arg0));
-					break;
-				}
-			}
-			break;
-		case asBCTYPE_QW_ARG: // qword imm
-			{
-				uint64_t arg0 = asBC_QWORDARG(inst);
-				// #todo-csasm: Potentially add 64-bit pointer opcode handling
-				disas = fmtString("%-8s 0x%llx (i:%lld, f:%g)", mnem,
-								  arg0, reinterpret_cast<int64_t &>(arg0), reinterpret_cast<double &>(arg0));
-			}
-			break;
-		case asBCTYPE_wW_QW_ARG: // word dst, qword imm
-		case asBCTYPE_rW_QW_ARG: // word src, qword imm
-			{
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				uint64_t arg1 = asBC_QWORDARG(inst);
-				switch (op)
-				{
-				case asBC_RefCpyV:
-				case asBC_FREE:
-					{
-						asIObjectType *type = reinterpret_cast<asIObjectType *>(arg1);
-						disas = fmtString("%-8s v%d, 0x%x (type:%s)", mnem,
-										  reinterpret_cast<int16_t &>(arg0),
-										  static_cast<uint32_t>(arg1),
-										  type->GetName());
-					}
-					break;
-				default:
-					disas = fmtString("%-8s v%d, 0x%llx (i:%lld, f:%g)", mnem,
-									  reinterpret_cast<int16_t &>(arg0),
-									  arg1,
-									  reinterpret_cast<int64_t &>(arg1),
-									  reinterpret_cast<double &>(arg1));
-					break;
-				}
-			}
-			break;
-		case asBCTYPE_DW_DW_ARG: // dword imm, dword imm
-			{
-				// #todo-csasm: Investigate DW_DW layout further
-				#define asBC_DWORDARG1(x)  (*(((asDWORD*)x)+2))
-				uint32_t arg0 = asBC_DWORDARG(inst);
-				uint32_t arg1 = asBC_DWORDARG1(inst);
-				switch (op)
-				{
-				case asBC_ALLOC:
-					{
-						asIObjectType *type = reinterpret_cast<asIObjectType *>(arg0);
-						asIScriptFunction *func = engine->GetFunctionById(asBC_WORDARG0(inst));
-						disas = fmtString("%-8s 0x%x, %d (type:%s, %s)", mnem,
-										  arg0,
-										  reinterpret_cast<int &>(arg1),
-										  type->GetName(),
-										  func ? func->GetDeclaration() : "{no func}");
-					}
-					break;
-				case asBC_SetG4:
-					{
-						asCGlobalProperty *prop = function->GetPropertyByGlobalVarPtr(reinterpret_cast<void *>(arg0));
-						disas = fmtString("%-8s 0x%x, %d (%d:%s)", mnem,
-										  arg0,
-										  reinterpret_cast<int &>(arg1),
-										  prop->id,
-										  prop->name.AddressOf());
-					}
-					break;
-				default:
-					disas = fmtString("%-8s %u, %d", mnem,
-									  arg0,
-									  reinterpret_cast<int &>(arg1));
-					break;
-				}
-			}
-			break;
-		case asBCTYPE_rW_DW_DW_ARG: // word src, dword imm, dword imm
-			{
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				uint32_t arg1 = asBC_DWORDARG(inst);
-				uint32_t arg2 = asBC_DWORDARG1(inst);
+	if (badNumber)
+	{
+		PrintUsage();
+		resetConsoleCodePage();
+		return -1;
+	}
 
-				disas = fmtString("%-8s v%d, %u, %u", mnem,
-								  reinterpret_cast<int16_t &>(arg0), arg1, arg2);
-			}
-			break;
-		case asBCTYPE_QW_DW_ARG: // qword imm, dword imm
-			{
-				// #todo-csasm: Consider adding support for 64-bit asBC_ALLOC
-				uint64_t arg0 = asBC_QWORDARG(inst);
-				uint32_t arg1 = asBC_DWORDARG(inst);
+	// Profiles cover dumps and batches only
+	if ((printProfile || !profilePath.empty()) && (!queryPath.empty() || !findPath.empty() || diffMode || statsMode || stringsMode))
+	{
+		PrintUsage();
+		resetConsoleCodePage();
+		return -1;
+	}
 
-				disas = fmtString("%-8s %llu, %d", mnem,
-								  reinterpret_cast<int64_t &>(arg0), reinterpret_cast<int &>(arg1));
-			}
-			break;
-		case asBCTYPE_INFO: // word imm
+	if (!queryPath.empty() || !findPath.empty())
+	{
+		// Lookups only read the index
+		if (positional.size() != 2 || (!queryPath.empty() && !findPath.empty()))
+		{
+			PrintUsage();
+			resetConsoleCodePage();
+			return -1;
+		}
+
+		StreamSink outputSink(std::cout);
+		std::string error;
+		int result = 0;
+		const std::string &indexPath = queryPath.empty() ? findPath : queryPath;
+		bool answered = queryPath.empty() ?
+		                QueryConstantIndex(findPath, positional[0], positional[1], outputSink, error) :
+		                QueryXrefIndex(queryPath, positional[0], positional[1], outputSink, error);
+		if (!answered)
+		{
+			outputSink.flush();
+			std::cout << indexPath << ": " << error << "\n";
+			result = -1;
+		}
+		resetConsoleCodePage();
+		return result;
+	}
+
+	if (diffMode)
+	{
+		// Compares the stored bytecode; no engine or config involved
+		if (positional.size() != 2)
+		{
+			PrintUsage();
+			resetConsoleCodePage();
+			return -1;
+		}
+
+		DiffOptions diffOptions;
+		diffOptions.oldRoot = positional[0];
+		diffOptions.newRoot = positional[1];
+		diffOptions.listFile = batchOptions.listFile;
+		int result = WriteOutput(outputPath, [&diffOptions](OutputSink &outputSink)
+		{
+			return DiffBuilds(diffOptions, outputSink);
+		});
+		resetConsoleCodePage();
+		return result;
+	}
+
+	if (statsMode)
+	{
+		// Counts over the stored bytecode; no engine or config involved
+		if (positional.size() != 1)
+		{
+			PrintUsage();
+			resetConsoleCodePage();
+			return -1;
+		}
+
+		StatsOptions statsOptions;
+		statsOptions.root = positional[0];
+		statsOptions.listFile = batchOptions.listFile;
+		statsOptions.jobs = batchOptions.jobs;
+		statsOptions.summaryPath = summaryPath;
+		statsOptions.summaryFormat = batchOptions.format == FORMAT_BINARY ? FORMAT_BINARY : FORMAT_JSON_LINES;
+		int result = WriteOutput(outputPath, [&statsOptions](OutputSink &outputSink)
+		{
+			return CollectCorpusStats(statsOptions, outputSink);
+		});
+		resetConsoleCodePage();
+		return result;
+	}
+
+	if (stringsMode)
+	{
+		// Gathered from the stored bytecode; no engine or config involved
+		if (positional.size() != 1)
+		{
+			PrintUsage();
+			resetConsoleCodePage();
+			return -1;
+		}
+
+		StringTableOptions stringOptions;
+		stringOptions.root = positional[0];
+		stringOptions.listFile = batchOptions.listFile;
+		stringOptions.jobs = batchOptions.jobs;
+		stringOptions.format = batchOptions.format;
+		int result = WriteOutput(outputPath, [&stringOptions](OutputSink &outputSink)
+		{
+			return ExtractStringTable(stringOptions, outputSink);
+		});
+		resetConsoleCodePage();
+		return result;
+	}
+
+	// Corpus generation takes the place of the module
+	bool corpusMode = generateMode || !benchSizes.empty();
+	size_t positionalCount = inspectMode ? 1u : (batchMode || corpusMode || serveMode ? 2u : 3u);
+	if (positional.size() != positionalCount || (corpusMode && (batchMode || inspectMode || benchIterations || filtered)) ||
+	    (!socketPath.empty() && !serveMode) || (serveMode && (batchMode || inspectMode || corpusMode || benchIterations || filtered || printProfile || !profilePath.empty())) ||
+	    (shaped && !corpusMode) || (generateMode && !benchSizes.empty()) || (inspectMode && batchOptions.format != FORMAT_TEXT) ||
+	    ((!xrefPath.empty() || !constantPath.empty()) && !batchMode) || (splitShared && (!batchMode || batchOptions.format != FORMAT_TEXT)) || (batchOptions.memoryBudget && !serveMode && (!batchMode || inspectMode)) ||
+	    (filtered && (batchMode || benchIterations || (inspectMode && dumpFilter.getFunctionId() >= 0))) ||
+	    ((printProfile || !profilePath.empty()) && (corpusMode || benchIterations)))
+	{
+		PrintUsage();
+		resetConsoleCodePage();
+		return -1;
+	}
+
+	// From here on, so the whole run is covered
+	if (printProfile || !profilePath.empty())
+	{
+		Profiler::enable();
+	}
+
+	// Inspection reads the modules on their own, without an engine or the
+	// config
+	if (inspectMode)
+	{
+		// Inspection doesn't depend on the config
+		std::unique_ptr<DumpCache> cache;
+		if (!cacheDir.empty())
+		{
+			cache.reset(new DumpCache(cacheDir, 0));
+		}
+
+		int result = 0;
+		if (batchMode)
+		{
+			batchOptions.root = positional[0];
+			batchOptions.inspect = true;
+			batchOptions.cache = cache.get();
+			result = RunIndexedBatch(EngineFactory(), batchOptions, xrefPath, constantPath, splitShared);
+		}
+		else
+		{
+			// Filtered dumps are quick to make and not worth caching
+			const std::string &path = positional[0];
+			const DumpFilter *filter = filtered ? &dumpFilter : nullptr;
+			Profiler::beginModule(path);
+			uint64_t key;
+			bool keyed = false;
+			if (!filter && cache)
 			{
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				switch (op)
-				{
-				case asBC_LABEL:
-					disas = fmtString("%d:", arg0);
-					break;
-				case asBC_LINE:
-					disas = fmtString("%-8s", mnem);
-					break;
-				case asBC_Block:
-					// #todo-csasm: Add block indenting
-					disas = fmtString("%c", arg0 ? '{' : '}');
-					break;
-				}
+				ProfileScope scope(STAGE_CACHE);
+				keyed = cache->getStandaloneKey(path, GetCacheVariant(FORMAT_TEXT, true), key);
 			}
-			break;
-		case asBCTYPE_rW_DW_ARG: // word src, dword imm
-		case asBCTYPE_wW_DW_ARG: // word dst, dword imm
-		case asBCTYPE_W_DW_ARG: // word imm, dword imm
+			result = WriteOutput(outputPath, [&](OutputSink &outputSink)
 			{
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				uint32_t arg1 = asBC_DWORDARG(inst);
-				switch (op)
+				return DumpThroughCache(cache.get(), keyed ? &key : nullptr, outputSink, [&path, filter](OutputSink &dumpSink)
 				{
-				case asBC_SetV1:
-					disas = fmtString("%-8s v%d, 0x%x", mnem,
-									  reinterpret_cast<int16_t &>(arg0),
-									  static_cast<uint8_t>(arg1));
-					break;
-				case asBC_SetV2:
-					disas = fmtString("%-8s v%d, 0x%x", mnem,
-									  reinterpret_cast<int16_t &>(arg0),
-									  static_cast<uint16_t>(arg1));
-					break;
-				case asBC_SetV4:
-					disas = fmtString("%-8s v%d, 0x%x (i:%d, f:%g)", mnem,
-									  reinterpret_cast<int16_t &>(arg0),
-									  arg1,
-									  reinterpret_cast<int &>(arg1),
-									  reinterpret_cast<float &>(arg1));
-					break;
-				case asBC_CMPIf:
-					disas = fmtString("%-8s v%d, %f", mnem,
-									  reinterpret_cast<int16_t &>(arg0),
-									  reinterpret_cast<float &>(arg1));
-					break;
-				case asBC_LdGRdR4: // global vars
-				case asBC_CpyGtoV4:
-				case asBC_CpyVtoV4:
+					RawModule module;
+					std::string error;
 					{
-						asCGlobalProperty *prop = function->GetPropertyByGlobalVarPtr(reinterpret_cast<void *>(arg1));
-						disas = fmtString("%-8s v%d, 0x%x (%d:%s)", mnem,
-										  reinterpret_cast<int16_t &>(arg0),
-										  reinterpret_cast<int &>(arg1),
-										  prop->id,
-										  prop->name.AddressOf());
+						ProfileScope scope(STAGE_LOAD);
+						if (!LoadRawModule(path, module, error, filter))
+						{
+							std::cout << path << ": " << error << "\n";
+							return false;
+						}
 					}
-					break;
-				default:
-					disas = fmtString("%-8s v%d, %d", mnem,
-									  reinterpret_cast<int16_t &>(arg0),
-									  reinterpret_cast<int &>(arg1));
-					break;
-				}
-			}
-			break;
-		case asBCTYPE_wW_rW_rW_ARG: // dst word, src word, src word
+					ProfileScope scope(STAGE_DUMP);
+					DumpRawModule(module, dumpSink, filter);
+					return true;
+				});
+			});
+			Profiler::endModule();
+			if (cache)
 			{
-				// #todo-csasm: Investigate wW_rW_rW layout further
-#define asBC_WORDARG2(x)  (*(((asWORD*)x)+3))
-				uint16_t arg0 = asBC_WORDARG0(inst);
-				uint16_t arg1 = asBC_WORDARG1(inst);
-				uint16_t arg2 = asBC_WORDARG2(inst);
-				disas = fmtString("%-8s v%d, v%d, v%d", mnem,
-								  reinterpret_cast<int16_t &>(arg0),
-								  reinterpret_cast<int16_t &>(arg1),
-								  reinterpret_cast<int16_t &>(arg2));
+				PrintCacheStats(*cache);
 			}
-			break;
-		default:
-			__debugbreak();
-			break;
 		}
-		dump.append(fmtString("\t\t%04x: %s\n", position, disas.c_str()));
 
-		position += asBCTypeSize[asBCInfo[op].type];
+		WriteProfile(printProfile, profilePath);
+		resetConsoleCodePage();
+		return result;
 	}
-	return dump;
-}
 
-std::string DumpModule(asIScriptModule *module)
-{
-	// Dump all information in the module
-	std::string dump = "";
-
-	// Enums
-	dump.append(fmtString("enums: %u\n", module->GetEnumCount()));
-	for (unsigned int i = 0; i < module->GetEnumCount(); ++i)
+	// We must replicate the scripting environment that PMCS registers in order to parse its scripts
+	// A single engine registers the config while it is being parsed. Batch
+	// workers each configure their own engine, so the records are read once
+	// and replayed; the snapshot stands in for them as long as the config is
+	// unchanged.
+	const std::string &configPath = positional[1];
+	std::vector<PreregRecord> prereg;
+	PreregSource preregSource = [&configPath](const PreregCallback &callback)
 	{
-		int typeId;
-		const char *nameSpace;
-		const char *enumName = module->GetEnumByIndex(i, &typeId, &nameSpace);
+		ProfileScope scope(STAGE_CONFIG);
+		return ReadPreregConfig(configPath, callback);
+	};
+	uint64_t configHash = 0;
+	if (!snapshotPath.empty() || !cacheDir.empty())
+	{
+		ProfileScope scope(STAGE_CONFIG);
+		configHash = HashConfigFile(configPath);
+	}
 
-		std::string prefix = "";
-		if (std::string(nameSpace) != "")
+	// Cached dumps are only valid for the config they were made with
+	std::unique_ptr<DumpCache> cache;
+	if (!cacheDir.empty() && !benchIterations)
+	{
+		if (!configHash)
 		{
-			prefix = nameSpace;
-			prefix += "::";
+			std::cout << "failed to read config " << configPath << "\n";
+			resetConsoleCodePage();
+			return -1;
 		}
-		dump.append(fmtString("\t%s%s",
-							  prefix.c_str(),
-							  enumName));
+		cache.reset(new DumpCache(cacheDir, configHash));
+	}
 
-		asIObjectType *type = module->GetEngine()->GetObjectTypeById(typeId);
-		if (type)
+	if (batchMode || serveMode || !benchSizes.empty() || !snapshotPath.empty())
+	{
+		ProfileScope scope(STAGE_CONFIG);
+		bool useSnapshot = !snapshotPath.empty() && configHash;
+		if (!useSnapshot || !LoadPreregSnapshot(snapshotPath, configHash, prereg))
 		{
-			dump.append(fmtString(" : %s", type->GetName()));
+			if (!ReadPreregConfig(configPath, prereg))
+			{
+				std::cout << "failed to read config " << configPath << "\n";
+				resetConsoleCodePage();
+				return -1;
+			}
+			if (useSnapshot && !SavePreregSnapshot(snapshotPath, configHash, prereg))
+			{
+				std::cout << "failed to write snapshot " << snapshotPath << "\n";
+			}
 		}
-		dump.append("\n");
 
-		// Values
-		for (int j = 0; j < module->GetEnumValueCount(typeId); ++j)
+		preregSource = [&prereg](const PreregCallback &callback)
 		{
-			int value;
-			const char *valueName = module->GetEnumValueByIndex(typeId, j, &value);
-			dump.append(fmtString("\t\t%s = %d,\n", valueName, value));
-		}
+			for (const PreregRecord &record : prereg)
+			{
+				callback(record);
+			}
+			return true;
+		};
 	}
-	
-	// Typedefs
-	dump.append(fmtString("typedefs: %u\n", module->GetTypedefCount()));
-	for (unsigned int i = 0; i < module->GetTypedefCount(); ++i)
+
+	// Modules are measured by what the engine allocates for them, which has to
+	// be counted from the first allocation on
+	if (batchOptions.memoryBudget || Profiler::isEnabled())
 	{
-		int typeId;
-		const char *typedefName = module->GetTypedefByIndex(i, &typeId);
-		dump.append(fmtString("\t%s %d\n", typedefName, typeId));
+		InstallScriptMemoryAccounting();
 	}
 
-	// Object types
-	dump.append(fmtString("object_types: %u\n", module->GetObjectTypeCount()));
-	for (unsigned int i = 0; i < module->GetObjectTypeCount(); ++i)
+	EngineFactory engineFactory = [&preregSource, &configPath]() -> asIScriptEngine *
 	{
-		asIObjectType *type = module->GetObjectTypeByIndex(i);
-		dump.append(fmtString("\t%s %d %08x\n", type->GetName(), type->GetSize(), type->GetFlags()));
-		// #todo-csasm: Advanced object type dumping
-		dump.append(fmtString("\t\tproperties: %u\n", type->GetPropertyCount()));
-		for (unsigned int j = 0; j < type->GetPropertyCount(); ++j)
+		asIScriptEngine *engine = asCreateScriptEngine();
+		if (!engine)
 		{
-			dump.append(fmtString("\t\t\t%s\n", type->GetPropertyDeclaration(j)));
+			return nullptr;
 		}
-	}
 
-	// Global variables
-	dump.append(fmtString("global_variables: %u\n", module->GetGlobalVarCount()));
-	for (unsigned int i = 0; i < module->GetGlobalVarCount(); ++i)
+		engine->SetMessageCallback(asFUNCTION(AngelScriptMessageCallback), 0, asCALL_CDECL);
+		ProfileScope scope(STAGE_ENGINE);
+		if (!ConfigureEngine(engine, preregSource))
+		{
+			std::cout << "failed to read config " << configPath << "\n";
+			engine->ShutDownAndRelease();
+			return nullptr;
+		}
+		return engine;
+	};
+
+	int result = 0;
+	if (generateMode)
 	{
-		// #todo-csasm: Dump global variables
-		dump.append(fmtString("\t%s\n", module->GetGlobalVarDeclaration(i, true)));
+		asIScriptEngine *engine = engineFactory();
+		std::vector<std::string> names;
+		std::string error;
+		if (!engine)
+		{
+			result = -1;
+		}
+		else
+		{
+			if (!GenerateCorpus(engine, corpusShape, positional[0], names, error))
+			{
+				std::cout << error << "\n";
+				result = -1;
+			}
+			engine->ShutDownAndRelease();
+		}
+		if (!result)
+		{
+			std::cout << fmtString("generated %u modules\n", static_cast<unsigned int>(names.size()));
+		}
 	}
-
-	// Imported functions
-	dump.append(fmtString("imported_functions: %u\n", module->GetImportedFunctionCount()));
-	for (unsigned int i = 0; i < module->GetImportedFunctionCount(); ++i)
+	else if (serveMode)
 	{
-		// #todo-csasm: Dump imported functions
-		dump.append(fmtString("\t%s %s\n",
-							  module->GetImportedFunctionDeclaration(i),
-							  module->GetImportedFunctionSourceModule(i)));
+		ServerOptions serverOptions;
+		serverOptions.root = positional[0];
+		serverOptions.socketPath = socketPath;
+		serverOptions.engines = batchOptions.jobs;
+		serverOptions.memoryBudget = batchOptions.memoryBudget;
+		result = RunServer(engineFactory, serverOptions);
 	}
-
-	// Functions
-	dump.append(fmtString("functions: %u\n", module->GetFunctionCount()));
-	for (unsigned int i = 0; i < module->GetFunctionCount(); ++i)
+	else if (!benchSizes.empty())
 	{
-		asIScriptFunction *func = module->GetFunctionByIndex(i);
-		// #todo-csasm: Dump functions
-		dump.append(fmtString("\t%s\n",
-							  func->GetDeclaration(true, true, true)));
-		dump.append(dumpBytecode(func));
+		// Every corpus and stage gets a freshly configured engine
+		result = BenchCorpus(engineFactory, positional[0], corpusShape, benchSizes) ? 0 : -1;
 	}
-
-	return dump;
-}
-
-int main(int argc, char **argv)
-{
-	// ConIO for UTF8 characters
-	setupConsoleCodePage();
-
-	std::cout << fmtString("csasm by PistonMiner, built on %s\n\n", __TIMESTAMP__);
-
-	// Create engine
-	asIScriptEngine *engine = asCreateScriptEngine();
-	if (!engine)
+	else if (batchMode)
 	{
-		return -1;
+		// Every worker configures its engine once and reuses it for all of
+		// its modules
+		batchOptions.root = positional[0];
+		batchOptions.cache = cache.get();
+		result = RunIndexedBatch(engineFactory, batchOptions, xrefPath, constantPath, splitShared);
 	}
+	else
+	{
+		const std::string &root = positional[0];
+		const std::string &name = positional[2];
 
-	engine->SetMessageCallback(asFUNCTION(AngelScriptMessageCallback), 0, asCALL_CDECL);
-
-	// We must replicate the scripting environment that PMCS registers in order to parse its scripts
-	std::ifstream configStream(argv[2]);
-	nlohmann::json config = nlohmann::json::parse(configStream);
-	ConfigureEngine(engine, config);
+		// The engine is only created when the dump isn't cached
+		auto loadModule = [&]() -> asIScriptModule *
+		{
+			asIScriptEngine *engine = engineFactory();
+			if (!engine)
+			{
+				return nullptr;
+			}
+			AsfModuleTracker tracker(engine, root);
+			return tracker.getModule(name)->getScriptModule();
+		};
 
-	AsfModuleTracker tracker(engine, argv[1]);
-	AsfModule *mainModule = tracker.getModule(argv[3]);
-	std::cout << DumpModule(mainModule->getScriptModule());
+		if (benchIterations)
+		{
+			asIScriptModule *module = loadModule();
+			if (module)
+			{
+				BenchDecode(module, benchIterations);
+			}
+			else
+			{
+				result = -1;
+			}
+		}
+		else
+		{
+			Profiler::beginModule(name);
+			uint64_t key;
+			bool keyed = false;
+			if (!filtered && cache)
+			{
+				ProfileScope scope(STAGE_CACHE);
+				keyed = cache->getKey(root, name, GetCacheVariant(batchOptions.format, false), key);
+			}
+			result = WriteOutput(outputPath, [&](OutputSink &outputSink)
+			{
+				return DumpThroughCache(cache.get(), keyed ? &key : nullptr, outputSink, [&](OutputSink &dumpSink)
+				{
+					asIScriptModule *module = loadModule();
+					if (!module)
+					{
+						return false;
+					}
+					ProfileScope scope(STAGE_DUMP);
+					DumpModule(module, dumpSink, batchOptions.format, filtered ? &dumpFilter : nullptr);
+					return true;
+				});
+			});
+			Profiler::endModule();
+			if (cache)
+			{
+				PrintCacheStats(*cache);
+			}
+		}
+	}
 
+	WriteProfile(printProfile, profilePath);
 	resetConsoleCodePage();
-}
\ No newline at end of file
+	return result;
+}
@@ -0,0 +1,225 @@
+#include "decoder.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+
+struct TypeLayout
+{
+	uint8_t length;
+	uint8_t operandCount;
+	OperandDescriptor operands[3];
+};
+
+// Operand positions of every instruction type. Words come after the opcode
+// byte and its padding, dwords and qwords start at the second dword.
+constexpr OperandDescriptor cVar0 = { 2, 2, OPERAND_VARIABLE };
+constexpr OperandDescriptor cVar1 = { 4, 2, OPERAND_VARIABLE };
+constexpr OperandDescriptor cVar2 = { 6, 2, OPERAND_VARIABLE };
+
+constexpr TypeLayout cTypeLayouts[] =
+{
+	/* asBCTYPE_INFO         */ { 0, 1, { { 2, 2, OPERAND_UNSIGNED } } },
+	/* asBCTYPE_NO_ARG       */ { 1, 0, { } },
+	/* asBCTYPE_W_ARG        */ { 1, 1, { { 2, 2, OPERAND_UNSIGNED } } },
+	/* asBCTYPE_wW_ARG       */ { 1, 1, { cVar0 } },
+	/* asBCTYPE_DW_ARG       */ { 2, 1, { { 4, 4, OPERAND_SIGNED } } },
+	/* asBCTYPE_rW_DW_ARG    */ { 2, 2, { cVar0, { 4, 4, OPERAND_SIGNED } } },
+	/* asBCTYPE_QW_ARG       */ { 3, 1, { { 4, 8, OPERAND_CONSTANT } } },
+	/* asBCTYPE_DW_DW_ARG    */ { 3, 2, { { 4, 4, OPERAND_UNSIGNED }, { 8, 4, OPERAND_SIGNED } } },
+	/* asBCTYPE_wW_rW_rW_ARG */ { 2, 3, { cVar0, cVar1, cVar2 } },
+	/* asBCTYPE_wW_QW_ARG    */ { 3, 2, { cVar0, { 4, 8, OPERAND_CONSTANT } } },
+	/* asBCTYPE_wW_rW_ARG    */ { 2, 2, { cVar0, cVar1 } },
+	/* asBCTYPE_rW_ARG       */ { 1, 1, { cVar0 } },
+	/* asBCTYPE_wW_DW_ARG    */ { 2, 2, { cVar0, { 4, 4, OPERAND_SIGNED } } },
+	/* asBCTYPE_wW_rW_DW_ARG */ { 3, 3, { cVar0, cVar1, { 8, 4, OPERAND_SIGNED } } },
+	/* asBCTYPE_rW_rW_ARG    */ { 2, 2, { cVar0, cVar1 } },
+	/* asBCTYPE_wW_W_ARG     */ { 2, 2, { cVar0, { 4, 2, OPERAND_SIGNED } } },
+	/* asBCTYPE_QW_DW_ARG    */ { 4, 2, { { 4, 8, OPERAND_UNSIGNED }, { 12, 4, OPERAND_SIGNED } } },
+	/* asBCTYPE_rW_QW_ARG    */ { 3, 2, { cVar0, { 4, 8, OPERAND_CONSTANT } } },
+	/* asBCTYPE_W_DW_ARG     */ { 2, 2, { { 2, 2, OPERAND_UNSIGNED }, { 4, 4, OPERAND_SIGNED } } },
+	/* asBCTYPE_rW_W_DW_ARG  */ { 3, 3, { cVar0, { 4, 2, OPERAND_SIGNED }, { 8, 4, OPERAND_SIGNED } } },
+	/* asBCTYPE_rW_DW_DW_ARG */ { 3, 3, { cVar0, { 4, 4, OPERAND_UNSIGNED }, { 8, 4, OPERAND_UNSIGNED } } },
+};
+
+constexpr size_t cTypeCount = sizeof(cTypeLayouts) / sizeof(cTypeLayouts[0]);
+
+constexpr bool OperandsFitTypeLayouts()
+{
+	for (size_t i = 0; i < cTypeCount; ++i)
+	{
+		const TypeLayout &layout = cTypeLayouts[i];
+		for (int j = 0; j < layout.operandCount; ++j)
+		{
+			// Info instructions take no space, their word sits in the opcode dword
+			int space = layout.length ? layout.length * 4 : 4;
+			if (layout.operands[j].offset + layout.operands[j].size > space)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static_assert(cTypeCount == sizeof(asBCTypeSize) / sizeof(asBCTypeSize[0]), "instruction types changed");
+static_assert(OperandsFitTypeLayouts(), "operand runs past the end of its instruction");
+
+constexpr OperandDescriptor Retype(OperandDescriptor operand, OperandKind kind, uint8_t size = 0)
+{
+	return { operand.offset, size ? size : operand.size, kind };
+}
+
+// What the operands of specific opcodes mean beyond their raw type
+constexpr OperandDescriptor RefineOperand(asEBCInstr op, int index, OperandDescriptor operand)
+{
+	switch (op)
+	{
+	case asBC_JMP:
+	case asBC_JZ:
+	case asBC_JNZ:
+	case asBC_JS:
+	case asBC_JNS:
+	case asBC_JP:
+	case asBC_JNP:
+	case asBC_JLowZ:
+	case asBC_JLowNZ:
+		return Retype(operand, OPERAND_JUMP);
+	case asBC_CALL:
+	case asBC_CALLSYS:
+	case asBC_CALLBND:
+	case asBC_CALLINTF:
+	case asBC_Thiscall1:
+		return Retype(operand, OPERAND_FUNCTION);
+	case asBC_FuncPtr:
+		return Retype(operand, OPERAND_FUNCTION_POINTER);
+	case asBC_OBJTYPE:
+	case asBC_REFCPY:
+		return Retype(operand, OPERAND_TYPE);
+	case asBC_FREE:
+	case asBC_RefCpyV:
+		return index == 1 ? Retype(operand, OPERAND_TYPE) : operand;
+	case asBC_ALLOC:
+		return Retype(operand, index == 0 ? OPERAND_TYPE : OPERAND_CONSTRUCTOR);
+	case asBC_TYPEID:
+		return Retype(operand, OPERAND_TYPE_ID);
+	case asBC_PGA:
+	case asBC_PshGPtr:
+	case asBC_LDG:
+	case asBC_PshG4:
+		return Retype(operand, OPERAND_GLOBAL);
+	case asBC_LdGRdR4:
+	case asBC_CpyGtoV4:
+	case asBC_CpyVtoG4:
+		return index == 1 ? Retype(operand, OPERAND_GLOBAL) : operand;
+	case asBC_SetG4:
+		return index == 0 ? Retype(operand, OPERAND_GLOBAL) : operand;
+	case asBC_STR:
+		return Retype(operand, OPERAND_STRING);
+	case asBC_PshC4:
+	case asBC_Cast:
+		return Retype(operand, OPERAND_CONSTANT);
+	case asBC_SetV4:
+		return index == 1 ? Retype(operand, OPERAND_CONSTANT) : operand;
+	case asBC_SetV1:
+		return index == 1 ? Retype(operand, OPERAND_HEX, 1) : operand;
+	case asBC_SetV2:
+		return index == 1 ? Retype(operand, OPERAND_HEX, 2) : operand;
+	case asBC_ADDIf:
+	case asBC_SUBIf:
+	case asBC_MULIf:
+		return index == 2 ? Retype(operand, OPERAND_FLOAT) : operand;
+	case asBC_CMPIf:
+		return index == 1 ? Retype(operand, OPERAND_FLOAT) : operand;
+	default:
+		return operand;
+	}
+}
+
+constexpr InstructionLayout GetLayout(asEBCInstr op, asEBCType type)
+{
+	switch (op)
+	{
+	case asBC_LABEL:
+		return LAYOUT_LABEL;
+	case asBC_Block:
+		return LAYOUT_BLOCK;
+	case asBC_LINE:
+		return LAYOUT_MNEMONIC;
+	default:
+		return type == asBCTYPE_INFO ? LAYOUT_UNKNOWN : LAYOUT_OPERANDS;
+	}
+}
+
+// asBCInfo isn't constexpr, so the per-opcode table is put together from the
+// constant parts above once at startup
+struct OpcodeTable
+{
+	OpcodeTable()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			asEBCInstr op = static_cast<asEBCInstr>(i);
+			asEBCType type = asBCInfo[i].type;
+			const TypeLayout &layout = cTypeLayouts[type];
+			assert(layout.length == asBCTypeSize[type]);
+
+			OpcodeDescriptor &descriptor = descriptors[i];
+			descriptor.name = asBCInfo[i].name;
+			descriptor.type = type;
+			// Info instructions have no size; step over them anyway
+			descriptor.length = layout.length ? layout.length : 1;
+			descriptor.layout = GetLayout(op, type);
+			descriptor.operandCount = layout.operandCount;
+			for (int j = 0; j < layout.operandCount; ++j)
+			{
+				descriptor.operands[j] = RefineOperand(op, j, layout.operands[j]);
+			}
+		}
+	}
+
+	OpcodeDescriptor descriptors[256];
+};
+
+const OpcodeTable sOpcodeTable;
+
+}
+
+const OpcodeDescriptor &GetOpcodeDescriptor(asEBCInstr op)
+{
+	return sOpcodeTable.descriptors[op & 0xff];
+}
+
+bool DecodeInstruction(const asDWORD *code, asUINT length, asUINT position, DecodedInstruction &instruction)
+{
+	if (position >= length)
+	{
+		return false;
+	}
+
+	const asBYTE *bytes = reinterpret_cast<const asBYTE *>(code + position);
+	const OpcodeDescriptor &descriptor = sOpcodeTable.descriptors[bytes[0]];
+	if (descriptor.length > length - position)
+	{
+		return false;
+	}
+
+	instruction.op = static_cast<asEBCInstr>(bytes[0]);
+	instruction.position = position;
+	instruction.descriptor = &descriptor;
+	for (int i = 0; i < descriptor.operandCount; ++i)
+	{
+		const OperandDescriptor &operand = descriptor.operands[i];
+		DecodedOperand &decoded = instruction.operands[i];
+		decoded.kind = operand.kind;
+		decoded.size = operand.size;
+
+		// Loaded bytecode is in host order, and csasm only runs on little
+		// endian hosts, so narrow operands land in the low bytes
+		decoded.value = 0;
+		memcpy(&decoded.value, bytes + operand.offset, operand.size);
+	}
+	return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <cstring>
+
+// What an operand means; decides how it is printed and resolved
+enum OperandKind : uint8_t
+{
+	OPERAND_VARIABLE,         // stack variable offset
+	OPERAND_SIGNED,           // plain immediates
+	OPERAND_UNSIGNED,
+	OPERAND_HEX,
+	OPERAND_FLOAT,
+	OPERAND_CONSTANT,         // raw bits that may be meant as int or float
+	OPERAND_JUMP,             // relative to the end of the instruction
+	OPERAND_STRING,           // string constant id
+	OPERAND_TYPE,             // asIObjectType pointer
+	OPERAND_TYPE_ID,
+	OPERAND_FUNCTION,         // function id, imports have 0x40000000 set
+	OPERAND_FUNCTION_POINTER, // asIScriptFunction pointer
+	OPERAND_CONSTRUCTOR,      // function id for ALLOC, 0 for none
+	OPERAND_GLOBAL,           // address of a global variable
+};
+
+// How an instruction is printed as a whole
+enum InstructionLayout : uint8_t
+{
+	LAYOUT_OPERANDS, // mnemonic followed by the operands
+	LAYOUT_MNEMONIC, // operands are not shown
+	LAYOUT_LABEL,
+	LAYOUT_BLOCK,
+	LAYOUT_UNKNOWN,
+};
+
+struct OperandDescriptor
+{
+	uint8_t offset; // bytes from the start of the instruction
+	uint8_t size;   // bytes
+	OperandKind kind;
+};
+
+struct OpcodeDescriptor
+{
+	const char *name;
+	asEBCType type;
+	uint8_t length; // dwords, at least 1
+	InstructionLayout layout;
+	uint8_t operandCount;
+	OperandDescriptor operands[3];
+};
+
+struct DecodedOperand
+{
+	OperandKind kind;
+	uint8_t size;
+	uint64_t value; // zero extended
+
+	int64_t getSigned() const
+	{
+		switch (size)
+		{
+		case 1: return static_cast<int8_t>(value);
+		case 2: return static_cast<int16_t>(value);
+		case 4: return static_cast<int32_t>(value);
+		default: return static_cast<int64_t>(value);
+		}
+	}
+
+	void *getPointer() const
+	{
+		return reinterpret_cast<void *>(static_cast<asPWORD>(value));
+	}
+
+	float getFloat() const
+	{
+		uint32_t bits = static_cast<uint32_t>(value);
+		float result;
+		memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+	double getDouble() const
+	{
+		double result;
+		memcpy(&result, &value, sizeof(result));
+		return result;
+	}
+};
+
+struct DecodedInstruction
+{
+	asEBCInstr op;
+	asUINT position;
+	const OpcodeDescriptor *descriptor;
+	DecodedOperand operands[3];
+
+	asUINT getLength() const
+	{
+		return descriptor->length;
+	}
+
+	// Only meaningful for operands of kind OPERAND_JUMP
+	asUINT getJumpTarget(const DecodedOperand &operand) const
+	{
+		return static_cast<asUINT>(position + descriptor->length + operand.getSigned());
+	}
+};
+
+const OpcodeDescriptor &GetOpcodeDescriptor(asEBCInstr op);
+
+// Decodes the instruction at position; returns false if it would run past
+// the end of the code
+bool DecodeInstruction(const asDWORD *code, asUINT length, asUINT position, DecodedInstruction &instruction);
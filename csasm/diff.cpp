@@ -0,0 +1,496 @@
+#include "diff.h"
+
+#include "batch.h"
+#include "decoder.h"
+#include "hash.h"
+#include "rawmodule.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+// Instruction diffs give up past this many differing lines and show the
+// whole body as replaced; the search costs quadratic memory in it
+const int cMaxEditDistance = 2000;
+
+// Unchanged instructions shown around each change
+const size_t cDiffContext = 2;
+
+struct FunctionPrint
+{
+	// Unique within the module; repeated declarations get a counter
+	std::string declaration;
+
+	uint64_t fingerprint;
+
+	// Normalized instructions and where they are in the bytecode
+	std::vector<std::string> lines;
+	std::vector<asUINT> positions;
+};
+
+void FingerprintModule(const RawModule &module, std::vector<FunctionPrint> &functions)
+{
+	RawAnnotator annotator(module, false);
+	std::map<std::string, unsigned int> seen;
+	for (const RawFunction &function : module.functions)
+	{
+		if (function.funcType != asFUNC_SCRIPT)
+		{
+			continue;
+		}
+
+		FunctionPrint print;
+		print.declaration = function.getDeclaration();
+		unsigned int repeat = seen[print.declaration]++;
+		if (repeat)
+		{
+			print.declaration += " #" + std::to_string(repeat + 1);
+		}
+
+		StringSink text;
+		DecodedInstruction instruction;
+		const asDWORD *code = function.byteCode.data();
+		asUINT length = static_cast<asUINT>(function.byteCode.size());
+		for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+		{
+			WriteNormalizedInstruction(text, instruction, annotator);
+			text.put('\n');
+			print.positions.push_back(position);
+		}
+
+		const std::string &body = text.str();
+		print.fingerprint = HashBytes(body.data(), body.size());
+		size_t start = 0;
+		for (size_t end = body.find('\n'); end != std::string::npos; end = body.find('\n', start))
+		{
+			print.lines.push_back(body.substr(start, end - start));
+			start = end + 1;
+		}
+		functions.push_back(std::move(print));
+	}
+}
+
+enum EditKind
+{
+	EDIT_KEEP,
+	EDIT_DELETE,
+	EDIT_INSERT,
+};
+
+struct Edit
+{
+	EditKind kind;
+	size_t oldIndex;
+	size_t newIndex;
+};
+
+// Shortest edit script by Myers' algorithm, on line hashes; false if the
+// lines differ in more than cMaxEditDistance places
+bool DiffLines(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b, std::vector<Edit> &edits)
+{
+	edits.clear();
+
+	// Common ends cost nothing and are most of a typical change
+	size_t prefix = 0;
+	while (prefix < a.size() && prefix < b.size() && a[prefix] == b[prefix])
+	{
+		++prefix;
+	}
+	size_t suffix = 0;
+	while (suffix < a.size() - prefix && suffix < b.size() - prefix &&
+	       a[a.size() - 1 - suffix] == b[b.size() - 1 - suffix])
+	{
+		++suffix;
+	}
+
+	int n = static_cast<int>(a.size() - prefix - suffix);
+	int m = static_cast<int>(b.size() - prefix - suffix);
+	int maxDistance = std::min(n + m, cMaxEditDistance);
+	int offset = maxDistance + 1;
+
+	// The furthest x on each diagonal; after step d the diagonals -d..d are
+	// kept for backtracking
+	std::vector<int> v(2 * offset + 1, 0);
+	std::vector<std::vector<int>> trace;
+	int distance = -1;
+	for (int d = 0; d <= maxDistance && distance < 0; ++d)
+	{
+		for (int k = -d; k <= d; k += 2)
+		{
+			int x;
+			if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+			{
+				x = v[offset + k + 1];
+			}
+			else
+			{
+				x = v[offset + k - 1] + 1;
+			}
+			int y = x - k;
+			while (x < n && y < m && a[prefix + x] == b[prefix + y])
+			{
+				++x;
+				++y;
+			}
+			v[offset + k] = x;
+			if (x >= n && y >= m)
+			{
+				distance = d;
+				break;
+			}
+		}
+		trace.emplace_back(v.begin() + offset - d, v.begin() + offset + d + 1);
+	}
+	if (distance < 0)
+	{
+		return false;
+	}
+
+	// Walk back from the end, collecting the middle in reverse
+	std::vector<Edit> middle;
+	int x = n;
+	int y = m;
+	for (int d = distance; d > 0; --d)
+	{
+		// Diagonal k of the previous step is at k + d - 1
+		const std::vector<int> &previous = trace[d - 1];
+		int k = x - y;
+		bool down = k == -d || (k != d && previous[k - 1 + d - 1] < previous[k + 1 + d - 1]);
+		int previousK = down ? k + 1 : k - 1;
+		int previousX = previous[previousK + d - 1];
+		int previousY = previousX - previousK;
+		while (x > previousX && y > previousY)
+		{
+			--x;
+			--y;
+			middle.push_back({ EDIT_KEEP, prefix + x, prefix + y });
+		}
+		if (down)
+		{
+			--y;
+			middle.push_back({ EDIT_INSERT, prefix + x, prefix + y });
+		}
+		else
+		{
+			--x;
+			middle.push_back({ EDIT_DELETE, prefix + x, prefix + y });
+		}
+	}
+	while (x > 0 && y > 0)
+	{
+		--x;
+		--y;
+		middle.push_back({ EDIT_KEEP, prefix + x, prefix + y });
+	}
+
+	for (size_t i = 0; i < prefix; ++i)
+	{
+		edits.push_back({ EDIT_KEEP, i, i });
+	}
+	edits.insert(edits.end(), middle.rbegin(), middle.rend());
+	for (size_t i = 0; i < suffix; ++i)
+	{
+		edits.push_back({ EDIT_KEEP, a.size() - suffix + i, b.size() - suffix + i });
+	}
+	return true;
+}
+
+void WriteDiffLine(OutputSink &sink, char mark, asUINT position, const std::string &line)
+{
+	sink.write("\t\t", 2);
+	sink.put(mark);
+	sink.writeHex(position, 4);
+	sink.write(": ", 2);
+	sink.write(line);
+	sink.put('\n');
+}
+
+// Changed instructions with a little context, like a unified diff
+void WriteFunctionDiff(OutputSink &sink, const FunctionPrint &before, const FunctionPrint &after)
+{
+	auto hashLines = [](const FunctionPrint &function)
+	{
+		std::vector<uint64_t> hashes;
+		hashes.reserve(function.lines.size());
+		for (const std::string &line : function.lines)
+		{
+			hashes.push_back(HashBytes(line.data(), line.size()));
+		}
+		return hashes;
+	};
+
+	std::vector<Edit> edits;
+	if (!DiffLines(hashLines(before), hashLines(after), edits))
+	{
+		sink.write("\t\t(rewritten)\n");
+		for (size_t i = 0; i < before.lines.size(); ++i)
+		{
+			WriteDiffLine(sink, '-', before.positions[i], before.lines[i]);
+		}
+		for (size_t i = 0; i < after.lines.size(); ++i)
+		{
+			WriteDiffLine(sink, '+', after.positions[i], after.lines[i]);
+		}
+		return;
+	}
+
+	// Kept instructions are shown if a change is close enough
+	std::vector<bool> shown(edits.size(), false);
+	for (size_t i = 0; i < edits.size(); ++i)
+	{
+		if (edits[i].kind == EDIT_KEEP)
+		{
+			continue;
+		}
+		size_t first = i > cDiffContext ? i - cDiffContext : 0;
+		size_t last = std::min(i + cDiffContext, edits.size() - 1);
+		for (size_t j = first; j <= last; ++j)
+		{
+			shown[j] = true;
+		}
+	}
+
+	bool skipped = false;
+	for (size_t i = 0; i < edits.size(); ++i)
+	{
+		if (!shown[i])
+		{
+			skipped = true;
+			continue;
+		}
+		if (skipped)
+		{
+			sink.write("\t\t...\n");
+			skipped = false;
+		}
+
+		const Edit &edit = edits[i];
+		switch (edit.kind)
+		{
+		case EDIT_KEEP:
+			WriteDiffLine(sink, ' ', after.positions[edit.newIndex], after.lines[edit.newIndex]);
+			break;
+		case EDIT_DELETE:
+			WriteDiffLine(sink, '-', before.positions[edit.oldIndex], before.lines[edit.oldIndex]);
+			break;
+		case EDIT_INSERT:
+			WriteDiffLine(sink, '+', after.positions[edit.newIndex], after.lines[edit.newIndex]);
+			break;
+		}
+	}
+}
+
+enum ModuleState
+{
+	MODULE_IN_BOTH,
+	MODULE_ADDED,
+	MODULE_REMOVED,
+};
+
+struct ModuleReport
+{
+	std::string name;
+	ModuleState state = MODULE_IN_BOTH;
+	std::string error;
+	std::vector<std::string> added;
+	std::vector<std::string> removed;
+	std::vector<std::string> moved;
+
+	// Declarations with their instruction diffs
+	std::vector<std::string> changed;
+};
+
+// A function without a counterpart of the same declaration
+struct Unpaired
+{
+	size_t module;
+	std::string declaration;
+	uint64_t fingerprint;
+};
+
+bool LoadBuildModule(const std::string &root, const std::string &name, ModuleReport &report,
+                     std::vector<FunctionPrint> &functions)
+{
+	boost::filesystem::path filePath = root;
+	filePath.concat(name);
+
+	RawModule module;
+	std::string error;
+	if (!LoadRawModule(filePath.string(), module, error))
+	{
+		report.error += "\t" + filePath.string() + ": " + error + "\n";
+		return false;
+	}
+	FingerprintModule(module, functions);
+	return true;
+}
+
+std::vector<std::string> CollectBuildModuleNames(const DiffOptions &options)
+{
+	if (!options.listFile.empty())
+	{
+		return ReadModuleList(options.listFile);
+	}
+
+	std::set<std::string> names;
+	for (const std::string *root : { &options.oldRoot, &options.newRoot })
+	{
+		std::vector<std::string> rootNames = CollectModuleNames(*root);
+		names.insert(rootNames.begin(), rootNames.end());
+	}
+	return std::vector<std::string>(names.begin(), names.end());
+}
+
+}
+
+bool DiffBuilds(const DiffOptions &options, OutputSink &sink)
+{
+	std::vector<std::string> names = CollectBuildModuleNames(options);
+	std::vector<ModuleReport> reports(names.size());
+	std::vector<Unpaired> added;
+	std::vector<Unpaired> removed;
+	unsigned int changedCount = 0;
+	bool failed = false;
+
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		ModuleReport &report = reports[i];
+		report.name = names[i];
+
+		boost::filesystem::path oldPath = options.oldRoot;
+		oldPath.concat(report.name);
+		boost::filesystem::path newPath = options.newRoot;
+		newPath.concat(report.name);
+		bool inOld = boost::filesystem::exists(oldPath);
+		bool inNew = boost::filesystem::exists(newPath);
+		report.state = !inOld ? MODULE_ADDED : (!inNew ? MODULE_REMOVED : MODULE_IN_BOTH);
+
+		// A missing module counts as one without functions
+		std::vector<FunctionPrint> before;
+		std::vector<FunctionPrint> after;
+		if ((inOld && !LoadBuildModule(options.oldRoot, report.name, report, before)) ||
+		    (inNew && !LoadBuildModule(options.newRoot, report.name, report, after)))
+		{
+			failed = true;
+			continue;
+		}
+
+		std::unordered_map<std::string, const FunctionPrint *> beforeByDeclaration;
+		for (const FunctionPrint &function : before)
+		{
+			beforeByDeclaration[function.declaration] = &function;
+		}
+
+		for (const FunctionPrint &function : after)
+		{
+			auto it = beforeByDeclaration.find(function.declaration);
+			if (it == beforeByDeclaration.end())
+			{
+				added.push_back({ i, function.declaration, function.fingerprint });
+				continue;
+			}
+
+			const FunctionPrint &previous = *it->second;
+			beforeByDeclaration.erase(it);
+			if (previous.fingerprint != function.fingerprint)
+			{
+				StringSink diff;
+				diff.format("\t~ %s\n", function.declaration.c_str());
+				WriteFunctionDiff(diff, previous, function);
+				report.changed.push_back(diff.str());
+				++changedCount;
+			}
+		}
+
+		// In stream order, like the rest
+		for (const FunctionPrint &function : before)
+		{
+			if (beforeByDeclaration.count(function.declaration))
+			{
+				removed.push_back({ i, function.declaration, function.fingerprint });
+			}
+		}
+	}
+
+	// Identical bodies under another declaration or in another module
+	std::unordered_multimap<uint64_t, size_t> removedByFingerprint;
+	for (size_t i = 0; i < removed.size(); ++i)
+	{
+		removedByFingerprint.emplace(removed[i].fingerprint, i);
+	}
+	std::vector<bool> moved(removed.size(), false);
+	unsigned int movedCount = 0;
+	for (const Unpaired &function : added)
+	{
+		ModuleReport &report = reports[function.module];
+		auto it = removedByFingerprint.find(function.fingerprint);
+		if (it == removedByFingerprint.end())
+		{
+			report.added.push_back(function.declaration);
+			continue;
+		}
+
+		const Unpaired &previous = removed[it->second];
+		moved[it->second] = true;
+		removedByFingerprint.erase(it);
+		++movedCount;
+
+		std::string from = previous.declaration;
+		if (previous.module != function.module)
+		{
+			from += " in " + names[previous.module];
+		}
+		report.moved.push_back(function.declaration + " (was " + from + ")");
+	}
+	unsigned int removedCount = 0;
+	for (size_t i = 0; i < removed.size(); ++i)
+	{
+		if (!moved[i])
+		{
+			reports[removed[i].module].removed.push_back(removed[i].declaration);
+			++removedCount;
+		}
+	}
+
+	for (const ModuleReport &report : reports)
+	{
+		if (report.error.empty() && report.added.empty() && report.removed.empty() &&
+		    report.moved.empty() && report.changed.empty() && report.state == MODULE_IN_BOTH)
+		{
+			continue;
+		}
+
+		const char *const cStateNames[] = { "", " (added)", " (removed)" };
+		sink.format("%s%s\n", report.name.c_str(), cStateNames[report.state]);
+		sink.write(report.error);
+		for (const std::string &declaration : report.added)
+		{
+			sink.format("\t+ %s\n", declaration.c_str());
+		}
+		for (const std::string &declaration : report.removed)
+		{
+			sink.format("\t- %s\n", declaration.c_str());
+		}
+		for (const std::string &declaration : report.moved)
+		{
+			sink.format("\t> %s\n", declaration.c_str());
+		}
+		for (const std::string &diff : report.changed)
+		{
+			sink.write(diff);
+		}
+	}
+
+	sink.format("%u modules, %u functions added, %u removed, %u moved, %u changed\n",
+	            static_cast<unsigned int>(names.size()),
+	            static_cast<unsigned int>(added.size() - movedCount), removedCount, movedCount, changedCount);
+	sink.flush();
+	return !failed;
+}
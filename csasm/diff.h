@@ -0,0 +1,25 @@
+#pragma once
+
+#include "sink.h"
+
+#include <string>
+
+struct DiffOptions
+{
+	// Directories of the two builds; module names are relative to them
+	std::string oldRoot;
+	std::string newRoot;
+
+	// Optional file with one module name per line; both roots are scanned
+	// for .asf files if this is empty
+	std::string listFile;
+};
+
+// Compares two builds function by function, reading the modules without an
+// engine. Every function is fingerprinted by its bytecode with operands
+// resolved to symbols, so ids, table indices and load addresses don't show
+// up as changes. Functions are paired by declaration, and those left over by
+// fingerprint to find renames and moves between modules; added, removed,
+// moved and changed functions are reported, the changed ones with an
+// instruction diff. Returns false if a module can't be read.
+bool DiffBuilds(const DiffOptions &options, OutputSink &sink);
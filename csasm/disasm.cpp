@@ -0,0 +1,710 @@
+#include "disasm.h"
+#include "cfg.h"
+#include "decoder.h"
+#include "shared.h"
+#include "sjis.h"
+#include "symbols.h"
+
+#include <cstring>
+#include <memory>
+
+// for bytecode translation features
+#include <../source/as_scriptengine.h>
+
+asIScriptFunction *GetImportedFunction(asIScriptModule *module, asUINT index)
+{
+	asCModule *internalModule = static_cast<asCModule *>(module);
+	if (index >= internalModule->bindInformations.GetLength())
+	{
+		return nullptr;
+	}
+	return internalModule->bindInformations[index]->importedFunctionSignature;
+}
+
+asIScriptFunction *ResolveFunction(asIScriptEngine *scriptEngine, asUINT id)
+{
+	asCScriptEngine *engine = static_cast<asCScriptEngine *>(scriptEngine);
+	if (id & 0x40000000)
+	{
+		asUINT index = id & ~0x40000000;
+		if (index < engine->importedFunctions.GetLength() && engine->importedFunctions[index])
+		{
+			return engine->importedFunctions[index]->importedFunctionSignature;
+		}
+		return nullptr;
+	}
+	return engine->GetFunctionById(static_cast<int>(id));
+}
+
+const char *ResolveGlobal(asIScriptFunction *function, void *address, asUINT *id)
+{
+	asCGlobalProperty *prop = static_cast<asCScriptFunction *>(function)->GetPropertyByGlobalVarPtr(address);
+	if (!prop)
+	{
+		return nullptr;
+	}
+	*id = prop->id;
+	return prop->name.AddressOf();
+}
+
+const char *ResolveString(asIScriptEngine *scriptEngine, asUINT id, size_t *length)
+{
+	asCScriptEngine *engine = static_cast<asCScriptEngine *>(scriptEngine);
+	if (id >= engine->stringConstants.GetLength())
+	{
+		return nullptr;
+	}
+	const asCString &str = *engine->stringConstants[id];
+	*length = str.GetLength();
+	return str.AddressOf();
+}
+
+namespace
+{
+
+bool HasAnnotation(OperandKind kind)
+{
+	switch (kind)
+	{
+	case OPERAND_CONSTANT:
+	case OPERAND_JUMP:
+	case OPERAND_STRING:
+	case OPERAND_TYPE:
+	case OPERAND_TYPE_ID:
+	case OPERAND_FUNCTION:
+	case OPERAND_FUNCTION_POINTER:
+	case OPERAND_CONSTRUCTOR:
+	case OPERAND_GLOBAL:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool IsId(OperandKind kind)
+{
+	return kind == OPERAND_STRING || kind == OPERAND_TYPE_ID || kind == OPERAND_FUNCTION || kind == OPERAND_CONSTRUCTOR;
+}
+
+void WriteOperand(OutputSink &sink, const DecodedOperand &operand)
+{
+	switch (operand.kind)
+	{
+	case OPERAND_VARIABLE:
+		sink.put('v');
+		sink.writeSigned(operand.getSigned());
+		break;
+	case OPERAND_SIGNED:
+	case OPERAND_FUNCTION:
+	case OPERAND_CONSTRUCTOR:
+		sink.writeSigned(operand.getSigned());
+		break;
+	case OPERAND_UNSIGNED:
+	case OPERAND_STRING:
+		sink.writeUnsigned(operand.value);
+		break;
+	case OPERAND_FLOAT:
+		sink.format("%f", operand.getFloat());
+		break;
+	case OPERAND_JUMP:
+		if (operand.getSigned() >= 0)
+		{
+			sink.put('+');
+		}
+		sink.writeSigned(operand.getSigned());
+		break;
+	default: // constants, pointers and ids
+		sink.write("0x", 2);
+		sink.writeHex(operand.value);
+		break;
+	}
+}
+
+void WriteAnnotation(OutputSink &sink, const DecodedInstruction &instruction, const DecodedOperand &operand, OperandAnnotator &annotator)
+{
+	switch (operand.kind)
+	{
+	case OPERAND_CONSTANT:
+		sink.write("i:", 2);
+		sink.writeSigned(operand.getSigned());
+		sink.format(", f:%g", operand.size == 8 ? operand.getDouble() : operand.getFloat());
+		break;
+	case OPERAND_JUMP:
+		sink.write("d:", 2);
+		sink.writeHex(instruction.getJumpTarget(operand));
+		break;
+	default:
+		annotator.writeAnnotation(sink, instruction, operand);
+		break;
+	}
+}
+
+// Symbols of a function loaded into an engine. Without ids, globals are
+// written by name alone, as their ids only hold within the module dumped.
+class EngineAnnotator : public OperandAnnotator
+{
+public:
+	EngineAnnotator(asCScriptFunction *function, ModuleIds &ids, bool withIds = true)
+		: mFunction(function), mEngine(static_cast<asCScriptEngine *>(function->GetEngine())),
+		  mSymbols(SymbolCache::get(function->GetEngine())), mIds(ids), mWithIds(withIds)
+	{
+
+	}
+
+	virtual uint64_t mapId(const DecodedOperand &operand)
+	{
+		switch (operand.kind)
+		{
+		case OPERAND_STRING:
+			return mIds.getStringId(static_cast<asUINT>(operand.value));
+		case OPERAND_TYPE_ID:
+			return static_cast<uint32_t>(mIds.getTypeId(static_cast<int>(operand.value)));
+		case OPERAND_FUNCTION:
+		case OPERAND_CONSTRUCTOR:
+			return static_cast<uint32_t>(mIds.getFunctionId(static_cast<asUINT>(operand.value)));
+		default:
+			return operand.value;
+		}
+	}
+
+	virtual void writeAnnotation(OutputSink &sink, const DecodedInstruction &instruction, const DecodedOperand &operand)
+	{
+		switch (operand.kind)
+		{
+		case OPERAND_STRING:
+			{
+				// The size is the stored one, the text comes out as UTF-8
+				size_t strLength = 0;
+				const char *str = ResolveString(mEngine, static_cast<asUINT>(operand.value), &strLength);
+				sink.writeUnsigned(strLength);
+				sink.write(":\"", 2);
+				size_t utf8Length;
+				const char *utf8 = SjisToUtf8Scratch(str ? str : "", strLength, &utf8Length);
+				sink.write(utf8, utf8Length);
+				sink.put('"');
+			}
+			break;
+		case OPERAND_TYPE:
+			{
+				asIObjectType *type = static_cast<asIObjectType *>(operand.getPointer());
+				sink.write("type:", 5);
+				sink.write(type ? type->GetName() : "{null}");
+			}
+			break;
+		case OPERAND_TYPE_ID:
+			{
+				const std::string *decl = mSymbols.getTypeDeclaration(static_cast<int>(operand.value));
+				sink.write("decl:", 5);
+				if (decl)
+				{
+					sink.write(*decl);
+				}
+				else
+				{
+					sink.put('?');
+				}
+			}
+			break;
+		case OPERAND_FUNCTION:
+			{
+				asIScriptFunction *func = ResolveFunction(mEngine, static_cast<asUINT>(operand.value));
+				if (func)
+				{
+					sink.write(mSymbols.getDeclaration(func));
+				}
+				else
+				{
+					sink.write("{no func}");
+				}
+			}
+			break;
+		case OPERAND_FUNCTION_POINTER:
+			{
+				asIScriptFunction *func = static_cast<asIScriptFunction *>(operand.getPointer());
+				sink.write("func:", 5);
+				if (func)
+				{
+					sink.write(mSymbols.getShortDeclaration(func));
+				}
+				else
+				{
+					sink.write("{null}");
+				}
+			}
+			break;
+		case OPERAND_CONSTRUCTOR:
+			{
+				asIScriptFunction *func = mEngine->GetFunctionById(static_cast<int>(operand.value));
+				if (func)
+				{
+					sink.write(mSymbols.getShortDeclaration(func));
+				}
+				else
+				{
+					sink.write("{no func}");
+				}
+			}
+			break;
+		case OPERAND_GLOBAL:
+			{
+				asUINT id;
+				const char *name = mSymbols.resolveGlobal(mFunction, operand.getPointer(), &id);
+				if (name)
+				{
+					if (mWithIds)
+					{
+						sink.writeUnsigned(mIds.getGlobalId(operand.getPointer()));
+						sink.put(':');
+					}
+					sink.write(name);
+				}
+				else
+				{
+					sink.put('?');
+				}
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+private:
+	asCScriptFunction *mFunction;
+	asCScriptEngine *mEngine;
+	SymbolCache &mSymbols;
+	ModuleIds &mIds;
+	bool mWithIds;
+};
+
+}
+
+void WriteInstruction(OutputSink &sink, const DecodedInstruction &instruction, OperandAnnotator &annotator)
+{
+	const OpcodeDescriptor &descriptor = *instruction.descriptor;
+	switch (descriptor.layout)
+	{
+	case LAYOUT_OPERANDS:
+		{
+			sink.writePadded(descriptor.name, 8);
+			for (int i = 0; i < descriptor.operandCount; ++i)
+			{
+				sink.write(i ? ", " : " ");
+				DecodedOperand shown = instruction.operands[i];
+				if (IsId(shown.kind))
+				{
+					shown.value = annotator.mapId(shown);
+				}
+				WriteOperand(sink, shown);
+			}
+
+			// Resolved names and alternative readings go into one group at the end
+			bool annotated = false;
+			for (int i = 0; i < descriptor.operandCount; ++i)
+			{
+				if (HasAnnotation(instruction.operands[i].kind))
+				{
+					sink.write(annotated ? ", " : " (");
+					WriteAnnotation(sink, instruction, instruction.operands[i], annotator);
+					annotated = true;
+				}
+			}
+			if (annotated)
+			{
+				sink.put(')');
+			}
+		}
+		break;
+	case LAYOUT_MNEMONIC:
+		sink.writePadded(descriptor.name, 8);
+		break;
+	case LAYOUT_LABEL:
+		sink.writeUnsigned(instruction.operands[0].value);
+		sink.put(':');
+		break;
+	case LAYOUT_BLOCK:
+		// #todo-csasm: Add block indenting
+		sink.put(instruction.operands[0].value ? '{' : '}');
+		break;
+	default:
+		sink.write("UNK");
+		break;
+	}
+}
+
+void WriteNormalizedInstruction(OutputSink &sink, const DecodedInstruction &instruction, OperandAnnotator &annotator)
+{
+	const OpcodeDescriptor &descriptor = *instruction.descriptor;
+	if (descriptor.layout != LAYOUT_OPERANDS)
+	{
+		WriteInstruction(sink, instruction, annotator);
+		return;
+	}
+
+	sink.writePadded(descriptor.name, 8);
+	for (int i = 0; i < descriptor.operandCount; ++i)
+	{
+		const DecodedOperand &operand = instruction.operands[i];
+		sink.write(i ? ", " : " ");
+
+		// Constants and jumps are the same in every build; their readings
+		// would only add noise
+		if (HasAnnotation(operand.kind) && operand.kind != OPERAND_CONSTANT && operand.kind != OPERAND_JUMP)
+		{
+			annotator.writeAnnotation(sink, instruction, operand);
+		}
+		else
+		{
+			WriteOperand(sink, operand);
+		}
+	}
+}
+
+void WriteInstructionKey(OutputSink &sink, const DecodedInstruction &instruction, OperandAnnotator &annotator)
+{
+	const OpcodeDescriptor &descriptor = *instruction.descriptor;
+	sink.put(static_cast<char>(instruction.op));
+	int operandCount = descriptor.layout == LAYOUT_OPERANDS ? descriptor.operandCount : 0;
+	if (descriptor.layout == LAYOUT_LABEL || descriptor.layout == LAYOUT_BLOCK)
+	{
+		operandCount = 1;
+	}
+	for (int i = 0; i < operandCount; ++i)
+	{
+		const DecodedOperand &operand = instruction.operands[i];
+		if (HasAnnotation(operand.kind) && operand.kind != OPERAND_CONSTANT && operand.kind != OPERAND_JUMP)
+		{
+			// Terminated, so adjacent names can't run into each other
+			annotator.writeAnnotation(sink, instruction, operand);
+			sink.put('\0');
+		}
+		else
+		{
+			sink.write(reinterpret_cast<const char *>(&operand.value), sizeof(operand.value));
+		}
+	}
+}
+
+namespace
+{
+
+void WriteBlockList(OutputSink &sink, const char *label, const std::vector<asUINT> &blocks)
+{
+	if (blocks.empty())
+	{
+		return;
+	}
+	sink.format(", %s", label);
+	for (asUINT block : blocks)
+	{
+		sink.format(" %u", block);
+	}
+}
+
+void WriteBlockHeader(OutputSink &sink, const ControlFlowGraph &graph, asUINT index)
+{
+	const BasicBlock &block = graph.getBlocks()[index];
+	sink.format("\t\tblock %u: %u instructions", index, block.instructions);
+	if (!block.reachable)
+	{
+		sink.write(", unreachable", 13);
+	}
+	WriteBlockList(sink, "preds", block.predecessors);
+	WriteBlockList(sink, "succs", block.successors);
+	if (block.immediateDominator != cNoBlock)
+	{
+		sink.format(", idom %u", block.immediateDominator);
+	}
+	if (block.loop != cNoLoop)
+	{
+		sink.format(", loop %u depth %u", block.loop, block.loopDepth);
+	}
+	sink.put('\n');
+}
+
+void WriteLoops(OutputSink &sink, const ControlFlowGraph &graph)
+{
+	const std::vector<Loop> &loops = graph.getLoops();
+	for (asUINT index = 0; index < loops.size(); ++index)
+	{
+		const Loop &loop = loops[index];
+		sink.format("\t\tloop %u: header %u", index, loop.header);
+		WriteBlockList(sink, "latches", loop.latches);
+		WriteBlockList(sink, "blocks", loop.blocks);
+		if (loop.parent != cNoLoop)
+		{
+			sink.format(", parent %u", loop.parent);
+		}
+		sink.put('\n');
+	}
+}
+
+}
+
+void WriteBytecode(OutputSink &sink, const asDWORD *code, asUINT length, OperandAnnotator &annotator, bool withBlocks)
+{
+	ControlFlowGraph graph;
+	if (withBlocks)
+	{
+		graph.build(code, length);
+	}
+	const std::vector<BasicBlock> &blocks = graph.getBlocks();
+
+	asUINT nextBlock = 0;
+	DecodedInstruction instruction;
+	for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+	{
+		if (nextBlock < blocks.size() && blocks[nextBlock].start == position)
+		{
+			WriteBlockHeader(sink, graph, nextBlock++);
+		}
+		sink.write("\t\t", 2);
+		sink.writeHex(position, 4);
+		sink.write(": ", 2);
+		WriteInstruction(sink, instruction, annotator);
+		sink.put('\n');
+	}
+	WriteLoops(sink, graph);
+}
+
+void dumpBytecode(asIScriptFunction *func, ModuleIds &ids, OutputSink &sink, bool withBlocks)
+{
+	asCScriptFunction *function = static_cast<asCScriptFunction *>(func);
+
+	asUINT length;
+	asDWORD *code = function->GetByteCode(&length);
+
+	EngineAnnotator annotator(function, ids);
+	WriteBytecode(sink, code, length, annotator, withBlocks);
+}
+
+void SelectFunctions(asIScriptModule *module, const DumpFilter *filter, std::vector<asIScriptFunction *> &functions)
+{
+	if (filter && filter->getFunctionId() >= 0)
+	{
+		// Looked up directly rather than searched for
+		std::vector<asIScriptFunction *> scriptFunctions;
+		GetScriptFunctions(module, scriptFunctions);
+		size_t id = static_cast<size_t>(filter->getFunctionId());
+		if (id < scriptFunctions.size() && scriptFunctions[id]->GetFuncType() == asFUNC_SCRIPT &&
+		    filter->matchesFunction(scriptFunctions[id], filter->getFunctionId()))
+		{
+			functions.push_back(scriptFunctions[id]);
+		}
+		return;
+	}
+
+	for (unsigned int i = 0; i < module->GetFunctionCount(); ++i)
+	{
+		asIScriptFunction *func = module->GetFunctionByIndex(i);
+		if (!filter || filter->matchesFunction(func))
+		{
+			functions.push_back(func);
+		}
+	}
+
+	// Methods aren't among the module's functions; they are only of interest
+	// when asking for their type
+	if (!filter || filter->getObjectType().empty())
+	{
+		return;
+	}
+	for (unsigned int i = 0; i < module->GetObjectTypeCount(); ++i)
+	{
+		asIObjectType *type = module->GetObjectTypeByIndex(i);
+		for (unsigned int j = 0; j < type->GetBehaviourCount(); ++j)
+		{
+			asEBehaviours behaviour;
+			asIScriptFunction *func = type->GetBehaviourByIndex(j, &behaviour);
+			if (func && func->GetFuncType() == asFUNC_SCRIPT && filter->matchesFunction(func))
+			{
+				functions.push_back(func);
+			}
+		}
+		for (unsigned int j = 0; j < type->GetMethodCount(); ++j)
+		{
+			asIScriptFunction *func = type->GetMethodByIndex(j, false);
+			if (func && func->GetFuncType() == asFUNC_SCRIPT && filter->matchesFunction(func))
+			{
+				functions.push_back(func);
+			}
+		}
+	}
+}
+
+void GetScriptFunctions(asIScriptModule *scriptModule, std::vector<asIScriptFunction *> &functions)
+{
+	asCModule *module = static_cast<asCModule *>(scriptModule);
+
+	// Methods are in the module's own list, only initializers of globals
+	// have to be found separately
+	functions.assign(module->scriptFunctions.AddressOf(), module->scriptFunctions.AddressOf() + module->scriptFunctions.GetLength());
+	for (asCSymbolTableIterator<asCGlobalProperty> it = module->scriptGlobals.List(); it; it++)
+	{
+		if ((*it)->GetInitFunc())
+		{
+			functions.push_back((*it)->GetInitFunc());
+		}
+	}
+}
+
+void DumpModule(asIScriptModule *module, OutputSink &sink, const DumpFilter *filter, SharedCodeWriter *shared,
+                ModuleIds *keptIds)
+{
+	// Dump all information in the module, or what the filter leaves of it
+	std::unique_ptr<ModuleIds> ownIds(keptIds ? nullptr : new ModuleIds(module));
+	ModuleIds &ids = keptIds ? *keptIds : *ownIds;
+
+	// Enums
+	std::vector<unsigned int> selected;
+	for (unsigned int i = 0; i < module->GetEnumCount(); ++i)
+	{
+		int typeId;
+		const char *nameSpace;
+		const char *enumName = module->GetEnumByIndex(i, &typeId, &nameSpace);
+		if (!filter || filter->matchesType(nameSpace, enumName))
+		{
+			selected.push_back(i);
+		}
+	}
+	sink.format("enums: %u\n", static_cast<unsigned int>(selected.size()));
+	for (unsigned int i : selected)
+	{
+		int typeId;
+		const char *nameSpace;
+		const char *enumName = module->GetEnumByIndex(i, &typeId, &nameSpace);
+
+		sink.put('\t');
+		if (nameSpace[0])
+		{
+			sink.write(nameSpace);
+			sink.write("::");
+		}
+		sink.write(enumName);
+
+		asIObjectType *type = module->GetEngine()->GetObjectTypeById(typeId);
+		if (type)
+		{
+			sink.format(" : %s", type->GetName());
+		}
+		sink.put('\n');
+
+		// Values
+		for (int j = 0; j < module->GetEnumValueCount(typeId); ++j)
+		{
+			int value;
+			const char *valueName = module->GetEnumValueByIndex(typeId, j, &value);
+			sink.format("\t\t%s = %d,\n", valueName, value);
+		}
+	}
+	
+	// Typedefs
+	selected.clear();
+	for (unsigned int i = 0; i < module->GetTypedefCount(); ++i)
+	{
+		int typeId;
+		const char *typedefName = module->GetTypedefByIndex(i, &typeId);
+		asIObjectType *type = module->GetEngine()->GetObjectTypeById(typeId);
+		if (!filter || filter->matchesType(type ? type->GetNamespace() : "", typedefName))
+		{
+			selected.push_back(i);
+		}
+	}
+	sink.format("typedefs: %u\n", static_cast<unsigned int>(selected.size()));
+	for (unsigned int i : selected)
+	{
+		int typeId;
+		const char *typedefName = module->GetTypedefByIndex(i, &typeId);
+		sink.format("\t%s %d\n", typedefName, ids.getTypeId(typeId));
+	}
+
+	// Object types
+	selected.clear();
+	for (unsigned int i = 0; i < module->GetObjectTypeCount(); ++i)
+	{
+		asIObjectType *type = module->GetObjectTypeByIndex(i);
+		if (!filter || filter->matchesType(type->GetNamespace(), type->GetName()))
+		{
+			selected.push_back(i);
+		}
+	}
+	sink.format("object_types: %u\n", static_cast<unsigned int>(selected.size()));
+	for (unsigned int i : selected)
+	{
+		asIObjectType *type = module->GetObjectTypeByIndex(i);
+		sink.format("\t%s %d %08x\n", type->GetName(), type->GetSize(), type->GetFlags());
+		// #todo-csasm: Advanced object type dumping
+		sink.format("\t\tproperties: %u\n", type->GetPropertyCount());
+		for (unsigned int j = 0; j < type->GetPropertyCount(); ++j)
+		{
+			sink.format("\t\t\t%s\n", type->GetPropertyDeclaration(j));
+		}
+	}
+
+	// Global variables
+	selected.clear();
+	for (unsigned int i = 0; i < module->GetGlobalVarCount(); ++i)
+	{
+		const char *name;
+		const char *nameSpace;
+		module->GetGlobalVar(i, &name, &nameSpace);
+		if (!filter || filter->matchesGlobal(nameSpace, name))
+		{
+			selected.push_back(i);
+		}
+	}
+	sink.format("global_variables: %u\n", static_cast<unsigned int>(selected.size()));
+	for (unsigned int i : selected)
+	{
+		// #todo-csasm: Dump global variables
+		sink.format("\t%s\n", module->GetGlobalVarDeclaration(i, true));
+	}
+
+	// Imported functions
+	selected.clear();
+	for (unsigned int i = 0; i < module->GetImportedFunctionCount(); ++i)
+	{
+		if (!filter || filter->matchesFunction(GetImportedFunction(module, i)))
+		{
+			selected.push_back(i);
+		}
+	}
+	sink.format("imported_functions: %u\n", static_cast<unsigned int>(selected.size()));
+	for (unsigned int i : selected)
+	{
+		// #todo-csasm: Dump imported functions
+		sink.format("\t%s %s\n",
+		            module->GetImportedFunctionDeclaration(i),
+		            module->GetImportedFunctionSourceModule(i));
+	}
+
+	// Functions; those filtered out are never decoded
+	std::vector<asIScriptFunction *> functions;
+	SelectFunctions(module, filter, functions);
+	bool withBytecode = !filter || filter->withBytecode();
+	bool withBlocks = filter && filter->getLevel() == DUMP_BLOCKS;
+	sink.format("functions: %u\n", static_cast<unsigned int>(functions.size()));
+	for (asIScriptFunction *func : functions)
+	{
+		// #todo-csasm: Dump functions
+		const char *declaration = func->GetDeclaration(true, true, true);
+		sink.format("\t%s\n", declaration);
+		if (!withBytecode)
+		{
+			continue;
+		}
+		if (shared && func->IsShared())
+		{
+			asCScriptFunction *function = static_cast<asCScriptFunction *>(func);
+			asUINT length;
+			asDWORD *code = function->GetByteCode(&length);
+			// Copies in other modules number globals differently
+			EngineAnnotator annotator(function, ids, false);
+			shared->writeFunction(sink, declaration, code, length, annotator);
+		}
+		else
+		{
+			dumpBytecode(func, ids, sink, withBlocks);
+		}
+	}
+}
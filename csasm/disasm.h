@@ -0,0 +1,82 @@
+#pragma once
+
+#include "decoder.h"
+#include "filter.h"
+#include "sink.h"
+
+#include <angelscript.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class ModuleIds;
+class SharedCodeWriter;
+
+template<typename... A>
+static std::string fmtString(const std::string &format, A... args)
+{
+	// Thread safe
+	static thread_local char sFormatBuf[2048];
+	snprintf(sFormatBuf, sizeof(sFormatBuf), format.c_str(), args...);
+	return std::string(sFormatBuf);
+}
+
+// Symbol lookups for decoded operands; null if the operand doesn't resolve
+asIScriptFunction *ResolveFunction(asIScriptEngine *engine, asUINT id);
+const char *ResolveGlobal(asIScriptFunction *function, void *address, asUINT *id);
+const char *ResolveString(asIScriptEngine *engine, asUINT id, size_t *length);
+
+// Signature of an imported function, which the interface only has as text
+asIScriptFunction *GetImportedFunction(asIScriptModule *module, asUINT index);
+
+// Resolves the symbolic operands of an instruction for the text dump.
+// Constants and jump targets are written by WriteInstruction itself.
+class OperandAnnotator
+{
+public:
+	virtual ~OperandAnnotator() {}
+
+	virtual void writeAnnotation(OutputSink &sink, const DecodedInstruction &instruction, const DecodedOperand &operand) = 0;
+
+	// The number a string, type or function id is shown as; its value unless
+	// that only means something to one engine
+	virtual uint64_t mapId(const DecodedOperand &operand)
+	{
+		return operand.value;
+	}
+};
+
+// One instruction in the text dump form, without position or line break
+void WriteInstruction(OutputSink &sink, const DecodedInstruction &instruction, OperandAnnotator &annotator);
+
+// The same with symbolic operands written only as what they resolve to, so
+// nothing depends on ids, table indices or where things were loaded
+void WriteNormalizedInstruction(OutputSink &sink, const DecodedInstruction &instruction, OperandAnnotator &annotator);
+
+// What WriteNormalizedInstruction tells instructions apart by, packed for
+// hashing and comparing rather than reading; only symbolic operands are
+// resolved
+void WriteInstructionKey(OutputSink &sink, const DecodedInstruction &instruction, OperandAnnotator &annotator);
+
+// Numbered instructions, one per line. With blocks, each basic block is headed
+// by its edges, dominator and loop, and the function's loops follow the code.
+void WriteBytecode(OutputSink &sink, const asDWORD *code, asUINT length, OperandAnnotator &annotator, bool withBlocks);
+
+// Ids as the module dumped numbers them, see ModuleIds
+void dumpBytecode(asIScriptFunction *func, ModuleIds &ids, OutputSink &sink, bool withBlocks = false);
+
+// Functions a dump shows: the module's global functions, plus the methods of
+// the type a filter asks for; a function id is looked up directly among the
+// module's own functions, which it is the index of
+void SelectFunctions(asIScriptModule *module, const DumpFilter *filter, std::vector<asIScriptFunction *> &functions);
+
+// Every function of the module with bytecode: methods and the initializers
+// of globals included
+void GetScriptFunctions(asIScriptModule *module, std::vector<asIScriptFunction *> &functions);
+
+// Everything in the module, or only what the filter picks. With a writer,
+// shared functions name their bytecode in it instead of listing it. Ids kept
+// for the loaded module save numbering them again; see AsfModule::getIds.
+void DumpModule(asIScriptModule *module, OutputSink &sink, const DumpFilter *filter = nullptr,
+                SharedCodeWriter *shared = nullptr, ModuleIds *ids = nullptr);
@@ -0,0 +1,165 @@
+#include "filter.h"
+#include "rawmodule.h"
+
+#include <cstring>
+
+namespace
+{
+
+// Namespaces may be given with or without the leading ::
+const char *SkipGlobalScope(const char *name)
+{
+	return strncmp(name, "::", 2) == 0 ? name + 2 : name;
+}
+
+std::string Qualify(const char *nameSpace, const char *name)
+{
+	return nameSpace[0] ? std::string(nameSpace) + "::" + name : std::string(name);
+}
+
+bool MatchesTypeName(const std::string &wanted, const char *nameSpace, const char *name)
+{
+	const char *wantedName = SkipGlobalScope(wanted.c_str());
+	return strcmp(wantedName, name) == 0 || Qualify(nameSpace, name) == wantedName;
+}
+
+}
+
+bool MatchGlob(const char *pattern, const char *str)
+{
+	// Greedy with a single backtrack point, the last star seen
+	const char *starPattern = nullptr;
+	const char *starStr = nullptr;
+	while (*str)
+	{
+		if (*pattern == '*')
+		{
+			starPattern = ++pattern;
+			starStr = str;
+		}
+		else if (*pattern == '?' || *pattern == *str)
+		{
+			++pattern;
+			++str;
+		}
+		else if (starPattern)
+		{
+			pattern = starPattern;
+			str = ++starStr;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	while (*pattern == '*')
+	{
+		++pattern;
+	}
+	return !*pattern;
+}
+
+bool DumpFilter::setPattern(const std::string &pattern, bool regex)
+{
+	mPattern = pattern;
+	mPatternKind = regex ? PATTERN_REGEX : PATTERN_GLOB;
+	if (regex)
+	{
+		try
+		{
+			mRegex = std::regex(pattern, std::regex::ECMAScript | std::regex::optimize);
+		}
+		catch (const std::regex_error &)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool DumpFilter::matchesFunction(asIScriptFunction *function, int id) const
+{
+	if (mFunctionId >= 0 && id != mFunctionId)
+	{
+		return false;
+	}
+
+	asIObjectType *type = function->GetObjectType();
+	if (!mObjectType.empty() && (!type || !MatchesTypeName(mObjectType, type->GetNamespace(), type->GetName())))
+	{
+		return false;
+	}
+	return matchesNamespace(function->GetNamespace()) &&
+	       matchesName(function->GetNamespace(), type ? type->GetName() : "", function->GetName());
+}
+
+bool DumpFilter::matchesFunction(const RawFunction &function) const
+{
+	// Raw functions have no ids
+	if (mFunctionId >= 0)
+	{
+		return false;
+	}
+
+	// The type is known by its declaration, which is qualified
+	if (!mObjectType.empty())
+	{
+		const char *wanted = SkipGlobalScope(mObjectType.c_str());
+		size_t scope = function.objectType.rfind("::");
+		if (function.objectType != wanted &&
+		    (scope == std::string::npos || function.objectType.compare(scope + 2, std::string::npos, wanted) != 0))
+		{
+			return false;
+		}
+	}
+	// Qualified with the type's declaration, which already has the namespace
+	const std::string &qualifier = function.objectType.empty() ? function.nameSpace : function.objectType;
+	return matchesNamespace(function.nameSpace.c_str()) && matchesName(qualifier.c_str(), "", function.name.c_str());
+}
+
+bool DumpFilter::matchesType(const char *nameSpace, const char *name) const
+{
+	if (mFunctionId >= 0 || (!mObjectType.empty() && !MatchesTypeName(mObjectType, nameSpace, name)))
+	{
+		return false;
+	}
+	return matchesNamespace(nameSpace) && matchesName(nameSpace, "", name);
+}
+
+bool DumpFilter::matchesGlobal(const char *nameSpace, const char *name) const
+{
+	if (mFunctionId >= 0 || !mObjectType.empty())
+	{
+		return false;
+	}
+	return matchesNamespace(nameSpace) && matchesName(nameSpace, "", name);
+}
+
+bool DumpFilter::matchesNamespace(const char *nameSpace) const
+{
+	return !mHasNamespace || strcmp(SkipGlobalScope(mNamespace.c_str()), SkipGlobalScope(nameSpace)) == 0;
+}
+
+bool DumpFilter::matchesName(const char *nameSpace, const char *objectType, const char *name) const
+{
+	if (mPatternKind == PATTERN_NONE)
+	{
+		return true;
+	}
+	if (matchesPattern(name))
+	{
+		return true;
+	}
+
+	std::string qualified = Qualify(nameSpace, objectType[0] ? (std::string(objectType) + "::" + name).c_str() : name);
+	return qualified != name && matchesPattern(qualified);
+}
+
+bool DumpFilter::matchesPattern(const std::string &str) const
+{
+	if (mPatternKind == PATTERN_REGEX)
+	{
+		return std::regex_match(str, mRegex);
+	}
+	return MatchGlob(mPattern.c_str(), str.c_str());
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <angelscript.h>
+
+#include <regex>
+#include <string>
+
+struct RawFunction;
+
+enum DumpLevel
+{
+	DUMP_FULL,
+
+	// Declarations only; no bytecode is decoded
+	DUMP_HEADERS,
+
+	// Bytecode split into basic blocks, with their edges, dominators and
+	// loops; the same as DUMP_FULL in records
+	DUMP_BLOCKS,
+};
+
+// Picks what a dump shows. Every criterion that is set has to match. Names
+// match as written or qualified with their namespace and, for methods,
+// their type. Types and globals have no ids, so they drop out when a
+// function id is asked for; an object type picks the type itself and its
+// methods.
+class DumpFilter
+{
+public:
+	// Glob with * and ?, or an ECMAScript regex; false if the regex doesn't
+	// compile
+	bool setPattern(const std::string &pattern, bool regex);
+
+	void setNamespace(const std::string &nameSpace)
+	{
+		mNamespace = nameSpace;
+		mHasNamespace = true;
+	}
+
+	void setObjectType(const std::string &objectType)
+	{
+		mObjectType = objectType;
+	}
+
+	void setFunctionId(int id)
+	{
+		mFunctionId = id;
+	}
+
+	void setLevel(DumpLevel level)
+	{
+		mLevel = level;
+	}
+
+	DumpLevel getLevel() const
+	{
+		return mLevel;
+	}
+
+	bool withBytecode() const
+	{
+		return mLevel != DUMP_HEADERS;
+	}
+
+	int getFunctionId() const
+	{
+		return mFunctionId;
+	}
+
+	const std::string &getObjectType() const
+	{
+		return mObjectType;
+	}
+
+	// Nothing is left out
+	bool isEmpty() const
+	{
+		return mPatternKind == PATTERN_NONE && !mHasNamespace && mObjectType.empty() && mFunctionId < 0;
+	}
+
+	// Whether the function is shown at all; its bytecode is decoded only if
+	// the level asks for it as well. The id is the one the module gives it,
+	// see ModuleIds; -1 if it has none.
+	bool matchesFunction(asIScriptFunction *function, int id = -1) const;
+	bool matchesFunction(const RawFunction &function) const;
+
+	// Object types, enums and typedefs
+	bool matchesType(const char *nameSpace, const char *name) const;
+
+	// Global variables
+	bool matchesGlobal(const char *nameSpace, const char *name) const;
+
+private:
+	enum PatternKind
+	{
+		PATTERN_NONE,
+		PATTERN_GLOB,
+		PATTERN_REGEX,
+	};
+
+	bool matchesNamespace(const char *nameSpace) const;
+	bool matchesName(const char *nameSpace, const char *objectType, const char *name) const;
+	bool matchesPattern(const std::string &str) const;
+
+	PatternKind mPatternKind = PATTERN_NONE;
+	std::string mPattern;
+	std::regex mRegex;
+
+	bool mHasNamespace = false;
+	std::string mNamespace;
+
+	std::string mObjectType;
+	int mFunctionId = -1;
+	DumpLevel mLevel = DUMP_FULL;
+};
+
+// Whether a whole string matches a glob with * and ?
+bool MatchGlob(const char *pattern, const char *str);
@@ -0,0 +1,363 @@
+#include "generator.h"
+#include "asf.h"
+#include "disasm.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+
+namespace
+{
+
+// Every module has this; the game's scripts share helpers the same way
+const char *const cSharedHelper =
+	"shared int sharedMix(int a, int b)\n"
+	"{\n"
+	"\tint h = a * 31 + b;\n"
+	"\tfor (int i = 0; i < 4; i++) h ^= h >> 3;\n"
+	"\treturn h;\n"
+	"}\n";
+
+// あいう in Shift-JIS
+const char *const cSjisText = "\x82\xa0\x82\xa2\x82\xa4";
+
+class ByteCodeBuffer : public asIBinaryStream
+{
+public:
+	virtual void Read(void *ptr, asUINT size)
+	{
+		// Only written to
+	}
+
+	virtual void Write(const void *ptr, asUINT size)
+	{
+		const uint8_t *bytes = static_cast<const uint8_t *>(ptr);
+		mData.insert(mData.end(), bytes, bytes + size);
+	}
+
+	const std::vector<uint8_t> &getData() const
+	{
+		return mData;
+	}
+
+private:
+	std::vector<uint8_t> mData;
+};
+
+void CollectMessages(const asSMessageInfo *msg, void *param)
+{
+	if (msg->type == asMSGTYPE_ERROR)
+	{
+		std::string &messages = *static_cast<std::string *>(param);
+		messages += fmtString("%s (%d, %d): %s\n", msg->section, msg->row, msg->col, msg->message);
+	}
+}
+
+std::string GetModuleName(unsigned int index)
+{
+	return fmtString("m%04u.asf", index);
+}
+
+// A literal of a primitive type, or empty if there is none
+std::string GetPrimitiveLiteral(int typeId)
+{
+	switch (typeId)
+	{
+	case asTYPEID_BOOL:   return "true";
+	case asTYPEID_INT8:   return "int8(3)";
+	case asTYPEID_INT16:  return "int16(3)";
+	case asTYPEID_INT32:  return "3";
+	case asTYPEID_INT64:  return "int64(3)";
+	case asTYPEID_UINT8:  return "uint8(3)";
+	case asTYPEID_UINT16: return "uint16(3)";
+	case asTYPEID_UINT32: return "3u";
+	case asTYPEID_UINT64: return "uint64(3)";
+	case asTYPEID_FLOAT:  return "1.5f";
+	case asTYPEID_DOUBLE: return "1.5";
+	default:              return "";
+	}
+}
+
+// Builds a block calling the function, with locals for the arguments that
+// aren't primitives passed by value
+std::string BuildCall(asIScriptEngine *engine, asIScriptFunction *function)
+{
+	std::string locals;
+	std::string arguments;
+	for (asUINT i = 0; i < function->GetParamCount(); ++i)
+	{
+		int typeId;
+		asDWORD flags;
+		function->GetParam(i, &typeId, &flags);
+
+		std::string argument = flags == asTM_NONE ? GetPrimitiveLiteral(typeId) : "";
+		if (argument.empty())
+		{
+			// Reference types can't always be constructed; a null handle
+			// still compiles
+			asIObjectType *type = engine->GetObjectTypeById(typeId);
+			bool handle = (typeId & asTYPEID_OBJHANDLE) || (type && (type->GetFlags() & asOBJ_REF));
+			argument = fmtString("a%u", i);
+			locals += fmtString("%s%s %s; ", engine->GetTypeDeclaration(typeId & ~asTYPEID_OBJHANDLE, true),
+			                    handle ? "@" : "", argument.c_str());
+		}
+		if (i)
+		{
+			arguments += ", ";
+		}
+		arguments += argument;
+	}
+
+	const char *nameSpace = function->GetNamespace();
+	return fmtString("{ %s%s%s%s(%s); }", locals.c_str(), nameSpace, *nameSpace ? "::" : "", function->GetName(),
+	                 arguments.c_str());
+}
+
+// The calls of registered functions that compile, found by compiling each in
+// a scratch module
+std::vector<std::string> CollectRegisteredCalls(asIScriptEngine *engine)
+{
+	std::vector<std::string> calls;
+	asIScriptModule *module = engine->GetModule("$generator", asGM_ALWAYS_CREATE);
+	for (asUINT i = 0; i < engine->GetGlobalFunctionCount(); ++i)
+	{
+		std::string call = BuildCall(engine, engine->GetGlobalFunctionByIndex(i));
+		std::string code = "void probe() " + call;
+
+		asIScriptFunction *probe = nullptr;
+		if (module->CompileFunction("probe", code.c_str(), 0, 0, &probe) >= 0)
+		{
+			calls.push_back(call);
+		}
+		if (probe)
+		{
+			probe->Release();
+		}
+	}
+	module->Discard();
+	return calls;
+}
+
+struct ModulePlan
+{
+	unsigned int index;
+	std::vector<unsigned int> imports;
+};
+
+class ModuleWriter
+{
+public:
+	ModuleWriter(const CorpusShape &shape, const std::vector<std::string> &registeredCalls, std::mt19937 &random)
+		: mShape(shape), mRegisteredCalls(registeredCalls), mRandom(random)
+	{
+
+	}
+
+	std::string write(const ModulePlan &plan)
+	{
+		mPlan = &plan;
+		mSource = cSharedHelper;
+
+		unsigned int index = plan.index;
+		mSource += fmtString("int gCounter = %u;\n", index);
+		mSource += fmtString("string gLabel = \"module %u\";\n", index);
+
+		for (unsigned int imported : plan.imports)
+		{
+			std::string from = GetModuleName(imported);
+			mSource += fmtString("import int m%u_f0(int) from \"%s\";\n", imported, from.c_str());
+		}
+
+		for (unsigned int k = 0; k < mShape.classes; ++k)
+		{
+			mSource += fmtString(
+				"class C%u_%u\n"
+				"{\n"
+				"\tint a;\n"
+				"\tfloat b;\n"
+				"\tstring s;\n"
+				"\tC%u_%u() { a = %u; b = %u.25f; }\n"
+				"\tint get(int x) { return a * x + int(b); }\n"
+				"\tvoid set(int v) { a = v; s = \"C%u_%u \" + v; }\n"
+				"}\n",
+				index, k, index, k, k, k, index, k);
+		}
+
+		unsigned int functionCount = std::max(mShape.functions, 1u);
+		for (unsigned int j = 0; j < functionCount; ++j)
+		{
+			mSource += fmtString("int m%u_f%u(int x)\n{\n\tint r = %u;\n", index, j, j);
+			for (unsigned int s = 0; s < mShape.statements; ++s)
+			{
+				writeStatement(j);
+			}
+			mSource += "\treturn r;\n}\n";
+		}
+		return mSource;
+	}
+
+private:
+	unsigned int pick(unsigned int count)
+	{
+		return std::uniform_int_distribution<unsigned int>(0, count - 1)(mRandom);
+	}
+
+	void writeStatement(unsigned int function)
+	{
+		unsigned int n = pick(1000);
+		switch (pick(15))
+		{
+		case 0:
+			mSource += fmtString("\tr += x * %u;\n", n);
+			break;
+		case 1:
+			mSource += fmtString("\tif (r > %u) r -= x; else r += %u;\n", n, n / 2);
+			break;
+		case 2:
+			mSource += fmtString("\tfor (int i = 0; i < %u; i++) r += i ^ x;\n", n % 16 + 1);
+			break;
+		case 3:
+			mSource += fmtString("\twhile (r > %u) r /= 2;\n", n);
+			break;
+		case 4:
+			mSource += fmtString("\tswitch (x %% 4) { case 0: r++; break; case 1: r--; break; case 2: r *= 3; break; default: r += %u; }\n", n);
+			break;
+		case 5:
+			mSource += fmtString("\t{ float f = x * 0.5f + %u.5f; r += int(f); }\n", n);
+			break;
+		case 6:
+			mSource += fmtString("\t{ string s = \"m%u text %u\"; s += r; r += int(s.length()); }\n", mPlan->index, n);
+			break;
+		case 7:
+			mSource += fmtString("\t{ array<int> a = { r, x, %u }; r += a[uint(x) %% 3] + int(a.length()); }\n", n);
+			break;
+		case 8:
+			mSource += "\tgCounter += r;\n";
+			break;
+		case 9:
+			mSource += fmtString("\tr += sharedMix(r, %u);\n", n);
+			break;
+		case 10:
+			mSource += fmtString("\t{ string s = \"%s %u\"; r += int(s.length()); }\n", cSjisText, n);
+			break;
+		case 11:
+			// Earlier functions only, so nothing recurses
+			if (function)
+			{
+				mSource += fmtString("\tr += m%u_f%u(x + %u);\n", mPlan->index, pick(function), n);
+				break;
+			}
+			// Fall through
+		case 12:
+			if (!mPlan->imports.empty())
+			{
+				mSource += fmtString("\tr += m%u_f0(r);\n", mPlan->imports[pick(static_cast<unsigned int>(mPlan->imports.size()))]);
+				break;
+			}
+			// Fall through
+		case 13:
+			if (mShape.classes)
+			{
+				unsigned int k = pick(mShape.classes);
+				mSource += fmtString("\t{ C%u_%u c; c.set(x); r += c.get(%u); }\n", mPlan->index, k, n);
+				break;
+			}
+			// Fall through
+		default:
+			if (!mRegisteredCalls.empty())
+			{
+				mSource += "\t" + mRegisteredCalls[pick(static_cast<unsigned int>(mRegisteredCalls.size()))] + "\n";
+				break;
+			}
+			mSource += fmtString("\tr -= %u;\n", n);
+			break;
+		}
+	}
+
+	const CorpusShape &mShape;
+	const std::vector<std::string> &mRegisteredCalls;
+	std::mt19937 &mRandom;
+
+	const ModulePlan *mPlan = nullptr;
+	std::string mSource;
+};
+
+}
+
+bool GenerateCorpus(asIScriptEngine *engine, const CorpusShape &shape, const std::string &outputDir,
+                    std::vector<std::string> &names, std::string &error)
+{
+	boost::system::error_code fsError;
+	boost::filesystem::create_directories(outputDir, fsError);
+	if (fsError)
+	{
+		error = "failed to create " + outputDir;
+		return false;
+	}
+
+	std::string messages;
+	engine->SetMessageCallback(asFUNCTION(CollectMessages), &messages, asCALL_CDECL);
+
+	// The UTF-8 scanner would re-encode the Shift-JIS bytes of the string
+	// constants; only the compiler looks at this
+	engine->SetEngineProperty(asEP_SCRIPT_SCANNER, 0);
+
+	std::vector<std::string> registeredCalls = CollectRegisteredCalls(engine);
+	messages.clear();
+
+	std::mt19937 random(shape.seed);
+	ModuleWriter writer(shape, registeredCalls, random);
+	names.clear();
+	for (unsigned int index = 0; index < shape.modules; ++index)
+	{
+		// Imports come from the modules written so far, nearby ones first
+		ModulePlan plan;
+		plan.index = index;
+		unsigned int importCount = std::min(index, shape.imports);
+		for (unsigned int i = 0; i < importCount; ++i)
+		{
+			unsigned int imported = index - 1 - std::uniform_int_distribution<unsigned int>(0, std::min(index, 8u) - 1)(random);
+			if (std::find(plan.imports.begin(), plan.imports.end(), imported) == plan.imports.end())
+			{
+				plan.imports.push_back(imported);
+			}
+		}
+
+		std::string name = GetModuleName(index);
+		std::string source = writer.write(plan);
+		asIScriptModule *module = engine->GetModule(name.c_str(), asGM_ALWAYS_CREATE);
+		module->AddScriptSection(name.c_str(), source.c_str(), source.size());
+		if (module->Build() < 0)
+		{
+			module->Discard();
+			error = name + " doesn't compile\n" + messages;
+			return false;
+		}
+
+		// The game's modules are stripped
+		ByteCodeBuffer code;
+		module->SaveByteCode(&code, true);
+		module->Discard();
+
+		std::vector<std::string> dependencies;
+		for (unsigned int imported : plan.imports)
+		{
+			dependencies.push_back(GetModuleName(imported));
+		}
+		std::vector<uint8_t> fileData = BuildAsfFile(dependencies, code.getData().data(), code.getData().size());
+
+		boost::filesystem::path filePath = outputDir;
+		filePath /= name;
+		std::ofstream file(filePath.string(), std::ios::binary);
+		file.write(reinterpret_cast<const char *>(fileData.data()), fileData.size());
+		if (!file)
+		{
+			error = "failed to write " + filePath.string();
+			return false;
+		}
+		names.push_back(name);
+	}
+	return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Size and shape of a synthetic corpus
+struct CorpusShape
+{
+	unsigned int modules = 16;
+
+	// Per module
+	unsigned int functions = 32;
+	unsigned int classes = 2;
+
+	// Per function
+	unsigned int statements = 12;
+
+	// Most modules each module imports functions from
+	unsigned int imports = 2;
+
+	uint32_t seed = 1;
+};
+
+// Compiles modules of the given shape in an engine set up by ConfigureEngine
+// and writes them into outputDir the way the game ships them: stripped
+// bytecode behind an ASF header that names the modules it imports from.
+// Besides arithmetic, control flow, strings, arrays and script classes, the
+// functions call the registered global functions that compile with plain
+// arguments, so the operands look like the game's. Modules only import from
+// modules generated before them, which keeps the dependencies a DAG; the same
+// shape, seed and config give the same files.
+//
+// The engine's message callback and script scanner are replaced. names gets
+// the file names, dependencies first. Returns false, with the reason in
+// error, if a module doesn't compile or can't be written.
+bool GenerateCorpus(asIScriptEngine *engine, const CorpusShape &shape, const std::string &outputDir,
+                    std::vector<std::string> &names, std::string &error);
@@ -0,0 +1,85 @@
+#include "hash.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstring>
+
+namespace
+{
+
+const uint64_t cMultiplier = 0xc6a4a7935bd1e995ull;
+const int cShift = 47;
+
+}
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed)
+{
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	uint64_t hash = seed ^ (size * cMultiplier);
+
+	const unsigned char *end = bytes + (size & ~size_t(7));
+	for (; bytes != end; bytes += 8)
+	{
+		uint64_t k;
+		memcpy(&k, bytes, sizeof(k));
+
+		k *= cMultiplier;
+		k ^= k >> cShift;
+		k *= cMultiplier;
+
+		hash ^= k;
+		hash *= cMultiplier;
+	}
+
+	switch (size & 7)
+	{
+	case 7: hash ^= uint64_t(bytes[6]) << 48; // fall through
+	case 6: hash ^= uint64_t(bytes[5]) << 40; // fall through
+	case 5: hash ^= uint64_t(bytes[4]) << 32; // fall through
+	case 4: hash ^= uint64_t(bytes[3]) << 24; // fall through
+	case 3: hash ^= uint64_t(bytes[2]) << 16; // fall through
+	case 2: hash ^= uint64_t(bytes[1]) << 8; // fall through
+	case 1: hash ^= uint64_t(bytes[0]);
+		hash *= cMultiplier;
+	}
+
+	hash ^= hash >> cShift;
+	hash *= cMultiplier;
+	hash ^= hash >> cShift;
+	return hash;
+}
+
+uint64_t CombineHash(uint64_t hash, uint64_t value)
+{
+	return HashBytes(&value, sizeof(value), hash);
+}
+
+bool HashFile(const std::string &path, uint64_t &hash)
+{
+	boost::system::error_code error;
+	uintmax_t size = boost::filesystem::file_size(path, error);
+	if (error)
+	{
+		return false;
+	}
+
+	// Empty files can't be mapped
+	if (size == 0)
+	{
+		hash = HashBytes(nullptr, 0);
+		return true;
+	}
+
+	boost::iostreams::mapped_file_source file;
+	try
+	{
+		file.open(path);
+	}
+	catch (const std::exception &)
+	{
+		return false;
+	}
+	hash = HashBytes(file.data(), file.size());
+	return true;
+}
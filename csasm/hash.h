@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// MurmurHash64A; eight bytes per step, for change detection rather than
+// anything adversarial
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+// Mixes another value into a running hash; the order matters
+uint64_t CombineHash(uint64_t hash, uint64_t value);
+
+// Hashes a whole file through a read-only mapping
+bool HashFile(const std::string &path, uint64_t &hash);
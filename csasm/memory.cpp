@@ -0,0 +1,56 @@
+#include "memory.h"
+
+#include <angelscript.h>
+
+#include <cstdlib>
+
+namespace
+{
+
+// Keeps the size in front of each block, padded to keep the alignment malloc
+// guarantees
+const size_t cSizePrefix = 16;
+
+thread_local int64_t tScriptMemory = 0;
+thread_local uint64_t tScriptAllocations = 0;
+
+void *CountingAlloc(size_t size)
+{
+	uint8_t *block = static_cast<uint8_t *>(malloc(size + cSizePrefix));
+	if (!block)
+	{
+		return nullptr;
+	}
+	*reinterpret_cast<size_t *>(block) = size;
+	tScriptMemory += size;
+	++tScriptAllocations;
+	return block + cSizePrefix;
+}
+
+void CountingFree(void *ptr)
+{
+	if (!ptr)
+	{
+		return;
+	}
+	uint8_t *block = static_cast<uint8_t *>(ptr) - cSizePrefix;
+	tScriptMemory -= *reinterpret_cast<size_t *>(block);
+	free(block);
+}
+
+}
+
+void InstallScriptMemoryAccounting()
+{
+	asSetGlobalMemoryFunctions(CountingAlloc, CountingFree);
+}
+
+int64_t GetThreadScriptMemory()
+{
+	return tScriptMemory;
+}
+
+uint64_t GetThreadScriptAllocations()
+{
+	return tScriptAllocations;
+}
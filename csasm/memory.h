@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+// Routes AngelScript's allocations through counters, so the script memory
+// held on a thread can be measured. Has to be installed before the engine
+// allocates anything, i.e. before any engine is created.
+void InstallScriptMemoryAccounting();
+
+// Net bytes AngelScript has allocated on the calling thread so far; memory
+// freed on another thread than it was allocated on moves between the counts
+int64_t GetThreadScriptMemory();
+
+// Allocations AngelScript has made on the calling thread so far
+uint64_t GetThreadScriptAllocations();
@@ -1,7 +1,4 @@
 #pragma once
 
-#include <string>
-
 void setupConsoleCodePage();
 void resetConsoleCodePage();
-std::string sjis2utf8(const std::string &in);
\ No newline at end of file
@@ -0,0 +1,710 @@
+#include "prereg.h"
+
+#include "hash.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+
+const char cSnapshotMagic[4] = { 'C', 'S', 'P', 'S' };
+const uint32_t cSnapshotVersion = 1;
+
+// Config keys in registration order
+const char *const cPreregKeys[PREREG_KIND_COUNT] =
+{
+	"namespaces",
+	"object_types",
+	"object_properties",
+	"object_behaviours",
+	"object_methods",
+	"global_functions",
+	"global_properties",
+};
+
+// Maps a file for reading; empty files can't be mapped
+bool MapFile(const std::string &path, boost::iostreams::mapped_file_source &file)
+{
+	boost::system::error_code error;
+	if (boost::filesystem::file_size(path, error) == 0 || error)
+	{
+		return false;
+	}
+
+	try
+	{
+		file.open(path);
+	}
+	catch (const std::exception &)
+	{
+		return false;
+	}
+	return file.is_open();
+}
+
+class SnapshotReader
+{
+public:
+	SnapshotReader(const char *data, size_t size)
+		: mData(data), mSize(size)
+	{
+
+	}
+
+	template<typename T>
+	bool read(T &value)
+	{
+		if (sizeof(T) > mSize - mHead)
+		{
+			return false;
+		}
+		memcpy(&value, mData + mHead, sizeof(T));
+		mHead += sizeof(T);
+		return true;
+	}
+
+	bool read(std::string &str)
+	{
+		uint32_t length;
+		if (!read(length) || length > mSize - mHead)
+		{
+			return false;
+		}
+		str.assign(mData + mHead, length);
+		mHead += length;
+		return true;
+	}
+
+	bool atEnd() const
+	{
+		return mHead == mSize;
+	}
+
+private:
+	const char *mData;
+	size_t mSize;
+	size_t mHead = 0;
+};
+
+// Numeric fields and where they go, per kind
+struct NumericField
+{
+	PreregKind kind;
+	const char *key;
+	bool isFlags;
+};
+
+const NumericField cNumericFields[] =
+{
+	{ PREREG_OBJECT_TYPE, "size", false },
+	{ PREREG_OBJECT_TYPE, "flags", true },
+	{ PREREG_OBJECT_PROPERTY, "offset", false },
+	{ PREREG_OBJECT_BEHAVIOUR, "behaviour", false },
+	{ PREREG_OBJECT_BEHAVIOUR, "calling_convention", true },
+	{ PREREG_OBJECT_METHOD, "global", false },
+};
+
+// Streams the config straight into records without building a tree. Records
+// are passed on as soon as every earlier kind is complete; only records that
+// show up ahead of their phase are held back.
+class ConfigReader
+{
+public:
+	ConfigReader(const char *data, size_t size, const PreregCallback &callback)
+		: mHead(data), mEnd(data + size), mCallback(callback)
+	{
+
+	}
+
+	bool read()
+	{
+		if (!consume('{'))
+		{
+			return false;
+		}
+
+		bool seen[PREREG_KIND_COUNT] = {};
+		std::string key;
+		if (!consume('}'))
+		{
+			do
+			{
+				if (!readString(key) || !consume(':'))
+				{
+					return false;
+				}
+
+				int kind = findKind(key);
+				if (kind < 0)
+				{
+					if (!skipValue())
+					{
+						return false;
+					}
+					continue;
+				}
+
+				// A repeated key would break the registration order
+				if (seen[kind] || !readRegistrations(static_cast<PreregKind>(kind)))
+				{
+					return false;
+				}
+				seen[kind] = true;
+				finishKind(kind);
+			} while (consume(','));
+
+			if (!consume('}'))
+			{
+				return false;
+			}
+		}
+
+		skipWhitespace();
+		if (mHead != mEnd)
+		{
+			return false;
+		}
+
+		// Kinds missing from the config hold nothing back
+		for (int kind = 0; kind < PREREG_KIND_COUNT; ++kind)
+		{
+			finishKind(kind);
+		}
+		return true;
+	}
+
+private:
+	static int findKind(const std::string &key)
+	{
+		for (int kind = 0; kind < PREREG_KIND_COUNT; ++kind)
+		{
+			if (key == cPreregKeys[kind])
+			{
+				return kind;
+			}
+		}
+		return -1;
+	}
+
+	bool readRegistrations(PreregKind kind)
+	{
+		if (!consume('['))
+		{
+			return false;
+		}
+		if (consume(']'))
+		{
+			return true;
+		}
+
+		// Reused for every entry to keep the string storage
+		PreregRecord record;
+		record.kind = kind;
+		do
+		{
+			if (!readRecord(record))
+			{
+				return false;
+			}
+			issue(record);
+		} while (consume(','));
+		return consume(']');
+	}
+
+	bool readRecord(PreregRecord &record)
+	{
+		record.nameSpace.clear();
+		record.objectName.clear();
+		record.declaration.clear();
+		record.value = 0;
+		record.flags = 0;
+
+		if (!consume('{'))
+		{
+			return false;
+		}
+		if (consume('}'))
+		{
+			return true;
+		}
+
+		do
+		{
+			if (!readString(mKey) || !consume(':'))
+			{
+				return false;
+			}
+
+			bool ok;
+			if (mKey == "namespace")
+			{
+				ok = readString(record.nameSpace);
+			}
+			else if (mKey == "object_name")
+			{
+				ok = readString(record.objectName);
+			}
+			else if (mKey == "declaration")
+			{
+				ok = readString(record.declaration);
+			}
+			else
+			{
+				const NumericField *field = nullptr;
+				for (const NumericField &candidate : cNumericFields)
+				{
+					if (candidate.kind == record.kind && mKey == candidate.key)
+					{
+						field = &candidate;
+						break;
+					}
+				}
+
+				int64_t number;
+				if (!field)
+				{
+					ok = skipValue();
+				}
+				else if ((ok = readNumber(number)))
+				{
+					if (field->isFlags)
+					{
+						record.flags = static_cast<asDWORD>(number);
+					}
+					else
+					{
+						record.value = static_cast<int>(number);
+					}
+				}
+			}
+
+			if (!ok)
+			{
+				return false;
+			}
+		} while (consume(','));
+		return consume('}');
+	}
+
+	void issue(const PreregRecord &record)
+	{
+		if (record.kind <= mReadyKind)
+		{
+			mCallback(record);
+		}
+		else
+		{
+			mPending[record.kind].push_back(record);
+		}
+	}
+
+	// Releases whatever was waiting on this kind
+	void finishKind(int kind)
+	{
+		mComplete[kind] = true;
+		while (mReadyKind < PREREG_KIND_COUNT - 1 && mComplete[mReadyKind])
+		{
+			++mReadyKind;
+		}
+
+		for (int i = 0; i <= mReadyKind; ++i)
+		{
+			for (const PreregRecord &record : mPending[i])
+			{
+				mCallback(record);
+			}
+			mPending[i].clear();
+			mPending[i].shrink_to_fit();
+		}
+	}
+
+	void skipWhitespace()
+	{
+		while (mHead != mEnd && (*mHead == ' ' || *mHead == '\t' || *mHead == '\n' || *mHead == '\r'))
+		{
+			++mHead;
+		}
+	}
+
+	bool consume(char c)
+	{
+		skipWhitespace();
+		if (mHead != mEnd && *mHead == c)
+		{
+			++mHead;
+			return true;
+		}
+		return false;
+	}
+
+	bool consumeLiteral(const char *literal)
+	{
+		size_t length = strlen(literal);
+		if (static_cast<size_t>(mEnd - mHead) < length || memcmp(mHead, literal, length) != 0)
+		{
+			return false;
+		}
+		mHead += length;
+		return true;
+	}
+
+	bool readHex4(uint32_t &value)
+	{
+		if (mEnd - mHead < 4)
+		{
+			return false;
+		}
+
+		value = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			char c = *mHead++;
+			value <<= 4;
+			if (c >= '0' && c <= '9')
+			{
+				value |= c - '0';
+			}
+			else if (c >= 'a' && c <= 'f')
+			{
+				value |= c - 'a' + 10;
+			}
+			else if (c >= 'A' && c <= 'F')
+			{
+				value |= c - 'A' + 10;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static void appendUtf8(std::string &str, uint32_t codePoint)
+	{
+		if (codePoint < 0x80)
+		{
+			str += static_cast<char>(codePoint);
+		}
+		else if (codePoint < 0x800)
+		{
+			str += static_cast<char>(0xc0 | (codePoint >> 6));
+			str += static_cast<char>(0x80 | (codePoint & 0x3f));
+		}
+		else if (codePoint < 0x10000)
+		{
+			str += static_cast<char>(0xe0 | (codePoint >> 12));
+			str += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+			str += static_cast<char>(0x80 | (codePoint & 0x3f));
+		}
+		else
+		{
+			str += static_cast<char>(0xf0 | (codePoint >> 18));
+			str += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+			str += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+			str += static_cast<char>(0x80 | (codePoint & 0x3f));
+		}
+	}
+
+	bool readString(std::string &str)
+	{
+		if (!consume('"'))
+		{
+			return false;
+		}
+
+		str.clear();
+		while (mHead != mEnd)
+		{
+			// Copy unescaped runs in one go
+			const char *run = mHead;
+			while (mHead != mEnd && *mHead != '"' && *mHead != '\\')
+			{
+				++mHead;
+			}
+			str.append(run, mHead);
+			if (mHead == mEnd)
+			{
+				break;
+			}
+			if (*mHead++ == '"')
+			{
+				return true;
+			}
+
+			if (mHead == mEnd)
+			{
+				break;
+			}
+			char escape = *mHead++;
+			switch (escape)
+			{
+			case '"': str += '"'; break;
+			case '\\': str += '\\'; break;
+			case '/': str += '/'; break;
+			case 'b': str += '\b'; break;
+			case 'f': str += '\f'; break;
+			case 'n': str += '\n'; break;
+			case 'r': str += '\r'; break;
+			case 't': str += '\t'; break;
+			case 'u':
+			{
+				uint32_t codePoint;
+				if (!readHex4(codePoint))
+				{
+					return false;
+				}
+				if (codePoint >= 0xd800 && codePoint < 0xdc00)
+				{
+					uint32_t low;
+					if (!consumeLiteral("\\u") || !readHex4(low) || low < 0xdc00 || low >= 0xe000)
+					{
+						return false;
+					}
+					codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+				}
+				appendUtf8(str, codePoint);
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		return false;
+	}
+
+	// Integers, plus booleans as 0 and 1; fractions are truncated
+	bool readNumber(int64_t &value)
+	{
+		skipWhitespace();
+		if (consumeLiteral("true"))
+		{
+			value = 1;
+			return true;
+		}
+		if (consumeLiteral("false"))
+		{
+			value = 0;
+			return true;
+		}
+
+		const char *start = mHead;
+		bool negative = mHead != mEnd && *mHead == '-';
+		if (negative)
+		{
+			++mHead;
+		}
+
+		uint64_t magnitude = 0;
+		const char *digits = mHead;
+		while (mHead != mEnd && *mHead >= '0' && *mHead <= '9')
+		{
+			magnitude = magnitude * 10 + (*mHead++ - '0');
+		}
+		if (mHead == digits)
+		{
+			return false;
+		}
+
+		if (mHead != mEnd && (*mHead == '.' || *mHead == 'e' || *mHead == 'E'))
+		{
+			while (mHead != mEnd && strchr("0123456789.eE+-", *mHead))
+			{
+				++mHead;
+			}
+			value = static_cast<int64_t>(strtod(std::string(start, mHead).c_str(), nullptr));
+			return true;
+		}
+
+		value = negative ? -static_cast<int64_t>(magnitude) : static_cast<int64_t>(magnitude);
+		return true;
+	}
+
+	bool skipValue()
+	{
+		skipWhitespace();
+		if (mHead == mEnd)
+		{
+			return false;
+		}
+
+		switch (*mHead)
+		{
+		case '"':
+			return readString(mKey);
+		case '{':
+			++mHead;
+			if (consume('}'))
+			{
+				return true;
+			}
+			do
+			{
+				if (!readString(mKey) || !consume(':') || !skipValue())
+				{
+					return false;
+				}
+			} while (consume(','));
+			return consume('}');
+		case '[':
+			++mHead;
+			if (consume(']'))
+			{
+				return true;
+			}
+			do
+			{
+				if (!skipValue())
+				{
+					return false;
+				}
+			} while (consume(','));
+			return consume(']');
+		case 'n':
+			return consumeLiteral("null");
+		default:
+			int64_t number;
+			return readNumber(number);
+		}
+	}
+
+	const char *mHead;
+	const char *mEnd;
+	const PreregCallback &mCallback;
+
+	// Scratch for keys and skipped strings
+	std::string mKey;
+
+	bool mComplete[PREREG_KIND_COUNT] = {};
+	int mReadyKind = 0;
+	std::vector<PreregRecord> mPending[PREREG_KIND_COUNT];
+};
+
+template<typename T>
+void AppendValue(std::string &out, T value)
+{
+	out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void AppendString(std::string &out, const std::string &str)
+{
+	AppendValue(out, static_cast<uint32_t>(str.size()));
+	out.append(str);
+}
+
+}
+
+uint64_t HashConfigFile(const std::string &path)
+{
+	uint64_t hash;
+	return HashFile(path, hash) ? hash : 0;
+}
+
+bool ReadPreregConfig(const std::string &path, const PreregCallback &callback)
+{
+	boost::iostreams::mapped_file_source file;
+	if (!MapFile(path, file))
+	{
+		return false;
+	}
+
+	ConfigReader reader(file.data(), file.size(), callback);
+	return reader.read();
+}
+
+bool ReadPreregConfig(const std::string &path, std::vector<PreregRecord> &records)
+{
+	records.clear();
+	return ReadPreregConfig(path, [&records](const PreregRecord &record)
+	{
+		records.push_back(record);
+	});
+}
+
+bool LoadPreregSnapshot(const std::string &path, uint64_t configHash, std::vector<PreregRecord> &records)
+{
+	boost::iostreams::mapped_file_source file;
+	if (!MapFile(path, file))
+	{
+		return false;
+	}
+
+	SnapshotReader reader(file.data(), file.size());
+	char magic[4];
+	uint32_t version;
+	uint64_t hash;
+	uint32_t count;
+	if (!reader.read(magic) || memcmp(magic, cSnapshotMagic, sizeof(magic)) != 0 ||
+	    !reader.read(version) || version != cSnapshotVersion ||
+	    !reader.read(hash) || hash != configHash ||
+	    !reader.read(count))
+	{
+		return false;
+	}
+
+	records.clear();
+	records.reserve(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		PreregRecord record;
+		uint8_t kind;
+		if (!reader.read(kind) || kind >= PREREG_KIND_COUNT ||
+		    !reader.read(record.value) ||
+		    !reader.read(record.flags) ||
+		    !reader.read(record.nameSpace) ||
+		    !reader.read(record.objectName) ||
+		    !reader.read(record.declaration))
+		{
+			return false;
+		}
+		record.kind = static_cast<PreregKind>(kind);
+		records.push_back(std::move(record));
+	}
+	return reader.atEnd();
+}
+
+bool SavePreregSnapshot(const std::string &path, uint64_t configHash, const std::vector<PreregRecord> &records)
+{
+	// Host byte order; a snapshot is only a cache for the machine that made it
+	std::string out;
+	out.append(cSnapshotMagic, sizeof(cSnapshotMagic));
+	AppendValue(out, cSnapshotVersion);
+	AppendValue(out, configHash);
+	AppendValue(out, static_cast<uint32_t>(records.size()));
+	for (const PreregRecord &record : records)
+	{
+		AppendValue(out, static_cast<uint8_t>(record.kind));
+		AppendValue(out, record.value);
+		AppendValue(out, record.flags);
+		AppendString(out, record.nameSpace);
+		AppendString(out, record.objectName);
+		AppendString(out, record.declaration);
+	}
+
+	// Write next to the target and rename, so a concurrent run never maps a
+	// half written snapshot; the name is random, as cache entries' are, so
+	// runs rebuilding the same snapshot don't truncate each other's file
+	std::string tempPath = path + boost::filesystem::unique_path(".%%%%%%%%.tmp").string();
+	bool written;
+	{
+		std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+		written = static_cast<bool>(stream.write(out.data(), out.size()));
+	}
+
+	boost::system::error_code error;
+	if (written)
+	{
+		boost::filesystem::rename(tempPath, path, error);
+	}
+	if (!written || error)
+	{
+		boost::filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// One registration from the prereg config. The kinds are in the order
+// ConfigureEngine has to issue them in.
+enum PreregKind : uint8_t
+{
+	PREREG_NAMESPACE,
+	PREREG_OBJECT_TYPE,
+	PREREG_OBJECT_PROPERTY,
+	PREREG_OBJECT_BEHAVIOUR,
+	PREREG_OBJECT_METHOD,
+	PREREG_GLOBAL_FUNCTION,
+	PREREG_GLOBAL_PROPERTY,
+	PREREG_KIND_COUNT
+};
+
+struct PreregRecord
+{
+	PreregKind kind;
+	std::string nameSpace;
+	std::string objectName;
+	std::string declaration;
+
+	// Size, property offset, behaviour or the method's global flag
+	int value = 0;
+
+	// Object type flags or behaviour calling convention
+	asDWORD flags = 0;
+};
+
+// Hash of the whole file; 0 if it can't be read
+uint64_t HashConfigFile(const std::string &path);
+
+// Receives registrations in registration order
+typedef std::function<void(const PreregRecord &)> PreregCallback;
+
+// Feeds a whole config to a callback, e.g. straight from the JSON or from
+// records read earlier
+typedef std::function<bool(const PreregCallback &)> PreregSource;
+
+// Streams the prereg config JSON without keeping a tree. Records are passed on
+// while parsing; only ones that appear ahead of their phase are held back.
+bool ReadPreregConfig(const std::string &path, const PreregCallback &callback);
+
+// Reads the prereg config JSON into records, sorted into registration order
+bool ReadPreregConfig(const std::string &path, std::vector<PreregRecord> &records);
+
+// Snapshots hold the records of one config in a flat binary form, so later
+// runs skip reading the JSON. They are tied to the config by its hash.
+bool LoadPreregSnapshot(const std::string &path, uint64_t configHash, std::vector<PreregRecord> &records);
+bool SavePreregSnapshot(const std::string &path, uint64_t configHash, const std::vector<PreregRecord> &records);
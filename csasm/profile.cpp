@@ -0,0 +1,236 @@
+#include "profile.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock ProfileClock;
+
+const char *const cStageNames[STAGE_COUNT] =
+{
+	"config",
+	"engine",
+	"read",
+	"load",
+	"xref",
+	"dump",
+	"cache",
+};
+
+struct ModuleProfile
+{
+	std::string name;
+	StageCounters stages[STAGE_COUNT];
+
+	uint64_t getNanoseconds() const
+	{
+		uint64_t nanoseconds = 0;
+		for (const StageCounters &stage : stages)
+		{
+			nanoseconds += stage.nanoseconds;
+		}
+		return nanoseconds;
+	}
+};
+
+struct ProfileState
+{
+	std::mutex mutex;
+	ProfileClock::time_point start;
+	StageCounters totals[STAGE_COUNT];
+	std::vector<ModuleProfile> modules;
+};
+
+ProfileState sState;
+
+// The module being worked on by this thread, if any
+thread_local std::unique_ptr<ModuleProfile> tModule;
+
+// What the scopes nested in the innermost open one have taken so far
+thread_local StageCounters tNested;
+
+double ToMilliseconds(uint64_t nanoseconds)
+{
+	return nanoseconds / 1000000.0;
+}
+
+// Slowest first, ties by name
+std::vector<const ModuleProfile *> GetSlowestModules(size_t count)
+{
+	std::vector<const ModuleProfile *> modules;
+	for (const ModuleProfile &module : sState.modules)
+	{
+		modules.push_back(&module);
+	}
+	auto slower = [](const ModuleProfile *a, const ModuleProfile *b)
+	{
+		uint64_t aTime = a->getNanoseconds();
+		uint64_t bTime = b->getNanoseconds();
+		return aTime != bTime ? aTime > bTime : a->name < b->name;
+	};
+	count = std::min(count, modules.size());
+	std::partial_sort(modules.begin(), modules.begin() + count, modules.end(), slower);
+	modules.resize(count);
+	return modules;
+}
+
+}
+
+bool Profiler::sEnabled = false;
+
+void Profiler::enable()
+{
+	sEnabled = true;
+	sState.start = ProfileClock::now();
+}
+
+void Profiler::beginModule(const std::string &name)
+{
+	if (!sEnabled)
+	{
+		return;
+	}
+	tModule.reset(new ModuleProfile);
+	tModule->name = name;
+}
+
+void Profiler::endModule()
+{
+	if (!sEnabled || !tModule)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(sState.mutex);
+	for (int stage = 0; stage < STAGE_COUNT; ++stage)
+	{
+		sState.totals[stage].add(tModule->stages[stage]);
+	}
+	sState.modules.push_back(std::move(*tModule));
+	tModule.reset();
+}
+
+void Profiler::addStage(ProfileStage stage, const StageCounters &counters)
+{
+	if (tModule)
+	{
+		tModule->stages[stage].add(counters);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(sState.mutex);
+	sState.totals[stage].add(counters);
+}
+
+void Profiler::writeReport(OutputSink &sink, size_t slowestCount)
+{
+	std::lock_guard<std::mutex> lock(sState.mutex);
+	uint64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(ProfileClock::now() - sState.start).count();
+	uint64_t total = 0;
+	for (const StageCounters &stage : sState.totals)
+	{
+		total += stage.nanoseconds;
+	}
+
+	// Stages of different threads overlap, so the total can exceed the wall
+	// time
+	sink.format("profile: %.3f ms wall, %.3f ms in stages, %u modules\n",
+	            ToMilliseconds(wall), ToMilliseconds(total), static_cast<unsigned int>(sState.modules.size()));
+	sink.format("\t%-8s %10s %12s %7s %12s %12s\n", "stage", "calls", "ms", "share", "allocations", "script KiB");
+	for (int stage = 0; stage < STAGE_COUNT; ++stage)
+	{
+		const StageCounters &counters = sState.totals[stage];
+		sink.format("\t%-8s %10llu %12.3f %6.2f%% %12llu %12.1f\n",
+		            cStageNames[stage],
+		            static_cast<unsigned long long>(counters.calls),
+		            ToMilliseconds(counters.nanoseconds),
+		            total ? 100.0 * counters.nanoseconds / total : 0.0,
+		            static_cast<unsigned long long>(counters.allocations),
+		            counters.bytes / 1024.0);
+	}
+
+	std::vector<const ModuleProfile *> slowest = GetSlowestModules(slowestCount);
+	sink.format("slowest_modules: top %u\n", static_cast<unsigned int>(slowest.size()));
+	for (const ModuleProfile *module : slowest)
+	{
+		sink.format("\t%12.3f ms  read %.3f, load %.3f, dump %.3f  %s\n",
+		            ToMilliseconds(module->getNanoseconds()),
+		            ToMilliseconds(module->stages[STAGE_READ].nanoseconds),
+		            ToMilliseconds(module->stages[STAGE_LOAD].nanoseconds),
+		            ToMilliseconds(module->stages[STAGE_DUMP].nanoseconds),
+		            module->name.c_str());
+	}
+	sink.flush();
+}
+
+void Profiler::writeRecords(RecordWriter &writer, size_t slowestCount)
+{
+	std::lock_guard<std::mutex> lock(sState.mutex);
+	uint64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(ProfileClock::now() - sState.start).count();
+
+	writer.beginRecord(RECORD_PROFILE);
+	writer.writeUnsigned(FIELD_NANOSECONDS, wall);
+	writer.writeUnsigned(FIELD_MODULES, sState.modules.size());
+	writer.endRecord();
+
+	for (int stage = 0; stage < STAGE_COUNT; ++stage)
+	{
+		const StageCounters &counters = sState.totals[stage];
+		writer.beginRecord(RECORD_STAGE_PROFILE);
+		writer.writeString(FIELD_NAME, cStageNames[stage]);
+		writer.writeUnsigned(FIELD_CALLS, counters.calls);
+		writer.writeUnsigned(FIELD_NANOSECONDS, counters.nanoseconds);
+		writer.writeUnsigned(FIELD_ALLOCATIONS, counters.allocations);
+		writer.writeSigned(FIELD_BYTES, counters.bytes);
+		writer.endRecord();
+	}
+
+	// Stage times in the order of the stage records
+	for (const ModuleProfile *module : GetSlowestModules(slowestCount))
+	{
+		writer.beginRecord(RECORD_MODULE_PROFILE);
+		writer.writeString(FIELD_MODULE, module->name.data(), module->name.size());
+		writer.writeUnsigned(FIELD_NANOSECONDS, module->getNanoseconds());
+		writer.beginArray(FIELD_STAGES);
+		for (const StageCounters &stage : module->stages)
+		{
+			writer.appendSigned(static_cast<int64_t>(stage.nanoseconds));
+		}
+		writer.endArray();
+		writer.endRecord();
+	}
+}
+
+void ProfileScope::start(ProfileStage stage)
+{
+	mActive = true;
+	mStage = stage;
+	mOuterNested = tNested;
+	tNested = StageCounters();
+	mAllocations = GetThreadScriptAllocations();
+	mMemory = GetThreadScriptMemory();
+	mStart = ProfileClock::now();
+}
+
+void ProfileScope::stop()
+{
+	StageCounters inclusive;
+	inclusive.calls = 1;
+	inclusive.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(ProfileClock::now() - mStart).count();
+	inclusive.allocations = GetThreadScriptAllocations() - mAllocations;
+	inclusive.bytes = GetThreadScriptMemory() - mMemory;
+
+	StageCounters exclusive = inclusive;
+	exclusive.nanoseconds -= std::min(exclusive.nanoseconds, tNested.nanoseconds);
+	exclusive.allocations -= std::min(exclusive.allocations, tNested.allocations);
+	exclusive.bytes -= tNested.bytes;
+	Profiler::addStage(mStage, exclusive);
+
+	// The enclosing scope leaves out all of this one
+	tNested = mOuterNested;
+	inclusive.calls = 0;
+	tNested.add(inclusive);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "records.h"
+#include "sink.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+enum ProfileStage
+{
+	STAGE_CONFIG,  // reading the config or its snapshot
+	STAGE_ENGINE,  // ConfigureEngine, less the config reading in it
+	STAGE_READ,    // mapping module files and reading their headers
+	STAGE_LOAD,    // LoadByteCode, or the engine-free reader
+	STAGE_XREF,    // collecting references and constants for the indexes
+	STAGE_DUMP,    // DumpModule and writing the dump out
+	STAGE_CACHE,   // cache lookups, fetches and stores
+	STAGE_COUNT
+};
+
+struct StageCounters
+{
+	uint64_t calls = 0;
+	uint64_t nanoseconds = 0;
+
+	// Of AngelScript, so only counted with InstallScriptMemoryAccounting;
+	// bytes is the net change in script memory
+	uint64_t allocations = 0;
+	int64_t bytes = 0;
+
+	void add(const StageCounters &other)
+	{
+		calls += other.calls;
+		nanoseconds += other.nanoseconds;
+		allocations += other.allocations;
+		bytes += other.bytes;
+	}
+};
+
+// Times the stages of a run and counts what they allocate, per module and in
+// total. Off unless enabled before any work starts; when off, a stage costs
+// a check of a flag. Stages on a thread between beginModule and endModule
+// count towards that module, including the dependencies it pulls in; the
+// others only count towards the totals. Nested stages are counted
+// exclusively, e.g. reading the config doesn't count towards configuring
+// the engine it happens in.
+class Profiler
+{
+public:
+	static void enable();
+
+	static bool isEnabled()
+	{
+		return sEnabled;
+	}
+
+	static void beginModule(const std::string &name);
+	static void endModule();
+
+	static void addStage(ProfileStage stage, const StageCounters &counters);
+
+	// Per stage totals, then the slowest modules
+	static void writeReport(OutputSink &sink, size_t slowestCount);
+	static void writeRecords(RecordWriter &writer, size_t slowestCount);
+
+private:
+	static bool sEnabled;
+};
+
+// Counts its lifetime towards a stage
+class ProfileScope
+{
+public:
+	explicit ProfileScope(ProfileStage stage)
+	{
+		if (Profiler::isEnabled())
+		{
+			start(stage);
+		}
+	}
+
+	~ProfileScope()
+	{
+		if (mActive)
+		{
+			stop();
+		}
+	}
+
+	ProfileScope(const ProfileScope &) = delete;
+	ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+	void start(ProfileStage stage);
+	void stop();
+
+	bool mActive = false;
+	ProfileStage mStage = STAGE_COUNT;
+	std::chrono::steady_clock::time_point mStart;
+	uint64_t mAllocations = 0;
+	int64_t mMemory = 0;
+
+	// What the scopes nested in this one took, to leave it out
+	StageCounters mOuterNested;
+};
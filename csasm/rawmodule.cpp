@@ -0,0 +1,1319 @@
+#include "rawmodule.h"
+
+#include "asf.h"
+#include "decoder.h"
+#include "disasm.h"
+#include "shared.h"
+#include "sjis.h"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+// for the token names of primitive types
+#include <../source/as_scriptengine.h>
+#include <../source/as_tokenizer.h>
+
+namespace
+{
+
+const char *const cDelegateFactory = "$dlgte";
+
+std::string QualifyName(const std::string &nameSpace, const std::string &name)
+{
+	return nameSpace.empty() ? name : nameSpace + "::" + name;
+}
+
+const char *GetPrimitiveName(int tokenType)
+{
+	const char *name = tokenType == ttIdentifier ? nullptr : asCTokenizer::GetDefinition(tokenType);
+	return name ? name : "?";
+}
+
+// Mirrors asCReader, reading the same fields in the same order but keeping
+// names instead of resolving them against an engine
+class RawReader
+{
+public:
+	RawReader(const uint8_t *data, size_t size, RawModule &module, const DumpFilter *filter)
+		: mData(data), mSize(size), mModule(module), mFilter(filter)
+	{
+
+	}
+
+	bool read()
+	{
+		mModule.debugInfoStripped = readByte() != 0;
+
+		asUINT count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			mModule.enums.emplace_back();
+			readObjectTypeDeclaration(mModule.enums.back(), 1);
+			readObjectTypeDeclaration(mModule.enums.back(), 2);
+		}
+
+		// Classes are declared first, then the funcdefs, then the classes'
+		// members, interfaces before the rest
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			mModule.classes.emplace_back();
+			readObjectTypeDeclaration(mModule.classes.back(), 1);
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			size_t function = readFunction();
+			if (function == cNoRawFunction)
+			{
+				mError = true;
+				break;
+			}
+			mModule.funcDefs.push_back(function);
+		}
+
+		for (RawObjectType &type : mModule.classes)
+		{
+			if (type.isInterface())
+			{
+				readObjectTypeDeclaration(type, 2);
+			}
+		}
+		for (RawObjectType &type : mModule.classes)
+		{
+			if (!type.isInterface())
+			{
+				readObjectTypeDeclaration(type, 2);
+			}
+		}
+		for (RawObjectType &type : mModule.classes)
+		{
+			if (!type.isInterface())
+			{
+				readObjectTypeDeclaration(type, 3);
+			}
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			mModule.typedefs.emplace_back();
+			readObjectTypeDeclaration(mModule.typedefs.back(), 1);
+			readObjectTypeDeclaration(mModule.typedefs.back(), 2);
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			RawGlobal global;
+			readString(global.name);
+			readString(global.nameSpace);
+			global.type = readDataType();
+			global.initFunction = readFunction();
+			mModule.globals.push_back(std::move(global));
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			size_t function = readFunction();
+			if (function == cNoRawFunction)
+			{
+				mError = true;
+				break;
+			}
+			mModule.scriptFunctions.push_back(function);
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			size_t function = readFunction();
+			if (function == cNoRawFunction)
+			{
+				mError = true;
+				break;
+			}
+			mModule.globalFunctions.push_back(function);
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			RawImport import;
+			import.function = readFunction();
+			if (import.function == cNoRawFunction)
+			{
+				mError = true;
+				break;
+			}
+			readString(import.fromModule);
+			mModule.imports.push_back(std::move(import));
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			mModule.usedTypes.push_back(readObjectType());
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			mModule.usedTypeIds.push_back(readDataType());
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			RawUsedFunction used;
+			char c = static_cast<char>(readByte());
+			used.isModuleFunction = c == 'm';
+			if (c != 'n')
+			{
+				RawFunction signature;
+				readFunctionSignature(signature);
+				used.declaration = signature.getDeclaration();
+			}
+			mModule.usedFunctions.push_back(std::move(used));
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			RawUsedGlobal used;
+			readString(used.name);
+			readString(used.nameSpace);
+			used.type = readDataType();
+			used.isModuleProperty = readByte() != 0;
+			mModule.usedGlobals.push_back(std::move(used));
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			mModule.usedStrings.emplace_back();
+			readString(mModule.usedStrings.back());
+		}
+
+		count = readCount();
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			RawUsedObjectProperty used;
+			used.objectType = readObjectType();
+			readString(used.name);
+			mModule.usedObjectProperties.push_back(std::move(used));
+		}
+
+		return !mError;
+	}
+
+private:
+	uint8_t readByte()
+	{
+		if (mHead >= mSize)
+		{
+			mError = true;
+			return 0;
+		}
+		return mData[mHead++];
+	}
+
+	// Fixed size fields are stored big endian
+	asDWORD readDword()
+	{
+		asDWORD value = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			value = (value << 8) | readByte();
+		}
+		return value;
+	}
+
+	asQWORD readEncodedUInt64()
+	{
+		asQWORD value = 0;
+		uint8_t b = readByte();
+		bool isNegative = (b & 0x80) != 0;
+		b &= 0x7f;
+
+		// The run of leading ones says how many bytes follow
+		int extraBytes;
+		if ((b & 0x7f) == 0x7f)
+		{
+			extraBytes = 8;
+			value = 0;
+		}
+		else if ((b & 0x7e) == 0x7e)
+		{
+			extraBytes = 6;
+			value = b & 0x01;
+		}
+		else if ((b & 0x7c) == 0x7c)
+		{
+			extraBytes = 5;
+			value = b & 0x03;
+		}
+		else if ((b & 0x78) == 0x78)
+		{
+			extraBytes = 4;
+			value = b & 0x07;
+		}
+		else if ((b & 0x70) == 0x70)
+		{
+			extraBytes = 3;
+			value = b & 0x0f;
+		}
+		else if ((b & 0x60) == 0x60)
+		{
+			extraBytes = 2;
+			value = b & 0x1f;
+		}
+		else if ((b & 0x40) == 0x40)
+		{
+			extraBytes = 1;
+			value = b & 0x3f;
+		}
+		else
+		{
+			extraBytes = 0;
+			value = b;
+		}
+
+		for (int i = 0; i < extraBytes; ++i)
+		{
+			value = (value << 8) | readByte();
+		}
+		return isNegative ? static_cast<asQWORD>(-static_cast<int64_t>(value)) : value;
+	}
+
+	asUINT readEncodedUInt()
+	{
+		asQWORD value = readEncodedUInt64();
+		if ((value >> 32) != 0 && (value >> 32) != 0xffffffff)
+		{
+			mError = true;
+		}
+		return static_cast<asUINT>(value);
+	}
+
+	asWORD readEncodedUInt16()
+	{
+		asDWORD value = readEncodedUInt();
+		if ((value >> 16) != 0 && (value >> 16) != 0xffff)
+		{
+			mError = true;
+		}
+		return static_cast<asWORD>(value);
+	}
+
+	// A count of things still to be read; every one of them takes at least
+	// a byte, so anything larger than the rest of the stream is corrupt
+	asUINT readCount()
+	{
+		asUINT count = readEncodedUInt();
+		if (count > mSize - mHead)
+		{
+			mError = true;
+			return 0;
+		}
+		return count;
+	}
+
+	void readString(std::string &str)
+	{
+		// Odd lengths refer back to an earlier string
+		asUINT length = readEncodedUInt();
+		if (length & 1)
+		{
+			asUINT index = length / 2;
+			if (index < mSavedStrings.size())
+			{
+				str = mSavedStrings[index];
+			}
+			else
+			{
+				mError = true;
+				str.clear();
+			}
+		}
+		else if (length > 0)
+		{
+			length /= 2;
+			if (length > mSize - mHead)
+			{
+				mError = true;
+				str.clear();
+				return;
+			}
+			str.assign(reinterpret_cast<const char *>(mData + mHead), length);
+			mHead += length;
+			mSavedStrings.push_back(str);
+		}
+		else
+		{
+			str.clear();
+		}
+	}
+
+	std::string readObjectType()
+	{
+		char c = static_cast<char>(readByte());
+		switch (c)
+		{
+		case 'a':
+			{
+				// Template instance
+				std::string name;
+				std::string nameSpace;
+				readString(name);
+				readString(nameSpace);
+
+				std::string declaration = QualifyName(nameSpace, name) + "<";
+				asUINT subTypeCount = readCount();
+				for (asUINT i = 0; i < subTypeCount && !mError; ++i)
+				{
+					if (i)
+					{
+						declaration += ",";
+					}
+					if (readByte() == 's')
+					{
+						declaration += readDataType();
+					}
+					else
+					{
+						declaration += GetPrimitiveName(readEncodedUInt());
+					}
+				}
+				return declaration + ">";
+			}
+		case 'l':
+			return "$list<" + readObjectType() + ">";
+		case 's':
+			{
+				// Template subtype
+				std::string name;
+				readString(name);
+				return name;
+			}
+		case 'o':
+			{
+				std::string name;
+				std::string nameSpace;
+				readString(name);
+				readString(nameSpace);
+				return QualifyName(nameSpace, name);
+			}
+		default:
+			return "";
+		}
+	}
+
+	std::string readDataType()
+	{
+		// Non-zero refers back to an earlier type
+		asUINT index = readEncodedUInt();
+		if (index != 0)
+		{
+			if (index - 1 < mSavedDataTypes.size())
+			{
+				return mSavedDataTypes[index - 1];
+			}
+			mError = true;
+			return "";
+		}
+
+		int tokenType = static_cast<int>(readEncodedUInt());
+
+		// The slot is taken before any nested types are read
+		size_t slot = mSavedDataTypes.size();
+		mSavedDataTypes.emplace_back();
+
+		std::string name;
+		if (tokenType == ttIdentifier)
+		{
+			name = readObjectType();
+		}
+
+		// The flags are in the high nibble in this build, see ReadDataType
+		uint8_t bits = readByte();
+		bool isReadOnly = (bits & 0x10) != 0;
+		bool isReference = (bits & 0x20) != 0;
+		bool isHandleToConst = (bits & 0x40) != 0;
+		bool isObjectHandle = (bits & 0x80) != 0;
+
+		if (tokenType == ttIdentifier && name == "$func")
+		{
+			// Funcdefs are stored as their signature
+			RawFunction signature;
+			readFunctionSignature(signature);
+			name = QualifyName(signature.nameSpace, signature.name);
+		}
+		else if (tokenType != ttIdentifier)
+		{
+			name = GetPrimitiveName(tokenType);
+		}
+
+		std::string declaration;
+		if (isObjectHandle ? isHandleToConst : isReadOnly)
+		{
+			declaration = "const ";
+		}
+		declaration += name;
+		if (isObjectHandle)
+		{
+			declaration += "@";
+			if (isReadOnly)
+			{
+				declaration += " const";
+			}
+		}
+		if (isReference)
+		{
+			declaration += "&";
+		}
+
+		mSavedDataTypes[slot] = declaration;
+		return declaration;
+	}
+
+	void readFunctionSignature(RawFunction &function)
+	{
+		readString(function.name);
+		if (function.name == cDelegateFactory)
+		{
+			// The engine already knows everything else about it
+			function.funcType = asFUNC_SYSTEM;
+			return;
+		}
+
+		function.returnType = readDataType();
+
+		asUINT count = readEncodedUInt();
+		if (count > 256)
+		{
+			mError = true;
+			return;
+		}
+		for (asUINT i = 0; i < count && !mError; ++i)
+		{
+			function.parameterTypes.push_back(readDataType());
+		}
+
+		function.inOutFlags.assign(function.parameterTypes.size(), 0);
+		count = readEncodedUInt();
+		if (count > function.parameterTypes.size())
+		{
+			mError = true;
+			return;
+		}
+		for (asUINT i = 0; i < count; ++i)
+		{
+			function.inOutFlags[i] = readEncodedUInt();
+		}
+
+		asUINT funcType = readEncodedUInt();
+		if (funcType > asFUNC_DELEGATE)
+		{
+			mError = true;
+			return;
+		}
+		function.funcType = static_cast<asEFuncType>(funcType);
+
+		// Default args are stored from the last one to the first
+		count = readEncodedUInt();
+		if (count > function.parameterTypes.size())
+		{
+			mError = true;
+			return;
+		}
+		if (count)
+		{
+			function.defaultArgs.resize(function.parameterTypes.size());
+			for (asUINT i = 0; i < count; ++i)
+			{
+				readString(function.defaultArgs[function.defaultArgs.size() - 1 - i]);
+			}
+		}
+
+		function.objectType = readObjectType();
+		if (!function.objectType.empty())
+		{
+			function.isReadOnly = (readByte() & 1) != 0;
+		}
+		else
+		{
+			readString(function.nameSpace);
+		}
+	}
+
+	size_t readFunction()
+	{
+		if (mError)
+		{
+			return cNoRawFunction;
+		}
+
+		char c = static_cast<char>(readByte());
+		if (c == '\0')
+		{
+			return cNoRawFunction;
+		}
+		if (c == 'r')
+		{
+			asUINT index = readEncodedUInt();
+			if (index >= mModule.functions.size())
+			{
+				mError = true;
+				return cNoRawFunction;
+			}
+			return index;
+		}
+
+		RawFunction function;
+		readFunctionSignature(function);
+		if (mError)
+		{
+			return cNoRawFunction;
+		}
+
+		if (function.funcType == asFUNC_SCRIPT)
+		{
+			// Bytecode nobody is going to look at is only stepped over
+			readByteCode(function, !mFilter || (mFilter->withBytecode() && mFilter->matchesFunction(function)));
+			function.variableSpace = readEncodedUInt();
+
+			// Object variables: type, funcdef index and position
+			asUINT count = readCount();
+			for (asUINT i = 0; i < count && !mError; ++i)
+			{
+				readObjectType();
+				readEncodedUInt();
+				readEncodedUInt();
+			}
+			if (count > 0)
+			{
+				readEncodedUInt();
+			}
+
+			// Object variable info: position, offset and option
+			count = readCount();
+			for (asUINT i = 0; i < count && !mError; ++i)
+			{
+				readEncodedUInt();
+				readEncodedUInt();
+				readEncodedUInt();
+			}
+
+			std::string scratch;
+			if (!mModule.debugInfoStripped)
+			{
+				// Line numbers
+				count = readCount();
+				for (asUINT i = 0; i < count && !mError; ++i)
+				{
+					readEncodedUInt();
+				}
+
+				// Script sections, alternating positions and names
+				count = readCount();
+				for (asUINT i = 0; i < count && !mError; ++i)
+				{
+					if ((i & 1) == 0)
+					{
+						readEncodedUInt();
+					}
+					else
+					{
+						readString(scratch);
+					}
+				}
+
+				// Variables
+				count = readCount();
+				for (asUINT i = 0; i < count && !mError; ++i)
+				{
+					readEncodedUInt();
+					readEncodedUInt();
+					readString(scratch);
+					readDataType();
+				}
+			}
+
+			function.isShared = (readByte() & 1) != 0;
+
+			if (!mModule.debugInfoStripped)
+			{
+				readString(function.scriptSection);
+				function.declaredAt = static_cast<int>(readEncodedUInt());
+
+				asQWORD nameCount = readEncodedUInt64();
+				if (nameCount > function.parameterTypes.size())
+				{
+					mError = true;
+					return cNoRawFunction;
+				}
+				function.parameterNames.resize(static_cast<size_t>(nameCount));
+				for (std::string &name : function.parameterNames)
+				{
+					readString(name);
+				}
+			}
+		}
+		else if (function.funcType == asFUNC_VIRTUAL || function.funcType == asFUNC_INTERFACE)
+		{
+			// vftable index
+			readEncodedUInt();
+		}
+		else if (function.funcType == asFUNC_FUNCDEF)
+		{
+			function.isShared = readByte() != 0;
+		}
+
+		if (mError)
+		{
+			return cNoRawFunction;
+		}
+		mModule.functions.push_back(std::move(function));
+		return mModule.functions.size() - 1;
+	}
+
+	void readByteCode(RawFunction &function, bool keep)
+	{
+		asUINT instructionCount = readCount();
+		std::vector<asDWORD> &code = function.byteCode;
+		if (keep)
+		{
+			code.reserve(instructionCount * 2);
+		}
+
+		// Instructions that aren't kept are decoded into here
+		asDWORD skipped[4];
+
+		// Positions of every instruction, to turn jump offsets from
+		// instruction counts into dword offsets afterwards
+		std::vector<asUINT> positions;
+		if (keep)
+		{
+			positions.reserve(instructionCount + 1);
+		}
+
+		for (asUINT i = 0; i < instructionCount && !mError; ++i)
+		{
+			uint8_t op = readByte();
+			asEBCType type = asBCInfo[op].type;
+			asUINT length = asBCTypeSize[type];
+			if (length == 0)
+			{
+				mError = true;
+				return;
+			}
+
+			// Laid out like the engine's bytecode: the opcode in the low
+			// byte, words after it, then dwords and qwords
+			uint8_t *bc = reinterpret_cast<uint8_t *>(skipped);
+			if (keep)
+			{
+				asUINT position = static_cast<asUINT>(code.size());
+				positions.push_back(position);
+				code.resize(position + length, 0);
+				bc = reinterpret_cast<uint8_t *>(&code[position]);
+			}
+			bc[0] = op;
+			switch (type)
+			{
+			case asBCTYPE_NO_ARG:
+				break;
+			case asBCTYPE_W_ARG:
+			case asBCTYPE_wW_ARG:
+			case asBCTYPE_rW_ARG:
+				putWord(bc + 2, readEncodedUInt16());
+				break;
+			case asBCTYPE_rW_DW_ARG:
+			case asBCTYPE_wW_DW_ARG:
+			case asBCTYPE_W_DW_ARG:
+				putWord(bc + 2, readEncodedUInt16());
+				putDword(bc + 4, readEncodedUInt());
+				break;
+			case asBCTYPE_DW_ARG:
+				putDword(bc + 4, readEncodedUInt());
+				break;
+			case asBCTYPE_DW_DW_ARG:
+				putDword(bc + 4, readEncodedUInt());
+				putDword(bc + 8, readEncodedUInt());
+				break;
+			case asBCTYPE_wW_rW_rW_ARG:
+				putWord(bc + 2, readEncodedUInt16());
+				putWord(bc + 4, readEncodedUInt16());
+				putWord(bc + 6, readEncodedUInt16());
+				break;
+			case asBCTYPE_wW_rW_ARG:
+			case asBCTYPE_rW_rW_ARG:
+			case asBCTYPE_wW_W_ARG:
+				putWord(bc + 2, readEncodedUInt16());
+				putWord(bc + 4, readEncodedUInt16());
+				break;
+			case asBCTYPE_wW_rW_DW_ARG:
+			case asBCTYPE_rW_W_DW_ARG:
+				putWord(bc + 2, readEncodedUInt16());
+				putWord(bc + 4, readEncodedUInt16());
+				putDword(bc + 8, readEncodedUInt());
+				break;
+			case asBCTYPE_QW_ARG:
+				putQword(bc + 4, readEncodedUInt64());
+				break;
+			case asBCTYPE_QW_DW_ARG:
+				putQword(bc + 4, readEncodedUInt64());
+				putDword(bc + 12, readEncodedUInt());
+				break;
+			case asBCTYPE_rW_QW_ARG:
+			case asBCTYPE_wW_QW_ARG:
+				putWord(bc + 2, readEncodedUInt16());
+				putQword(bc + 4, readEncodedUInt64());
+				break;
+			case asBCTYPE_rW_DW_DW_ARG:
+				putWord(bc + 2, readEncodedUInt16());
+				putDword(bc + 4, readEncodedUInt());
+				putDword(bc + 8, readEncodedUInt());
+				break;
+			default:
+				// Only hand written bytecode could get here
+				mError = true;
+				return;
+			}
+		}
+		if (!keep)
+		{
+			return;
+		}
+		positions.push_back(static_cast<asUINT>(code.size()));
+
+		for (size_t i = 0; i + 1 < positions.size() && !mError; ++i)
+		{
+			switch (code[positions[i]] & 0xff)
+			{
+			case asBC_JMP:
+			case asBC_JZ:
+			case asBC_JNZ:
+			case asBC_JLowZ:
+			case asBC_JLowNZ:
+			case asBC_JS:
+			case asBC_JNS:
+			case asBC_JP:
+			case asBC_JNP:
+				{
+					// Stored relative to the next instruction, in instructions
+					int64_t target = static_cast<int64_t>(i) + 1 + static_cast<int>(code[positions[i] + 1]);
+					if (target < 0 || target >= static_cast<int64_t>(positions.size()))
+					{
+						mError = true;
+						return;
+					}
+					code[positions[i] + 1] = positions[static_cast<size_t>(target)] - positions[i + 1];
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	static void putWord(uint8_t *out, asWORD value)
+	{
+		memcpy(out, &value, sizeof(value));
+	}
+
+	static void putDword(uint8_t *out, asDWORD value)
+	{
+		memcpy(out, &value, sizeof(value));
+	}
+
+	static void putQword(uint8_t *out, asQWORD value)
+	{
+		memcpy(out, &value, sizeof(value));
+	}
+
+	void readObjectTypeDeclaration(RawObjectType &type, int phase)
+	{
+		if (phase == 1)
+		{
+			readString(type.name);
+			type.flags = readDword();
+			type.size = readEncodedUInt();
+			readString(type.nameSpace);
+		}
+		else if (phase == 2)
+		{
+			if (type.flags & asOBJ_ENUM)
+			{
+				asUINT count = readCount();
+				for (asUINT i = 0; i < count && !mError; ++i)
+				{
+					RawEnumValue value;
+					readString(value.name);
+					value.value = static_cast<int>(readDword());
+					type.enumValues.push_back(std::move(value));
+				}
+			}
+			else if (type.flags & asOBJ_TYPEDEF)
+			{
+				type.aliasOf = GetPrimitiveName(readEncodedUInt());
+			}
+			else
+			{
+				type.derivedFrom = readObjectType();
+
+				// Interfaces with their vftable offsets
+				asUINT count = readCount();
+				for (asUINT i = 0; i < count && !mError; ++i)
+				{
+					type.interfaces.push_back(readObjectType());
+					readEncodedUInt();
+				}
+
+				if (!type.isInterface())
+				{
+					type.destructor = readFunction();
+
+					// Each constructor is followed by its factory
+					count = readCount();
+					for (asUINT i = 0; i < count && !mError; ++i)
+					{
+						type.constructors.push_back(readFunction());
+						type.factories.push_back(readFunction());
+					}
+				}
+
+				count = readCount();
+				for (asUINT i = 0; i < count && !mError; ++i)
+				{
+					type.methods.push_back(readFunction());
+				}
+
+				count = readCount();
+				for (asUINT i = 0; i < count && !mError; ++i)
+				{
+					type.virtualFunctions.push_back(readFunction());
+				}
+			}
+		}
+		else if (phase == 3)
+		{
+			asUINT count = readCount();
+			for (asUINT i = 0; i < count && !mError; ++i)
+			{
+				RawProperty property;
+				readString(property.name);
+				property.type = readDataType();
+				property.flags = readEncodedUInt();
+				type.properties.push_back(std::move(property));
+			}
+		}
+	}
+
+	const uint8_t *mData;
+	size_t mSize;
+	size_t mHead = 0;
+	bool mError = false;
+
+	RawModule &mModule;
+	const DumpFilter *mFilter;
+
+	// Back references in the stream index these
+	std::vector<std::string> mSavedStrings;
+	std::vector<std::string> mSavedDataTypes;
+};
+
+const std::string *GetUsedFunction(const RawModule &module, size_t index)
+{
+	if (index < module.usedFunctions.size() && !module.usedFunctions[index].declaration.empty())
+	{
+		return &module.usedFunctions[index].declaration;
+	}
+	return nullptr;
+}
+
+template<typename T, typename Predicate>
+unsigned int CountSelected(const std::vector<T> &items, const Predicate &selected)
+{
+	return static_cast<unsigned int>(std::count_if(items.begin(), items.end(), selected));
+}
+
+void DumpRawBytecode(const RawModule &module, const RawFunction &function, OutputSink &sink, bool withBlocks)
+{
+	RawAnnotator annotator(module);
+	WriteBytecode(sink, function.byteCode.data(), static_cast<asUINT>(function.byteCode.size()), annotator, withBlocks);
+}
+
+}
+
+RawAnnotator::RawAnnotator(const RawModule &module, bool withIndices)
+	: mModule(module), mWithIndices(withIndices)
+{
+
+}
+
+void RawAnnotator::writeAnnotation(OutputSink &sink, const DecodedInstruction &instruction, const DecodedOperand &operand)
+{
+	size_t index = static_cast<size_t>(operand.value);
+	switch (operand.kind)
+	{
+	case OPERAND_STRING:
+		if (index < mModule.usedStrings.size())
+		{
+			const std::string &str = mModule.usedStrings[index];
+			sink.writeUnsigned(str.size());
+			sink.write(":\"", 2);
+			size_t utf8Length;
+			const char *utf8 = SjisToUtf8Scratch(str.data(), str.size(), &utf8Length);
+			sink.write(utf8, utf8Length);
+			sink.put('"');
+		}
+		else
+		{
+			sink.put('?');
+		}
+		break;
+	case OPERAND_TYPE:
+		sink.write("type:", 5);
+		sink.write(index < mModule.usedTypes.size() ? mModule.usedTypes[index].c_str() : "{null}");
+		break;
+	case OPERAND_TYPE_ID:
+		sink.write("decl:", 5);
+		sink.write(index < mModule.usedTypeIds.size() ? mModule.usedTypeIds[index].c_str() : "?");
+		break;
+	case OPERAND_FUNCTION:
+		if (instruction.op == asBC_CALLBND)
+		{
+			// Imports are numbered by their bind slot
+			const RawFunction *function = index < mModule.imports.size() ? &mModule.functions[mModule.imports[index].function] : nullptr;
+			sink.write(function ? function->getDeclaration().c_str() : "{no func}");
+		}
+		else
+		{
+			writeUsedFunction(sink, index);
+		}
+		break;
+	case OPERAND_FUNCTION_POINTER:
+		sink.write("func:", 5);
+		writeUsedFunction(sink, index);
+		break;
+	case OPERAND_CONSTRUCTOR:
+		// Stored one higher, so zero can mean no constructor
+		writeUsedFunction(sink, index - 1);
+		break;
+	case OPERAND_GLOBAL:
+		if (index < mModule.usedGlobals.size())
+		{
+			const RawUsedGlobal &global = mModule.usedGlobals[index];
+			if (mWithIndices)
+			{
+				sink.writeUnsigned(index);
+				sink.put(':');
+			}
+			sink.write(QualifyName(global.nameSpace, global.name).c_str());
+		}
+		else
+		{
+			sink.put('?');
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void RawAnnotator::writeUsedFunction(OutputSink &sink, size_t index)
+{
+	if (index < mModule.usedFunctions.size() && !mModule.usedFunctions[index].declaration.empty())
+	{
+		sink.write(mModule.usedFunctions[index].declaration.c_str());
+	}
+	else
+	{
+		sink.write("{no func}");
+	}
+}
+
+
+std::string RawFunction::getDeclaration() const
+{
+	std::string declaration;
+	if (!returnType.empty())
+	{
+		declaration = returnType + " ";
+	}
+	if (!objectType.empty())
+	{
+		declaration += objectType + "::";
+	}
+	else if (!nameSpace.empty())
+	{
+		declaration += nameSpace + "::";
+	}
+	declaration += name + "(";
+
+	for (size_t i = 0; i < parameterTypes.size(); ++i)
+	{
+		if (i)
+		{
+			declaration += ", ";
+		}
+		declaration += parameterTypes[i];
+
+		asDWORD inOut = i < inOutFlags.size() ? inOutFlags[i] : 0;
+		if (inOut == asTM_INREF)
+		{
+			declaration += "in";
+		}
+		else if (inOut == asTM_OUTREF)
+		{
+			declaration += "out";
+		}
+		else if (inOut == asTM_INOUTREF)
+		{
+			declaration += "inout";
+		}
+
+		if (i < parameterNames.size() && !parameterNames[i].empty())
+		{
+			declaration += " " + parameterNames[i];
+		}
+		if (i < defaultArgs.size() && !defaultArgs[i].empty())
+		{
+			declaration += " = " + defaultArgs[i];
+		}
+	}
+	declaration += ")";
+
+	if (isReadOnly)
+	{
+		declaration += " const";
+	}
+	return declaration;
+}
+
+bool ReadRawModule(const uint8_t *data, size_t size, RawModule &module, const DumpFilter *filter)
+{
+	RawReader reader(data, size, module, filter);
+	return reader.read();
+}
+
+bool LoadRawModule(const std::string &path, RawModule &module, std::string &error, const DumpFilter *filter)
+{
+	boost::iostreams::mapped_file_source file;
+	try
+	{
+		file.open(path);
+	}
+	catch (const std::exception &e)
+	{
+		error = e.what();
+		return false;
+	}
+	const uint8_t *fileData = reinterpret_cast<const uint8_t *>(file.data());
+
+	AsfHeader header;
+	const char *headerError;
+	if (!ParseAsfHeader(fileData, file.size(), header, &headerError))
+	{
+		error = headerError ? headerError : "not an ASF file";
+		return false;
+	}
+	module.dependencies = std::move(header.dependencies);
+
+	if (!ReadRawModule(fileData + header.codeOffset, header.codeSize, module, filter))
+	{
+		error = "failed to read bytecode";
+		return false;
+	}
+	return true;
+}
+
+bool ResolveRawSymbol(const RawModule &module, const DecodedInstruction &instruction, const DecodedOperand &operand, std::string &symbol)
+{
+	// Operands index the module's tables
+	size_t index = static_cast<size_t>(operand.value);
+	const std::string *resolved = nullptr;
+	switch (operand.kind)
+	{
+	case OPERAND_FUNCTION:
+		if (instruction.op == asBC_CALLBND)
+		{
+			if (index < module.imports.size())
+			{
+				symbol = module.functions[module.imports[index].function].getDeclaration();
+				return true;
+			}
+			return false;
+		}
+		resolved = GetUsedFunction(module, index);
+		break;
+	case OPERAND_FUNCTION_POINTER:
+		resolved = GetUsedFunction(module, index);
+		break;
+	case OPERAND_CONSTRUCTOR:
+		// Stored one higher, so zero can mean no constructor
+		resolved = GetUsedFunction(module, index - 1);
+		break;
+	case OPERAND_TYPE:
+		resolved = index < module.usedTypes.size() ? &module.usedTypes[index] : nullptr;
+		break;
+	case OPERAND_GLOBAL:
+		if (index < module.usedGlobals.size())
+		{
+			const RawUsedGlobal &global = module.usedGlobals[index];
+			symbol = global.nameSpace.empty() ? global.name : global.nameSpace + "::" + global.name;
+			return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+
+	if (!resolved)
+	{
+		return false;
+	}
+	symbol = *resolved;
+	return true;
+}
+
+void DumpRawModule(const RawModule &module, OutputSink &sink, const DumpFilter *filter, SharedCodeWriter *shared)
+{
+	auto typeSelected = [filter](const RawObjectType &type)
+	{
+		return !filter || filter->matchesType(type.nameSpace.c_str(), type.name.c_str());
+	};
+	auto functionSelected = [filter](const RawFunction &function)
+	{
+		return !filter || filter->matchesFunction(function);
+	};
+
+	sink.format("enums: %u\n", CountSelected(module.enums, typeSelected));
+	for (const RawObjectType &type : module.enums)
+	{
+		if (!typeSelected(type))
+		{
+			continue;
+		}
+		sink.format("\t%s\n", QualifyName(type.nameSpace, type.name).c_str());
+		for (const RawEnumValue &value : type.enumValues)
+		{
+			sink.format("\t\t%s = %d,\n", value.name.c_str(), value.value);
+		}
+	}
+
+	sink.format("typedefs: %u\n", CountSelected(module.typedefs, typeSelected));
+	for (const RawObjectType &type : module.typedefs)
+	{
+		if (!typeSelected(type))
+		{
+			continue;
+		}
+		sink.format("\t%s %s\n", QualifyName(type.nameSpace, type.name).c_str(), type.aliasOf.c_str());
+	}
+
+	sink.format("object_types: %u\n", CountSelected(module.classes, typeSelected));
+	for (const RawObjectType &type : module.classes)
+	{
+		if (!typeSelected(type))
+		{
+			continue;
+		}
+		sink.format("\t%s %u %08x\n", QualifyName(type.nameSpace, type.name).c_str(), type.size, type.flags);
+		sink.format("\t\tproperties: %u\n", static_cast<unsigned int>(type.properties.size()));
+		for (const RawProperty &property : type.properties)
+		{
+			sink.format("\t\t\t%s %s\n", property.type.c_str(), property.name.c_str());
+		}
+	}
+
+	auto globalSelected = [filter](const RawGlobal &global)
+	{
+		return !filter || filter->matchesGlobal(global.nameSpace.c_str(), global.name.c_str());
+	};
+	sink.format("global_variables: %u\n", CountSelected(module.globals, globalSelected));
+	for (const RawGlobal &global : module.globals)
+	{
+		if (!globalSelected(global))
+		{
+			continue;
+		}
+		sink.format("\t%s %s\n", global.type.c_str(), QualifyName(global.nameSpace, global.name).c_str());
+	}
+
+	auto importSelected = [&module, &functionSelected](const RawImport &import)
+	{
+		return functionSelected(module.functions[import.function]);
+	};
+	sink.format("imported_functions: %u\n", CountSelected(module.imports, importSelected));
+	for (const RawImport &import : module.imports)
+	{
+		if (!importSelected(import))
+		{
+			continue;
+		}
+		sink.format("\t%s %s\n",
+		            module.functions[import.function].getDeclaration().c_str(),
+		            import.fromModule.c_str());
+	}
+
+	sink.format("used_functions: %u\n", static_cast<unsigned int>(module.usedFunctions.size()));
+	for (size_t i = 0; i < module.usedFunctions.size(); ++i)
+	{
+		const RawUsedFunction &used = module.usedFunctions[i];
+		sink.format("\t%u: %s%s\n",
+		            static_cast<unsigned int>(i),
+		            used.declaration.empty() ? "{null}" : used.declaration.c_str(),
+		            used.isModuleFunction || used.declaration.empty() ? "" : " (application)");
+	}
+
+	sink.format("string_constants: %u\n", static_cast<unsigned int>(module.usedStrings.size()));
+	for (size_t i = 0; i < module.usedStrings.size(); ++i)
+	{
+		const std::string &str = module.usedStrings[i];
+		sink.format("\t%u: %u:\"", static_cast<unsigned int>(i), static_cast<unsigned int>(str.size()));
+		size_t utf8Length;
+		const char *utf8 = SjisToUtf8Scratch(str.data(), str.size(), &utf8Length);
+		sink.write(utf8, utf8Length);
+		sink.write("\"\n", 2);
+	}
+
+	// Every function with bytecode, methods and initializers included
+	auto scriptFunctionSelected = [&functionSelected](const RawFunction &function)
+	{
+		return function.funcType == asFUNC_SCRIPT && functionSelected(function);
+	};
+	sink.format("functions: %u\n", CountSelected(module.functions, scriptFunctionSelected));
+	bool withBytecode = !filter || filter->withBytecode();
+	bool withBlocks = filter && filter->getLevel() == DUMP_BLOCKS;
+	for (const RawFunction &function : module.functions)
+	{
+		if (!scriptFunctionSelected(function))
+		{
+			continue;
+		}
+		std::string declaration = function.getDeclaration();
+		sink.format("\t%s\n", declaration.c_str());
+		if (!withBytecode)
+		{
+			continue;
+		}
+		if (shared && function.isShared)
+		{
+			// Table indices differ between the modules carrying a copy
+			RawAnnotator annotator(module, false);
+			shared->writeFunction(sink, declaration, function.byteCode.data(),
+			                      static_cast<asUINT>(function.byteCode.size()), annotator);
+		}
+		else
+		{
+			DumpRawBytecode(module, function, sink, withBlocks);
+		}
+	}
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "disasm.h"
+#include "sink.h"
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A module read straight from the stream asCWriter produces, without an
+// engine or the application's registrations. Everything refers to types and
+// functions by their declarations. The bytecode is kept in its stored form:
+// operands index the module's used* tables and variable offsets are the
+// writer's platform neutral ones. Only jump offsets are converted to dword
+// offsets, the way the engine does on load.
+
+const size_t cNoRawFunction = ~size_t(0);
+
+struct RawFunction
+{
+	std::string name;
+	std::string nameSpace;
+
+	// Declaration of the type for methods, empty for global functions
+	std::string objectType;
+
+	std::string returnType;
+	std::vector<std::string> parameterTypes;
+	std::vector<asDWORD> inOutFlags;
+	std::vector<std::string> defaultArgs;
+	asEFuncType funcType = asFUNC_DUMMY;
+	bool isReadOnly = false;
+	bool isShared = false;
+
+	// Script functions only
+	std::vector<asDWORD> byteCode;
+	asUINT variableSpace = 0;
+	std::vector<std::string> parameterNames;
+	std::string scriptSection;
+	int declaredAt = 0;
+
+	std::string getDeclaration() const;
+};
+
+struct RawEnumValue
+{
+	std::string name;
+	int value;
+};
+
+struct RawProperty
+{
+	std::string name;
+	std::string type;
+	asDWORD flags;
+};
+
+struct RawObjectType
+{
+	std::string name;
+	std::string nameSpace;
+	asDWORD flags = 0;
+	asUINT size = 0;
+
+	// Enums
+	std::vector<RawEnumValue> enumValues;
+
+	// Typedefs
+	std::string aliasOf;
+
+	// Classes and interfaces; functions are indices into RawModule::functions
+	std::string derivedFrom;
+	std::vector<std::string> interfaces;
+	size_t destructor = cNoRawFunction;
+	std::vector<size_t> constructors;
+	std::vector<size_t> factories;
+	std::vector<size_t> methods;
+	std::vector<size_t> virtualFunctions;
+	std::vector<RawProperty> properties;
+
+	bool isInterface() const
+	{
+		return (flags & asOBJ_SCRIPT_OBJECT) && size == 0;
+	}
+};
+
+struct RawGlobal
+{
+	std::string name;
+	std::string nameSpace;
+	std::string type;
+	size_t initFunction = cNoRawFunction;
+};
+
+struct RawImport
+{
+	size_t function;
+	std::string fromModule;
+};
+
+struct RawUsedFunction
+{
+	// Empty for a null function pointer
+	std::string declaration;
+
+	// Declared by the module itself rather than the application
+	bool isModuleFunction;
+};
+
+struct RawUsedGlobal
+{
+	std::string name;
+	std::string nameSpace;
+	std::string type;
+	bool isModuleProperty;
+};
+
+struct RawUsedObjectProperty
+{
+	std::string objectType;
+	std::string name;
+};
+
+struct RawModule
+{
+	std::vector<std::string> dependencies;
+	bool debugInfoStripped = false;
+
+	std::vector<RawObjectType> enums;
+	std::vector<RawObjectType> classes;
+	std::vector<RawObjectType> typedefs;
+
+	// Every function in the stream, in the order it was first written;
+	// this is also the index 'r' references in the stream use
+	std::vector<RawFunction> functions;
+	std::vector<size_t> funcDefs;
+	std::vector<size_t> scriptFunctions;
+	std::vector<size_t> globalFunctions;
+
+	std::vector<RawGlobal> globals;
+	std::vector<RawImport> imports;
+
+	// The tables the bytecode operands index into
+	std::vector<std::string> usedTypes;
+	std::vector<std::string> usedTypeIds;
+	std::vector<RawUsedFunction> usedFunctions;
+	std::vector<RawUsedGlobal> usedGlobals;
+	std::vector<std::string> usedStrings;
+	std::vector<RawUsedObjectProperty> usedObjectProperties;
+};
+
+// Operands refer to the module's used* tables before linking. Without indices
+// only what they resolve to is written, which doesn't change between builds.
+class RawAnnotator : public OperandAnnotator
+{
+public:
+	RawAnnotator(const RawModule &module, bool withIndices = true);
+
+	virtual void writeAnnotation(OutputSink &sink, const DecodedInstruction &instruction, const DecodedOperand &operand);
+
+private:
+	void writeUsedFunction(OutputSink &sink, size_t index);
+
+	const RawModule &mModule;
+	bool mWithIndices;
+};
+
+// What a symbolic operand refers to: the declaration of a function or type,
+// or the qualified name of a global. False if it doesn't resolve.
+bool ResolveRawSymbol(const RawModule &module, const DecodedInstruction &instruction, const DecodedOperand &operand, std::string &symbol);
+
+// Reads the serialized module from the bytecode region of an ASF file. With
+// a filter, the bytecode of functions it wouldn't dump is skipped over rather
+// than translated and stays empty.
+bool ReadRawModule(const uint8_t *data, size_t size, RawModule &module, const DumpFilter *filter = nullptr);
+
+// Maps an ASF file and reads its module; error is set on failure
+bool LoadRawModule(const std::string &path, RawModule &module, std::string &error, const DumpFilter *filter = nullptr);
+
+// Text dump in the layout of DumpModule, plus the used function and string
+// tables the operands refer to, which a filter leaves whole. With a writer,
+// shared functions name their bytecode in it instead of listing it.
+void DumpRawModule(const RawModule &module, OutputSink &sink, const DumpFilter *filter = nullptr,
+                   SharedCodeWriter *shared = nullptr);
@@ -0,0 +1,612 @@
+#include "records.h"
+#include "decoder.h"
+#include "disasm.h"
+#include "sjis.h"
+#include "symbols.h"
+
+#include <cmath>
+#include <memory>
+
+namespace
+{
+
+const char *const cRecordNames[RECORD_TYPE_COUNT] =
+{
+	"module",
+	"enum",
+	"enum_value",
+	"typedef",
+	"object_type",
+	"property",
+	"global",
+	"import",
+	"function",
+	"instruction",
+	"stats",
+	"opcode",
+	"pair",
+	"call",
+	"function_size",
+	"profile",
+	"stage_profile",
+	"module_profile",
+	"string_table",
+	"string",
+	"string_use",
+};
+
+const char *const cFieldNames[FIELD_COUNT] =
+{
+	"name",
+	"namespace",
+	"decl",
+	"id",
+	"type_id",
+	"value",
+	"size",
+	"flags",
+	"source",
+	"function",
+	"pos",
+	"op",
+	"args",
+	"target",
+	"callee",
+	"type",
+	"string",
+	"global",
+	"int",
+	"float",
+	"module",
+	"next",
+	"count",
+	"modules",
+	"functions",
+	"instructions",
+	"calls",
+	"ns",
+	"allocations",
+	"bytes",
+	"stages",
+	"hash",
+	"strings",
+};
+
+}
+
+bool ParseOutputFormat(const std::string &name, OutputFormat &format)
+{
+	if (name == "text")
+	{
+		format = FORMAT_TEXT;
+	}
+	else if (name == "jsonl")
+	{
+		format = FORMAT_JSON_LINES;
+	}
+	else if (name == "binary")
+	{
+		format = FORMAT_BINARY;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+const char *GetOutputExtension(OutputFormat format)
+{
+	switch (format)
+	{
+	case FORMAT_JSON_LINES:
+		return ".jsonl";
+	case FORMAT_BINARY:
+		return ".bin";
+	default:
+		return ".txt";
+	}
+}
+
+void JsonLinesWriter::beginRecord(RecordType type)
+{
+	mSink.write("{\"record\":\"");
+	mSink.write(cRecordNames[type]);
+	mSink.put('"');
+}
+
+void JsonLinesWriter::endRecord()
+{
+	mSink.write("}\n", 2);
+}
+
+void JsonLinesWriter::writeSigned(RecordField field, int64_t value)
+{
+	writeKey(field);
+	mSink.writeSigned(value);
+}
+
+void JsonLinesWriter::writeUnsigned(RecordField field, uint64_t value)
+{
+	writeKey(field);
+	mSink.writeUnsigned(value);
+}
+
+void JsonLinesWriter::writeDouble(RecordField field, double value)
+{
+	writeKey(field);
+	// JSON has no representation for these
+	if (std::isfinite(value))
+	{
+		mSink.format("%.17g", value);
+	}
+	else
+	{
+		mSink.write("null", 4);
+	}
+}
+
+void JsonLinesWriter::writeString(RecordField field, const char *str, size_t length)
+{
+	writeKey(field);
+	mSink.put('"');
+	writeEscaped(str, length);
+	mSink.put('"');
+}
+
+void JsonLinesWriter::beginArray(RecordField field)
+{
+	writeKey(field);
+	mSink.put('[');
+	mFirstElement = true;
+}
+
+void JsonLinesWriter::endArray()
+{
+	mSink.put(']');
+}
+
+void JsonLinesWriter::appendSigned(int64_t value)
+{
+	writeElementSeparator();
+	mSink.writeSigned(value);
+}
+
+void JsonLinesWriter::writeKey(RecordField field)
+{
+	mSink.write(",\"", 2);
+	mSink.write(cFieldNames[field]);
+	mSink.write("\":", 2);
+}
+
+void JsonLinesWriter::writeElementSeparator()
+{
+	if (!mFirstElement)
+	{
+		mSink.put(',');
+	}
+	mFirstElement = false;
+}
+
+void JsonLinesWriter::writeEscaped(const char *str, size_t length)
+{
+	static const char cHexDigits[] = "0123456789abcdef";
+
+	// Copy runs that need no escaping in one go
+	size_t runStart = 0;
+	for (size_t i = 0; i < length; ++i)
+	{
+		unsigned char c = static_cast<unsigned char>(str[i]);
+		if (c >= 0x20 && c != '"' && c != '\\')
+		{
+			continue;
+		}
+
+		mSink.write(str + runStart, i - runStart);
+		runStart = i + 1;
+		switch (c)
+		{
+		case '"': mSink.write("\\\"", 2); break;
+		case '\\': mSink.write("\\\\", 2); break;
+		case '\n': mSink.write("\\n", 2); break;
+		case '\r': mSink.write("\\r", 2); break;
+		case '\t': mSink.write("\\t", 2); break;
+		default:
+			mSink.write("\\u00", 4);
+			mSink.put(cHexDigits[c >> 4]);
+			mSink.put(cHexDigits[c & 0xf]);
+			break;
+		}
+	}
+	mSink.write(str + runStart, length - runStart);
+}
+
+BinaryRecordWriter::BinaryRecordWriter(OutputSink &sink)
+	: RecordWriter(sink)
+{
+	mSink.write("CSAR", 4);
+	mSink.put(static_cast<char>(cVersion));
+}
+
+void BinaryRecordWriter::beginRecord(RecordType type)
+{
+	mRecord.clear();
+	mRecord.push_back(static_cast<char>(type));
+}
+
+void BinaryRecordWriter::endRecord()
+{
+	uint32_t size = static_cast<uint32_t>(mRecord.size());
+	char sizeBytes[4] =
+	{
+		static_cast<char>(size),
+		static_cast<char>(size >> 8),
+		static_cast<char>(size >> 16),
+		static_cast<char>(size >> 24),
+	};
+	mSink.write(sizeBytes, sizeof(sizeBytes));
+	mSink.write(mRecord);
+}
+
+void BinaryRecordWriter::writeSigned(RecordField field, int64_t value)
+{
+	mRecord.push_back(static_cast<char>(field));
+	mRecord.push_back(static_cast<char>(TAG_SIGNED));
+	putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void BinaryRecordWriter::writeUnsigned(RecordField field, uint64_t value)
+{
+	mRecord.push_back(static_cast<char>(field));
+	mRecord.push_back(static_cast<char>(TAG_UNSIGNED));
+	putVarint(value);
+}
+
+void BinaryRecordWriter::writeDouble(RecordField field, double value)
+{
+	mRecord.push_back(static_cast<char>(field));
+	mRecord.push_back(static_cast<char>(TAG_DOUBLE));
+
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	for (int i = 0; i < 8; ++i)
+	{
+		mRecord.push_back(static_cast<char>(bits >> (i * 8)));
+	}
+}
+
+void BinaryRecordWriter::writeString(RecordField field, const char *str, size_t length)
+{
+	mRecord.push_back(static_cast<char>(field));
+	mRecord.push_back(static_cast<char>(TAG_STRING));
+	putVarint(length);
+	mRecord.append(str, length);
+}
+
+void BinaryRecordWriter::beginArray(RecordField field)
+{
+	mRecord.push_back(static_cast<char>(field));
+	mRecord.push_back(static_cast<char>(TAG_ARRAY));
+
+	// The count goes first, so the elements wait in mArray until the end
+	mArray.clear();
+	mArrayCount = 0;
+}
+
+void BinaryRecordWriter::endArray()
+{
+	putVarint(mArrayCount);
+	mRecord.append(mArray);
+}
+
+void BinaryRecordWriter::appendSigned(int64_t value)
+{
+	uint64_t encoded = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+	do
+	{
+		uint8_t byte = encoded & 0x7f;
+		encoded >>= 7;
+		mArray.push_back(static_cast<char>(encoded ? byte | 0x80 : byte));
+	} while (encoded);
+	++mArrayCount;
+}
+
+void BinaryRecordWriter::putVarint(uint64_t value)
+{
+	do
+	{
+		uint8_t byte = value & 0x7f;
+		value >>= 7;
+		mRecord.push_back(static_cast<char>(value ? byte | 0x80 : byte));
+	} while (value);
+}
+
+namespace
+{
+
+void WriteInstructionRecord(RecordWriter &writer, asIScriptFunction *function, const DecodedInstruction &instruction,
+                            SymbolCache &symbols, ModuleIds &ids)
+{
+	asIScriptEngine *engine = function->GetEngine();
+	const OpcodeDescriptor &descriptor = *instruction.descriptor;
+
+	writer.beginRecord(RECORD_INSTRUCTION);
+	writer.writeSigned(FIELD_FUNCTION, ids.getFunctionId(function));
+	writer.writeUnsigned(FIELD_POSITION, instruction.position);
+	writer.writeString(FIELD_OPCODE, descriptor.name);
+
+	writer.beginArray(FIELD_ARGS);
+	for (int i = 0; i < descriptor.operandCount; ++i)
+	{
+		const DecodedOperand &operand = instruction.operands[i];
+		switch (operand.kind)
+		{
+		case OPERAND_VARIABLE:
+		case OPERAND_SIGNED:
+		case OPERAND_JUMP:
+		case OPERAND_CONSTANT:
+			writer.appendSigned(operand.getSigned());
+			break;
+		case OPERAND_FUNCTION:
+		case OPERAND_CONSTRUCTOR:
+			writer.appendSigned(ids.getFunctionId(static_cast<asUINT>(operand.value)));
+			break;
+		case OPERAND_STRING:
+			writer.appendSigned(ids.getStringId(static_cast<asUINT>(operand.value)));
+			break;
+		case OPERAND_TYPE_ID:
+			writer.appendSigned(ids.getTypeId(static_cast<int>(operand.value)));
+			break;
+		default:
+			writer.appendSigned(static_cast<int64_t>(operand.value));
+			break;
+		}
+	}
+	writer.endArray();
+
+	// Whatever the operands resolve to
+	for (int i = 0; i < descriptor.operandCount; ++i)
+	{
+		const DecodedOperand &operand = instruction.operands[i];
+		switch (operand.kind)
+		{
+		case OPERAND_FLOAT:
+			writer.writeDouble(FIELD_FLOAT, operand.getFloat());
+			break;
+		case OPERAND_CONSTANT:
+			writer.writeSigned(FIELD_INT, operand.getSigned());
+			writer.writeDouble(FIELD_FLOAT, operand.size == 8 ? operand.getDouble() : operand.getFloat());
+			break;
+		case OPERAND_JUMP:
+			writer.writeUnsigned(FIELD_TARGET, instruction.getJumpTarget(operand));
+			break;
+		case OPERAND_STRING:
+			{
+				size_t length = 0;
+				const char *str = ResolveString(engine, static_cast<asUINT>(operand.value), &length);
+				if (str)
+				{
+					size_t utf8Length;
+					const char *utf8 = SjisToUtf8Scratch(str, length, &utf8Length);
+					writer.writeString(FIELD_STRING, utf8, utf8Length);
+				}
+			}
+			break;
+		case OPERAND_TYPE:
+			{
+				asIObjectType *type = static_cast<asIObjectType *>(operand.getPointer());
+				if (type)
+				{
+					writer.writeString(FIELD_TYPE, type->GetName());
+				}
+			}
+			break;
+		case OPERAND_TYPE_ID:
+			{
+				const std::string *decl = symbols.getTypeDeclaration(static_cast<int>(operand.value));
+				if (decl)
+				{
+					writer.writeString(FIELD_DECL, decl->data(), decl->size());
+				}
+			}
+			break;
+		case OPERAND_FUNCTION:
+		case OPERAND_CONSTRUCTOR:
+			{
+				asIScriptFunction *callee = operand.kind == OPERAND_FUNCTION
+					? ResolveFunction(engine, static_cast<asUINT>(operand.value))
+					: engine->GetFunctionById(static_cast<int>(operand.value));
+				if (callee)
+				{
+					const std::string &decl = symbols.getDeclaration(callee);
+					writer.writeSigned(FIELD_CALLEE, ids.getFunctionId(static_cast<asUINT>(operand.value)));
+					writer.writeString(FIELD_DECL, decl.data(), decl.size());
+				}
+			}
+			break;
+		case OPERAND_FUNCTION_POINTER:
+			{
+				asIScriptFunction *callee = static_cast<asIScriptFunction *>(operand.getPointer());
+				if (callee)
+				{
+					const std::string &decl = symbols.getDeclaration(callee);
+					writer.writeSigned(FIELD_CALLEE, ids.getFunctionId(callee));
+					writer.writeString(FIELD_DECL, decl.data(), decl.size());
+				}
+			}
+			break;
+		case OPERAND_GLOBAL:
+			{
+				asUINT id;
+				const char *name = symbols.resolveGlobal(function, operand.getPointer(), &id);
+				if (name)
+				{
+					writer.writeUnsigned(FIELD_GLOBAL, ids.getGlobalId(operand.getPointer()));
+					writer.writeString(FIELD_NAME, name);
+				}
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	writer.endRecord();
+}
+
+}
+
+void DumpModuleRecords(asIScriptModule *module, RecordWriter &writer, const DumpFilter *filter, ModuleIds *keptIds)
+{
+	std::unique_ptr<ModuleIds> ownIds(keptIds ? nullptr : new ModuleIds(module));
+	ModuleIds &ids = keptIds ? *keptIds : *ownIds;
+
+	writer.beginRecord(RECORD_MODULE);
+	writer.writeString(FIELD_NAME, module->GetName());
+	writer.endRecord();
+
+	for (asUINT i = 0; i < module->GetEnumCount(); ++i)
+	{
+		int typeId;
+		const char *nameSpace;
+		const char *enumName = module->GetEnumByIndex(i, &typeId, &nameSpace);
+		if (filter && !filter->matchesType(nameSpace, enumName))
+		{
+			continue;
+		}
+
+		writer.beginRecord(RECORD_ENUM);
+		writer.writeString(FIELD_NAME, enumName);
+		writer.writeString(FIELD_NAMESPACE, nameSpace);
+		writer.writeSigned(FIELD_TYPE_ID, ids.getTypeId(typeId));
+		writer.endRecord();
+
+		for (int j = 0; j < module->GetEnumValueCount(typeId); ++j)
+		{
+			int value;
+			const char *valueName = module->GetEnumValueByIndex(typeId, j, &value);
+
+			writer.beginRecord(RECORD_ENUM_VALUE);
+			writer.writeSigned(FIELD_TYPE_ID, ids.getTypeId(typeId));
+			writer.writeString(FIELD_NAME, valueName);
+			writer.writeSigned(FIELD_VALUE, value);
+			writer.endRecord();
+		}
+	}
+
+	for (asUINT i = 0; i < module->GetTypedefCount(); ++i)
+	{
+		int typeId;
+		const char *typedefName = module->GetTypedefByIndex(i, &typeId);
+		asIObjectType *type = module->GetEngine()->GetObjectTypeById(typeId);
+		if (filter && !filter->matchesType(type ? type->GetNamespace() : "", typedefName))
+		{
+			continue;
+		}
+
+		writer.beginRecord(RECORD_TYPEDEF);
+		writer.writeString(FIELD_NAME, typedefName);
+		writer.writeSigned(FIELD_TYPE_ID, ids.getTypeId(typeId));
+		writer.endRecord();
+	}
+
+	for (asUINT i = 0; i < module->GetObjectTypeCount(); ++i)
+	{
+		asIObjectType *type = module->GetObjectTypeByIndex(i);
+		if (filter && !filter->matchesType(type->GetNamespace(), type->GetName()))
+		{
+			continue;
+		}
+
+		writer.beginRecord(RECORD_OBJECT_TYPE);
+		writer.writeString(FIELD_NAME, type->GetName());
+		writer.writeSigned(FIELD_TYPE_ID, ids.getTypeId(type->GetTypeId()));
+		writer.writeUnsigned(FIELD_SIZE, type->GetSize());
+		writer.writeUnsigned(FIELD_FLAGS, type->GetFlags());
+		writer.endRecord();
+
+		for (asUINT j = 0; j < type->GetPropertyCount(); ++j)
+		{
+			writer.beginRecord(RECORD_PROPERTY);
+			writer.writeSigned(FIELD_TYPE_ID, ids.getTypeId(type->GetTypeId()));
+			writer.writeString(FIELD_DECL, type->GetPropertyDeclaration(j));
+			writer.endRecord();
+		}
+	}
+
+	for (asUINT i = 0; i < module->GetGlobalVarCount(); ++i)
+	{
+		const char *name;
+		const char *nameSpace;
+		module->GetGlobalVar(i, &name, &nameSpace);
+		if (filter && !filter->matchesGlobal(nameSpace, name))
+		{
+			continue;
+		}
+
+		writer.beginRecord(RECORD_GLOBAL);
+		writer.writeUnsigned(FIELD_ID, i);
+		writer.writeString(FIELD_DECL, module->GetGlobalVarDeclaration(i, true));
+		writer.endRecord();
+	}
+
+	for (asUINT i = 0; i < module->GetImportedFunctionCount(); ++i)
+	{
+		if (filter && !filter->matchesFunction(GetImportedFunction(module, i)))
+		{
+			continue;
+		}
+
+		writer.beginRecord(RECORD_IMPORT);
+		writer.writeUnsigned(FIELD_ID, i);
+		writer.writeString(FIELD_DECL, module->GetImportedFunctionDeclaration(i));
+		writer.writeString(FIELD_SOURCE, module->GetImportedFunctionSourceModule(i));
+		writer.endRecord();
+	}
+
+	SymbolCache &symbols = SymbolCache::get(module->GetEngine());
+	std::vector<asIScriptFunction *> functions;
+	SelectFunctions(module, filter, functions);
+	for (asIScriptFunction *func : functions)
+	{
+		writer.beginRecord(RECORD_FUNCTION);
+		writer.writeSigned(FIELD_ID, ids.getFunctionId(func));
+		writer.writeString(FIELD_DECL, func->GetDeclaration(true, true, true));
+		writer.endRecord();
+		if (filter && !filter->withBytecode())
+		{
+			continue;
+		}
+
+		asUINT length;
+		asDWORD *code = func->GetByteCode(&length);
+
+		DecodedInstruction instruction;
+		for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+		{
+			WriteInstructionRecord(writer, func, instruction, symbols, ids);
+		}
+	}
+}
+
+void DumpModule(asIScriptModule *module, OutputSink &sink, OutputFormat format, const DumpFilter *filter,
+                SharedCodeWriter *shared, ModuleIds *ids)
+{
+	switch (format)
+	{
+	case FORMAT_JSON_LINES:
+		{
+			JsonLinesWriter writer(sink);
+			DumpModuleRecords(module, writer, filter, ids);
+		}
+		break;
+	case FORMAT_BINARY:
+		{
+			BinaryRecordWriter writer(sink);
+			DumpModuleRecords(module, writer, filter, ids);
+		}
+		break;
+	default:
+		DumpModule(module, sink, filter, shared, ids);
+		break;
+	}
+}
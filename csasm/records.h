@@ -0,0 +1,217 @@
+#pragma once
+
+#include "filter.h"
+#include "sink.h"
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <string>
+
+class ModuleIds;
+class SharedCodeWriter;
+
+enum OutputFormat
+{
+	FORMAT_TEXT,
+	FORMAT_JSON_LINES,
+	FORMAT_BINARY,
+};
+
+bool ParseOutputFormat(const std::string &name, OutputFormat &format);
+
+// File extension for batch output, including the dot
+const char *GetOutputExtension(OutputFormat format);
+
+enum RecordType : uint8_t
+{
+	RECORD_MODULE,
+	RECORD_ENUM,
+	RECORD_ENUM_VALUE,
+	RECORD_TYPEDEF,
+	RECORD_OBJECT_TYPE,
+	RECORD_PROPERTY,
+	RECORD_GLOBAL,
+	RECORD_IMPORT,
+	RECORD_FUNCTION,
+	RECORD_INSTRUCTION,
+	RECORD_STATS,
+	RECORD_OPCODE_COUNT,
+	RECORD_PAIR_COUNT,
+	RECORD_CALL_COUNT,
+	RECORD_FUNCTION_SIZE,
+	RECORD_PROFILE,
+	RECORD_STAGE_PROFILE,
+	RECORD_MODULE_PROFILE,
+	RECORD_STRING_TABLE,
+	RECORD_STRING,
+	RECORD_STRING_USE,
+	RECORD_TYPE_COUNT
+};
+
+enum RecordField : uint8_t
+{
+	FIELD_NAME,
+	FIELD_NAMESPACE,
+	FIELD_DECL,
+	FIELD_ID,
+	FIELD_TYPE_ID,
+	FIELD_VALUE,
+	FIELD_SIZE,
+	FIELD_FLAGS,
+	FIELD_SOURCE,
+	FIELD_FUNCTION,
+	FIELD_POSITION,
+	FIELD_OPCODE,
+	FIELD_ARGS,
+	FIELD_TARGET,
+	FIELD_CALLEE,
+	FIELD_TYPE,
+	FIELD_STRING,
+	FIELD_GLOBAL,
+	FIELD_INT,
+	FIELD_FLOAT,
+	FIELD_MODULE,
+	FIELD_NEXT,
+	FIELD_TALLY,
+	FIELD_MODULES,
+	FIELD_FUNCTIONS,
+	FIELD_INSTRUCTIONS,
+	FIELD_CALLS,
+	FIELD_NANOSECONDS,
+	FIELD_ALLOCATIONS,
+	FIELD_BYTES,
+	FIELD_STAGES,
+	FIELD_HASH,
+	FIELD_STRINGS,
+	FIELD_COUNT
+};
+
+// Receives one flat record at a time and streams it out. Fields are written
+// in call order; an array holds plain values only.
+class RecordWriter
+{
+public:
+	RecordWriter(OutputSink &sink)
+		: mSink(sink)
+	{
+
+	}
+
+	virtual ~RecordWriter() {}
+
+	virtual void beginRecord(RecordType type) = 0;
+	virtual void endRecord() = 0;
+
+	virtual void writeSigned(RecordField field, int64_t value) = 0;
+	virtual void writeUnsigned(RecordField field, uint64_t value) = 0;
+	virtual void writeDouble(RecordField field, double value) = 0;
+	virtual void writeString(RecordField field, const char *str, size_t length) = 0;
+
+	// Null is written as an empty string
+	void writeString(RecordField field, const char *str)
+	{
+		writeString(field, str ? str : "", str ? strlen(str) : 0);
+	}
+
+	virtual void beginArray(RecordField field) = 0;
+	virtual void endArray() = 0;
+
+	// Array elements
+	virtual void appendSigned(int64_t value) = 0;
+
+protected:
+	OutputSink &mSink;
+};
+
+// One JSON object per line, e.g.
+// {"record":"instruction","function":12,"pos":4,"op":"CALL","args":[434],"callee":434,"decl":"int f(int)"}
+// Strings are written byte for byte apart from JSON escapes.
+class JsonLinesWriter : public RecordWriter
+{
+public:
+	JsonLinesWriter(OutputSink &sink)
+		: RecordWriter(sink)
+	{
+
+	}
+
+	virtual void beginRecord(RecordType type);
+	virtual void endRecord();
+
+	virtual void writeSigned(RecordField field, int64_t value);
+	virtual void writeUnsigned(RecordField field, uint64_t value);
+	virtual void writeDouble(RecordField field, double value);
+	virtual void writeString(RecordField field, const char *str, size_t length);
+
+	virtual void beginArray(RecordField field);
+	virtual void endArray();
+	virtual void appendSigned(int64_t value);
+
+private:
+	void writeKey(RecordField field);
+	void writeElementSeparator();
+	void writeEscaped(const char *str, size_t length);
+
+	bool mFirstElement = true;
+};
+
+// Compact binary records. The stream starts with "CSAR" and a version byte,
+// then each record is
+//   u32 payload size (little endian), u8 record type, fields...
+// and each field is
+//   u8 field id, u8 tag, value
+// with the tags
+//   TAG_SIGNED   zigzag varint
+//   TAG_UNSIGNED varint
+//   TAG_DOUBLE   8 bytes, little endian IEEE 754
+//   TAG_STRING   varint size, bytes
+//   TAG_ARRAY    varint count, count zigzag varints
+// Record and field ids are the RecordType and RecordField values.
+class BinaryRecordWriter : public RecordWriter
+{
+public:
+	enum Tag : uint8_t
+	{
+		TAG_SIGNED,
+		TAG_UNSIGNED,
+		TAG_DOUBLE,
+		TAG_STRING,
+		TAG_ARRAY,
+	};
+
+	static const uint8_t cVersion = 1;
+
+	BinaryRecordWriter(OutputSink &sink);
+
+	virtual void beginRecord(RecordType type);
+	virtual void endRecord();
+
+	virtual void writeSigned(RecordField field, int64_t value);
+	virtual void writeUnsigned(RecordField field, uint64_t value);
+	virtual void writeDouble(RecordField field, double value);
+	virtual void writeString(RecordField field, const char *str, size_t length);
+
+	virtual void beginArray(RecordField field);
+	virtual void endArray();
+	virtual void appendSigned(int64_t value);
+
+private:
+	void putVarint(uint64_t value);
+
+	// The record is assembled here so its size can go first; the storage is
+	// reused for every record
+	std::string mRecord;
+	std::string mArray;
+	uint64_t mArrayCount = 0;
+};
+
+// Streams the whole module as records, in the same order as the text dump;
+// a filter leaves out what it doesn't pick
+void DumpModuleRecords(asIScriptModule *module, RecordWriter &writer, const DumpFilter *filter = nullptr,
+                       ModuleIds *ids = nullptr);
+
+// DumpModule in any of the output formats; shared bytecode is only written
+// apart from text dumps
+void DumpModule(asIScriptModule *module, OutputSink &sink, OutputFormat format, const DumpFilter *filter = nullptr,
+                SharedCodeWriter *shared = nullptr, ModuleIds *ids = nullptr);
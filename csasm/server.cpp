@@ -0,0 +1,500 @@
+#include "server.h"
+#include "asf.h"
+#include "disasm.h"
+#include "filter.h"
+#include "records.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+struct EngineSlot
+{
+	asIScriptEngine *engine = nullptr;
+	std::unique_ptr<AsfModuleTracker> tracker;
+};
+
+// Hands out the engines to requests, one request per engine at a time
+class EnginePool
+{
+public:
+	~EnginePool()
+	{
+		for (const std::unique_ptr<EngineSlot> &slot : mSlots)
+		{
+			slot->tracker.reset();
+			slot->engine->ShutDownAndRelease();
+		}
+	}
+
+	bool create(const EngineFactory &engineFactory, const ServerOptions &options)
+	{
+		for (unsigned int i = 0; i < std::max(options.engines, 1u); ++i)
+		{
+			asIScriptEngine *engine = engineFactory();
+			if (!engine)
+			{
+				return false;
+			}
+
+			std::unique_ptr<EngineSlot> slot(new EngineSlot);
+			slot->engine = engine;
+			slot->tracker.reset(new AsfModuleTracker(engine, options.root));
+			slot->tracker->setMemoryBudget(options.memoryBudget);
+			slot->tracker->setReaderCount(options.engines > 1 ? 1 : 0);
+			slot->tracker->setTrackChanges(true);
+			mFree.push_back(slot.get());
+			mSlots.push_back(std::move(slot));
+		}
+		return true;
+	}
+
+	EngineSlot *acquire()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mAvailable.wait(lock, [this]()
+		{
+			return !mFree.empty();
+		});
+		EngineSlot *slot = mFree.back();
+		mFree.pop_back();
+		return slot;
+	}
+
+	void release(EngineSlot *slot)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mFree.push_back(slot);
+		}
+		mAvailable.notify_one();
+	}
+
+private:
+	std::vector<std::unique_ptr<EngineSlot>> mSlots;
+	std::vector<EngineSlot *> mFree;
+	std::mutex mMutex;
+	std::condition_variable mAvailable;
+};
+
+class Connection
+{
+public:
+	virtual ~Connection() {}
+
+	// Without the line break; false once the client is gone
+	virtual bool readLine(std::string &line) = 0;
+	virtual bool write(const std::string &data) = 0;
+};
+
+class StdioConnection : public Connection
+{
+public:
+	virtual bool readLine(std::string &line)
+	{
+		return static_cast<bool>(std::getline(std::cin, line));
+	}
+
+	virtual bool write(const std::string &data)
+	{
+		// Straight to the file; std::cout carries the log to stderr
+		return fwrite(data.data(), 1, data.size(), stdout) == data.size() && fflush(stdout) == 0;
+	}
+};
+
+#ifndef _WIN32
+class SocketConnection : public Connection
+{
+public:
+	SocketConnection(int socket)
+		: mSocket(socket)
+	{
+
+	}
+
+	~SocketConnection()
+	{
+		close(mSocket);
+	}
+
+	virtual bool readLine(std::string &line)
+	{
+		for (;;)
+		{
+			size_t end = mBuffer.find('\n');
+			if (end != std::string::npos)
+			{
+				line.assign(mBuffer, 0, end);
+				mBuffer.erase(0, end + 1);
+				return true;
+			}
+
+			char data[4096];
+			ssize_t received = recv(mSocket, data, sizeof(data), 0);
+			if (received < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (received <= 0)
+			{
+				return false;
+			}
+			mBuffer.append(data, received);
+		}
+	}
+
+	virtual bool write(const std::string &data)
+	{
+		for (size_t sent = 0; sent < data.size(); )
+		{
+			ssize_t result = send(mSocket, data.data() + sent, data.size() - sent, 0);
+			if (result < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (result <= 0)
+			{
+				return false;
+			}
+			sent += result;
+		}
+		return true;
+	}
+
+private:
+	int mSocket;
+	std::string mBuffer;
+};
+#endif
+
+// Splits off the first space separated word of rest
+std::string TakeWord(std::string &rest)
+{
+	size_t start = rest.find_first_not_of(' ');
+	size_t end = start == std::string::npos ? std::string::npos : rest.find(' ', start);
+	std::string word = start == std::string::npos ? "" : rest.substr(start, end - start);
+	size_t next = end == std::string::npos ? std::string::npos : rest.find_first_not_of(' ', end);
+	rest = next == std::string::npos ? "" : rest.substr(next);
+	return word;
+}
+
+bool IsNumber(const std::string &str)
+{
+	return !str.empty() && str.find_first_not_of("0123456789") == std::string::npos;
+}
+
+// Names come from clients, so only ones that stay under the root are served
+bool IsModuleName(const std::string &name)
+{
+	boost::filesystem::path path = name;
+	if (path.has_root_path())
+	{
+		return false;
+	}
+	for (const boost::filesystem::path &element : path)
+	{
+		if (element == "..")
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool DumpRequested(EnginePool &pool, const ServerOptions &options, const std::string &name, OutputFormat format,
+                   const DumpFilter *filter, std::string &response)
+{
+	if (!IsModuleName(name))
+	{
+		response = "no module " + name;
+		return false;
+	}
+
+	boost::filesystem::path filePath = options.root;
+	filePath.concat(name);
+	boost::system::error_code error;
+	if (!boost::filesystem::is_regular_file(filePath, error))
+	{
+		response = "no module " + name;
+		return false;
+	}
+
+	EngineSlot *slot = pool.acquire();
+	slot->tracker->refresh(name);
+	AsfModule *asfModule = slot->tracker->getModule(name);
+	asIScriptModule *module = asfModule->getScriptModule();
+	bool loaded = module != nullptr;
+	if (loaded)
+	{
+		// The ids stay with the engine's copy, so later requests skip the walk
+		StringSink sink;
+		DumpModule(module, sink, format, filter, nullptr, &asfModule->getIds());
+		response = sink.str();
+	}
+	pool.release(slot);
+
+	if (!loaded)
+	{
+		response = "failed to load " + name;
+	}
+	return loaded;
+}
+
+bool HandleRequest(EnginePool &pool, const ServerOptions &options, const std::string &request, std::string &response)
+{
+	std::string rest = request;
+	std::string command = TakeWord(rest);
+	if (command == "list")
+	{
+		response.clear();
+		for (const std::string &name : CollectModuleNames(options.root))
+		{
+			response += name;
+			response += '\n';
+		}
+		return true;
+	}
+
+	std::string name = TakeWord(rest);
+	if (name.empty() || (command != "dump" && command != "headers" && command != "function"))
+	{
+		response = "unknown request";
+		return false;
+	}
+
+	OutputFormat format = FORMAT_TEXT;
+	DumpFilter filter;
+	const DumpFilter *usedFilter = nullptr;
+	if (command == "dump")
+	{
+		// Binary records aren't offered over the line protocol
+		if (!rest.empty() && (!ParseOutputFormat(rest, format) || format == FORMAT_BINARY))
+		{
+			response = "unknown format " + rest;
+			return false;
+		}
+	}
+	else if (command == "headers")
+	{
+		filter.setLevel(DUMP_HEADERS);
+		usedFilter = &filter;
+	}
+	else
+	{
+		if (IsNumber(rest))
+		{
+			// Digits alone can still be out of range
+			errno = 0;
+			long id = strtol(rest.c_str(), nullptr, 10);
+			if (errno == ERANGE || id > INT_MAX)
+			{
+				response = "function id out of range";
+				return false;
+			}
+			filter.setFunctionId(static_cast<int>(id));
+		}
+		else if (rest.empty() || !filter.setPattern(rest, false))
+		{
+			response = "function needs an id or a pattern";
+			return false;
+		}
+		usedFilter = &filter;
+	}
+	return DumpRequested(pool, options, name, format, usedFilter, response);
+}
+
+std::mutex sLogMutex;
+
+void Serve(Connection &connection, EnginePool &pool, const ServerOptions &options)
+{
+	std::string request;
+	while (connection.readLine(request))
+	{
+		if (!request.empty() && request.back() == '\r')
+		{
+			request.pop_back();
+		}
+		if (request.empty())
+		{
+			continue;
+		}
+		if (request == "quit")
+		{
+			break;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		std::string response;
+		bool ok = HandleRequest(pool, options, request, response);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		{
+			std::lock_guard<std::mutex> lock(sLogMutex);
+			std::cout << fmtString("%s: %s, %.3f ms", request.c_str(), ok ? "ok" : "error", elapsed.count() * 1000.0) << std::endl;
+		}
+
+		std::string header = fmtString("%s %u\n", ok ? "ok" : "error", static_cast<unsigned int>(response.size()));
+		if (!connection.write(header + response))
+		{
+			break;
+		}
+	}
+}
+
+#ifndef _WIN32
+int ServeSocket(EnginePool &pool, const ServerOptions &options)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (options.socketPath.size() >= sizeof(address.sun_path))
+	{
+		std::cout << "socket path too long: " << options.socketPath << "\n";
+		return -1;
+	}
+	memcpy(address.sun_path, options.socketPath.c_str(), options.socketPath.size() + 1);
+
+	// A socket left behind by an earlier server is replaced; anything else
+	// at the path is left alone
+	struct stat existing;
+	if (lstat(options.socketPath.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+	{
+		unlink(options.socketPath.c_str());
+	}
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listener, 16) < 0)
+	{
+		std::cout << "failed to listen on " << options.socketPath << "\n";
+		if (listener >= 0)
+		{
+			close(listener);
+		}
+		return -1;
+	}
+
+	// A client hanging up mid response is only that connection's problem
+	signal(SIGPIPE, SIG_IGN);
+	std::cout << "listening on " << options.socketPath << std::endl;
+
+	std::mutex connectionMutex;
+	std::condition_variable connectionsDone;
+	unsigned int connections = 0;
+	for (;;)
+	{
+		int client = accept(listener, nullptr, nullptr);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(connectionMutex);
+			++connections;
+		}
+		std::thread([&, client]()
+		{
+			{
+				SocketConnection connection(client);
+				Serve(connection, pool, options);
+			}
+			asThreadCleanup();
+
+			std::lock_guard<std::mutex> lock(connectionMutex);
+			if (--connections == 0)
+			{
+				connectionsDone.notify_all();
+			}
+		}).detach();
+	}
+
+	std::cout << "failed to accept connections on " << options.socketPath << "\n";
+	close(listener);
+	unlink(options.socketPath.c_str());
+
+	// The pool has to outlive the connections
+	std::unique_lock<std::mutex> lock(connectionMutex);
+	connectionsDone.wait(lock, [&connections]()
+	{
+		return connections == 0;
+	});
+	return -1;
+}
+#endif
+
+}
+
+int RunServer(const EngineFactory &engineFactory, const ServerOptions &options)
+{
+#ifdef _WIN32
+	if (!options.socketPath.empty())
+	{
+		std::cout << "unix domain sockets aren't supported here, serve stdin instead\n";
+		return -1;
+	}
+#endif
+
+	// Keep stdout for the responses
+	std::streambuf *log = nullptr;
+	if (options.socketPath.empty())
+	{
+		log = std::cout.rdbuf(std::cerr.rdbuf());
+	}
+
+	// Connections use the engines on their own threads
+	asPrepareMultithread();
+
+	int result = 0;
+	{
+		EnginePool pool;
+		if (!pool.create(engineFactory, options))
+		{
+			result = -1;
+		}
+#ifndef _WIN32
+		else if (!options.socketPath.empty())
+		{
+			result = ServeSocket(pool, options);
+		}
+#endif
+		else
+		{
+			StdioConnection connection;
+			if (connection.write("ready\n"))
+			{
+				Serve(connection, pool, options);
+			}
+		}
+	}
+
+	if (log)
+	{
+		std::cout.rdbuf(log);
+	}
+	return result;
+}
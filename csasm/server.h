@@ -0,0 +1,44 @@
+#pragma once
+
+#include "batch.h"
+
+#include <cstdint>
+#include <string>
+
+struct ServerOptions
+{
+	// Directory the module names are relative to
+	std::string root;
+
+	// Unix domain socket to listen on; requests come in on stdin and go out
+	// on stdout if this is empty
+	std::string socketPath;
+
+	// Number of engines, each with its own loaded modules; this many
+	// requests are served at once
+	unsigned int engines = 1;
+
+	// As in BatchOptions, per engine
+	int64_t memoryBudget = 0;
+};
+
+// Keeps configured engines and their loaded modules around between requests,
+// so only the first request for a module pays for loading it. Each request is
+// a line:
+//
+//   list                           module names under the root
+//   dump <module> [text|jsonl]     the whole module
+//   headers <module>               declarations without bytecode
+//   function <module> <id|glob>    functions by id or declaration
+//   quit                           closes the connection
+//
+// Function ids are the module's own, as the dumps print them, so a request
+// means the same function on whichever engine serves it. Module names are
+// relative to the root; absolute ones and ones with ".." are refused.
+// and is answered with "ok <length>\n" or "error <length>\n" followed by
+// that many bytes. Before a module is used, the files of it and its
+// dependencies are checked and whatever changed is loaded again. On stdin,
+// "ready\n" is written once the engines are configured; the log goes to
+// stderr meanwhile. Every socket connection gets a thread. Returns once
+// stdin closes; a socket is served until the process ends.
+int RunServer(const EngineFactory &engineFactory, const ServerOptions &options);
@@ -0,0 +1,192 @@
+#include "shared.h"
+#include "decoder.h"
+#include "hash.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+
+const char cReferencePrefix[] = "\t\tshared ";
+
+std::string GetFunctionName(uint64_t fingerprint, size_t index)
+{
+	std::string name = fmtString("%016llx", static_cast<unsigned long long>(fingerprint));
+	if (index)
+	{
+		name += fmtString("-%u", static_cast<unsigned int>(index));
+	}
+	return name;
+}
+
+}
+
+SharedCodeWriter::SharedCodeWriter(const std::string &directory)
+	: mDirectory(directory), mWritten(0), mReferences(0), mFailed(0)
+{
+
+}
+
+void SharedCodeWriter::writeFunction(OutputSink &sink, const std::string &declaration, const asDWORD *code, asUINT length,
+                                     OperandAnnotator &annotator)
+{
+	// Packed rather than rendered, as every copy is fingerprinted
+	StringSink key;
+	key.write(declaration);
+	key.put('\0');
+	DecodedInstruction instruction;
+	for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+	{
+		WriteInstructionKey(key, instruction, annotator);
+	}
+
+	std::string name = claim(key.str(), [&]()
+	{
+		// Only resolved operands, so the body doesn't depend on which copy
+		// comes first
+		StringSink body;
+		body.format("%s\n", declaration.c_str());
+		for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+		{
+			body.write("\t\t", 2);
+			body.writeHex(position, 4);
+			body.write(": ", 2);
+			WriteNormalizedInstruction(body, instruction, annotator);
+			body.put('\n');
+		}
+		return body.str();
+	});
+	sink.format("%s%s\n", cReferencePrefix, name.c_str());
+	++mReferences;
+}
+
+std::string SharedCodeWriter::claim(const std::string &key, const std::function<std::string()> &render)
+{
+	uint64_t fingerprint = HashBytes(key.data(), key.size());
+	std::string name;
+	std::string body;
+	{
+		// Rendered while holding the lock, so an exported function always
+		// has its body
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::vector<Function> &functions = mFunctions[fingerprint];
+		auto it = std::find_if(functions.begin(), functions.end(), [&](const Function &function)
+		{
+			return function.key == key;
+		});
+		size_t index = it - functions.begin();
+		name = GetFunctionName(fingerprint, index);
+		if (it != functions.end())
+		{
+			return name;
+		}
+		body = render();
+		functions.push_back({ key, body });
+		mNames[name] = std::make_pair(fingerprint, index);
+	}
+	writeBody(name, body);
+	return name;
+}
+
+void SharedCodeWriter::writeBody(const std::string &name, const std::string &body)
+{
+	boost::filesystem::path path = mDirectory;
+	path /= name + ".txt";
+	boost::system::error_code error;
+	boost::filesystem::create_directories(path.parent_path(), error);
+	FileSink file(path.string());
+	if (!file.isOpen())
+	{
+		++mFailed;
+		return;
+	}
+	file.write(body);
+	++mWritten;
+}
+
+bool SharedCodeWriter::exportFunctions(const std::vector<std::string> &names, std::string &contents)
+{
+	// Keys and bodies go by length, as keys hold raw operands
+	std::lock_guard<std::mutex> lock(mMutex);
+	contents = std::to_string(names.size()) + "\n";
+	for (const std::string &name : names)
+	{
+		auto it = mNames.find(name);
+		if (it == mNames.end())
+		{
+			return false;
+		}
+		const Function &function = mFunctions[it->second.first][it->second.second];
+		contents += fmtString("%s\t%u\t%u\n", name.c_str(),
+		                      static_cast<unsigned int>(function.key.size()),
+		                      static_cast<unsigned int>(function.body.size()));
+		contents += function.key;
+		contents += function.body;
+	}
+	return true;
+}
+
+bool SharedCodeWriter::importFunctions(const std::string &contents)
+{
+	size_t lineEnd = contents.find('\n');
+	if (lineEnd == std::string::npos)
+	{
+		return false;
+	}
+	size_t count = std::strtoul(contents.c_str(), nullptr, 10);
+	size_t position = lineEnd + 1;
+	for (size_t i = 0; i < count; ++i)
+	{
+		lineEnd = contents.find('\n', position);
+		if (lineEnd == std::string::npos)
+		{
+			return false;
+		}
+		std::istringstream line(contents.substr(position, lineEnd - position));
+		std::string name;
+		size_t keySize;
+		size_t bodySize;
+		if (!(line >> name >> keySize >> bodySize) || contents.size() - lineEnd - 1 < keySize + bodySize)
+		{
+			return false;
+		}
+		position = lineEnd + 1;
+		std::string key = contents.substr(position, keySize);
+		std::string body = contents.substr(position + keySize, bodySize);
+		position += keySize + bodySize;
+
+		if (claim(key, [&]() { return body; }) != name)
+		{
+			return false;
+		}
+	}
+	mReferences += static_cast<unsigned int>(count);
+	return true;
+}
+
+bool ReadSharedNames(const std::string &dumpPath, std::vector<std::string> &names)
+{
+	std::ifstream stream(dumpPath, std::ios::binary);
+	if (!stream)
+	{
+		return false;
+	}
+	const size_t prefixLength = sizeof(cReferencePrefix) - 1;
+	std::string line;
+	while (std::getline(stream, line))
+	{
+		if (line.compare(0, prefixLength, cReferencePrefix) == 0)
+		{
+			std::string name = line.substr(prefixLength);
+			if (std::find(names.begin(), names.end(), name) == names.end())
+			{
+				names.push_back(name);
+			}
+		}
+	}
+	return true;
+}
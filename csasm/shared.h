@@ -0,0 +1,84 @@
+#pragma once
+
+#include "disasm.h"
+#include "sink.h"
+
+#include <angelscript.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shared functions are compiled into every module using them. Across a batch,
+// their bytecode goes to the directory once per fingerprint, as
+// <fingerprint>.txt, and text dumps only name the fingerprint. Fingerprints
+// cover the declaration and the bytecode with symbolic operands resolved, so
+// copies in different modules and engines match; the bytecode is written in
+// the normalized form for the same reason. Used from several workers at once.
+class SharedCodeWriter
+{
+public:
+	explicit SharedCodeWriter(const std::string &directory);
+
+	// Writes the function's fingerprint in place of its bytecode, and the
+	// bytecode to the directory if it is the first copy
+	void writeFunction(OutputSink &sink, const std::string &declaration, const asDWORD *code, asUINT length,
+	                   OperandAnnotator &annotator);
+
+	// The named functions in a form importFunctions takes back, for caching
+	// the dumps naming them; false if one of them isn't known
+	bool exportFunctions(const std::vector<std::string> &names, std::string &contents);
+
+	// Takes exported functions in as if their copies had been written again,
+	// writing the bytecode of those new to this batch; false if one of them
+	// would get another name here, so dumps naming them don't fit
+	bool importFunctions(const std::string &contents);
+
+	unsigned int getWrittenCount() const
+	{
+		return mWritten;
+	}
+
+	unsigned int getReferenceCount() const
+	{
+		return mReferences;
+	}
+
+	// Bodies that couldn't be written
+	unsigned int getFailedCount() const
+	{
+		return mFailed;
+	}
+
+private:
+	struct Function
+	{
+		// What the fingerprint is taken of, to tell functions sharing one apart
+		std::string key;
+		std::string body;
+	};
+
+	// Takes in a function, rendering its body if it's new; returns its name
+	std::string claim(const std::string &key, const std::function<std::string()> &render);
+	void writeBody(const std::string &name, const std::string &body);
+
+	std::string mDirectory;
+
+	// By fingerprint; functions after the first one of a fingerprint get the
+	// index appended to their name
+	std::mutex mMutex;
+	std::unordered_map<uint64_t, std::vector<Function>> mFunctions;
+	std::unordered_map<std::string, std::pair<uint64_t, size_t>> mNames;
+
+	std::atomic<unsigned int> mWritten;
+	std::atomic<unsigned int> mReferences;
+	std::atomic<unsigned int> mFailed;
+};
+
+// Names of the shared functions a text dump refers to, in order of first
+// reference
+bool ReadSharedNames(const std::string &dumpPath, std::vector<std::string> &names);
@@ -0,0 +1,111 @@
+#include "sink.h"
+
+#include <cstring>
+
+void OutputSink::write(const char *data, size_t size)
+{
+	if (size > sizeof(mBuffer) - mUsed)
+	{
+		flush();
+
+		// Big blocks skip the buffer
+		if (size >= sizeof(mBuffer))
+		{
+			writeOut(data, size);
+			return;
+		}
+	}
+	memcpy(mBuffer + mUsed, data, size);
+	mUsed += size;
+}
+
+void OutputSink::writeSigned(int64_t value)
+{
+	if (value < 0)
+	{
+		put('-');
+		writeUnsigned(0 - static_cast<uint64_t>(value));
+		return;
+	}
+	writeUnsigned(static_cast<uint64_t>(value));
+}
+
+void OutputSink::writeUnsigned(uint64_t value)
+{
+	char digits[20];
+	char *end = digits + sizeof(digits);
+	char *start = end;
+	do
+	{
+		*--start = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value);
+	write(start, end - start);
+}
+
+void OutputSink::writeHex(uint64_t value, int minDigits)
+{
+	static const char cHexDigits[] = "0123456789abcdef";
+
+	char digits[16];
+	char *end = digits + sizeof(digits);
+	char *start = end;
+	do
+	{
+		*--start = cHexDigits[value & 0xf];
+		value >>= 4;
+	} while (value);
+	while (end - start < minDigits && start > digits)
+	{
+		*--start = '0';
+	}
+	write(start, end - start);
+}
+
+void OutputSink::writePadded(const char *str, size_t width)
+{
+	size_t length = strlen(str);
+	write(str, length);
+	for (; length < width; ++length)
+	{
+		put(' ');
+	}
+}
+
+FileSink::FileSink(const std::string &path)
+{
+	mFile = fopen(path.c_str(), "wb");
+	mOwned = true;
+	if (mFile)
+	{
+		// Already buffered on our side
+		setvbuf(mFile, nullptr, _IONBF, 0);
+	}
+}
+
+FileSink::FileSink(FILE *file)
+{
+	mFile = file;
+	mOwned = false;
+}
+
+FileSink::~FileSink()
+{
+	flush();
+	if (mFile && mOwned)
+	{
+		fclose(mFile);
+	}
+	else if (mFile)
+	{
+		fflush(mFile);
+	}
+}
+
+void FileSink::writeOut(const char *data, size_t size)
+{
+	if (mFile)
+	{
+		fwrite(data, 1, size, mFile);
+	}
+}
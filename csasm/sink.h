@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+// Destination for disassembly text. Everything written goes through a fixed
+// buffer that is handed to the destination whenever it fills up, so output
+// size doesn't affect memory use and nothing is allocated per line.
+class OutputSink
+{
+public:
+	virtual ~OutputSink() {}
+
+	void write(const char *data, size_t size);
+
+	void write(const char *str)
+	{
+		write(str, strlen(str));
+	}
+
+	void write(const std::string &str)
+	{
+		write(str.data(), str.size());
+	}
+
+	void put(char c)
+	{
+		if (mUsed == sizeof(mBuffer))
+		{
+			flush();
+		}
+		mBuffer[mUsed++] = c;
+	}
+
+	// Integers without going through printf
+	void writeSigned(int64_t value);
+	void writeUnsigned(uint64_t value);
+	void writeHex(uint64_t value, int minDigits = 1);
+
+	// Left aligned in a field of at least width characters, like "%-8s"
+	void writePadded(const char *str, size_t width);
+
+	// printf into the buffer
+	template<typename... A>
+	void format(const char *format, A... args)
+	{
+		size_t space = sizeof(mBuffer) - mUsed;
+		int length = snprintf(mBuffer + mUsed, space, format, args...);
+		if (length < 0)
+		{
+			return;
+		}
+		if (static_cast<size_t>(length) < space)
+		{
+			mUsed += length;
+			return;
+		}
+
+		// Didn't fit, retry with the whole buffer
+		flush();
+		if (static_cast<size_t>(length) < sizeof(mBuffer))
+		{
+			mUsed = snprintf(mBuffer, sizeof(mBuffer), format, args...);
+			return;
+		}
+
+		// Longer than the buffer itself, e.g. a huge string constant
+		std::string overflow(length + 1, '\0');
+		snprintf(&overflow[0], overflow.size(), format, args...);
+		writeOut(overflow.data(), length);
+	}
+
+	void flush()
+	{
+		if (mUsed)
+		{
+			writeOut(mBuffer, mUsed);
+			mUsed = 0;
+		}
+	}
+
+protected:
+	// Receives the buffered data
+	virtual void writeOut(const char *data, size_t size) = 0;
+
+private:
+	char mBuffer[64 * 1024];
+	size_t mUsed = 0;
+};
+
+// Writes to a file, or to an already open stdio stream
+class FileSink : public OutputSink
+{
+public:
+	FileSink(const std::string &path);
+	FileSink(FILE *file);
+	~FileSink();
+
+	bool isOpen() const
+	{
+		return mFile != nullptr;
+	}
+
+protected:
+	virtual void writeOut(const char *data, size_t size);
+
+private:
+	FILE *mFile;
+	bool mOwned;
+};
+
+class StreamSink : public OutputSink
+{
+public:
+	StreamSink(std::ostream &stream)
+		: mStream(stream)
+	{
+
+	}
+
+	~StreamSink()
+	{
+		flush();
+	}
+
+protected:
+	virtual void writeOut(const char *data, size_t size)
+	{
+		mStream.write(data, size);
+	}
+
+private:
+	std::ostream &mStream;
+};
+
+// Collects everything in memory
+class StringSink : public OutputSink
+{
+public:
+	~StringSink()
+	{
+		flush();
+	}
+
+	const std::string &str()
+	{
+		flush();
+		return mString;
+	}
+
+protected:
+	virtual void writeOut(const char *data, size_t size)
+	{
+		mString.append(data, size);
+	}
+
+private:
+	std::string mString;
+};
+
+// Discards everything, for measuring the dumpers themselves
+class NullSink : public OutputSink
+{
+public:
+	~NullSink()
+	{
+		flush();
+	}
+
+protected:
+	virtual void writeOut(const char *data, size_t size)
+	{
+
+	}
+};
@@ -0,0 +1,170 @@
+#include "sjis.h"
+#include "sjistable.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CSASM_SJIS_SSE2
+#endif
+
+namespace
+{
+
+const uint32_t cReplacementCharacter = 0xfffd;
+
+size_t PutUtf8(char *out, uint32_t codePoint)
+{
+	// Code page 932 only maps into the BMP
+	if (codePoint < 0x80)
+	{
+		out[0] = static_cast<char>(codePoint);
+		return 1;
+	}
+	if (codePoint < 0x800)
+	{
+		out[0] = static_cast<char>(0xc0 | (codePoint >> 6));
+		out[1] = static_cast<char>(0x80 | (codePoint & 0x3f));
+		return 2;
+	}
+	out[0] = static_cast<char>(0xe0 | (codePoint >> 12));
+	out[1] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+	out[2] = static_cast<char>(0x80 | (codePoint & 0x3f));
+	return 3;
+}
+
+// Single bytes outside of ASCII, as Windows maps them
+uint32_t GetSingleByteCodePoint(uint8_t byte)
+{
+	if (byte >= 0xa1 && byte <= 0xdf)
+	{
+		// Half width katakana
+		return 0xff61 + (byte - 0xa1);
+	}
+	switch (byte)
+	{
+	case 0x80:
+		return 0x80;
+	case 0xa0:
+		return 0xf8f0;
+	case 0xfd:
+		return 0xf8f1;
+	case 0xfe:
+		return 0xf8f2;
+	case 0xff:
+		return 0xf8f3;
+	default:
+		return cReplacementCharacter;
+	}
+}
+
+}
+
+size_t FindNonAscii(const char *str, size_t length)
+{
+	size_t offset = 0;
+#ifdef CSASM_SJIS_SSE2
+	// The high bit of every byte at once
+	for (; offset + 16 <= length; offset += 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + offset));
+		int mask = _mm_movemask_epi8(chunk);
+		if (mask)
+		{
+			for (int bit = 0; ; ++bit)
+			{
+				if (mask & (1 << bit))
+				{
+					return offset + bit;
+				}
+			}
+		}
+	}
+#else
+	for (; offset + 8 <= length; offset += 8)
+	{
+		uint64_t word;
+		memcpy(&word, str + offset, sizeof(word));
+		if (word & 0x8080808080808080ull)
+		{
+			break;
+		}
+	}
+#endif
+	while (offset < length && !(static_cast<uint8_t>(str[offset]) & 0x80))
+	{
+		++offset;
+	}
+	return offset;
+}
+
+size_t SjisToUtf8(const char *in, size_t length, char *out)
+{
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(in);
+	size_t written = 0;
+	size_t offset = 0;
+	while (offset < length)
+	{
+		size_t ascii = FindNonAscii(in + offset, length - offset);
+		memcpy(out + written, in + offset, ascii);
+		written += ascii;
+		offset += ascii;
+
+		// Everything up to the next ASCII byte
+		while (offset < length && (bytes[offset] & 0x80))
+		{
+			uint8_t byte = bytes[offset];
+			int lead = GetSjisLeadIndex(byte);
+			if (lead < 0)
+			{
+				written += PutUtf8(out + written, GetSingleByteCodePoint(byte));
+				++offset;
+				continue;
+			}
+
+			// A trail byte out of range isn't consumed; it may start the
+			// next character
+			uint8_t trail = offset + 1 < length ? bytes[offset + 1] : 0;
+			if (trail < cSjisFirstTrail || trail == 0x7f || trail > 0xfc)
+			{
+				written += PutUtf8(out + written, cReplacementCharacter);
+				++offset;
+				continue;
+			}
+
+			uint16_t codePoint = cSjisDoubleByteTable[lead][trail - cSjisFirstTrail];
+			written += PutUtf8(out + written, codePoint ? codePoint : cReplacementCharacter);
+			offset += 2;
+		}
+	}
+	return written;
+}
+
+std::string SjisToUtf8(const std::string &sjis)
+{
+	size_t ascii = FindNonAscii(sjis.data(), sjis.size());
+	if (ascii == sjis.size())
+	{
+		return sjis;
+	}
+
+	std::string utf8(GetSjisUtf8Capacity(sjis.size()), '\0');
+	utf8.resize(SjisToUtf8(sjis.data(), sjis.size(), &utf8[0]));
+	return utf8;
+}
+
+const char *SjisToUtf8Scratch(const char *in, size_t length, size_t *outLength)
+{
+	*outLength = length;
+	if (FindNonAscii(in, length) == length)
+	{
+		return in;
+	}
+
+	static thread_local std::vector<char> sScratch;
+	sScratch.resize(GetSjisUtf8Capacity(length));
+	*outLength = SjisToUtf8(in, length, sScratch.data());
+	return sScratch.data();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// UTF-8 takes at most three bytes for any one or two bytes of Shift-JIS
+inline size_t GetSjisUtf8Capacity(size_t length)
+{
+	return length * 3;
+}
+
+// Converts Shift-JIS (code page 932) to UTF-8 into out, which has to have
+// room for GetSjisUtf8Capacity(length) bytes, and returns the size written.
+// Runs of ASCII are copied in bulk. Truncated, invalid and unmapped
+// sequences come out as U+FFFD.
+size_t SjisToUtf8(const char *in, size_t length, char *out);
+
+// Length of the ASCII prefix of the string
+size_t FindNonAscii(const char *str, size_t length);
+
+std::string SjisToUtf8(const std::string &sjis);
+
+// Converts into a buffer of the calling thread that stays valid until its
+// next call; ASCII strings are handed back as they are
+const char *SjisToUtf8Scratch(const char *in, size_t length, size_t *outLength);
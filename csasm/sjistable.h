@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+// Double byte characters of code page 932 by lead and trail byte. Lead bytes
+// are 0x81-0x9f and 0xe0-0xfc, trail bytes 0x40-0xfc without 0x7f; entries
+// are UTF-16 code units, 0 where nothing is mapped.
+const int cSjisLeadCount = 60;
+const int cSjisTrailCount = 189;
+const uint8_t cSjisFirstTrail = 0x40;
+
+extern const uint16_t cSjisDoubleByteTable[cSjisLeadCount][cSjisTrailCount];
+
+inline int GetSjisLeadIndex(uint8_t byte)
+{
+	if (byte >= 0x81 && byte <= 0x9f)
+	{
+		return byte - 0x81;
+	}
+	if (byte >= 0xe0 && byte <= 0xfc)
+	{
+		return byte - 0xe0 + 0x1f;
+	}
+	return -1;
+}
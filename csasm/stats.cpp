@@ -0,0 +1,349 @@
+#include "stats.h"
+#include "batch.h"
+#include "decoder.h"
+#include "rawmodule.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+const size_t cOpcodeCount = asBC_MAXBYTECODE;
+
+// Rows of each table; the summary has everything
+const size_t cTableRows = 20;
+
+const char *const cIndirectCall = "(function pointer)";
+const char *const cUnresolvedCall = "?";
+
+struct FunctionSize
+{
+	size_t module;
+	std::string declaration;
+	uint64_t instructions;
+};
+
+struct CorpusStats
+{
+	uint64_t modules = 0;
+	uint64_t functions = 0;
+	uint64_t instructions = 0;
+	unsigned int failed = 0;
+
+	// By asEBCInstr, and by first * cOpcodeCount + second
+	std::vector<uint64_t> opcodes = std::vector<uint64_t>(cOpcodeCount, 0);
+	std::vector<uint64_t> pairs = std::vector<uint64_t>(cOpcodeCount * cOpcodeCount, 0);
+
+	std::unordered_map<std::string, uint64_t> calls;
+	std::vector<FunctionSize> functionSizes;
+
+	void merge(CorpusStats &other)
+	{
+		modules += other.modules;
+		functions += other.functions;
+		instructions += other.instructions;
+		for (size_t i = 0; i < opcodes.size(); ++i)
+		{
+			opcodes[i] += other.opcodes[i];
+		}
+		for (size_t i = 0; i < pairs.size(); ++i)
+		{
+			pairs[i] += other.pairs[i];
+		}
+		for (const auto &call : other.calls)
+		{
+			calls[call.first] += call.second;
+		}
+		std::move(other.functionSizes.begin(), other.functionSizes.end(), std::back_inserter(functionSizes));
+	}
+};
+
+void CountFunction(const RawModule &module, const RawFunction &function, size_t moduleIndex, CorpusStats &stats)
+{
+	const asDWORD *code = function.byteCode.data();
+	asUINT length = static_cast<asUINT>(function.byteCode.size());
+
+	uint64_t count = 0;
+	size_t previous = cOpcodeCount;
+	std::string target;
+	DecodedInstruction instruction;
+	for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+	{
+		++count;
+
+		// Pairs don't span an opcode the engine doesn't know
+		size_t op = static_cast<size_t>(instruction.op);
+		if (op < cOpcodeCount)
+		{
+			++stats.opcodes[op];
+			if (previous < cOpcodeCount)
+			{
+				++stats.pairs[previous * cOpcodeCount + op];
+			}
+		}
+		previous = op;
+
+		if (instruction.op == asBC_CallPtr)
+		{
+			++stats.calls[cIndirectCall];
+			continue;
+		}
+		for (int i = 0; i < instruction.descriptor->operandCount; ++i)
+		{
+			const DecodedOperand &operand = instruction.operands[i];
+			bool isCall = operand.kind == OPERAND_FUNCTION || (operand.kind == OPERAND_CONSTRUCTOR && operand.value);
+			if (isCall)
+			{
+				++stats.calls[ResolveRawSymbol(module, instruction, operand, target) ? target : cUnresolvedCall];
+			}
+		}
+	}
+
+	++stats.functions;
+	stats.instructions += count;
+	stats.functionSizes.push_back({moduleIndex, function.getDeclaration(), count});
+}
+
+double GetShare(uint64_t count, uint64_t total)
+{
+	return total ? 100.0 * count / total : 0.0;
+}
+
+// The most frequent entries first, ties in key order
+template<typename T>
+void SortByCount(std::vector<std::pair<T, uint64_t>> &entries)
+{
+	std::sort(entries.begin(), entries.end(), [](const std::pair<T, uint64_t> &a, const std::pair<T, uint64_t> &b)
+	{
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+}
+
+void WriteTables(const CorpusStats &stats, const std::vector<std::string> &names,
+                 const std::vector<std::pair<size_t, uint64_t>> &opcodes,
+                 const std::vector<std::pair<size_t, uint64_t>> &pairs,
+                 const std::vector<std::pair<std::string, uint64_t>> &calls,
+                 OutputSink &sink)
+{
+	sink.format("modules: %llu, %u failed\n", static_cast<unsigned long long>(stats.modules), stats.failed);
+	sink.format("functions: %llu\n", static_cast<unsigned long long>(stats.functions));
+	sink.format("instructions: %llu\n", static_cast<unsigned long long>(stats.instructions));
+
+	sink.format("opcodes: %u\n", static_cast<unsigned int>(opcodes.size()));
+	for (const auto &entry : opcodes)
+	{
+		sink.format("\t%12llu %6.2f%%  %s\n", static_cast<unsigned long long>(entry.second),
+		            GetShare(entry.second, stats.instructions),
+		            GetOpcodeDescriptor(static_cast<asEBCInstr>(entry.first)).name);
+	}
+
+	uint64_t pairTotal = stats.instructions > stats.functions ? stats.instructions - stats.functions : 0;
+	sink.format("opcode_pairs: %u, top %u\n", static_cast<unsigned int>(pairs.size()), static_cast<unsigned int>(cTableRows));
+	for (size_t i = 0; i < pairs.size() && i < cTableRows; ++i)
+	{
+		size_t first = pairs[i].first / cOpcodeCount;
+		size_t second = pairs[i].first % cOpcodeCount;
+		sink.format("\t%12llu %6.2f%%  %s %s\n", static_cast<unsigned long long>(pairs[i].second),
+		            GetShare(pairs[i].second, pairTotal),
+		            GetOpcodeDescriptor(static_cast<asEBCInstr>(first)).name,
+		            GetOpcodeDescriptor(static_cast<asEBCInstr>(second)).name);
+	}
+
+	uint64_t callTotal = 0;
+	for (const auto &entry : calls)
+	{
+		callTotal += entry.second;
+	}
+	sink.format("call_targets: %u, top %u\n", static_cast<unsigned int>(calls.size()), static_cast<unsigned int>(cTableRows));
+	for (size_t i = 0; i < calls.size() && i < cTableRows; ++i)
+	{
+		sink.format("\t%12llu %6.2f%%  %s\n", static_cast<unsigned long long>(calls[i].second),
+		            GetShare(calls[i].second, callTotal), calls[i].first.c_str());
+	}
+
+	// Powers of two: 0, 1, 2-3, 4-7, ...
+	std::vector<uint64_t> buckets;
+	for (const FunctionSize &size : stats.functionSizes)
+	{
+		size_t bucket = 0;
+		for (uint64_t count = size.instructions; count; count >>= 1)
+		{
+			++bucket;
+		}
+		if (bucket >= buckets.size())
+		{
+			buckets.resize(bucket + 1, 0);
+		}
+		++buckets[bucket];
+	}
+	sink.write("function_sizes:\n");
+	for (size_t bucket = 0; bucket < buckets.size(); ++bucket)
+	{
+		if (!buckets[bucket])
+		{
+			continue;
+		}
+		uint64_t low = bucket ? uint64_t(1) << (bucket - 1) : 0;
+		uint64_t high = bucket ? (uint64_t(1) << bucket) - 1 : 0;
+		sink.format("\t%12llu %6.2f%%  %llu-%llu\n", static_cast<unsigned long long>(buckets[bucket]),
+		            GetShare(buckets[bucket], stats.functions),
+		            static_cast<unsigned long long>(low), static_cast<unsigned long long>(high));
+	}
+
+	sink.format("largest_functions: top %u\n", static_cast<unsigned int>(cTableRows));
+	for (size_t i = 0; i < stats.functionSizes.size() && i < cTableRows; ++i)
+	{
+		const FunctionSize &size = stats.functionSizes[i];
+		sink.format("\t%12llu  %s  %s\n", static_cast<unsigned long long>(size.instructions),
+		            names[size.module].c_str(), size.declaration.c_str());
+	}
+}
+
+void WriteSummary(const CorpusStats &stats, const std::vector<std::string> &names,
+                  const std::vector<std::pair<size_t, uint64_t>> &opcodes,
+                  const std::vector<std::pair<size_t, uint64_t>> &pairs,
+                  const std::vector<std::pair<std::string, uint64_t>> &calls,
+                  RecordWriter &writer)
+{
+	writer.beginRecord(RECORD_STATS);
+	writer.writeUnsigned(FIELD_MODULES, stats.modules);
+	writer.writeUnsigned(FIELD_FUNCTIONS, stats.functions);
+	writer.writeUnsigned(FIELD_INSTRUCTIONS, stats.instructions);
+	writer.endRecord();
+
+	for (const auto &entry : opcodes)
+	{
+		writer.beginRecord(RECORD_OPCODE_COUNT);
+		writer.writeUnsigned(FIELD_ID, entry.first);
+		writer.writeString(FIELD_OPCODE, GetOpcodeDescriptor(static_cast<asEBCInstr>(entry.first)).name);
+		writer.writeUnsigned(FIELD_TALLY, entry.second);
+		writer.endRecord();
+	}
+
+	for (const auto &entry : pairs)
+	{
+		writer.beginRecord(RECORD_PAIR_COUNT);
+		writer.writeString(FIELD_OPCODE, GetOpcodeDescriptor(static_cast<asEBCInstr>(entry.first / cOpcodeCount)).name);
+		writer.writeString(FIELD_NEXT, GetOpcodeDescriptor(static_cast<asEBCInstr>(entry.first % cOpcodeCount)).name);
+		writer.writeUnsigned(FIELD_TALLY, entry.second);
+		writer.endRecord();
+	}
+
+	for (const auto &entry : calls)
+	{
+		writer.beginRecord(RECORD_CALL_COUNT);
+		writer.writeString(FIELD_DECL, entry.first.data(), entry.first.size());
+		writer.writeUnsigned(FIELD_TALLY, entry.second);
+		writer.endRecord();
+	}
+
+	for (const FunctionSize &size : stats.functionSizes)
+	{
+		writer.beginRecord(RECORD_FUNCTION_SIZE);
+		writer.writeString(FIELD_MODULE, names[size.module].data(), names[size.module].size());
+		writer.writeString(FIELD_DECL, size.declaration.data(), size.declaration.size());
+		writer.writeUnsigned(FIELD_INSTRUCTIONS, size.instructions);
+		writer.endRecord();
+	}
+}
+
+bool WriteSummaryFile(const StatsOptions &options, const CorpusStats &stats, const std::vector<std::string> &names,
+                      const std::vector<std::pair<size_t, uint64_t>> &opcodes,
+                      const std::vector<std::pair<size_t, uint64_t>> &pairs,
+                      const std::vector<std::pair<std::string, uint64_t>> &calls)
+{
+	FileSink summarySink(options.summaryPath);
+	if (!summarySink.isOpen())
+	{
+		return false;
+	}
+	if (options.summaryFormat == FORMAT_BINARY)
+	{
+		BinaryRecordWriter writer(summarySink);
+		WriteSummary(stats, names, opcodes, pairs, calls, writer);
+	}
+	else
+	{
+		JsonLinesWriter writer(summarySink);
+		WriteSummary(stats, names, opcodes, pairs, calls, writer);
+	}
+	summarySink.flush();
+	return true;
+}
+
+}
+
+bool CollectCorpusStats(const StatsOptions &options, OutputSink &sink)
+{
+	std::vector<std::string> names = CollectCorpusNames(options);
+	unsigned int jobs = GetCorpusJobs(options, names.size());
+
+	// Every worker counts on its own; the counts are merged at the end
+	std::vector<CorpusStats> workerStats(jobs);
+	unsigned int failed = ForEachRawModule(options, names, jobs, [&](unsigned int worker, size_t index, const RawModule &module)
+	{
+		CorpusStats &stats = workerStats[worker];
+		++stats.modules;
+		for (const RawFunction &function : module.functions)
+		{
+			if (function.funcType == asFUNC_SCRIPT)
+			{
+				CountFunction(module, function, index, stats);
+			}
+		}
+	});
+
+	CorpusStats &stats = workerStats[0];
+	for (unsigned int i = 1; i < jobs; ++i)
+	{
+		stats.merge(workerStats[i]);
+	}
+	stats.failed = failed;
+
+	std::vector<std::pair<size_t, uint64_t>> opcodes;
+	for (size_t op = 0; op < cOpcodeCount; ++op)
+	{
+		if (stats.opcodes[op])
+		{
+			opcodes.emplace_back(op, stats.opcodes[op]);
+		}
+	}
+	SortByCount(opcodes);
+
+	std::vector<std::pair<size_t, uint64_t>> pairs;
+	for (size_t pair = 0; pair < stats.pairs.size(); ++pair)
+	{
+		if (stats.pairs[pair])
+		{
+			pairs.emplace_back(pair, stats.pairs[pair]);
+		}
+	}
+	SortByCount(pairs);
+
+	std::vector<std::pair<std::string, uint64_t>> calls(stats.calls.begin(), stats.calls.end());
+	SortByCount(calls);
+
+	std::sort(stats.functionSizes.begin(), stats.functionSizes.end(), [](const FunctionSize &a, const FunctionSize &b)
+	{
+		if (a.instructions != b.instructions)
+		{
+			return a.instructions > b.instructions;
+		}
+		return a.module != b.module ? a.module < b.module : a.declaration < b.declaration;
+	});
+
+	WriteTables(stats, names, opcodes, pairs, calls, sink);
+	sink.flush();
+
+	bool result = stats.failed == 0;
+	if (!options.summaryPath.empty() && !WriteSummaryFile(options, stats, names, opcodes, pairs, calls))
+	{
+		std::cout << "failed to write summary " << options.summaryPath << "\n";
+		result = false;
+	}
+	return result;
+}
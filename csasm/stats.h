@@ -0,0 +1,22 @@
+#pragma once
+
+#include "batch.h"
+#include "records.h"
+#include "sink.h"
+
+#include <string>
+
+struct StatsOptions : CorpusOptions
+{
+	// Optional; every count is written here as records, in summaryFormat
+	std::string summaryPath;
+	OutputFormat summaryFormat = FORMAT_JSON_LINES;
+};
+
+// Reads every module without an engine and, in a single pass over the
+// bytecode, counts each opcode, each pair of consecutive opcodes within a
+// function, the targets of calls and the instructions of every function.
+// Nothing is rendered per instruction. Compact tables of the most frequent
+// entries go to the sink; the summary has all of them. Returns false if a
+// module can't be read or the summary can't be written.
+bool CollectCorpusStats(const StatsOptions &options, OutputSink &sink);
@@ -0,0 +1,309 @@
+#include "stringtable.h"
+#include "batch.h"
+#include "decoder.h"
+#include "hash.h"
+#include "rawmodule.h"
+#include "sjis.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+const uint32_t cNoString = ~0u;
+
+struct StringReference
+{
+	uint32_t module;
+	uint32_t function;
+	uint32_t uses;
+};
+
+struct InternedString
+{
+	std::string text;
+	uint64_t hash;
+
+	// Next string with the same hash
+	uint32_t next = cNoString;
+
+	uint64_t uses = 0;
+	std::vector<StringReference> references;
+};
+
+// Strings and the declarations of the functions using them, shared by the
+// workers; each adds a whole module at once
+class StringTable
+{
+public:
+	// Uses of one string by one function of a module
+	struct FunctionUse
+	{
+		uint32_t string;   // index into the module's used strings
+		uint32_t function; // index into the declarations
+		uint32_t uses;
+	};
+
+	// declarations has those of the functions using strings
+	void addModule(uint32_t module, const RawModule &rawModule, const std::vector<std::string> &declarations,
+	               const std::vector<FunctionUse> &uses)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mModules;
+
+		std::vector<uint32_t> declarationIds;
+		for (const std::string &declaration : declarations)
+		{
+			declarationIds.push_back(internDeclaration(declaration));
+		}
+		std::vector<uint32_t> strings(rawModule.usedStrings.size(), cNoString);
+		for (const FunctionUse &use : uses)
+		{
+			uint32_t declaration = declarationIds[use.function];
+			uint32_t &string = strings[use.string];
+			if (string == cNoString)
+			{
+				string = intern(rawModule.usedStrings[use.string]);
+			}
+
+			InternedString &interned = mStrings[string];
+			interned.uses += use.uses;
+			interned.references.push_back({ module, declaration, use.uses });
+		}
+	}
+
+	std::vector<InternedString> &getStrings()
+	{
+		return mStrings;
+	}
+
+	const std::string &getDeclaration(uint32_t id) const
+	{
+		return *mDeclarations[id];
+	}
+
+	unsigned int getModuleCount() const
+	{
+		return mModules;
+	}
+
+private:
+	uint32_t intern(const std::string &text)
+	{
+		uint64_t hash = HashBytes(text.data(), text.size());
+		auto inserted = mByHash.emplace(hash, static_cast<uint32_t>(mStrings.size()));
+		uint32_t id = inserted.first->second;
+		if (!inserted.second)
+		{
+			// Collisions are chained behind the first string with the hash
+			uint32_t last = id;
+			for (; id != cNoString; id = mStrings[id].next)
+			{
+				if (mStrings[id].text == text)
+				{
+					return id;
+				}
+				last = id;
+			}
+			id = static_cast<uint32_t>(mStrings.size());
+			mStrings[last].next = id;
+		}
+
+		mStrings.emplace_back();
+		mStrings.back().text = text;
+		mStrings.back().hash = hash;
+		return id;
+	}
+
+	uint32_t internDeclaration(const std::string &declaration)
+	{
+		auto inserted = mDeclarationIds.emplace(declaration, static_cast<uint32_t>(mDeclarations.size()));
+		if (inserted.second)
+		{
+			// Keys stay put when the map grows
+			mDeclarations.push_back(&inserted.first->first);
+		}
+		return inserted.first->second;
+	}
+
+	std::mutex mMutex;
+	std::vector<InternedString> mStrings;
+	std::unordered_map<uint64_t, uint32_t> mByHash;
+	std::unordered_map<std::string, uint32_t> mDeclarationIds;
+	std::vector<const std::string *> mDeclarations;
+	unsigned int mModules = 0;
+};
+
+// Counts the STR instructions of every script function by string
+void CollectModuleUses(const RawModule &module, std::vector<std::string> &declarations,
+                       std::vector<StringTable::FunctionUse> &uses)
+{
+	// Counts of the current function, cleared through the strings it used
+	std::vector<uint32_t> counts(module.usedStrings.size(), 0);
+	std::vector<uint32_t> used;
+	for (size_t function = 0; function < module.functions.size(); ++function)
+	{
+		const RawFunction &rawFunction = module.functions[function];
+		if (rawFunction.funcType != asFUNC_SCRIPT)
+		{
+			continue;
+		}
+
+		const asDWORD *code = rawFunction.byteCode.data();
+		asUINT length = static_cast<asUINT>(rawFunction.byteCode.size());
+		DecodedInstruction instruction;
+		for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+		{
+			if (instruction.op != asBC_STR || instruction.operands[0].value >= counts.size())
+			{
+				continue;
+			}
+			uint32_t string = static_cast<uint32_t>(instruction.operands[0].value);
+			if (!counts[string]++)
+			{
+				used.push_back(string);
+			}
+		}
+
+		if (used.empty())
+		{
+			continue;
+		}
+		for (uint32_t string : used)
+		{
+			uses.push_back({ string, static_cast<uint32_t>(declarations.size()), counts[string] });
+			counts[string] = 0;
+		}
+		used.clear();
+		declarations.push_back(rawFunction.getDeclaration());
+	}
+}
+
+struct TableTotals
+{
+	size_t strings;
+	uint64_t uses;
+	unsigned int modules;
+};
+
+void WriteTextTable(const std::vector<const InternedString *> &strings, const StringTable &table,
+                    const std::vector<std::string> &names, const TableTotals &totals, OutputSink &sink)
+{
+	sink.format("strings: %u distinct, %llu uses, %u modules\n",
+	            static_cast<unsigned int>(totals.strings), static_cast<unsigned long long>(totals.uses), totals.modules);
+	for (size_t id = 0; id < strings.size(); ++id)
+	{
+		const InternedString &string = *strings[id];
+
+		// The size is the stored one, the text comes out as UTF-8 as in dumps
+		sink.format("\t%u: %u:\"", static_cast<unsigned int>(id), static_cast<unsigned int>(string.text.size()));
+		size_t utf8Length;
+		const char *utf8 = SjisToUtf8Scratch(string.text.data(), string.text.size(), &utf8Length);
+		sink.write(utf8, utf8Length);
+		sink.format("\" %llu uses, hash %016llx\n",
+		            static_cast<unsigned long long>(string.uses), static_cast<unsigned long long>(string.hash));
+		for (const StringReference &reference : string.references)
+		{
+			sink.format("\t\t%u\t%s\t%s\n", reference.uses, names[reference.module].c_str(),
+			            table.getDeclaration(reference.function).c_str());
+		}
+	}
+}
+
+void WriteRecords(const std::vector<const InternedString *> &strings, const StringTable &table,
+                  const std::vector<std::string> &names, const TableTotals &totals, RecordWriter &writer)
+{
+	writer.beginRecord(RECORD_STRING_TABLE);
+	writer.writeUnsigned(FIELD_MODULES, totals.modules);
+	writer.writeUnsigned(FIELD_STRINGS, totals.strings);
+	writer.writeUnsigned(FIELD_TALLY, totals.uses);
+	writer.endRecord();
+
+	for (size_t id = 0; id < strings.size(); ++id)
+	{
+		const InternedString &string = *strings[id];
+		size_t utf8Length;
+		const char *utf8 = SjisToUtf8Scratch(string.text.data(), string.text.size(), &utf8Length);
+		writer.beginRecord(RECORD_STRING);
+		writer.writeUnsigned(FIELD_ID, id);
+		writer.writeString(FIELD_STRING, utf8, utf8Length);
+		writer.writeUnsigned(FIELD_SIZE, string.text.size());
+		writer.writeUnsigned(FIELD_HASH, string.hash);
+		writer.writeUnsigned(FIELD_TALLY, string.uses);
+		writer.endRecord();
+
+		for (const StringReference &reference : string.references)
+		{
+			const std::string &declaration = table.getDeclaration(reference.function);
+			writer.beginRecord(RECORD_STRING_USE);
+			writer.writeUnsigned(FIELD_ID, id);
+			writer.writeString(FIELD_MODULE, names[reference.module].data(), names[reference.module].size());
+			writer.writeString(FIELD_DECL, declaration.data(), declaration.size());
+			writer.writeUnsigned(FIELD_TALLY, reference.uses);
+			writer.endRecord();
+		}
+	}
+}
+
+}
+
+bool ExtractStringTable(const StringTableOptions &options, OutputSink &sink)
+{
+	std::vector<std::string> names = CollectCorpusNames(options);
+	unsigned int jobs = GetCorpusJobs(options, names.size());
+
+	// Scratch space per worker, reused for each of its modules
+	std::vector<std::vector<std::string>> declarations(jobs);
+	std::vector<std::vector<StringTable::FunctionUse>> uses(jobs);
+
+	StringTable table;
+	unsigned int failed = ForEachRawModule(options, names, jobs, [&](unsigned int worker, size_t index, const RawModule &module)
+	{
+		declarations[worker].clear();
+		uses[worker].clear();
+		CollectModuleUses(module, declarations[worker], uses[worker]);
+		table.addModule(static_cast<uint32_t>(index), module, declarations[worker], uses[worker]);
+	});
+
+	TableTotals totals = { 0, 0, table.getModuleCount() };
+	std::vector<const InternedString *> strings;
+	for (InternedString &string : table.getStrings())
+	{
+		std::sort(string.references.begin(), string.references.end(), [&](const StringReference &a, const StringReference &b)
+		{
+			if (a.module != b.module)
+			{
+				return names[a.module] < names[b.module];
+			}
+			return table.getDeclaration(a.function) < table.getDeclaration(b.function);
+		});
+		totals.uses += string.uses;
+		strings.push_back(&string);
+	}
+	std::sort(strings.begin(), strings.end(), [](const InternedString *a, const InternedString *b)
+	{
+		return a->text < b->text;
+	});
+	totals.strings = strings.size();
+
+	if (options.format == FORMAT_TEXT)
+	{
+		WriteTextTable(strings, table, names, totals, sink);
+	}
+	else if (options.format == FORMAT_BINARY)
+	{
+		BinaryRecordWriter writer(sink);
+		WriteRecords(strings, table, names, totals, writer);
+	}
+	else
+	{
+		JsonLinesWriter writer(sink);
+		WriteRecords(strings, table, names, totals, writer);
+	}
+	sink.flush();
+	return failed == 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "batch.h"
+#include "records.h"
+#include "sink.h"
+
+#include <string>
+
+struct StringTableOptions : CorpusOptions
+{
+	OutputFormat format = FORMAT_TEXT;
+};
+
+// Reads every module without an engine and gathers the string constants
+// its functions push with STR into one table for the whole corpus. Strings
+// are interned by the hash of their stored bytes, so each is kept and
+// converted to UTF-8 once however many modules carry it. Every entry lists
+// the modules and functions using it and how often. Entries are ordered by
+// their stored bytes and references by module and function, so the table
+// doesn't depend on the number of jobs. Returns false if a module can't be
+// read.
+bool ExtractStringTable(const StringTableOptions &options, OutputSink &sink);
@@ -0,0 +1,277 @@
+#include "symbols.h"
+#include "decoder.h"
+#include "disasm.h"
+
+// for the module's globals and imports
+#include <../source/as_scriptengine.h>
+
+namespace
+{
+
+// Engine user data slot of the cache; add-ons use theirs from 1000 up
+const asPWORD cSymbolCacheUserData = 0x6373796d;
+
+const asUINT cImportedFunction = 0x40000000;
+
+template<typename K>
+uint32_t Number(std::unordered_map<K, uint32_t> &ids, const K &key)
+{
+	return ids.emplace(key, static_cast<uint32_t>(ids.size())).first->second;
+}
+
+bool IsPrimitiveType(int typeId)
+{
+	return (typeId & asTYPEID_MASK_SEQNBR) <= asTYPEID_DOUBLE;
+}
+
+}
+
+SymbolCache &SymbolCache::get(asIScriptEngine *engine)
+{
+	SymbolCache *cache = static_cast<SymbolCache *>(engine->GetUserData(cSymbolCacheUserData));
+	if (!cache)
+	{
+		cache = new SymbolCache(engine);
+		engine->SetUserData(cache, cSymbolCacheUserData);
+		engine->SetEngineUserDataCleanupCallback(cleanUp, cSymbolCacheUserData);
+	}
+	return *cache;
+}
+
+void SymbolCache::invalidate(asIScriptEngine *engine)
+{
+	delete static_cast<SymbolCache *>(engine->SetUserData(nullptr, cSymbolCacheUserData));
+}
+
+void SymbolCache::cleanUp(asIScriptEngine *engine)
+{
+	delete static_cast<SymbolCache *>(engine->GetUserData(cSymbolCacheUserData));
+}
+
+SymbolCache::SymbolCache(asIScriptEngine *engine)
+	: mEngine(engine)
+{
+
+}
+
+const std::string &SymbolCache::getDeclaration(asIScriptFunction *function)
+{
+	auto it = mDeclarations.find(function);
+	if (it == mDeclarations.end())
+	{
+		it = mDeclarations.emplace(function, function->GetDeclaration(true, true, true)).first;
+	}
+	return it->second;
+}
+
+const std::string &SymbolCache::getShortDeclaration(asIScriptFunction *function)
+{
+	auto it = mShortDeclarations.find(function);
+	if (it == mShortDeclarations.end())
+	{
+		it = mShortDeclarations.emplace(function, function->GetDeclaration()).first;
+	}
+	return it->second;
+}
+
+const std::string *SymbolCache::getTypeDeclaration(int typeId)
+{
+	auto it = mTypeDeclarations.find(typeId);
+	if (it == mTypeDeclarations.end())
+	{
+		const char *decl = mEngine->GetTypeDeclaration(typeId);
+		it = mTypeDeclarations.emplace(typeId, CachedName{decl != nullptr, decl ? decl : ""}).first;
+	}
+	return it->second.resolved ? &it->second.text : nullptr;
+}
+
+const char *SymbolCache::resolveGlobal(asIScriptFunction *function, void *address, asUINT *id)
+{
+	auto it = mGlobals.find(address);
+	if (it == mGlobals.end())
+	{
+		CachedGlobal global = {false, 0, std::string()};
+		const char *name = ResolveGlobal(function, address, &global.id);
+		if (name)
+		{
+			global.resolved = true;
+			global.name = name;
+		}
+		it = mGlobals.emplace(address, std::move(global)).first;
+	}
+	if (!it->second.resolved)
+	{
+		return nullptr;
+	}
+	*id = it->second.id;
+	return it->second.name.c_str();
+}
+
+ModuleIds::ModuleIds(asIScriptModule *module)
+	: mModule(module), mEngine(module->GetEngine())
+{
+	std::vector<asIScriptFunction *> functions;
+	GetScriptFunctions(module, functions);
+	for (asIScriptFunction *function : functions)
+	{
+		Number(mFunctions, function);
+	}
+
+	asCModule *internalModule = static_cast<asCModule *>(module);
+	for (asUINT i = 0; i < internalModule->bindInformations.GetLength(); ++i)
+	{
+		mImports.emplace(internalModule->bindInformations[i], i);
+	}
+	for (asUINT i = 0; i < module->GetGlobalVarCount(); ++i)
+	{
+		Number(mGlobals, internalModule->scriptGlobals.Get(i)->GetAddressOfValue());
+	}
+
+	for (asUINT i = 0; i < module->GetEnumCount(); ++i)
+	{
+		int typeId;
+		module->GetEnumByIndex(i, &typeId);
+		Number(mTypes, typeId & asTYPEID_MASK_SEQNBR);
+	}
+	for (asUINT i = 0; i < module->GetObjectTypeCount(); ++i)
+	{
+		Number(mTypes, module->GetObjectTypeByIndex(i)->GetTypeId() & asTYPEID_MASK_SEQNBR);
+	}
+
+	// Then the types of their properties, so dumping the declarations alone
+	// never needs the walk
+	for (asUINT i = 0; i < module->GetObjectTypeCount(); ++i)
+	{
+		asIObjectType *type = module->GetObjectTypeByIndex(i);
+		for (asUINT j = 0; j < type->GetPropertyCount(); ++j)
+		{
+			int typeId;
+			type->GetProperty(j, nullptr, &typeId);
+			if (!IsPrimitiveType(typeId))
+			{
+				Number(mTypes, typeId & asTYPEID_MASK_SEQNBR);
+			}
+		}
+	}
+}
+
+template<typename K>
+uint32_t ModuleIds::getId(std::unordered_map<K, uint32_t> &ids, const K &key)
+{
+	auto it = ids.find(key);
+	if (it != ids.end())
+	{
+		return it->second;
+	}
+
+	// Only what no code of the module uses is left to be numbered on request
+	if (!mWalked)
+	{
+		walkCode();
+		it = ids.find(key);
+		if (it != ids.end())
+		{
+			return it->second;
+		}
+	}
+	return Number(ids, key);
+}
+
+int ModuleIds::getFunctionId(asUINT engineId)
+{
+	if (engineId & cImportedFunction)
+	{
+		asCScriptEngine *engine = static_cast<asCScriptEngine *>(mEngine);
+		asUINT index = engineId & ~cImportedFunction;
+		auto it = index < engine->importedFunctions.GetLength() ? mImports.find(engine->importedFunctions[index]) : mImports.end();
+		return it != mImports.end() ? static_cast<int>(it->second | cImportedFunction) : static_cast<int>(engineId);
+	}
+
+	asIScriptFunction *function = engineId ? mEngine->GetFunctionById(static_cast<int>(engineId)) : nullptr;
+	return function ? getFunctionId(function) : static_cast<int>(engineId);
+}
+
+int ModuleIds::getFunctionId(asIScriptFunction *function)
+{
+	return static_cast<int>(getId(mFunctions, function));
+}
+
+asUINT ModuleIds::getStringId(asUINT engineId)
+{
+	return getId(mStrings, engineId);
+}
+
+asUINT ModuleIds::getGlobalId(void *address)
+{
+	return getId(mGlobals, address);
+}
+
+int ModuleIds::getTypeId(int engineTypeId)
+{
+	if (IsPrimitiveType(engineTypeId))
+	{
+		return engineTypeId;
+	}
+	uint32_t index = getId(mTypes, engineTypeId & asTYPEID_MASK_SEQNBR);
+	return (engineTypeId & ~asTYPEID_MASK_SEQNBR) | static_cast<int>(asTYPEID_DOUBLE + 1 + index);
+}
+
+void ModuleIds::walkCode()
+{
+	mWalked = true;
+
+	std::vector<asIScriptFunction *> functions;
+	GetScriptFunctions(mModule, functions);
+	for (asIScriptFunction *function : functions)
+	{
+		asUINT length;
+		asDWORD *code = function->GetByteCode(&length);
+		if (!code)
+		{
+			continue;
+		}
+		DecodedInstruction instruction;
+		for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+		{
+			for (int i = 0; i < instruction.descriptor->operandCount; ++i)
+			{
+				const DecodedOperand &operand = instruction.operands[i];
+				switch (operand.kind)
+				{
+				case OPERAND_STRING:
+					Number(mStrings, static_cast<asUINT>(operand.value));
+					break;
+				case OPERAND_TYPE_ID:
+					if (!IsPrimitiveType(static_cast<int>(operand.value)))
+					{
+						Number(mTypes, static_cast<int>(operand.value) & asTYPEID_MASK_SEQNBR);
+					}
+					break;
+				case OPERAND_FUNCTION:
+				case OPERAND_CONSTRUCTOR:
+					{
+						// Imports are numbered already
+						asUINT id = static_cast<asUINT>(operand.value);
+						asIScriptFunction *callee = id && !(id & cImportedFunction) ? mEngine->GetFunctionById(static_cast<int>(id)) : nullptr;
+						if (callee)
+						{
+							Number(mFunctions, callee);
+						}
+					}
+					break;
+				case OPERAND_FUNCTION_POINTER:
+					if (operand.getPointer())
+					{
+						Number(mFunctions, static_cast<asIScriptFunction *>(operand.getPointer()));
+					}
+					break;
+				case OPERAND_GLOBAL:
+					Number(mGlobals, operand.getPointer());
+					break;
+				default:
+					break;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Rendered text of the symbols bytecode operands refer to, kept for the life
+// of an engine so every function and module dumped with it renders each
+// symbol once. Entries go stale when modules are discarded, since ids and
+// addresses get reused; invalidate has to be called then.
+class SymbolCache
+{
+public:
+	// The engine's cache, created on first use. An engine is only used from
+	// one thread at a time, so there is no locking.
+	static SymbolCache &get(asIScriptEngine *engine);
+
+	// Drops the engine's cache, if it has one
+	static void invalidate(asIScriptEngine *engine);
+
+	// GetDeclaration(true, true, true)
+	const std::string &getDeclaration(asIScriptFunction *function);
+
+	// GetDeclaration(), the short form without namespace or parameter names
+	const std::string &getShortDeclaration(asIScriptFunction *function);
+
+	// Null if the type id doesn't resolve
+	const std::string *getTypeDeclaration(int typeId);
+
+	// ResolveGlobal, remembered by address
+	const char *resolveGlobal(asIScriptFunction *function, void *address, asUINT *id);
+
+private:
+	SymbolCache(asIScriptEngine *engine);
+
+	static void cleanUp(asIScriptEngine *engine);
+
+	struct CachedName
+	{
+		bool resolved;
+		std::string text;
+	};
+
+	struct CachedGlobal
+	{
+		bool resolved;
+		asUINT id;
+		std::string name;
+	};
+
+	asIScriptEngine *mEngine;
+	std::unordered_map<asIScriptFunction *, std::string> mDeclarations;
+	std::unordered_map<asIScriptFunction *, std::string> mShortDeclarations;
+	std::unordered_map<int, CachedName> mTypeDeclarations;
+	std::unordered_map<void *, CachedGlobal> mGlobals;
+};
+
+// Engine ids depend on everything the engine loaded before, so they differ
+// between workers, runs and evictions. Dumps number what a module refers to
+// by the module itself instead, the way its ASF file does. The module's own
+// functions, globals and types come first, in the module's order. Whatever
+// else its code uses follows in the order of first use, walking the module's
+// functions in order; strings are all numbered that way. Imports are their
+// index among the module's imports with the import bit kept. Type ids keep
+// their flags, and primitive ones stay as they are. The types of the
+// properties of the module's classes are numbered up front with its own, so
+// only ids coming from bytecode need the walk; it is done once, on the first
+// such id. AsfModule keeps the ids while the module stays loaded.
+class ModuleIds
+{
+public:
+	explicit ModuleIds(asIScriptModule *module);
+
+	// Function operands as ResolveFunction takes them; 0 stays 0
+	int getFunctionId(asUINT engineId);
+	int getFunctionId(asIScriptFunction *function);
+
+	asUINT getStringId(asUINT engineId);
+
+	// By the address the bytecode uses
+	asUINT getGlobalId(void *address);
+
+	int getTypeId(int engineTypeId);
+
+private:
+	// Numbers the key, after the walk if it isn't known yet
+	template<typename K>
+	uint32_t getId(std::unordered_map<K, uint32_t> &ids, const K &key);
+
+	void walkCode();
+
+	asIScriptModule *mModule;
+	asIScriptEngine *mEngine;
+	bool mWalked = false;
+
+	std::unordered_map<asIScriptFunction *, uint32_t> mFunctions;
+	std::unordered_map<const void *, uint32_t> mImports;
+	std::unordered_map<asUINT, uint32_t> mStrings;
+	std::unordered_map<void *, uint32_t> mGlobals;
+
+	// By sequence number
+	std::unordered_map<int, uint32_t> mTypes;
+};
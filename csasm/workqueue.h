@@ -0,0 +1,69 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// One task deque per worker. Workers take tasks from the front of their own
+// deque and steal from the back of the others once it runs dry, so a worker
+// stuck on a huge task doesn't hold up the tasks queued behind it.
+class WorkStealingQueues
+{
+public:
+	WorkStealingQueues(size_t workerCount)
+		: mQueues(workerCount)
+	{
+
+	}
+
+	size_t getWorkerCount() const
+	{
+		return mQueues.size();
+	}
+
+	void push(size_t worker, size_t task)
+	{
+		Queue &queue = mQueues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+
+	bool pop(size_t worker, size_t &task)
+	{
+		// Own work first
+		{
+			Queue &queue = mQueues[worker];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty())
+			{
+				task = queue.tasks.front();
+				queue.tasks.pop_front();
+				return true;
+			}
+		}
+
+		// Steal, starting at the next worker so victims are spread out
+		for (size_t i = 1; i < mQueues.size(); ++i)
+		{
+			Queue &victim = mQueues[(worker + i) % mQueues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty())
+			{
+				task = victim.tasks.back();
+				victim.tasks.pop_back();
+				return true;
+			}
+		}
+
+		// Tasks are never added after the workers start, so this is final
+		return false;
+	}
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+	std::vector<Queue> mQueues;
+};
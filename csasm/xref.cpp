@@ -0,0 +1,716 @@
+#include "xref.h"
+
+#include "decoder.h"
+#include "disasm.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+
+// for global variable lookups
+#include <../source/as_scriptengine.h>
+
+namespace
+{
+
+const char cIndexMagic[4] = { 'C', 'S', 'X', 'I' };
+const uint32_t cIndexVersion = 1;
+
+// The index is laid out as
+//   IndexHeader
+//   u32 string offsets[stringCount + 1], into the string data
+//   XrefIndexEntry bySymbol[entryCount], by symbol, module, function, kind
+//   XrefIndexEntry byFunction[entryCount], by function, module, symbol, kind
+//   IndexName names[nameCount], by name
+//   string data
+// in host byte order. Strings are sorted, so their ids compare like them and
+// lookups are binary searches.
+struct IndexHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t stringCount;
+	uint32_t entryCount;
+	uint32_t nameCount;
+};
+
+// Qualified names the declarations can be looked up by
+struct IndexName
+{
+	uint32_t name;
+	uint32_t symbol;
+};
+
+const char *const cXrefKindNames[XREF_KIND_COUNT] =
+{
+	"call",
+	"read",
+	"write",
+	"address",
+	"type",
+};
+
+// What the operand refers to, if it refers to anything
+bool GetXrefKind(const DecodedInstruction &instruction, const DecodedOperand &operand, XrefKind &kind)
+{
+	switch (operand.kind)
+	{
+	case OPERAND_FUNCTION:
+	case OPERAND_CONSTRUCTOR:
+		kind = XREF_CALL;
+		return true;
+	case OPERAND_FUNCTION_POINTER:
+		kind = XREF_ADDRESS;
+		return true;
+	case OPERAND_TYPE:
+		kind = XREF_TYPE;
+		return true;
+	case OPERAND_GLOBAL:
+		switch (instruction.op)
+		{
+		case asBC_PshG4:
+		case asBC_PshGPtr:
+		case asBC_LdGRdR4:
+		case asBC_CpyGtoV4:
+			kind = XREF_READ;
+			break;
+		case asBC_SetG4:
+		case asBC_CpyVtoG4:
+			kind = XREF_WRITE;
+			break;
+		default:
+			// PGA and LDG only load the address; what is done through it
+			// isn't known here
+			kind = XREF_ADDRESS;
+			break;
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool XrefLess(const Xref &a, const Xref &b)
+{
+	return std::tie(a.function, a.kind, a.symbol) < std::tie(b.function, b.kind, b.symbol);
+}
+
+bool XrefEqual(const Xref &a, const Xref &b)
+{
+	return a.kind == b.kind && a.function == b.function && a.symbol == b.symbol;
+}
+
+// Adds the references of one function's bytecode; resolve names the symbol
+// an operand refers to and returns false if it doesn't resolve
+template<typename Resolve>
+void CollectFunctionXrefs(const asDWORD *code, asUINT length, const std::string &function,
+                          const Resolve &resolve, std::vector<Xref> &xrefs)
+{
+	size_t first = xrefs.size();
+
+	DecodedInstruction instruction;
+	for (asUINT position = 0; DecodeInstruction(code, length, position, instruction); position += instruction.getLength())
+	{
+		for (int i = 0; i < instruction.descriptor->operandCount; ++i)
+		{
+			const DecodedOperand &operand = instruction.operands[i];
+			Xref xref;
+			if (GetXrefKind(instruction, operand, xref.kind) && resolve(instruction, operand, xref.symbol))
+			{
+				xref.function = function;
+				xrefs.push_back(std::move(xref));
+			}
+		}
+	}
+
+	// Functions usually refer to the same few symbols many times over
+	std::sort(xrefs.begin() + first, xrefs.end(), XrefLess);
+	xrefs.erase(std::unique(xrefs.begin() + first, xrefs.end(), XrefEqual), xrefs.end());
+}
+
+bool SetFunctionSymbol(asIScriptFunction *function, std::string &symbol)
+{
+	if (!function)
+	{
+		return false;
+	}
+	symbol = function->GetDeclaration(true, true, false);
+	return true;
+}
+
+bool ResolveEngineSymbol(asCScriptFunction *function, const DecodedOperand &operand, std::string &symbol)
+{
+	asIScriptEngine *engine = function->GetEngine();
+	switch (operand.kind)
+	{
+	case OPERAND_FUNCTION:
+		return SetFunctionSymbol(ResolveFunction(engine, static_cast<asUINT>(operand.value)), symbol);
+	case OPERAND_CONSTRUCTOR:
+		return SetFunctionSymbol(engine->GetFunctionById(static_cast<int>(operand.value)), symbol);
+	case OPERAND_FUNCTION_POINTER:
+		return SetFunctionSymbol(static_cast<asIScriptFunction *>(operand.getPointer()), symbol);
+	case OPERAND_TYPE:
+		{
+			asIObjectType *type = static_cast<asIObjectType *>(operand.getPointer());
+			const char *decl = type ? engine->GetTypeDeclaration(type->GetTypeId(), true) : nullptr;
+			if (!decl)
+			{
+				return false;
+			}
+			symbol = decl;
+			return true;
+		}
+	case OPERAND_GLOBAL:
+		{
+			asCGlobalProperty *property = function->GetPropertyByGlobalVarPtr(operand.getPointer());
+			if (!property)
+			{
+				return false;
+			}
+			symbol.clear();
+			if (property->nameSpace && property->nameSpace->name.GetLength())
+			{
+				symbol = property->nameSpace->name.AddressOf();
+				symbol += "::";
+			}
+			symbol += property->name.AddressOf();
+			return true;
+		}
+	default:
+		return false;
+	}
+}
+
+// The names a declaration can be looked up by besides itself: its qualified
+// name and each shorter one, e.g. "ns::Obj::f", "Obj::f" and "f" for
+// "int ns::Obj::f(int)", or "array" for "array<int>"
+void GetLookupNames(const std::string &declaration, std::vector<std::string> &names)
+{
+	names.clear();
+
+	size_t start = 0;
+	size_t end = declaration.find('(');
+	if (end != std::string::npos)
+	{
+		size_t space = declaration.rfind(' ', end);
+		start = space == std::string::npos ? 0 : space + 1;
+	}
+	else
+	{
+		end = std::min(declaration.find('<'), declaration.size());
+	}
+
+	std::string name = declaration.substr(start, end - start);
+	if (name.empty())
+	{
+		return;
+	}
+	if (name != declaration)
+	{
+		names.push_back(name);
+	}
+	for (size_t scope = name.find("::"); scope != std::string::npos; scope = name.find("::", scope + 2))
+	{
+		names.push_back(name.substr(scope + 2));
+	}
+}
+
+template<typename T>
+void AppendValue(std::string &out, T value)
+{
+	out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+class XrefIndexReader
+{
+public:
+	bool open(const std::string &path, std::string &error)
+	{
+		boost::system::error_code sizeError;
+		if (boost::filesystem::file_size(path, sizeError) < sizeof(IndexHeader) || sizeError)
+		{
+			error = "not an xref index";
+			return false;
+		}
+
+		try
+		{
+			mFile.open(path);
+		}
+		catch (const std::exception &)
+		{
+			error = "failed to open";
+			return false;
+		}
+
+		const char *data = mFile.data();
+		size_t size = mFile.size();
+		memcpy(&mHeader, data, sizeof(mHeader));
+		if (memcmp(mHeader.magic, cIndexMagic, sizeof(cIndexMagic)) != 0 || mHeader.version != cIndexVersion)
+		{
+			error = "not an xref index of this version";
+			return false;
+		}
+
+		uint64_t tablesSize = (uint64_t(mHeader.stringCount) + 1) * sizeof(uint32_t) +
+		                      uint64_t(mHeader.entryCount) * 2 * sizeof(XrefIndexEntry) +
+		                      uint64_t(mHeader.nameCount) * sizeof(IndexName);
+		if (tablesSize > size - sizeof(IndexHeader))
+		{
+			error = "truncated";
+			return false;
+		}
+
+		// Every table is made of u32s and starts at a multiple of four
+		const char *head = data + sizeof(IndexHeader);
+		mOffsets = reinterpret_cast<const uint32_t *>(head);
+		head += (mHeader.stringCount + 1) * sizeof(uint32_t);
+		mBySymbol = reinterpret_cast<const XrefIndexEntry *>(head);
+		head += mHeader.entryCount * sizeof(XrefIndexEntry);
+		mByFunction = reinterpret_cast<const XrefIndexEntry *>(head);
+		head += mHeader.entryCount * sizeof(XrefIndexEntry);
+		mNames = reinterpret_cast<const IndexName *>(head);
+		head += mHeader.nameCount * sizeof(IndexName);
+		mStrings = head;
+		mStringsSize = data + size - head;
+
+		for (uint32_t i = 0; i < mHeader.stringCount; ++i)
+		{
+			if (mOffsets[i] > mOffsets[i + 1])
+			{
+				error = "corrupt string table";
+				return false;
+			}
+		}
+		if (mOffsets[mHeader.stringCount] > mStringsSize)
+		{
+			error = "corrupt string table";
+			return false;
+		}
+		return true;
+	}
+
+	std::string getString(uint32_t id) const
+	{
+		if (id >= mHeader.stringCount)
+		{
+			return "?";
+		}
+		return std::string(mStrings + mOffsets[id], mOffsets[id + 1] - mOffsets[id]);
+	}
+
+	// Declarations the query stands for: itself if it is one, and whatever
+	// it is the lookup name of
+	std::vector<uint32_t> resolve(const std::string &query) const
+	{
+		std::vector<uint32_t> ids;
+		uint32_t id;
+		if (!findString(query, id))
+		{
+			return ids;
+		}
+		ids.push_back(id);
+
+		const IndexName *end = mNames + mHeader.nameCount;
+		const IndexName *it = std::lower_bound(mNames, end, id, [](const IndexName &name, uint32_t value)
+		{
+			return name.name < value;
+		});
+		for (; it != end && it->name == id; ++it)
+		{
+			ids.push_back(it->symbol);
+		}
+
+		// A name can also be a declaration of its own, e.g. a global
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+		return ids;
+	}
+
+	// Entries whose symbol, or function, is id
+	std::pair<const XrefIndexEntry *, const XrefIndexEntry *> getEntries(uint32_t id, bool byFunction) const
+	{
+		const XrefIndexEntry *begin = byFunction ? mByFunction : mBySymbol;
+		const XrefIndexEntry *end = begin + mHeader.entryCount;
+		auto key = [byFunction](const XrefIndexEntry &entry)
+		{
+			return byFunction ? entry.function : entry.symbol;
+		};
+		begin = std::lower_bound(begin, end, id, [&key](const XrefIndexEntry &entry, uint32_t value)
+		{
+			return key(entry) < value;
+		});
+		end = std::upper_bound(begin, end, id, [&key](uint32_t value, const XrefIndexEntry &entry)
+		{
+			return value < key(entry);
+		});
+		return std::make_pair(begin, end);
+	}
+
+private:
+	bool findString(const std::string &str, uint32_t &id) const
+	{
+		uint32_t low = 0;
+		uint32_t high = mHeader.stringCount;
+		while (low < high)
+		{
+			uint32_t middle = low + (high - low) / 2;
+			int order = compare(middle, str);
+			if (order == 0)
+			{
+				id = middle;
+				return true;
+			}
+			if (order < 0)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return false;
+	}
+
+	int compare(uint32_t id, const std::string &str) const
+	{
+		size_t length = mOffsets[id + 1] - mOffsets[id];
+		int order = memcmp(mStrings + mOffsets[id], str.data(), std::min(length, str.size()));
+		if (order != 0)
+		{
+			return order;
+		}
+		return length < str.size() ? -1 : (length > str.size() ? 1 : 0);
+	}
+
+	boost::iostreams::mapped_file_source mFile;
+	IndexHeader mHeader;
+	const uint32_t *mOffsets = nullptr;
+	const XrefIndexEntry *mBySymbol = nullptr;
+	const XrefIndexEntry *mByFunction = nullptr;
+	const IndexName *mNames = nullptr;
+	const char *mStrings = nullptr;
+	size_t mStringsSize = 0;
+};
+
+}
+
+const char *GetXrefKindName(XrefKind kind)
+{
+	return kind < XREF_KIND_COUNT ? cXrefKindNames[kind] : "?";
+}
+
+void CollectXrefs(asIScriptModule *scriptModule, std::vector<Xref> &xrefs)
+{
+	std::vector<asIScriptFunction *> functions;
+	GetScriptFunctions(scriptModule, functions);
+	for (asIScriptFunction *scriptFunction : functions)
+	{
+		asCScriptFunction *function = static_cast<asCScriptFunction *>(scriptFunction);
+		asUINT length;
+		asDWORD *code = function->GetByteCode(&length);
+		if (!code)
+		{
+			continue;
+		}
+
+		auto resolve = [function](const DecodedInstruction &, const DecodedOperand &operand, std::string &symbol)
+		{
+			return ResolveEngineSymbol(function, operand, symbol);
+		};
+		CollectFunctionXrefs(code, length, function->GetDeclaration(true, true, false), resolve, xrefs);
+	}
+}
+
+void CollectRawXrefs(const RawModule &module, std::vector<Xref> &xrefs)
+{
+	auto resolve = [&module](const DecodedInstruction &instruction, const DecodedOperand &operand, std::string &symbol)
+	{
+		return ResolveRawSymbol(module, instruction, operand, symbol);
+	};
+	for (const RawFunction &function : module.functions)
+	{
+		if (function.funcType == asFUNC_SCRIPT)
+		{
+			CollectFunctionXrefs(function.byteCode.data(), static_cast<asUINT>(function.byteCode.size()),
+			                     function.getDeclaration(), resolve, xrefs);
+		}
+	}
+}
+
+std::string FormatXrefs(const std::vector<Xref> &xrefs)
+{
+	// The count goes first, so a module without references still has an
+	// entry; declarations never contain tabs or line breaks
+	std::string text = std::to_string(xrefs.size()) + "\n";
+	for (const Xref &xref : xrefs)
+	{
+		text += std::to_string(xref.kind);
+		text += '\t';
+		text += xref.function;
+		text += '\t';
+		text += xref.symbol;
+		text += '\n';
+	}
+	return text;
+}
+
+bool ParseXrefs(const std::string &text, std::vector<Xref> &xrefs)
+{
+	std::istringstream stream(text);
+	std::string line;
+	size_t count;
+	if (!std::getline(stream, line) || !(std::istringstream(line) >> count))
+	{
+		return false;
+	}
+
+	xrefs.clear();
+	while (std::getline(stream, line))
+	{
+		size_t functionStart = line.find('\t');
+		size_t symbolStart = functionStart == std::string::npos ? functionStart : line.find('\t', functionStart + 1);
+		if (symbolStart == std::string::npos)
+		{
+			return false;
+		}
+
+		unsigned int kind = std::strtoul(line.c_str(), nullptr, 10);
+		if (kind >= XREF_KIND_COUNT)
+		{
+			return false;
+		}
+
+		Xref xref;
+		xref.kind = static_cast<XrefKind>(kind);
+		xref.function = line.substr(functionStart + 1, symbolStart - functionStart - 1);
+		xref.symbol = line.substr(symbolStart + 1);
+		xrefs.push_back(std::move(xref));
+	}
+	return xrefs.size() == count;
+}
+
+uint32_t XrefIndexBuilder::intern(const std::string &str)
+{
+	auto inserted = mStringIds.emplace(str, static_cast<uint32_t>(mStrings.size()));
+	if (inserted.second)
+	{
+		// Keys stay put when the map grows
+		mStrings.push_back(&inserted.first->first);
+	}
+	return inserted.first->second;
+}
+
+void XrefIndexBuilder::addModule(const std::string &name, const std::vector<Xref> &xrefs)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	uint32_t module = intern(name);
+	for (const Xref &xref : xrefs)
+	{
+		XrefIndexEntry entry;
+		entry.symbol = intern(xref.symbol);
+		entry.function = intern(xref.function);
+		entry.module = module;
+		entry.kind = xref.kind;
+		mEntries.push_back(entry);
+	}
+}
+
+bool XrefIndexBuilder::write(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	// Lookup names of every declaration; interning them may add strings,
+	// so the declarations are gathered first
+	std::vector<bool> isDeclaration(mStrings.size());
+	for (const XrefIndexEntry &entry : mEntries)
+	{
+		isDeclaration[entry.symbol] = true;
+		isDeclaration[entry.function] = true;
+	}
+	std::vector<IndexName> names;
+	std::vector<std::string> lookupNames;
+	for (uint32_t id = 0; id < isDeclaration.size(); ++id)
+	{
+		if (!isDeclaration[id])
+		{
+			continue;
+		}
+		GetLookupNames(*mStrings[id], lookupNames);
+		for (const std::string &lookupName : lookupNames)
+		{
+			names.push_back({ intern(lookupName), id });
+		}
+	}
+
+	// Renumber the strings in sorted order
+	std::vector<uint32_t> order(mStrings.size());
+	for (uint32_t id = 0; id < order.size(); ++id)
+	{
+		order[id] = id;
+	}
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+	{
+		return *mStrings[a] < *mStrings[b];
+	});
+	std::vector<uint32_t> rank(order.size());
+	for (uint32_t i = 0; i < order.size(); ++i)
+	{
+		rank[order[i]] = i;
+	}
+
+	std::vector<XrefIndexEntry> bySymbol;
+	bySymbol.reserve(mEntries.size());
+	for (const XrefIndexEntry &entry : mEntries)
+	{
+		bySymbol.push_back({ rank[entry.symbol], rank[entry.function], rank[entry.module], entry.kind });
+	}
+	std::sort(bySymbol.begin(), bySymbol.end(), [](const XrefIndexEntry &a, const XrefIndexEntry &b)
+	{
+		return std::tie(a.symbol, a.module, a.function, a.kind) < std::tie(b.symbol, b.module, b.function, b.kind);
+	});
+	std::vector<XrefIndexEntry> byFunction = bySymbol;
+	std::sort(byFunction.begin(), byFunction.end(), [](const XrefIndexEntry &a, const XrefIndexEntry &b)
+	{
+		return std::tie(a.function, a.module, a.symbol, a.kind) < std::tie(b.function, b.module, b.symbol, b.kind);
+	});
+
+	for (IndexName &name : names)
+	{
+		name.name = rank[name.name];
+		name.symbol = rank[name.symbol];
+	}
+	std::sort(names.begin(), names.end(), [](const IndexName &a, const IndexName &b)
+	{
+		return std::tie(a.name, a.symbol) < std::tie(b.name, b.symbol);
+	});
+	names.erase(std::unique(names.begin(), names.end(), [](const IndexName &a, const IndexName &b)
+	{
+		return a.name == b.name && a.symbol == b.symbol;
+	}), names.end());
+
+	IndexHeader header;
+	memcpy(header.magic, cIndexMagic, sizeof(cIndexMagic));
+	header.version = cIndexVersion;
+	header.stringCount = static_cast<uint32_t>(order.size());
+	header.entryCount = static_cast<uint32_t>(bySymbol.size());
+	header.nameCount = static_cast<uint32_t>(names.size());
+
+	std::string out;
+	AppendValue(out, header);
+	uint32_t offset = 0;
+	AppendValue(out, offset);
+	for (uint32_t id : order)
+	{
+		offset += static_cast<uint32_t>(mStrings[id]->size());
+		AppendValue(out, offset);
+	}
+	out.append(reinterpret_cast<const char *>(bySymbol.data()), bySymbol.size() * sizeof(XrefIndexEntry));
+	out.append(reinterpret_cast<const char *>(byFunction.data()), byFunction.size() * sizeof(XrefIndexEntry));
+	out.append(reinterpret_cast<const char *>(names.data()), names.size() * sizeof(IndexName));
+	for (uint32_t id : order)
+	{
+		out.append(*mStrings[id]);
+	}
+
+	// Write next to the target and rename, so queries never map a half
+	// written index; under a random name, so batches writing the same index
+	// don't truncate each other's file
+	std::string tempPath = path + boost::filesystem::unique_path(".%%%%%%%%.tmp").string();
+	bool written;
+	{
+		std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+		written = static_cast<bool>(stream.write(out.data(), out.size()));
+	}
+
+	boost::system::error_code error;
+	if (written)
+	{
+		boost::filesystem::rename(tempPath, path, error);
+	}
+	if (!written || error)
+	{
+		boost::filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
+
+bool QueryXrefIndex(const std::string &path, const std::string &verb, const std::string &symbol,
+                    OutputSink &sink, std::string &error)
+{
+	// Which direction and which kinds each verb looks at
+	struct Verb
+	{
+		const char *name;
+		bool byFunction;
+		unsigned int kinds;
+	};
+	static const Verb cVerbs[] =
+	{
+		{ "refs", false, ~0u },
+		{ "callers", false, 1u << XREF_CALL },
+		{ "readers", false, (1u << XREF_READ) | (1u << XREF_ADDRESS) },
+		{ "writers", false, (1u << XREF_WRITE) | (1u << XREF_ADDRESS) },
+		{ "users", false, 1u << XREF_TYPE },
+		{ "callees", true, 1u << XREF_CALL },
+		{ "uses", true, ~0u },
+	};
+
+	const Verb *query = nullptr;
+	for (const Verb &candidate : cVerbs)
+	{
+		if (verb == candidate.name)
+		{
+			query = &candidate;
+		}
+	}
+	if (!query)
+	{
+		error = "unknown query " + verb;
+		return false;
+	}
+
+	XrefIndexReader index;
+	if (!index.open(path, error))
+	{
+		return false;
+	}
+
+	std::vector<uint32_t> ids = index.resolve(symbol);
+	unsigned int found = 0;
+	for (uint32_t id : ids)
+	{
+		auto entries = index.getEntries(id, query->byFunction);
+		bool first = true;
+		for (const XrefIndexEntry *entry = entries.first; entry != entries.second; ++entry)
+		{
+			if (entry->kind >= XREF_KIND_COUNT || !(query->kinds & (1u << entry->kind)))
+			{
+				continue;
+			}
+
+			if (first)
+			{
+				sink.format("%s\n", index.getString(id).c_str());
+				first = false;
+			}
+			sink.format("\t%s\t%s\t%s\n",
+			            GetXrefKindName(static_cast<XrefKind>(entry->kind)),
+			            index.getString(entry->module).c_str(),
+			            index.getString(query->byFunction ? entry->symbol : entry->function).c_str());
+			++found;
+		}
+	}
+	if (!found)
+	{
+		sink.format("no %s of %s\n", query->name, symbol.c_str());
+	}
+	return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "rawmodule.h"
+#include "sink.h"
+
+#include <angelscript.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// How a function refers to a symbol
+enum XrefKind : uint8_t
+{
+	XREF_CALL,    // calls a function
+	XREF_READ,    // reads a global
+	XREF_WRITE,   // writes a global
+	XREF_ADDRESS, // takes the address of a global or function, for either use
+	XREF_TYPE,    // uses an object type
+	XREF_KIND_COUNT
+};
+
+const char *GetXrefKindName(XrefKind kind);
+
+struct Xref
+{
+	XrefKind kind;
+
+	// Declaration of the referring function
+	std::string function;
+
+	// Declaration of the function, qualified name of the global or
+	// declaration of the type
+	std::string symbol;
+};
+
+// Distinct references made by every function with bytecode in a module
+void CollectXrefs(asIScriptModule *module, std::vector<Xref> &xrefs);
+void CollectRawXrefs(const RawModule &module, std::vector<Xref> &xrefs);
+
+// Plain text form, for keeping the references of a module in the dump cache
+std::string FormatXrefs(const std::vector<Xref> &xrefs);
+bool ParseXrefs(const std::string &text, std::vector<Xref> &xrefs);
+
+// A reference by string ids, as the index stores it
+struct XrefIndexEntry
+{
+	uint32_t symbol;
+	uint32_t function;
+	uint32_t module;
+	uint32_t kind;
+};
+
+// Collects the references of a whole batch and writes them out as an index.
+// Modules may be added from several workers at once.
+class XrefIndexBuilder
+{
+public:
+	void addModule(const std::string &name, const std::vector<Xref> &xrefs);
+
+	bool write(const std::string &path);
+
+private:
+	uint32_t intern(const std::string &str);
+
+	std::mutex mMutex;
+	std::unordered_map<std::string, uint32_t> mStringIds;
+	std::vector<const std::string *> mStrings;
+	std::vector<XrefIndexEntry> mEntries;
+};
+
+// Query verbs and what they look up
+//   refs <symbol>      everything referring to the symbol
+//   callers <function> calls of the function
+//   readers <global>   reads, and address uses that may be reads
+//   writers <global>   writes, and address uses that may be writes
+//   users <type>       uses of the type
+//   callees <function> functions it calls
+//   uses <function>    everything it refers to
+// Symbols are given by declaration or qualified name. Answered straight from
+// the mapped index; false with error set if it can't be read.
+bool QueryXrefIndex(const std::string &path, const std::string &verb, const std::string &symbol,
+                    OutputSink &sink, std::string &error);